@@ -15,6 +15,7 @@
 #define FOXXLL_IO_HEADER
 
 #include <foxxll/common/aligned_alloc.hpp>
+#include <foxxll/io/block_server.hpp>
 #include <foxxll/io/create_file.hpp>
 #include <foxxll/io/disk_queues.hpp>
 #include <foxxll/io/file.hpp>
@@ -23,6 +24,7 @@
 #include <foxxll/io/linuxaio_file.hpp>
 #include <foxxll/io/memory_file.hpp>
 #include <foxxll/io/mmap_file.hpp>
+#include <foxxll/io/remote_file.hpp>
 #include <foxxll/io/request.hpp>
 #include <foxxll/io/request_operations.hpp>
 #include <foxxll/io/syscall_file.hpp>
@@ -0,0 +1,271 @@
+/***************************************************************************
+ *  foxxll/io/block_protocol.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <foxxll/io/block_protocol.hpp>
+
+#if FOXXLL_HAVE_REMOTE_FILE
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <foxxll/common/error_handling.hpp>
+#include <foxxll/common/exceptions.hpp>
+
+namespace foxxll {
+namespace block_protocol {
+
+#ifdef MSG_NOSIGNAL
+//! do not raise SIGPIPE when the peer disconnected
+static constexpr int send_flags = MSG_NOSIGNAL;
+#else
+//! SO_NOSIGPIPE is set on the socket instead
+static constexpr int send_flags = 0;
+#endif
+
+//! close the socket on exec(), and suppress SIGPIPE where send() cannot
+static void prepare_socket(int fd, bool cloexec)
+{
+    if (cloexec)
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+//! socket() with close-on-exec set
+static int new_socket(int domain, int type, int protocol)
+{
+#ifdef SOCK_CLOEXEC
+    int fd = ::socket(domain, type | SOCK_CLOEXEC, protocol);
+    if (fd >= 0)
+        prepare_socket(fd, false);
+#else
+    int fd = ::socket(domain, type, protocol);
+    if (fd >= 0)
+        prepare_socket(fd, true);
+#endif
+    return fd;
+}
+
+static int open_unix_socket(const std::string& path, bool listen,
+                            std::string* bound)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        FOXXLL_THROW(io_error, "socket path too long: " << path);
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    int fd = new_socket(AF_UNIX, SOCK_STREAM, 0);
+    FOXXLL_THROW_ERRNO_IF(fd < 0, io_error, "socket() for unix:" << path);
+
+    int r;
+    if (listen) {
+        ::unlink(path.c_str());
+        r = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        if (r == 0)
+            r = ::listen(fd, SOMAXCONN);
+    }
+    else {
+        r = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+    if (r != 0) {
+        int err = errno;
+        ::close(fd);
+        FOXXLL_THROW_ERRNO2(
+            io_error, (listen ? "bind() to" : "connect() to")
+            << " unix:" << path, err);
+    }
+
+    if (bound)
+        *bound = "unix:" + path;
+    return fd;
+}
+
+static int open_tcp_socket(const std::string& endpoint, bool listen,
+                           std::string* bound)
+{
+    size_t colon = endpoint.rfind(':');
+    if (colon == std::string::npos) {
+        FOXXLL_THROW(io_error, "endpoint " << endpoint << " has no port");
+    }
+    std::string host = endpoint.substr(0, colon);
+    std::string port = endpoint.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (listen)
+        hints.ai_flags = AI_PASSIVE;
+
+    addrinfo* list = nullptr;
+    int r = ::getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                          port.c_str(), &hints, &list);
+    if (r != 0) {
+        FOXXLL_THROW(io_error, "cannot resolve " << endpoint << " : "
+                                                 << gai_strerror(r));
+    }
+
+    int fd = -1, err = 0;
+    for (addrinfo* ai = list; ai != nullptr; ai = ai->ai_next)
+    {
+        fd = new_socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+
+        int one = 1;
+        if (listen) {
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            r = ::bind(fd, ai->ai_addr, ai->ai_addrlen);
+            if (r == 0)
+                r = ::listen(fd, SOMAXCONN);
+        }
+        else {
+            r = ::connect(fd, ai->ai_addr, ai->ai_addrlen);
+        }
+        if (r == 0) {
+            // requests are small and latency bound, do not delay them
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        err = errno;
+        ::close(fd);
+        fd = -1;
+    }
+    ::freeaddrinfo(list);
+
+    if (fd < 0) {
+        FOXXLL_THROW_ERRNO2(
+            io_error, (listen ? "bind() to " : "connect() to ") << endpoint,
+            err);
+    }
+
+    if (bound)
+    {
+        // report the port actually bound, which differs for port zero
+        sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        unsigned short bound_port =
+            addr.ss_family == AF_INET6
+            ? ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port)
+            : ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+        std::string bound_host = host.empty() ? "localhost" : host;
+        if (bound_host.find(':') != std::string::npos)
+            bound_host = "[" + bound_host + "]";
+        *bound = bound_host + ":" + std::to_string(bound_port);
+    }
+    return fd;
+}
+
+int open_socket(const std::string& endpoint, bool listen, std::string* bound)
+{
+    if (endpoint.compare(0, 5, "unix:") == 0)
+        return open_unix_socket(endpoint.substr(5), listen, bound);
+    return open_tcp_socket(endpoint, listen, bound);
+}
+
+int accept_socket(int listen_fd)
+{
+#if FOXXLL_HAVE_ACCEPT4
+    int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0)
+        prepare_socket(fd, false);
+#else
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd >= 0)
+        prepare_socket(fd, true);
+#endif
+    return fd;
+}
+
+bool send_all(int fd, const void* data, size_t bytes)
+{
+    return send_all(fd, data, bytes, nullptr, 0);
+}
+
+bool send_all(int fd, const void* header, size_t header_bytes,
+              const void* data, size_t bytes)
+{
+    iovec iov[2];
+    iov[0].iov_base = const_cast<void*>(header);
+    iov[0].iov_len = header_bytes;
+    iov[1].iov_base = const_cast<void*>(data);
+    iov[1].iov_len = bytes;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = bytes != 0 ? 2 : 1;
+
+    while (msg.msg_iovlen != 0)
+    {
+        ssize_t r = ::sendmsg(fd, &msg, send_flags);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        // skip over what was sent
+        size_t sent = static_cast<size_t>(r);
+        while (msg.msg_iovlen != 0 && sent >= msg.msg_iov[0].iov_len) {
+            sent -= msg.msg_iov[0].iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+        if (msg.msg_iovlen != 0) {
+            msg.msg_iov[0].iov_base =
+                static_cast<char*>(msg.msg_iov[0].iov_base) + sent;
+            msg.msg_iov[0].iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+bool recv_all(int fd, void* data, size_t bytes)
+{
+    char* p = static_cast<char*>(data);
+    while (bytes != 0)
+    {
+        ssize_t r = ::recv(fd, p, bytes, MSG_WAITALL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        bytes -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+} // namespace block_protocol
+} // namespace foxxll
+
+#endif // FOXXLL_HAVE_REMOTE_FILE
+
+/**************************************************************************/
@@ -0,0 +1,126 @@
+/***************************************************************************
+ *  foxxll/io/block_protocol.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_IO_BLOCK_PROTOCOL_HEADER
+#define FOXXLL_IO_BLOCK_PROTOCOL_HEADER
+
+#include <foxxll/config.hpp>
+
+#if FOXXLL_HAVE_REMOTE_FILE
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_iolayer
+//! \{
+
+/*!
+ * Wire format spoken between remote_file and block_server.
+ *
+ * A connection first sends OPEN with the name of an export as payload, all
+ * later requests address that export. Requests carry an id chosen by the
+ * client, and the server answers each with a response holding the same id,
+ * so that many requests can be in flight on one connection. The server sends
+ * the responses in request order, clients match them by id nevertheless.
+ * Requests with id zero are not answered.
+ *
+ * READ responses are followed by the data, WRITE requests by the data. READ
+ * and WRITE requests transfer at most max_request_bytes, the server closes the
+ * connection on larger ones. A response with a non-zero status is followed by
+ * an error message of value bytes instead, at most max_message_bytes, clients
+ * close the connection on longer ones.
+ *
+ * All fields are in host byte order, client and server must share the
+ * architecture.
+ */
+namespace block_protocol {
+
+constexpr uint32_t magic = 0x42584F46; // "FOXB"
+
+//! largest READ or WRITE request, bounds the buffers of the server
+constexpr uint64_t max_request_bytes = uint64_t(64) << 20;
+
+//! longest error message, bounds the buffers of the client
+constexpr uint64_t max_message_bytes = uint64_t(64) << 10;
+
+enum opcode : uint32_t
+{
+    //! select export by name, answered with its size
+    OPEN = 1,
+    //! read bytes at offset
+    READ = 2,
+    //! write bytes at offset
+    WRITE = 3,
+    //! answered with the size of the export
+    SIZE = 4,
+    //! resize the export to offset
+    SET_SIZE = 5,
+    //! discard bytes at offset
+    DISCARD = 6
+};
+
+struct request_header
+{
+    uint32_t magic;
+    uint32_t op;
+    uint64_t id;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct response_header
+{
+    uint32_t magic;
+    //! zero or an errno value
+    uint32_t status;
+    uint64_t id;
+    //! SIZE, OPEN: size of the export, READ: bytes following,
+    //! on error: length of the message following
+    uint64_t value;
+};
+
+/*!
+ * Open a socket for an endpoint, either "unix:<path>" or "<host>:<port>".
+ * IPv6 hosts are written in brackets. If listen is set, the socket is bound
+ * and listening, an empty host binds to all interfaces and port zero to a
+ * free port. The endpoint clients can connect to is stored in bound.
+ * Throws io_error on failure.
+ */
+int open_socket(const std::string& endpoint, bool listen,
+                std::string* bound = nullptr);
+
+//! Accept a connection on a listening socket, returns -1 and sets errno on
+//! failure like accept().
+int accept_socket(int listen_fd);
+
+//! Send bytes, retrying on partial writes. Returns false on disconnect.
+bool send_all(int fd, const void* data, size_t bytes);
+
+//! Send a header followed by a payload in one call, without copying.
+bool send_all(int fd, const void* header, size_t header_bytes,
+              const void* data, size_t bytes);
+
+//! Receive exactly bytes. Returns false on disconnect.
+bool recv_all(int fd, void* data, size_t bytes);
+
+} // namespace block_protocol
+
+//! \}
+
+} // namespace foxxll
+
+#endif // FOXXLL_HAVE_REMOTE_FILE
+
+#endif // !FOXXLL_IO_BLOCK_PROTOCOL_HEADER
+
+/**************************************************************************/
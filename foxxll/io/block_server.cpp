@@ -0,0 +1,392 @@
+/***************************************************************************
+ *  foxxll/io/block_server.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <foxxll/io/block_server.hpp>
+
+#if FOXXLL_HAVE_REMOTE_FILE
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include <tlx/logger/core.hpp>
+
+#include <foxxll/common/aligned_alloc.hpp>
+#include <foxxll/io/block_protocol.hpp>
+
+namespace foxxll {
+
+//! longest export name accepted by OPEN
+static constexpr size_t max_export_name = 4096;
+
+//! A request read from the connection, waiting to be answered.
+struct block_server_reply
+{
+    uint64_t id;
+    uint32_t op;
+    uint32_t status = 0;
+    uint64_t value = 0;
+    std::string message;
+    //! I/O posted to the exported file, and its buffer
+    request_ptr req;
+    void* buffer = nullptr;
+    size_t bytes = 0;
+};
+
+struct block_server::connection
+{
+    int fd;
+    std::thread reader, responder;
+
+    //! exported file selected by OPEN, and its size limit
+    file_ptr file;
+    uint64_t max_size = 0;
+
+    //! replies in request order
+    std::deque<block_server_reply> replies;
+    //! set when the reader is done
+    bool closed = false;
+    //! set when both threads are done
+    std::atomic<bool> finished { false };
+
+    //! protects replies and closed
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    explicit connection(int _fd) : fd(_fd) { }
+};
+
+block_server::block_server(const std::string& endpoint, size_t max_outstanding,
+                           size_t max_connections)
+    : max_outstanding_(max_outstanding > 0 ? max_outstanding : 1),
+      max_connections_(max_connections > 0 ? max_connections : 1)
+{
+    listen_fd_ = block_protocol::open_socket(endpoint, /* listen */ true,
+                                             &endpoint_);
+}
+
+block_server::~block_server()
+{
+    stop();
+    reap_connections(true);
+    ::close(listen_fd_);
+}
+
+void block_server::add_export(const std::string& name, file_ptr file,
+                              uint64_t max_size)
+{
+    if (max_size == 0)
+        max_size = file->size();
+    std::unique_lock<std::mutex> lock(mutex_);
+    exports_.push_back(export_entry { name, std::move(file), max_size });
+}
+
+block_server::export_entry block_server::find_export(const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const export_entry& e : exports_)
+    {
+        if (name.empty() || e.name == name)
+            return e;
+    }
+    return export_entry { name, file_ptr(), 0 };
+}
+
+void block_server::run()
+{
+    while (!stop_)
+    {
+        int fd = block_protocol::accept_socket(listen_fd_);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (!stop_)
+                TLX_LOG1 << "block_server: accept() failed: " << strerror(errno);
+            break;
+        }
+
+        reap_connections(false);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (connections_.size() >= max_connections_) {
+            lock.unlock();
+            TLX_LOG1 << "block_server: already serving " << max_connections_
+                     << " connections, closing new one";
+            ::close(fd);
+            continue;
+        }
+        connections_.emplace_back(new connection(fd));
+        connection* conn = connections_.back().get();
+        conn->reader = std::thread([this, conn]() { read_requests(conn); });
+        conn->responder = std::thread([this, conn]() { send_responses(conn); });
+    }
+
+    reap_connections(true);
+}
+
+void block_server::stop()
+{
+    stop_ = true;
+    // wakes accept()
+    ::shutdown(listen_fd_, SHUT_RDWR);
+}
+
+void block_server::reap_connections(bool all)
+{
+    std::list<std::unique_ptr<connection> > done;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto it = connections_.begin(); it != connections_.end(); )
+        {
+            if (all || (*it)->finished) {
+                if (all)
+                    ::shutdown((*it)->fd, SHUT_RDWR);
+                done.splice(done.end(), connections_, it++);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+    for (std::unique_ptr<connection>& conn : done)
+    {
+        conn->reader.join();
+        conn->responder.join();
+        ::close(conn->fd);
+    }
+}
+
+//! check that a range lies within the size limit of an export
+static bool in_export(uint64_t max_size, uint64_t offset, uint64_t bytes)
+{
+    return offset <= max_size && bytes <= max_size - offset;
+}
+
+bool block_server::read_request(
+    connection* conn, const block_protocol::request_header& header,
+    block_server_reply& reply)
+{
+    switch (header.op)
+    {
+    case block_protocol::OPEN: {
+        if (header.bytes > max_export_name) {
+            TLX_LOG1 << "block_server: export name too long, closing connection";
+            return false;
+        }
+        std::string name(header.bytes, ' ');
+        if (header.bytes != 0 &&
+            !block_protocol::recv_all(conn->fd, &name[0], header.bytes))
+            return false;
+        export_entry e = find_export(name);
+        conn->file = e.file;
+        conn->max_size = e.max_size;
+        if (!conn->file) {
+            reply.status = ENOENT;
+            reply.message = "no export '" + name + "'";
+            return true;
+        }
+        reply.value = conn->file->size();
+        return true;
+    }
+    case block_protocol::READ:
+    case block_protocol::WRITE:
+        if (header.bytes > block_protocol::max_request_bytes) {
+            TLX_LOG1 << "block_server: request of " << header.bytes
+                     << " bytes too large, closing connection";
+            return false;
+        }
+        reply.bytes = header.bytes;
+        try {
+            reply.buffer = aligned_alloc<BlockAlignment>(header.bytes);
+        }
+        catch (const std::bad_alloc&) {
+            // the payload of a WRITE cannot be skipped reliably
+            TLX_LOG1 << "block_server: cannot allocate " << header.bytes
+                     << " bytes, closing connection";
+            return false;
+        }
+        if (header.op == block_protocol::WRITE &&
+            !block_protocol::recv_all(conn->fd, reply.buffer, header.bytes))
+            return false;
+        if (!conn->file) {
+            reply.status = EBADF;
+            reply.message = "no export opened";
+            return true;
+        }
+        if (!in_export(conn->max_size, header.offset, header.bytes)) {
+            reply.status = EINVAL;
+            reply.message = "access beyond the size limit of the export";
+            return true;
+        }
+        if (header.op == block_protocol::READ)
+            reply.req = conn->file->aread(
+                reply.buffer, header.offset, header.bytes);
+        else
+            reply.req = conn->file->awrite(
+                reply.buffer, header.offset, header.bytes);
+        return true;
+    case block_protocol::SIZE:
+    case block_protocol::SET_SIZE:
+    case block_protocol::DISCARD:
+        if (!conn->file) {
+            reply.status = EBADF;
+            reply.message = "no export opened";
+            return true;
+        }
+        if ((header.op == block_protocol::SET_SIZE &&
+             header.offset > conn->max_size) ||
+            (header.op == block_protocol::DISCARD &&
+             !in_export(conn->max_size, header.offset, header.bytes)))
+        {
+            reply.status = EINVAL;
+            reply.message = "access beyond the size limit of the export";
+            return true;
+        }
+        if (header.op == block_protocol::SIZE)
+            reply.value = conn->file->size();
+        else if (header.op == block_protocol::SET_SIZE)
+            conn->file->set_size(header.offset);
+        else
+            conn->file->discard(header.offset, header.bytes);
+        return true;
+    default:
+        TLX_LOG1 << "block_server: unknown request " << header.op
+                 << ", closing connection";
+        return false;
+    }
+}
+
+void block_server::read_requests(connection* conn)
+{
+    block_protocol::request_header header;
+
+    while (block_protocol::recv_all(conn->fd, &header, sizeof(header)))
+    {
+        if (header.magic != block_protocol::magic) {
+            TLX_LOG1 << "block_server: protocol error, closing connection";
+            break;
+        }
+
+        block_server_reply reply;
+        reply.id = header.id;
+        reply.op = header.op;
+
+        bool connected = true;
+        try {
+            connected = read_request(conn, header, reply);
+        }
+        catch (const std::exception& e) {
+            reply.status = EIO;
+            reply.message = e.what();
+        }
+        if (!connected) {
+            if (reply.buffer)
+                aligned_dealloc<BlockAlignment>(reply.buffer);
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(conn->mutex);
+        conn->cv.wait(lock, [this, conn]() {
+                          return conn->replies.size() < max_outstanding_;
+                      });
+        conn->replies.emplace_back(std::move(reply));
+        conn->cv.notify_all();
+    }
+
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    conn->closed = true;
+    conn->cv.notify_all();
+}
+
+void block_server::send_responses(connection* conn)
+{
+    bool connected = true;
+
+    while (true)
+    {
+        block_server_reply reply;
+        {
+            std::unique_lock<std::mutex> lock(conn->mutex);
+            conn->cv.wait(lock, [conn]() {
+                              return !conn->replies.empty() || conn->closed;
+                          });
+            if (conn->replies.empty())
+                break;
+            reply = std::move(conn->replies.front());
+            conn->replies.pop_front();
+            conn->cv.notify_all();
+        }
+
+        if (reply.req)
+        {
+            try {
+                reply.req->wait();
+            }
+            catch (const io_error& e) {
+                reply.status = EIO;
+                reply.message = e.what();
+            }
+            reply.req.reset();
+        }
+
+        if (connected && reply.id != 0)
+        {
+            block_protocol::response_header header;
+            header.magic = block_protocol::magic;
+            header.status = reply.status;
+            header.id = reply.id;
+
+            if (reply.status != 0) {
+                if (reply.message.size() > block_protocol::max_message_bytes)
+                    reply.message.resize(block_protocol::max_message_bytes);
+                header.value = reply.message.size();
+                connected = block_protocol::send_all(
+                    conn->fd, &header, sizeof(header),
+                    reply.message.data(), reply.message.size());
+            }
+            else if (reply.op == block_protocol::READ) {
+                header.value = reply.bytes;
+                connected = block_protocol::send_all(
+                    conn->fd, &header, sizeof(header),
+                    reply.buffer, reply.bytes);
+            }
+            else {
+                header.value = reply.value;
+                connected = block_protocol::send_all(
+                    conn->fd, &header, sizeof(header));
+            }
+
+            // let the reader run into the closed socket as well
+            if (!connected)
+                ::shutdown(conn->fd, SHUT_RDWR);
+        }
+
+        if (reply.buffer)
+            aligned_dealloc<BlockAlignment>(reply.buffer);
+    }
+
+    // the reader is done and all replies are sent: let the client see the end
+    // of the connection now instead of at the next reap
+    ::shutdown(conn->fd, SHUT_RDWR);
+    conn->finished = true;
+}
+
+} // namespace foxxll
+
+#endif // FOXXLL_HAVE_REMOTE_FILE
+
+/**************************************************************************/
@@ -0,0 +1,136 @@
+/***************************************************************************
+ *  foxxll/io/block_server.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_IO_BLOCK_SERVER_HEADER
+#define FOXXLL_IO_BLOCK_SERVER_HEADER
+
+#include <foxxll/config.hpp>
+
+#if FOXXLL_HAVE_REMOTE_FILE
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <foxxll/io/block_protocol.hpp>
+#include <foxxll/io/file.hpp>
+
+namespace foxxll {
+
+struct block_server_reply;
+
+//! \addtogroup foxxll_iolayer
+//! \{
+
+/*!
+ * Serves local files to remote_file clients, see block_protocol.
+ *
+ * Each connection is handled by a reader thread, which posts the requests to
+ * the exported file as they arrive, and a responder thread, which waits for
+ * them in order and sends the responses. Up to max_outstanding requests per
+ * connection are in flight, each holding a buffer of its size, and up to
+ * max_connections connections are served at a time, further ones are closed
+ * right after accepting them.
+ *
+ * Clients can only access the first max_size bytes of an export: READ, WRITE
+ * and DISCARD beyond and SET_SIZE to more are refused with EINVAL.
+ */
+class block_server
+{
+    struct connection;
+
+    struct export_entry
+    {
+        std::string name;
+        file_ptr file;
+        uint64_t max_size;
+    };
+
+    //! exported files, the first one is the default
+    std::vector<export_entry> exports_;
+
+    //! listening socket and the endpoint clients connect to
+    int listen_fd_;
+    std::string endpoint_;
+
+    //! limit of requests in flight per connection
+    size_t max_outstanding_;
+
+    //! limit of connections served at a time
+    size_t max_connections_;
+
+    //! active connections
+    std::list<std::unique_ptr<connection> > connections_;
+
+    //! set by stop()
+    std::atomic<bool> stop_ { false };
+
+    //! protects exports_ and connections_
+    std::mutex mutex_;
+
+    //! find an export by name, the first one for an empty name, returns an
+    //! entry without file if there is none
+    export_entry find_export(const std::string& name);
+
+    //! Read the rest of a request and post it. Returns false if the
+    //! connection must be closed.
+    bool read_request(connection* conn,
+                      const block_protocol::request_header& header,
+                      block_server_reply& reply);
+
+    //! loop of a connection's reader thread
+    void read_requests(connection* conn);
+
+    //! loop of a connection's responder thread
+    void send_responses(connection* conn);
+
+    //! join finished connections, or all after shutting them down
+    void reap_connections(bool all);
+
+public:
+    //! Listen on an endpoint, see block_protocol::open_socket().
+    explicit block_server(const std::string& endpoint,
+                          size_t max_outstanding = 64,
+                          size_t max_connections = 16);
+
+    //! non-copyable: delete copy-constructor
+    block_server(const block_server&) = delete;
+    //! non-copyable: delete assignment operator
+    block_server& operator = (const block_server&) = delete;
+
+    ~block_server();
+
+    //! Export a file under a name, clients may access and resize it up to
+    //! max_size bytes. Zero limits them to the current size of the file.
+    void add_export(const std::string& name, file_ptr file,
+                    uint64_t max_size = 0);
+
+    //! Returns the endpoint clients connect to, with the actual port.
+    const std::string & endpoint() const { return endpoint_; }
+
+    //! Accept and serve connections until stop() is called.
+    void run();
+
+    //! Make run() return, may be called from any thread.
+    void stop();
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // FOXXLL_HAVE_REMOTE_FILE
+
+#endif // !FOXXLL_IO_BLOCK_SERVER_HEADER
+
+/**************************************************************************/
@@ -181,6 +181,21 @@ file_ptr create_file(disk_config& cfg, int mode, int disk_allocator_id)
         return result;
     }
 #endif
+#if FOXXLL_HAVE_REMOTE_FILE
+    // path is "[export@]endpoint" of a block_server
+    else if (cfg.io_impl == "remote")
+    {
+        tlx::counting_ptr<remote_file> result =
+            tlx::make_counting<remote_file>(
+                cfg.path, cfg.queue, disk_allocator_id, cfg.device_id
+            );
+        result->lock();
+
+        // the export is owned by the server
+        cfg.delete_on_exit = cfg.unlink_on_open = false;
+        return result;
+    }
+#endif
 #if FOXXLL_HAVE_WINCALL_FILE
     else if (cfg.io_impl == "wincall")
     {
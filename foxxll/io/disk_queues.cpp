@@ -59,6 +59,8 @@ void disk_queues::make_queue(file* file)
 
 void disk_queues::add_request(request_ptr& req, disk_id_type disk)
 {
+    req->mark_posted();
+
     std::unique_lock<std::mutex> lock(mutex_);
 
 #ifdef FOXXLL_HACK_SINGLE_IO_THREAD
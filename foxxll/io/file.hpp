@@ -16,6 +16,7 @@
 #ifndef FOXXLL_IO_FILE_HEADER
 #define FOXXLL_IO_FILE_HEADER
 
+#include <atomic>
 #include <cassert>
 #include <limits>
 #include <ostream>
@@ -237,6 +238,32 @@ public:
         return request_ref_.reference_count();
     }
 
+private:
+    //! number of requests posted to be served and not completed yet
+    std::atomic<size_t> posted_requests_ { 0 };
+
+    //! only requests count themselves, see request::mark_posted()
+    friend class request;
+
+    //! increment posted requests
+    void add_posted_request()
+    {
+        ++posted_requests_;
+    }
+
+    //! decrement posted requests
+    void delete_posted_request()
+    {
+        --posted_requests_;
+    }
+
+public:
+    //! return number of requests queued or in flight
+    size_t get_posted_requests() const
+    {
+        return posted_requests_;
+    }
+
 public:
     //! \name Static Functions for Platform Abstraction
     //! \{
@@ -14,6 +14,7 @@
  **************************************************************************/
 
 #include <array>
+#include <atomic>
 #include <iomanip>
 #include <mutex>
 #include <numeric>
@@ -38,7 +39,8 @@ file_stats::file_stats(unsigned int device_id)
       read_bytes_(0), write_bytes_(0),
       read_time_(0.0), write_time_(0.0),
       p_begin_read_(0.0), p_begin_write_(0.0),
-      acc_reads_(0), acc_writes_(0)
+      acc_reads_(0), acc_writes_(0),
+      service_latency_(0.0)
 { }
 
 void file_stats::write_started(const size_t size, double now)
@@ -147,6 +149,17 @@ void file_stats::read_op_finished(const size_t size, double duration)
     read_bytes_ += size;
 }
 
+void file_stats::service_finished(double duration)
+{
+    double latency = service_latency_.load(std::memory_order_relaxed);
+    double update;
+    do {
+        update = (latency == 0.0) ? duration
+                 : latency + service_latency_weight * (duration - latency);
+    } while (!service_latency_.compare_exchange_weak(
+                 latency, update, std::memory_order_relaxed));
+}
+
 /******************************************************************************/
 // file_stats_data
 
@@ -190,6 +203,51 @@ file_stats_data file_stats_data::operator - (const file_stats_data& a) const
     return fsd;
 }
 
+/******************************************************************************/
+// io_tag_stats_data
+
+io_tag_stats_data io_tag_stats_data::operator + (const io_tag_stats_data& a) const
+{
+    FOXXLL_THROW_IF(
+        tag_ != a.tag_, std::runtime_error,
+        "foxxll::io_tag_stats_data objects do not belong to the same tag"
+    );
+
+    io_tag_stats_data d(tag_, name_);
+
+    d.read_count_ = read_count_ + a.read_count_;
+    d.write_count_ = write_count_ + a.write_count_;
+    d.read_bytes_ = read_bytes_ + a.read_bytes_;
+    d.write_bytes_ = write_bytes_ + a.write_bytes_;
+    d.read_time_ = read_time_ + a.read_time_;
+    d.write_time_ = write_time_ + a.write_time_;
+    d.wait_read_time_ = wait_read_time_ + a.wait_read_time_;
+    d.wait_write_time_ = wait_write_time_ + a.wait_write_time_;
+
+    return d;
+}
+
+io_tag_stats_data io_tag_stats_data::operator - (const io_tag_stats_data& a) const
+{
+    FOXXLL_THROW_IF(
+        tag_ != a.tag_, std::runtime_error,
+        "foxxll::io_tag_stats_data objects do not belong to the same tag"
+    );
+
+    io_tag_stats_data d(tag_, name_);
+
+    d.read_count_ = read_count_ - a.read_count_;
+    d.write_count_ = write_count_ - a.write_count_;
+    d.read_bytes_ = read_bytes_ - a.read_bytes_;
+    d.write_bytes_ = write_bytes_ - a.write_bytes_;
+    d.read_time_ = read_time_ - a.read_time_;
+    d.write_time_ = write_time_ - a.write_time_;
+    d.wait_read_time_ = wait_read_time_ - a.wait_read_time_;
+    d.wait_write_time_ = wait_write_time_ - a.wait_write_time_;
+
+    return d;
+}
+
 /******************************************************************************/
 // stats
 
@@ -211,7 +269,14 @@ stats::stats()
       p_begin_wait_write_(0.0),
       acc_waits_(0.0),
       acc_wait_read_(0.0), acc_wait_write_(0.0)
-{ }
+{
+    io_tags_.reset(new io_tag_counters[max_io_tags]);
+
+    // tag 0 collects all untagged I/O
+    io_tag_names_.emplace_back();
+}
+
+thread_local unsigned stats::current_io_tag_ = 0;
 
 #ifndef FOXXLL_DO_NOT_COUNT_WAIT_TIME
 void stats::wait_started(wait_op_type wait_op)
@@ -372,6 +437,94 @@ std::vector<file_stats_data> stats::deepcopy_file_stats_data_list() const
     };
 }
 
+std::vector<io_tag_stats_data> stats::deepcopy_io_tag_stats_data_list() const
+{
+    std::unique_lock<std::mutex> lock(io_tag_mutex_);
+
+    std::vector<io_tag_stats_data> list;
+    list.reserve(io_tag_names_.size());
+    for (unsigned tag = 0; tag < io_tag_names_.size(); ++tag)
+    {
+        const io_tag_counters& c = io_tags_[tag];
+        list.emplace_back(tag, io_tag_names_[tag]);
+        io_tag_stats_data& t = list.back();
+        t.read_count_ = c.read_count;
+        t.write_count_ = c.write_count;
+        t.read_bytes_ = c.read_bytes;
+        t.write_bytes_ = c.write_bytes;
+        t.read_time_ = c.read_time;
+        t.write_time_ = c.write_time;
+        t.wait_read_time_ = c.wait_read_time;
+        t.wait_write_time_ = c.wait_write_time;
+    }
+    return list;
+}
+
+unsigned stats::register_io_tag(const std::string& name)
+{
+    if (name.empty())
+        return 0;
+
+    std::unique_lock<std::mutex> lock(io_tag_mutex_);
+    for (unsigned tag = 1; tag < io_tag_names_.size(); ++tag) {
+        if (io_tag_names_[tag] == name)
+            return tag;
+    }
+
+    FOXXLL_THROW_IF(
+        io_tag_names_.size() >= max_io_tags, std::runtime_error,
+        "foxxll::stats: more than " << max_io_tags << " I/O tags, cannot add '"
+                                    << name << "'"
+    );
+
+    io_tag_names_.push_back(name);
+    return static_cast<unsigned>(io_tag_names_.size() - 1);
+}
+
+//! add to an atomic double, which has no fetch_add before C++20
+static void atomic_add(std::atomic<double>& a, double x)
+{
+    double v = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(v, v + x, std::memory_order_relaxed)) { }
+}
+
+void stats::io_tag_read_finished(unsigned tag, const size_t size, double duration)
+{
+    // untagged I/O is derived from the file statistics
+    if (tag == 0)
+        return;
+
+    io_tag_counters& t = io_tags_[tag];
+    t.read_count.fetch_add(1, std::memory_order_relaxed);
+    t.read_bytes.fetch_add(size, std::memory_order_relaxed);
+    atomic_add(t.read_time, duration);
+}
+
+void stats::io_tag_write_finished(unsigned tag, const size_t size, double duration)
+{
+    if (tag == 0)
+        return;
+
+    io_tag_counters& t = io_tags_[tag];
+    t.write_count.fetch_add(1, std::memory_order_relaxed);
+    t.write_bytes.fetch_add(size, std::memory_order_relaxed);
+    atomic_add(t.write_time, duration);
+}
+
+#ifndef FOXXLL_DO_NOT_COUNT_WAIT_TIME
+void stats::io_tag_wait_finished(unsigned tag, wait_op_type wait_op, double duration)
+{
+    if (tag == 0)
+        return;
+
+    // account WAIT_OP_ANY as write wait, as in wait_started()
+    if (wait_op == WAIT_OP_READ)
+        atomic_add(io_tags_[tag].wait_read_time, duration);
+    else
+        atomic_add(io_tags_[tag].wait_write_time, duration);
+}
+#endif
+
 std::ostream& operator << (std::ostream& o, const stats& s)
 {
     o << stats_data(s);
@@ -441,6 +594,14 @@ struct FileStatsDataCompare {
     }
 };
 
+struct IoTagStatsDataCompare {
+    long long operator () (const io_tag_stats_data& a, const io_tag_stats_data& b) const
+    {
+        return static_cast<long long>(a.get_tag())
+               - static_cast<long long>(b.get_tag());
+    }
+};
+
 stats_data stats_data::operator + (const stats_data& a) const
 {
     stats_data s;
@@ -455,6 +616,16 @@ stats_data stats_data::operator + (const stats_data& a) const
         }
     );
 
+    tlx::merge_combine(
+        io_tag_stats_data_list_.cbegin(), io_tag_stats_data_list_.cend(),
+        a.io_tag_stats_data_list_.cbegin(), a.io_tag_stats_data_list_.cend(),
+        std::back_inserter(s.io_tag_stats_data_list_),
+        IoTagStatsDataCompare(),
+        [](const io_tag_stats_data& a, const io_tag_stats_data& b) {
+            return a + b;
+        }
+    );
+
     s.p_reads_ = p_reads_ + a.p_reads_;
     s.p_writes_ = p_writes_ + a.p_writes_;
     s.p_ios_ = p_ios_ + a.p_ios_;
@@ -479,6 +650,16 @@ stats_data stats_data::operator - (const stats_data& a) const
         }
     );
 
+    tlx::merge_combine(
+        io_tag_stats_data_list_.cbegin(), io_tag_stats_data_list_.cend(),
+        a.io_tag_stats_data_list_.cbegin(), a.io_tag_stats_data_list_.cend(),
+        std::back_inserter(s.io_tag_stats_data_list_),
+        IoTagStatsDataCompare(),
+        [](const io_tag_stats_data& a, const io_tag_stats_data& b) {
+            return a - b;
+        }
+    );
+
     s.p_reads_ = p_reads_ - a.p_reads_;
     s.p_writes_ = p_writes_ - a.p_writes_;
     s.p_ios_ = p_ios_ - a.p_ios_;
@@ -489,6 +670,40 @@ stats_data stats_data::operator - (const stats_data& a) const
     return s;
 }
 
+void stats_data::derive_untagged()
+{
+    if (io_tag_stats_data_list_.empty())
+        return;
+
+    io_tag_stats_data tagged;
+    for (size_t i = 1; i < io_tag_stats_data_list_.size(); ++i) {
+        const io_tag_stats_data& t = io_tag_stats_data_list_[i];
+        tagged.read_count_ += t.read_count_;
+        tagged.write_count_ += t.write_count_;
+        tagged.read_bytes_ += t.read_bytes_;
+        tagged.write_bytes_ += t.write_bytes_;
+        tagged.read_time_ += t.read_time_;
+        tagged.write_time_ += t.write_time_;
+        tagged.wait_read_time_ += t.wait_read_time_;
+        tagged.wait_write_time_ += t.wait_write_time_;
+    }
+
+    // clamp, the file statistics time requests slightly differently
+    auto rest = [](auto total, auto part) {
+                    return total > part ? total - part : decltype(total)(0);
+                };
+
+    io_tag_stats_data& untagged = io_tag_stats_data_list_[0];
+    untagged.read_count_ = rest(get_read_count(), tagged.read_count_);
+    untagged.write_count_ = rest(get_write_count(), tagged.write_count_);
+    untagged.read_bytes_ = rest(get_read_bytes(), tagged.read_bytes_);
+    untagged.write_bytes_ = rest(get_write_bytes(), tagged.write_bytes_);
+    untagged.read_time_ = rest(get_read_time(), tagged.read_time_);
+    untagged.write_time_ = rest(get_write_time(), tagged.write_time_);
+    untagged.wait_read_time_ = rest(t_wait_read_, tagged.wait_read_time_);
+    untagged.wait_write_time_ = rest(t_wait_write_, tagged.wait_write_time_);
+}
+
 size_t stats_data::num_files() const
 {
     return file_stats_data_list_.size();
@@ -661,6 +876,15 @@ double stats_data::get_wait_write_time() const
     return t_wait_write_;
 }
 
+io_tag_stats_data stats_data::get_io_tag_stats(const std::string& name) const
+{
+    for (const io_tag_stats_data& t : io_tag_stats_data_list_) {
+        if (t.get_name() == name)
+            return t;
+    }
+    return io_tag_stats_data();
+}
+
 void stats_data::to_ostream(std::ostream& o, const std::string line_prefix) const
 {
     constexpr double one_mib = 1024.0 * 1024;
@@ -756,6 +980,34 @@ void stats_data::to_ostream(std::ostream& o, const std::string line_prefix) cons
         o << " I/O wait4write time                        : "
           << get_wait_write_time() << " s\n" << line_prefix;
 #endif
+    // print per-tag statistics only if any I/O was tagged
+    bool any_tagged = false;
+    for (const io_tag_stats_data& t : io_tag_stats_data_list_) {
+        if (t.get_tag() != 0 && (t.get_read_count() || t.get_write_count() ||
+                                 t.get_wait_read_time() != 0.0 ||
+                                 t.get_wait_write_time() != 0.0))
+            any_tagged = true;
+    }
+    if (any_tagged) {
+        for (const io_tag_stats_data& t : io_tag_stats_data_list_) {
+            std::string label = " I/O tag " +
+                                (t.get_tag() ? "'" + t.get_name() + "'" : std::string("(untagged)"));
+            if (label.size() < 44)
+                label.resize(44, ' ');
+            o << label << ": "
+              << add_IEC_binary_multiplier(t.get_read_count()) << " reads, "
+              << add_IEC_binary_multiplier(t.get_read_bytes(), "B") << " in "
+              << t.get_read_time() << " s; "
+              << add_IEC_binary_multiplier(t.get_write_count()) << " writes, "
+              << add_IEC_binary_multiplier(t.get_write_bytes(), "B") << " in "
+              << t.get_write_time() << " s";
+#ifndef FOXXLL_DO_NOT_COUNT_WAIT_TIME
+            o << "; wait4read " << t.get_wait_read_time() << " s"
+              << ", wait4write " << t.get_wait_write_time() << " s";
+#endif
+            o << "\n" << line_prefix;
+        }
+    }
     o << " Time since the last reset                  : "
       << get_elapsed_time() << " s";
 
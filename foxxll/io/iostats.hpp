@@ -18,9 +18,11 @@
 #define FOXXLL_IO_IOSTATS_HEADER
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <limits>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
@@ -61,7 +63,14 @@ class file_stats
 
     std::mutex read_mutex_, write_mutex_;
 
+    //! exponentially weighted moving average of the service time of
+    //! recently completed operations, in seconds. 0 before the first one.
+    std::atomic<double> service_latency_;
+
 public:
+    //! weight of the latest operation in the service latency average
+    static constexpr double service_latency_weight = 0.125;
+
     //! construct zero initialized
     explicit file_stats(unsigned int device_id);
 
@@ -233,6 +242,14 @@ public:
         return write_time_;
     }
 
+    //! Returns the moving average of the service time of recent read and
+    //! write operations, used for load-aware block allocation.
+    //! \return seconds per operation, 0 if no operation completed yet
+    double get_service_latency() const
+    {
+        return service_latency_.load(std::memory_order_relaxed);
+    }
+
     // for library use
     void write_started(const size_t size_, double now = 0.0);
     void write_canceled(const size_t size_);
@@ -243,6 +260,8 @@ public:
     void read_canceled(const size_t size_);
     void read_finished();
     void read_op_finished(const size_t size_, double duration);
+
+    void service_finished(double duration);
 };
 
 class file_stats_data
@@ -314,6 +333,90 @@ public:
     }
 };
 
+//! I/O counters attributed to one I/O tag, see stats::scoped_io_tag. Tag 0 is
+//! the default tag collecting all untagged I/O.
+class io_tag_stats_data
+{
+    friend class stats;
+    friend class stats_data;
+
+    //! tag id
+    unsigned tag_;
+    //! tag name
+    std::string name_;
+    //! number of operations
+    unsigned read_count_, write_count_;
+    //! number of bytes read/written
+    external_size_type read_bytes_, write_bytes_;
+    //! seconds spent serving the requests (summed, not parallel time)
+    double read_time_, write_time_;
+    //! seconds spent by threads carrying this tag waiting for I/O
+    double wait_read_time_, wait_write_time_;
+
+public:
+    explicit io_tag_stats_data(
+        unsigned tag = 0, const std::string& name = std::string())
+        : tag_(tag), name_(name),
+          read_count_(0), write_count_(0),
+          read_bytes_(0), write_bytes_(0),
+          read_time_(0.0), write_time_(0.0),
+          wait_read_time_(0.0), wait_write_time_(0.0)
+    { }
+
+    io_tag_stats_data operator + (const io_tag_stats_data& a) const;
+    io_tag_stats_data operator - (const io_tag_stats_data& a) const;
+
+    unsigned get_tag() const
+    {
+        return tag_;
+    }
+
+    const std::string & get_name() const
+    {
+        return name_;
+    }
+
+    unsigned get_read_count() const
+    {
+        return read_count_;
+    }
+
+    unsigned get_write_count() const
+    {
+        return write_count_;
+    }
+
+    external_size_type get_read_bytes() const
+    {
+        return read_bytes_;
+    }
+
+    external_size_type get_write_bytes() const
+    {
+        return write_bytes_;
+    }
+
+    double get_read_time() const
+    {
+        return read_time_;
+    }
+
+    double get_write_time() const
+    {
+        return write_time_;
+    }
+
+    double get_wait_read_time() const
+    {
+        return wait_read_time_;
+    }
+
+    double get_wait_write_time() const
+    {
+        return wait_write_time_;
+    }
+};
+
 //! Collects various I/O statistics.
 //! \remarks is a singleton
 class stats : public singleton<stats>
@@ -329,6 +432,36 @@ class stats : public singleton<stats>
 
     mutable std::mutex list_mutex_;
 
+    // *** I/O tags: attribute requests to application phases ***
+
+public:
+    //! maximum number of I/O tags, including the default tag 0
+    static constexpr unsigned max_io_tags = 256;
+
+private:
+    //! counters of one I/O tag, updated by the disk queue threads without
+    //! locking
+    struct io_tag_counters
+    {
+        std::atomic<unsigned> read_count { 0 }, write_count { 0 };
+        std::atomic<external_size_type> read_bytes { 0 }, write_bytes { 0 };
+        std::atomic<double> read_time { 0.0 }, write_time { 0.0 };
+        std::atomic<double> wait_read_time { 0.0 }, wait_write_time { 0.0 };
+    };
+
+    //! counters per tag, indexed by tag id. Untagged I/O is not counted here,
+    //! stats_data derives tag 0 from the file statistics.
+    std::unique_ptr<io_tag_counters[]> io_tags_;
+
+    //! names of the registered tags, indexed by tag id
+    std::vector<std::string> io_tag_names_;
+
+    //! protects io_tag_names_
+    mutable std::mutex io_tag_mutex_;
+
+    //! tag of the calling thread, captured by each request at creation
+    static thread_local unsigned current_io_tag_;
+
     // *** parallel times have to be counted globally ***
 
     //! seconds spent in parallel operations
@@ -367,11 +500,38 @@ public:
         WAIT_OP_WRITE
     };
 
+    //! Scoped I/O tag: all requests created by the calling thread while the
+    //! object is alive, and all of the thread's I/O waits, are accounted to the
+    //! named tag. Scopes nest; the previous tag is restored on destruction.
+    class scoped_io_tag
+    {
+        unsigned prev_tag_;
+
+    public:
+        explicit scoped_io_tag(const std::string& name)
+            : prev_tag_(current_io_tag_)
+        {
+            current_io_tag_ = stats::get_instance()->register_io_tag(name);
+        }
+
+        //! non-copyable: delete copy-constructor
+        scoped_io_tag(const scoped_io_tag&) = delete;
+        //! non-copyable: delete assignment operator
+        scoped_io_tag& operator = (const scoped_io_tag&) = delete;
+
+        ~scoped_io_tag()
+        {
+            current_io_tag_ = prev_tag_;
+        }
+    };
+
     class scoped_wait_timer
     {
 #ifndef FOXXLL_DO_NOT_COUNT_WAIT_TIME
         bool running_ = false;
         wait_op_type wait_op_;
+        unsigned io_tag_ = 0;
+        double begin_ = 0.0;
 #endif
 
     public:
@@ -394,6 +554,8 @@ public:
 #ifndef FOXXLL_DO_NOT_COUNT_WAIT_TIME
             if (!running_) {
                 running_ = true;
+                io_tag_ = current_io_tag_;
+                begin_ = timestamp();
                 stats::get_instance()->wait_started(wait_op_);
             }
 #endif
@@ -403,7 +565,9 @@ public:
         {
 #ifndef FOXXLL_DO_NOT_COUNT_WAIT_TIME
             if (running_) {
-                stats::get_instance()->wait_finished(wait_op_);
+                stats* s = stats::get_instance();
+                s->wait_finished(wait_op_);
+                s->io_tag_wait_finished(io_tag_, wait_op_, timestamp() - begin_);
                 running_ = false;
             }
 #endif
@@ -423,6 +587,20 @@ public:
     //! statistics. (for internal library use.)
     file_stats * create_file_stats(unsigned device_id);
 
+    //! return the current values of all I/O tag counters, ordered by tag id.
+    //! The counters of tag 0 are zero, see stats_data.
+    std::vector<io_tag_stats_data> deepcopy_io_tag_stats_data_list() const;
+
+    //! return id of the named I/O tag, creating it if necessary. Throws
+    //! std::runtime_error if there are max_io_tags tags already.
+    unsigned register_io_tag(const std::string& name);
+
+    //! return the I/O tag of the calling thread (0 if untagged).
+    static unsigned current_io_tag()
+    {
+        return current_io_tag_;
+    }
+
     //! I/O wait time counter.
     //! \return number of seconds spent in I/O waiting functions \link
     //! request::wait request::wait \endlink, \c wait_any and \c wait_all
@@ -476,11 +654,17 @@ private:
 public:
     void wait_started(wait_op_type wait_op_);
     void wait_finished(wait_op_type wait_op_);
+
+    // called by requests after being served, and by scoped_wait_timer
+    void io_tag_read_finished(unsigned tag, const size_t size, double duration);
+    void io_tag_write_finished(unsigned tag, const size_t size, double duration);
+    void io_tag_wait_finished(unsigned tag, wait_op_type wait_op, double duration);
 };
 
 #ifdef FOXXLL_DO_NOT_COUNT_WAIT_TIME
 inline void stats::wait_started(wait_op_type) { }
 inline void stats::wait_finished(wait_op_type) { }
+inline void stats::io_tag_wait_finished(unsigned, wait_op_type, double) { }
 #endif
 
 class stats_data
@@ -494,6 +678,10 @@ class stats_data
 
     double elapsed_;
 
+    //! list of I/O tag statistics, ordered by tag id. Copied before the file
+    //! statistics, such that these include all tagged I/O.
+    std::vector<io_tag_stats_data> io_tag_stats_data_list_;
+
     //! list of individual file statistics.
     std::vector<file_stats_data> file_stats_data_list_;
 
@@ -501,6 +689,9 @@ class stats_data
     template <typename T, typename Functor>
     T fetch_sum(const Functor& get_value) const;
 
+    //! set tag 0 to the I/O of all files not attributed to other tags
+    void derive_untagged();
+
 public:
     template <typename T>
     struct summary
@@ -531,8 +722,11 @@ public:
           t_wait_read_(s.get_wait_read_time()),
           t_wait_write_(s.get_wait_write_time()),
           elapsed_(timestamp() - s.get_creation_time()),
+          io_tag_stats_data_list_(s.deepcopy_io_tag_stats_data_list()),
           file_stats_data_list_(s.deepcopy_file_stats_data_list())
-    { }
+    {
+        derive_untagged();
+    }
 
     stats_data operator + (const stats_data& a) const;
     stats_data operator - (const stats_data& a) const;
@@ -630,6 +824,15 @@ public:
 
     double get_wait_write_time() const;
 
+    //! Returns the I/O statistics of all tags, ordered by tag id.
+    const std::vector<io_tag_stats_data> & get_io_tag_stats_data_list() const
+    {
+        return io_tag_stats_data_list_;
+    }
+
+    //! Returns the I/O statistics of the named tag (all zero if unused).
+    io_tag_stats_data get_io_tag_stats(const std::string& name) const;
+
     void to_ostream(std::ostream& o, const std::string line_prefix = "") const;
 
     friend std::ostream& operator << (std::ostream& o, const stats_data& s)
@@ -35,10 +35,13 @@ void linuxaio_request::completed(bool posted, bool canceled)
     {
         if (op_ == READ) {
             stats->read_op_finished(bytes_, duration);
+            foxxll::stats::get_instance()->io_tag_read_finished(io_tag_, bytes_, duration);
         }
         else {
             stats->write_op_finished(bytes_, duration);
+            foxxll::stats::get_instance()->io_tag_write_finished(io_tag_, bytes_, duration);
         }
+        stats->service_finished(duration);
     }
     else if (posted)
     {
@@ -0,0 +1,375 @@
+/***************************************************************************
+ *  foxxll/io/remote_file.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <foxxll/io/remote_file.hpp>
+
+#if FOXXLL_HAVE_REMOTE_FILE
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <utility>
+#include <vector>
+
+#include <tlx/logger/core.hpp>
+
+#include <foxxll/common/error_handling.hpp>
+#include <foxxll/common/timer.hpp>
+#include <foxxll/io/iostats.hpp>
+
+namespace foxxll {
+
+void remote_request::completed(bool canceled)
+{
+    TLX_LOG << "remote_request[" << this << "] completed(" << canceled << ")";
+
+    if (!canceled && !error_)
+    {
+        auto* stats = file_->get_file_stats();
+        const double duration = timestamp() - time_posted_;
+
+        if (op_ == READ) {
+            stats->read_op_finished(bytes_, duration);
+            foxxll::stats::get_instance()->io_tag_read_finished(io_tag_, bytes_, duration);
+        }
+        else {
+            stats->write_op_finished(bytes_, duration);
+            foxxll::stats::get_instance()->io_tag_write_finished(io_tag_, bytes_, duration);
+        }
+        stats->service_finished(duration);
+    }
+
+    request_with_state::completed(canceled);
+}
+
+remote_file::remote_file(
+    const std::string& location,
+    int queue_id, int allocator_id, unsigned int device_id,
+    size_t max_outstanding)
+    : file(device_id),
+      queue_id_(queue_id), allocator_id_(allocator_id),
+      max_outstanding_(max_outstanding > 0 ? max_outstanding : 1)
+{
+    size_t at = location.find('@');
+    if (at == std::string::npos) {
+        endpoint_ = location;
+    }
+    else {
+        export_ = location.substr(0, at);
+        endpoint_ = location.substr(at + 1);
+    }
+
+    fd_ = block_protocol::open_socket(endpoint_, /* listen */ false);
+    receiver_ = std::thread([this]() { receive(); });
+
+    try {
+        size_ = control(block_protocol::OPEN, 0, export_.size(), export_.data());
+    }
+    catch (...) {
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex_);
+            closing_ = true;
+        }
+        ::shutdown(fd_, SHUT_RDWR);
+        receiver_.join();
+        ::close(fd_);
+        throw;
+    }
+}
+
+remote_file::~remote_file()
+{
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex_);
+        closing_ = true;
+    }
+    // wakes the receiver, which fails requests still in flight
+    ::shutdown(fd_, SHUT_RDWR);
+    receiver_.join();
+    ::close(fd_);
+}
+
+bool remote_file::post(
+    uint32_t op, offset_type offset, size_type bytes,
+    const void* payload, const pending_call& call, std::string* error)
+{
+    block_protocol::request_header header;
+    header.magic = block_protocol::magic;
+    header.op = op;
+    header.id = 0;
+    header.offset = offset;
+    header.bytes = bytes;
+
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex_);
+        // completion handlers run on the receiver thread, which must not
+        // wait for the window it alone can open
+        if ((call.req || call.call) &&
+            std::this_thread::get_id() != receiver_.get_id())
+        {
+            pending_cv_.wait(lock, [this]() {
+                                 return pending_.size() < max_outstanding_ ||
+                                 !failure_.empty();
+                             });
+        }
+        if (!failure_.empty()) {
+            *error = failure_;
+            return false;
+        }
+        if (call.req || call.call) {
+            header.id = next_id_++;
+            pending_.emplace(header.id, call);
+        }
+    }
+
+    bool with_payload = (op == block_protocol::WRITE ||
+                         op == block_protocol::OPEN);
+
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    if (!block_protocol::send_all(fd_, &header, sizeof(header),
+                                  payload, with_payload ? bytes : 0))
+    {
+        // the receiver notices the broken connection and fails this request
+        // together with all others in flight
+        ::shutdown(fd_, SHUT_RDWR);
+    }
+    return true;
+}
+
+uint64_t remote_file::control(
+    uint32_t op, offset_type offset, size_type bytes, const void* payload)
+{
+    control_call call;
+    std::string error;
+    if (!post(op, offset, bytes, payload, pending_call { request_ptr(), &call },
+              &error))
+    {
+        FOXXLL_THROW(io_error, "remote_file " << export_ << "@" << endpoint_
+                                              << " : " << error);
+    }
+
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    pending_cv_.wait(lock, [&call]() { return call.done; });
+
+    if (call.status != 0) {
+        FOXXLL_THROW(io_error, "remote_file " << export_ << "@" << endpoint_
+                                              << " : " << call.message);
+    }
+    return call.value;
+}
+
+void remote_file::finish(pending_call& call, uint32_t status, uint64_t value,
+                         const std::string& message)
+{
+    if (call.req)
+    {
+        remote_request* req = static_cast<remote_request*>(call.req.get());
+        if (status != 0)
+            req->error_occured("remote_file " + export_ + "@" + endpoint_ +
+                               " : " + message);
+        req->completed(false);
+        call.req.reset();
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex_);
+        call.call->status = status;
+        call.call->value = value;
+        call.call->message = message;
+        call.call->done = true;
+        pending_cv_.notify_all();
+    }
+}
+
+void remote_file::receive()
+{
+    std::string reason = "connection closed by server";
+    block_protocol::response_header header;
+
+    while (block_protocol::recv_all(fd_, &header, sizeof(header)))
+    {
+        if (header.magic != block_protocol::magic) {
+            reason = "protocol error";
+            break;
+        }
+
+        pending_call call;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex_);
+            auto it = pending_.find(header.id);
+            if (it == pending_.end()) {
+                reason = "response to unknown request";
+                break;
+            }
+            call = std::move(it->second);
+            pending_.erase(it);
+            pending_cv_.notify_all();
+        }
+
+        bool ok = true;
+        std::string message;
+        if (header.status != 0)
+        {
+            if (header.value > block_protocol::max_message_bytes) {
+                finish(call, EPROTO, 0, "error message too long");
+                reason = "protocol error";
+                break;
+            }
+            message.resize(header.value);
+            ok = header.value == 0 ||
+                 block_protocol::recv_all(fd_, &message[0], header.value);
+        }
+        else if (call.req && call.req->op() == request::READ)
+        {
+            if (header.value != call.req->bytes()) {
+                finish(call, EPROTO, 0, "short read");
+                reason = "protocol error";
+                break;
+            }
+            // receive straight into the request's buffer
+            ok = block_protocol::recv_all(
+                fd_, call.req->buffer(), call.req->bytes());
+        }
+
+        if (!ok) {
+            finish(call, EIO, 0, reason);
+            break;
+        }
+        finish(call, header.status, header.value, message);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex_);
+        if (closing_)
+            reason = "file closed";
+    }
+    if (reason != "file closed")
+        TLX_LOG1 << "remote_file " << export_ << "@" << endpoint_
+                 << " : " << reason;
+
+    fail_pending(reason);
+}
+
+void remote_file::fail_pending(const std::string& reason)
+{
+    std::vector<pending_call> calls;
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex_);
+        failure_ = reason;
+        for (auto& p : pending_)
+            calls.emplace_back(std::move(p.second));
+        pending_.clear();
+        pending_cv_.notify_all();
+    }
+    for (pending_call& call : calls)
+        finish(call, EIO, 0, reason);
+}
+
+request_ptr remote_file::aread(
+    void* buffer, offset_type offset, size_type bytes,
+    const completion_handler& on_complete)
+{
+    tlx::counting_ptr<remote_request> req =
+        tlx::make_counting<remote_request>(
+            on_complete, this, buffer, offset, bytes, request::READ
+        );
+
+    req->time_posted_ = timestamp();
+    if (bytes > block_protocol::max_request_bytes) {
+        pending_call call { req, nullptr };
+        finish(call, EINVAL, 0, "remote_file: read of " + std::to_string(bytes) +
+               " bytes exceeds the protocol limit");
+        return req;
+    }
+
+    std::string error;
+    req->mark_posted();
+    if (!post(block_protocol::READ, offset, bytes, nullptr,
+              pending_call { req, nullptr }, &error))
+    {
+        pending_call call { req, nullptr };
+        finish(call, EIO, 0, error);
+    }
+    return req;
+}
+
+request_ptr remote_file::awrite(
+    void* buffer, offset_type offset, size_type bytes,
+    const completion_handler& on_complete)
+{
+    tlx::counting_ptr<remote_request> req =
+        tlx::make_counting<remote_request>(
+            on_complete, this, buffer, offset, bytes, request::WRITE
+        );
+
+    req->time_posted_ = timestamp();
+    if (bytes > block_protocol::max_request_bytes) {
+        pending_call call { req, nullptr };
+        finish(call, EINVAL, 0, "remote_file: write of " + std::to_string(bytes) +
+               " bytes exceeds the protocol limit");
+        return req;
+    }
+
+    std::string error;
+    req->mark_posted();
+    if (!post(block_protocol::WRITE, offset, bytes, buffer,
+              pending_call { req, nullptr }, &error))
+    {
+        pending_call call { req, nullptr };
+        finish(call, EIO, 0, error);
+    }
+    return req;
+}
+
+void remote_file::serve(void* buffer, offset_type offset, size_type bytes,
+                        request::read_or_write op)
+{
+    if (op == request::READ)
+        aread(buffer, offset, bytes)->wait();
+    else
+        awrite(buffer, offset, bytes)->wait();
+}
+
+file::offset_type remote_file::size()
+{
+    size_ = control(block_protocol::SIZE, 0, 0);
+    return size_;
+}
+
+void remote_file::set_size(offset_type newsize)
+{
+    control(block_protocol::SET_SIZE, newsize, 0);
+    size_ = newsize;
+}
+
+void remote_file::lock()
+{
+    // the server holds the lock on the exported file
+}
+
+void remote_file::discard(offset_type offset, offset_type size)
+{
+    // fire and forget, freed blocks need no answer
+    std::string error;
+    post(block_protocol::DISCARD, offset, size, nullptr,
+         pending_call { request_ptr(), nullptr }, &error);
+}
+
+const char* remote_file::io_type() const
+{
+    return "remote";
+}
+
+} // namespace foxxll
+
+#endif // FOXXLL_HAVE_REMOTE_FILE
+
+/**************************************************************************/
@@ -0,0 +1,192 @@
+/***************************************************************************
+ *  foxxll/io/remote_file.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_IO_REMOTE_FILE_HEADER
+#define FOXXLL_IO_REMOTE_FILE_HEADER
+
+#include <foxxll/config.hpp>
+
+#if FOXXLL_HAVE_REMOTE_FILE
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <foxxll/io/block_protocol.hpp>
+#include <foxxll/io/file.hpp>
+#include <foxxll/io/request_with_state.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_fileimpl
+//! \{
+
+/*!
+ * Implementation of \c file served by a block_server over TCP or a Unix
+ * socket.
+ *
+ * The location names an export and the endpoint of the server, e.g.
+ * "scratch@node7:5010" or "scratch@unix:/run/foxxll.sock". Without the
+ * "name@" part the first export of the server is used.
+ *
+ * Requests are not queued in the disk_queues but sent right away, up to
+ * max_outstanding of them are in flight on the connection. A receiver thread
+ * reads the data of completed reads directly into the request buffers and
+ * completes the requests.
+ */
+class remote_file final : public file
+{
+    //! result of a synchronous control call
+    struct control_call
+    {
+        bool done = false;
+        uint32_t status = 0;
+        uint64_t value = 0;
+        std::string message;
+    };
+
+    //! request waiting for its response, exactly one of both is set
+    struct pending_call
+    {
+        request_ptr req;
+        control_call* call = nullptr;
+    };
+
+    int queue_id_, allocator_id_;
+
+    //! endpoint and export name
+    std::string endpoint_, export_;
+
+    //! connected socket
+    int fd_ = -1;
+
+    //! limit of requests in flight
+    size_t max_outstanding_;
+
+    //! serializes sending on fd_
+    std::mutex send_mutex_;
+
+    //! requests in flight by id, and the next id
+    std::unordered_map<uint64_t, pending_call> pending_;
+    uint64_t next_id_ = 1;
+
+    //! set when the connection failed, all later requests fail
+    std::string failure_;
+
+    //! set during destruction
+    bool closing_ = false;
+
+    //! protects pending_, next_id_, failure_ and closing_
+    std::mutex pending_mutex_;
+
+    //! signaled when a pending request or control call completes
+    std::condition_variable pending_cv_;
+
+    //! size of the export as last reported
+    offset_type size_ = 0;
+
+    //! thread reading responses
+    std::thread receiver_;
+
+    //! Send a request and register it, blocks while the window is full. A
+    //! call without request and control call is sent with id zero and not
+    //! answered. Returns false if the connection already failed.
+    bool post(uint32_t op, offset_type offset, size_type bytes,
+              const void* payload, const pending_call& call,
+              std::string* error);
+
+    //! send a control request and wait for its response
+    uint64_t control(uint32_t op, offset_type offset, size_type bytes,
+                     const void* payload = nullptr);
+
+    //! loop of the receiver thread
+    void receive();
+
+    //! complete a request or control call
+    void finish(pending_call& call, uint32_t status, uint64_t value,
+                const std::string& message);
+
+    //! fail all pending requests after the connection broke
+    void fail_pending(const std::string& reason);
+
+public:
+    //! Connects to a block_server and opens an export.
+    //! \param location "[name@]endpoint", see block_protocol::open_socket()
+    //! \param queue_id queue identifier, only used to group files
+    //! \param allocator_id linked disk_allocator
+    //! \param device_id physical device identifier
+    //! \param max_outstanding maximum number of requests in flight
+    remote_file(
+        const std::string& location,
+        int queue_id = DEFAULT_QUEUE,
+        int allocator_id = NO_ALLOCATOR,
+        unsigned int device_id = DEFAULT_DEVICE_ID,
+        size_t max_outstanding = 64);
+
+    ~remote_file();
+
+    request_ptr aread(
+        void* buffer, offset_type pos, size_type bytes,
+        const completion_handler& on_complete = completion_handler()) final;
+
+    request_ptr awrite(
+        void* buffer, offset_type pos, size_type bytes,
+        const completion_handler& on_complete = completion_handler()) final;
+
+    void serve(void* buffer, offset_type offset, size_type bytes,
+               request::read_or_write op) final;
+
+    offset_type size() final;
+    void set_size(offset_type newsize) final;
+    void lock() final;
+    void discard(offset_type offset, offset_type size) final;
+
+    int get_queue_id() const final { return queue_id_; }
+    int get_allocator_id() const final { return allocator_id_; }
+
+    const char * io_type() const final;
+};
+
+//! Request of a remote_file, completed by its receiver thread.
+class remote_request : public request_with_state
+{
+    constexpr static bool debug = false;
+
+    friend class remote_file;
+
+    //! time the request was sent
+    double time_posted_ = 0;
+
+public:
+    remote_request(
+        const completion_handler& on_complete,
+        file* file, void* buffer, offset_type offset, size_type bytes,
+        read_or_write op)
+        : request_with_state(on_complete, file, buffer, offset, bytes, op)
+    { }
+
+    //! Requests on the wire cannot be canceled.
+    bool cancel() final { return false; }
+
+    void completed(bool canceled) final;
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // FOXXLL_HAVE_REMOTE_FILE
+
+#endif // !FOXXLL_IO_REMOTE_FILE_HEADER
+
+/**************************************************************************/
@@ -16,6 +16,7 @@
 #include <tlx/logger/core.hpp>
 
 #include <foxxll/io/file.hpp>
+#include <foxxll/io/iostats.hpp>
 #include <foxxll/io/request.hpp>
 
 namespace foxxll {
@@ -26,7 +27,7 @@ request::request(
     read_or_write op)
     : on_complete_(on_complete),
       file_(file), buffer_(buffer), offset_(offset), bytes_(bytes),
-      op_(op)
+      op_(op), io_tag_(stats::current_io_tag())
 {
     TLX_LOG << "request_with_state[" << static_cast<void*>(this) << "]::request(...), ref_cnt=" << reference_count();
     file_->add_request_ref();
@@ -92,9 +93,20 @@ const char* request::io_type() const
     return file_->io_type();
 }
 
+void request::mark_posted()
+{
+    assert(!posted_);
+    posted_ = true;
+    file_->add_posted_request();
+}
+
 void request::release_file_reference()
 {
     if (file_) {
+        if (posted_) {
+            file_->delete_posted_request();
+            posted_ = false;
+        }
         file_->delete_request_ref();
         file_ = nullptr;
     }
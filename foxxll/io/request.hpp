@@ -69,6 +69,10 @@ protected:
     size_type bytes_;
     //! READ or WRITE
     read_or_write op_;
+    //! I/O tag of the creating thread, see stats::scoped_io_tag
+    unsigned io_tag_;
+    //! whether the request counts as posted on its file
+    bool posted_ = false;
 
     //! \}
 
@@ -97,6 +101,7 @@ public:
     offset_type offset() const { return offset_; }
     size_type bytes() const { return bytes_; }
     read_or_write op() const { return op_; }
+    unsigned io_tag() const { return io_tag_; }
 
     void check_alignment() const;
 
@@ -119,6 +124,11 @@ public:
 
     const char * io_type() const override;
 
+    //! Count the request as posted on its file until its file reference is
+    //! released on completion. Called before the request is handed to a
+    //! queue or device.
+    void mark_posted();
+
     void release_file_reference();
 
     //! \}
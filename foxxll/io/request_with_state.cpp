@@ -58,8 +58,7 @@ bool request_with_state::cancel()
         if (on_complete_)
             on_complete_(this, /* success */ false);
         notify_waiters();
-        file_->delete_request_ref();
-        file_ = nullptr;
+        release_file_reference();
         state_.set_to(READY2DIE);
         return true;
     }
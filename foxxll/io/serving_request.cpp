@@ -15,7 +15,9 @@
 
 #include <foxxll/common/exceptions.hpp>
 #include <foxxll/common/shared_state.hpp>
+#include <foxxll/common/timer.hpp>
 #include <foxxll/io/file.hpp>
+#include <foxxll/io/iostats.hpp>
 #include <foxxll/io/request_interface.hpp>
 #include <foxxll/io/request_with_state.hpp>
 #include <foxxll/io/serving_request.hpp>
@@ -50,7 +52,17 @@ void serving_request::serve()
 
     try
     {
+        const double begin = timestamp();
         file_->serve(buffer_, offset_, bytes_, op_);
+        const double duration = timestamp() - begin;
+
+        // account service time to the I/O tag of the issuing thread
+        if (op_ == READ)
+            stats::get_instance()->io_tag_read_finished(io_tag_, bytes_, duration);
+        else
+            stats::get_instance()->io_tag_write_finished(io_tag_, bytes_, duration);
+
+        file_->get_file_stats()->service_finished(duration);
     }
     catch (const io_error& ex)
     {
@@ -167,6 +167,101 @@ size_t simulate_async_write(
     return (oldtime - 1);
 }
 
+// a write completed at a time, for devices with different service times
+struct weighted_event
+{
+    double timestamp;
+    //! order of scheduling, breaks ties
+    size_t seq;
+    size_t iblock;
+    inline weighted_event(double t, size_t s, size_t b)
+        : timestamp(t), seq(s), iblock(b) { }
+};
+
+struct weighted_event_cmp
+{
+    inline bool operator () (const weighted_event& a, const weighted_event& b) const
+    {
+        return a.timestamp > b.timestamp ||
+               (a.timestamp == b.timestamp && a.seq > b.seq);
+    }
+};
+
+using weighted_time_pair = std::pair<size_t, double>;
+
+// Like simulate_async_write, but each device takes its own service time per
+// block, and a device starts its next block as soon as the previous one
+// completed. Blocks are written from the end of the sequence.
+double simulate_async_write(
+    const size_t* disks,
+    const size_t L,
+    const size_t m_init,
+    const size_t D,
+    const double* service_times,
+    weighted_time_pair* o_time)
+{
+    using event_queue_type = std::priority_queue<
+              weighted_event, std::vector<weighted_event>, weighted_event_cmp>;
+    // + sentinel for remapping NO_ALLOCATOR
+    std::vector<std::queue<size_t> > disk_queues(D + 1);
+    std::vector<bool> disk_busy(D + 1, false);
+    event_queue_type event_queue;
+    size_t seq = 0;
+
+    auto start_next = [&](size_t disk, double now) {
+                          if (disk_busy[disk] || disk_queues[disk].empty())
+                              return;
+                          event_queue.push(weighted_event(
+                                               now + service_times[disk], seq++,
+                                               disk_queues[disk].front()));
+                          disk_queues[disk].pop();
+                          disk_busy[disk] = true;
+                      };
+
+    size_t m = m_init;
+    size_t i = L;
+    while (m && (i > 0))
+    {
+        i--;
+        m--;
+        disk_queues[get_disk(i, disks, D)].push(i);
+    }
+
+    for (size_t disk = 0; disk <= D; ++disk)
+        start_next(disk, 0.0);
+
+    double now = 0.0;
+    while (!event_queue.empty())
+    {
+        weighted_event cur = event_queue.top();
+        event_queue.pop();
+        now = cur.timestamp;
+
+        TLX_LOG << "Block " << cur.iblock << " put out, time " << now
+                << " disk: " << disks[cur.iblock];
+        o_time[cur.iblock] = weighted_time_pair(cur.iblock, now);
+
+        size_t disk = get_disk(cur.iblock, disks, D);
+        disk_busy[disk] = false;
+
+        // the freed buffer takes the next block
+        if (i > 0)
+        {
+            size_t next_disk = get_disk(--i, disks, D);
+            disk_queues[next_disk].push(i);
+            start_next(next_disk, now);
+        }
+
+        start_next(disk, now);
+    }
+
+    assert(i == 0);
+    for (size_t j = 0; j <= D; j++)
+        assert(disk_queues[j].empty());
+
+    return now;
+}
+
 } // namespace async_schedule_local
 
 void compute_prefetch_schedule(
@@ -174,7 +269,8 @@ void compute_prefetch_schedule(
     const size_t* last,
     size_t* out_first,
     size_t m,
-    size_t D)
+    size_t D,
+    const double* service_times)
 {
     constexpr bool debug = false;
 
@@ -187,6 +283,30 @@ void compute_prefetch_schedule(
 
         return;
     }
+
+    if (service_times)
+    {
+        using weighted_pair = async_schedule_local::weighted_time_pair;
+        std::vector<weighted_pair> write_order(L);
+
+        double w_time = async_schedule_local::simulate_async_write(
+            first, L, m, D, service_times, write_order.data());
+
+        TLX_LOG << "Write time: " << w_time;
+
+        std::stable_sort(
+            write_order.begin(), write_order.end(),
+            [](const weighted_pair& a, const weighted_pair& b) {
+                return a.second > b.second;
+            });
+
+        for (size_t i = 0; i < L; i++)
+            out_first[i] = write_order[i].first;
+
+        tlx::unused(w_time);
+        return;
+    }
+
     pair_type* write_order = new pair_type[L];
 
     size_t w_steps = async_schedule_local::simulate_async_write(first, L, m, D, write_order);
@@ -209,6 +329,114 @@ void compute_prefetch_schedule(
     tlx::unused(w_steps);
 }
 
+void compute_write_schedule(
+    const size_t* first,
+    const size_t* last,
+    size_t* out_first,
+    size_t queue_depth,
+    size_t D,
+    const double* service_times)
+{
+    using event_type = async_schedule_local::weighted_event;
+    using event_queue_type = std::priority_queue<
+              event_type, std::vector<event_type>,
+              async_schedule_local::weighted_event_cmp>;
+
+    const size_t L = last - first;
+    queue_depth = std::max(queue_depth, size_t(1));
+
+    // + sentinel for remapping NO_ALLOCATOR
+    std::vector<std::queue<size_t> > batches(D + 1);
+    for (size_t i = 0; i < L; ++i)
+        batches[async_schedule_local::get_disk(i, first, D)].push(i);
+
+    std::vector<size_t> writing(D + 1, 0);
+    std::vector<double> busy_until(D + 1, 0.0);
+    event_queue_type event_queue;
+    size_t seq = 0, posted = 0;
+
+    double now = 0.0;
+    while (true)
+    {
+        size_t d;
+        while ((d = choose_write_device(
+                    D + 1, [&](size_t i) { return batches[i].size(); },
+                    writing.data(), service_times, queue_depth, false)) != D + 1)
+        {
+            const size_t iblock = batches[d].front();
+            batches[d].pop();
+            out_first[posted++] = iblock;
+
+            // each device serves its writes in posting order
+            ++writing[d];
+            busy_until[d] = std::max(busy_until[d], now) +
+                            (service_times ? service_times[d] : 1.0);
+            event_queue.push(event_type(busy_until[d], seq++, iblock));
+        }
+
+        if (event_queue.empty())
+            break;
+
+        const event_type cur = event_queue.top();
+        event_queue.pop();
+        now = cur.timestamp;
+        --writing[async_schedule_local::get_disk(cur.iblock, first, D)];
+    }
+
+    assert(posted == L);
+    tlx::unused(posted);
+}
+
+windowed_prefetch_schedule::windowed_prefetch_schedule(
+    size_t window, size_t m, size_t D, std::vector<double> service_times)
+    : window_(std::max(window, size_t(1))), m_(m), D_(D),
+      service_times_(std::move(service_times))
+{
+    assert(service_times_.empty() || service_times_.size() == D_ + 1);
+    disks_.reserve(window_);
+}
+
+void windowed_prefetch_schedule::schedule_window()
+{
+    if (available() != 0 || disks_.empty())
+        return;
+    if (disks_.size() < window_ && !finished_)
+        return;
+
+    order_.resize(disks_.size());
+    compute_prefetch_schedule(
+        disks_.data(), disks_.data() + disks_.size(), order_.data(), m_, D_,
+        service_times_.empty() ? nullptr : service_times_.data());
+    for (size_t& i : order_)
+        i += base_;
+
+    base_ += disks_.size();
+    disks_.clear();
+    next_ = 0;
+}
+
+void windowed_prefetch_schedule::push(size_t disk)
+{
+    assert(!finished_);
+    assert(disks_.size() < window_);
+    disks_.push_back(disk);
+    schedule_window();
+}
+
+void windowed_prefetch_schedule::finish()
+{
+    finished_ = true;
+    schedule_window();
+}
+
+size_t windowed_prefetch_schedule::pop()
+{
+    size_t i = peek();
+    ++next_;
+    schedule_window();
+    return i;
+}
+
 } // namespace foxxll
 
 /**************************************************************************/
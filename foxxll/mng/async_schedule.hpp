@@ -19,26 +19,36 @@
 // and queued writing on parallel disks, 2005
 // DOI: 10.1137/S0097539703431573
 
+#include <cassert>
+#include <vector>
+
 #include <foxxll/common/types.hpp>
 #include <tlx/simple_vector.hpp>
 
 namespace foxxll {
 
+//! Computes the order in which to prefetch a sequence of blocks with m
+//! buffers, given the device id of each block.
+//! \param service_times if not null, the time to serve one block on each
+//!        device id below D, followed by the time for blocks without device
+//!        id. Otherwise all devices take the same time.
 void compute_prefetch_schedule(
     const size_t* first,
     const size_t* last,
     size_t* out_first,
     size_t m,
-    size_t D);
+    size_t D,
+    const double* service_times = nullptr);
 
 inline void compute_prefetch_schedule(
     size_t* first,
     size_t* last,
     size_t* out_first,
     size_t m,
-    size_t D)
+    size_t D,
+    const double* service_times = nullptr)
 {
-    compute_prefetch_schedule(static_cast<const size_t*>(first), static_cast<const size_t*>(last), out_first, m, D);
+    compute_prefetch_schedule(static_cast<const size_t*>(first), static_cast<const size_t*>(last), out_first, m, D, service_times);
 }
 
 template <typename RunType>
@@ -46,13 +56,14 @@ void compute_prefetch_schedule(
     const RunType& input,
     size_t* out_first,
     size_t m,
-    size_t D)
+    size_t D,
+    const double* service_times = nullptr)
 {
     const size_t L = input.size();
     tlx::simple_vector<size_t> disks(L);
     for (size_t i = 0; i < L; ++i)
         disks[i] = input[i].bid.storage->get_device_id();
-    compute_prefetch_schedule(disks.begin(), disks.end(), out_first, m, D);
+    compute_prefetch_schedule(disks.begin(), disks.end(), out_first, m, D, service_times);
 }
 
 template <typename BidIteratorType>
@@ -61,16 +72,128 @@ void compute_prefetch_schedule(
     BidIteratorType input_end,
     size_t* out_first,
     size_t m,
-    size_t D)
+    size_t D,
+    const double* service_times = nullptr)
 {
     const size_t L = input_end - input_begin;
     tlx::simple_vector<size_t> disks(L);
     size_t i = 0;
     for (BidIteratorType it = input_begin; it != input_end; ++it, ++i)
         disks[i] = it->storage->get_device_id();
-    compute_prefetch_schedule(disks.begin(), disks.end(), out_first, m, D);
+    compute_prefetch_schedule(disks.begin(), disks.end(), out_first, m, D, service_times);
+}
+
+//! Chooses the device that the next write of a disk aware buffered_writer
+//! goes to: among the devices with batched blocks and fewer than queue_depth
+//! writes in flight, or among all of them if all is set, the one whose
+//! batched and in flight writes take longest, such that slow devices are
+//! started first. Ties go to the device with fewer writes in flight. Returns
+//! ndevices if no device qualifies.
+//! \param batched returns the number of batched blocks of a device
+//! \param writing number of writes in flight per device
+//! \param service_times time to write one block per device, or nullptr if
+//!        all devices take the same time
+template <typename BatchedFunction>
+size_t choose_write_device(
+    size_t ndevices, const BatchedFunction& batched, const size_t* writing,
+    const double* service_times, size_t queue_depth, bool all)
+{
+    size_t best = ndevices;
+    double best_time = 0.0;
+    for (size_t d = 0; d < ndevices; ++d)
+    {
+        const size_t n = batched(d);
+        if (n == 0 || (!all && writing[d] >= queue_depth))
+            continue;
+
+        const double time = static_cast<double>(n + writing[d]) *
+                            (service_times ? service_times[d] : 1.0);
+        if (best == ndevices || time > best_time ||
+            (time == best_time && writing[d] < writing[best]))
+        {
+            best = d;
+            best_time = time;
+        }
+    }
+    return best;
 }
 
+//! Computes the order in which a disk aware buffered_writer posts the writes
+//! of a batch of blocks, given the device id of each block. Each device
+//! keeps up to queue_depth writes in flight and writes its blocks in
+//! sequence order, the device of each write is chosen by
+//! choose_write_device().
+//! \param service_times as for compute_prefetch_schedule()
+void compute_write_schedule(
+    const size_t* first,
+    const size_t* last,
+    size_t* out_first,
+    size_t queue_depth,
+    size_t D,
+    const double* service_times = nullptr);
+
+/*!
+ * Computes the prefetch schedule of a stream window by window, holding only
+ * the device ids of one window. Used for very long streams, or for streams
+ * whose blocks are not known in advance. Each window is scheduled by
+ * compute_prefetch_schedule() with m buffers, which yields the same order as
+ * for the whole stream if it fits into one window.
+ *
+ * Device ids are push()ed until entries are available(), which are then
+ * taken with pop(). The last partial window is scheduled after finish().
+ */
+class windowed_prefetch_schedule
+{
+    size_t window_, m_, D_;
+
+    //! service time of each device, empty if all are equal
+    std::vector<double> service_times_;
+
+    //! device ids of the window being collected
+    std::vector<size_t> disks_;
+    //! schedule of the current window, as indices into the stream
+    std::vector<size_t> order_;
+    //! next entry of order_
+    size_t next_ = 0;
+    //! stream index of the first block in disks_
+    size_t base_ = 0;
+    //! set by finish()
+    bool finished_ = false;
+
+    //! schedule the collected window once the current one is used up
+    void schedule_window();
+
+public:
+    //! \param window number of blocks per window
+    //! \param m number of prefetch buffers
+    //! \param D number of device ids
+    //! \param service_times see compute_prefetch_schedule(), D + 1 entries
+    //!        or empty if all devices take the same time
+    windowed_prefetch_schedule(
+        size_t window, size_t m, size_t D,
+        std::vector<double> service_times = std::vector<double>());
+
+    //! Append the device id of the next block of the stream.
+    void push(size_t disk);
+
+    //! Mark the end of the stream.
+    void finish();
+
+    //! Returns the number of entries that can be taken before the next
+    //! window is complete.
+    size_t available() const { return order_.size() - next_; }
+
+    //! Returns the stream index of the i-th next block to prefetch.
+    size_t peek(size_t i = 0) const
+    {
+        assert(i < available());
+        return order_[next_ + i];
+    }
+
+    //! Take the next block to prefetch and returns its stream index.
+    size_t pop();
+};
+
 } // namespace foxxll
 
 #endif // !FOXXLL_MNG_ASYNC_SCHEDULE_HEADER
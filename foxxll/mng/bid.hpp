@@ -197,6 +197,29 @@ std::ostream& operator << (std::ostream& s, const BID<BlockSize>& bid)
 template <size_t BlockSize>
 using BIDArray = tlx::simple_vector<BID<BlockSize> >;
 
+//! Returns the number of blocks at begin, begin + stride, begin + 2 * stride,
+//! ... before end which are stored back to back in one file, and hence can be
+//! transferred with a single I/O of their total size. Use stride D to follow
+//! the share of one disk in a batch striped over D disks.
+template <typename BIDIterator>
+size_t contiguous_blocks(BIDIterator begin, BIDIterator end, size_t stride = 1)
+{
+    if (begin == end)
+        return 0;
+
+    size_t count = 1;
+    for (BIDIterator prev = begin;
+         static_cast<size_t>(end - prev) > stride; prev += stride, ++count)
+    {
+        BIDIterator next = prev + stride;
+        if (next->storage != prev->storage ||
+            next->offset != prev->offset + prev->size)
+            break;
+    }
+
+    return count;
+}
+
 //! \}
 
 } // namespace foxxll
@@ -0,0 +1,229 @@
+/***************************************************************************
+ *  foxxll/mng/bid_index.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_BID_INDEX_HEADER
+#define FOXXLL_MNG_BID_INDEX_HEADER
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <utility>
+#include <vector>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_schedlayer
+//! \{
+
+//! Hash of a BID that mixes the storage pointer and the offset.
+template <typename BidType>
+inline size_t bid_hash(const BidType& bid)
+{
+    uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(bid.storage));
+    h ^= static_cast<uint64_t>(bid.offset) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return static_cast<size_t>(h);
+}
+
+/*!
+ * Dense array of entries with an open-addressing hash index on their BIDs.
+ *
+ * Entries must have a member \c bid. They are kept contiguously, so they can
+ * be iterated and passed to wait_any(), and erasing moves the last entry into
+ * the gap. The index uses linear probing with backward-shift deletion and is
+ * kept at most half full. After reserve(n), up to n entries are inserted and
+ * erased without allocating memory.
+ *
+ * An entry can be removed from the index while staying in the array, e.g. a
+ * stale write that must still be waited for.
+ */
+template <typename Entry>
+class bid_index
+{
+public:
+    using entry_type = Entry;
+    using iterator = typename std::vector<Entry>::iterator;
+    using const_iterator = typename std::vector<Entry>::const_iterator;
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+private:
+    //! dense array of entries
+    std::vector<Entry> entries_;
+
+    //! whether the entry at the same position is in the index
+    std::vector<bool> indexed_;
+
+    //! positions of indexed entries, npos for empty slots
+    std::vector<size_t> table_;
+
+    //! table_.size() - 1, table_.size() is a power of two
+    size_t mask_ = 0;
+
+    //! Returns the slot holding bid, or the empty slot where it belongs.
+    template <typename BidType>
+    size_t probe(const BidType& bid) const
+    {
+        size_t i = bid_hash(bid) & mask_;
+        while (table_[i] != npos && !(entries_[table_[i]].bid == bid))
+            i = (i + 1) & mask_;
+        return i;
+    }
+
+    void rehash(size_t table_size)
+    {
+        table_.assign(table_size, npos);
+        mask_ = table_size - 1;
+        for (size_t pos = 0; pos < entries_.size(); ++pos)
+        {
+            if (indexed_[pos])
+                table_[probe(entries_[pos].bid)] = pos;
+        }
+    }
+
+    //! Empty slot i and shift following entries of the probe run back.
+    void erase_slot(size_t i)
+    {
+        table_[i] = npos;
+        for (size_t j = (i + 1) & mask_; table_[j] != npos; j = (j + 1) & mask_)
+        {
+            size_t home = bid_hash(entries_[table_[j]].bid) & mask_;
+            // move the entry unless its home lies cyclically in (i, j]
+            bool stays = (i <= j) ? (i < home && home <= j)
+                         : (i < home || home <= j);
+            if (!stays) {
+                table_[i] = table_[j];
+                table_[j] = npos;
+                i = j;
+            }
+        }
+    }
+
+public:
+    explicit bid_index(size_t capacity = 1)
+    {
+        reserve(capacity);
+    }
+
+    //! Allocate room for n entries.
+    void reserve(size_t n)
+    {
+        if (entries_.capacity() < n) {
+            entries_.reserve(n);
+            indexed_.reserve(n);
+        }
+        size_t table_size = table_.empty() ? 8 : table_.size();
+        while (table_size < 2 * n)
+            table_size *= 2;
+        if (table_size != table_.size())
+            rehash(table_size);
+    }
+
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    iterator begin() { return entries_.begin(); }
+    iterator end() { return entries_.end(); }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+
+    Entry& operator [] (size_t pos) { return entries_[pos]; }
+    const Entry& operator [] (size_t pos) const { return entries_[pos]; }
+
+    //! Returns the position of the indexed entry with the bid, or npos.
+    template <typename BidType>
+    size_t position(const BidType& bid) const
+    {
+        return table_[probe(bid)];
+    }
+
+    //! Returns the indexed entry with the bid, or nullptr.
+    template <typename BidType>
+    Entry * find(const BidType& bid)
+    {
+        size_t pos = position(bid);
+        return pos == npos ? nullptr : &entries_[pos];
+    }
+
+    //! Append an entry and index it. There must be no indexed entry with the
+    //! same bid. Grows geometrically if more than the reserved room is needed.
+    void insert(const Entry& entry)
+    {
+        if (entries_.size() == entries_.capacity())
+            reserve(2 * entries_.size() + 1);
+        else if (2 * (entries_.size() + 1) > table_.size())
+            reserve(entries_.size() + 1);
+
+        size_t slot = probe(entry.bid);
+        assert(table_[slot] == npos);
+        table_[slot] = entries_.size();
+        entries_.push_back(entry);
+        indexed_.push_back(true);
+    }
+
+    //! Remove the entry at pos from the index, it stays in the array.
+    void unindex(size_t pos)
+    {
+        if (!indexed_[pos])
+            return;
+        size_t slot = probe(entries_[pos].bid);
+        assert(table_[slot] == pos);
+        erase_slot(slot);
+        indexed_[pos] = false;
+    }
+
+    //! Remove the entry at pos, moving the last entry into its place.
+    //! \return the removed entry
+    Entry erase(size_t pos)
+    {
+        unindex(pos);
+        Entry result = std::move(entries_[pos]);
+
+        size_t last = entries_.size() - 1;
+        if (pos != last)
+        {
+            if (indexed_[last])
+                table_[probe(entries_[last].bid)] = pos;
+            entries_[pos] = std::move(entries_[last]);
+            indexed_[pos] = indexed_[last];
+        }
+        entries_.pop_back();
+        indexed_.pop_back();
+        return result;
+    }
+
+    //! Remove the entry an iterator points to.
+    Entry erase(iterator it)
+    {
+        return erase(static_cast<size_t>(it - entries_.begin()));
+    }
+
+    void swap(bid_index& obj)
+    {
+        std::swap(entries_, obj.entries_);
+        std::swap(indexed_, obj.indexed_);
+        std::swap(table_, obj.table_);
+        std::swap(mask_, obj.mask_);
+    }
+};
+
+template <typename Entry>
+constexpr size_t bid_index<Entry>::npos;
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_BID_INDEX_HEADER
+
+/**************************************************************************/
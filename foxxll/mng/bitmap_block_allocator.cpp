@@ -0,0 +1,273 @@
+/***************************************************************************
+ *  foxxll/mng/bitmap_block_allocator.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include <tlx/math/ctz.hpp>
+
+#include <foxxll/common/error_handling.hpp>
+#include <foxxll/common/exceptions.hpp>
+#include <foxxll/common/utils.hpp>
+#include <foxxll/mng/bitmap_block_allocator.hpp>
+
+namespace foxxll {
+
+//! mask of bits [lo, hi) of a word, 0 <= lo < hi <= 64
+static inline uint64_t bit_mask(unsigned lo, unsigned hi)
+{
+    const uint64_t upper = (hi == 64) ? ~uint64_t(0) : ((uint64_t(1) << hi) - 1);
+    return upper & (~uint64_t(0) << lo);
+}
+
+bitmap_block_allocator::bitmap_block_allocator(uint64_t num_slots)
+{
+    levels_.emplace_back(1, 0);
+    grow(num_slots);
+}
+
+void bitmap_block_allocator::grow(uint64_t num_slots)
+{
+    if (num_slots == 0)
+        return;
+
+    const uint64_t old_size = size_;
+    size_ += num_slots;
+
+    // resize levels, adding summary levels until the top has a single word
+    uint64_t words = div_ceil(size_, 64);
+    for (size_t l = 0; ; ++l)
+    {
+        if (l == levels_.size())
+        {
+            // new summary level over the existing one
+            levels_.emplace_back(words, 0);
+            const std::vector<uint64_t>& below = levels_[l - 1];
+            for (uint64_t w = 0; w < below.size(); ++w) {
+                if (below[w] != 0)
+                    levels_[l][w / 64] |= uint64_t(1) << (w % 64);
+            }
+        }
+        else if (levels_[l].size() < words)
+        {
+            levels_[l].resize(words, 0);
+        }
+
+        if (words == 1)
+            break;
+        words = div_ceil(words, 64);
+    }
+
+    assign_range(old_size, size_, true);
+}
+
+uint64_t bitmap_block_allocator::find_next(size_t level, uint64_t bit) const
+{
+    const std::vector<uint64_t>& bits = levels_[level];
+
+    uint64_t w = bit / 64;
+    if (w >= bits.size())
+        return npos;
+
+    const uint64_t word = bits[w] & (~uint64_t(0) << (bit % 64));
+    if (word != 0)
+        return w * 64 + tlx::ctz(word);
+
+    if (level + 1 == levels_.size())
+    {
+        // top level: scan remaining words
+        for (++w; w < bits.size(); ++w) {
+            if (bits[w] != 0)
+                return w * 64 + tlx::ctz(bits[w]);
+        }
+        return npos;
+    }
+
+    // find next non-empty word using the summary level
+    w = find_next(level + 1, w + 1);
+    if (w == npos)
+        return npos;
+
+    assert(bits[w] != 0);
+    return w * 64 + tlx::ctz(bits[w]);
+}
+
+uint64_t bitmap_block_allocator::free_run_length(
+    uint64_t index, uint64_t limit) const
+{
+    uint64_t length = 0;
+
+    while (length < limit && index < size_)
+    {
+        const unsigned offset = index % 64;
+        // zero bits shifted in from above terminate the run at the word end
+        const uint64_t used = ~(levels_[0][index / 64] >> offset);
+        const unsigned run = tlx::ctz(used);
+
+        length += run;
+        index += run;
+
+        if (run < 64 - offset)
+            break;
+    }
+
+    return std::min(length, limit);
+}
+
+void bitmap_block_allocator::update_summary(size_t level, uint64_t word)
+{
+    for ( ; level + 1 < levels_.size(); ++level)
+    {
+        const uint64_t bit = uint64_t(1) << (word % 64);
+        uint64_t& up = levels_[level + 1][word / 64];
+        const bool was_empty = (up == 0);
+
+        if (levels_[level][word] != 0)
+            up |= bit;
+        else
+            up &= ~bit;
+
+        // stop if emptiness of the summary word did not change
+        if ((up == 0) == was_empty)
+            break;
+
+        word /= 64;
+    }
+}
+
+void bitmap_block_allocator::assign_range(uint64_t begin, uint64_t end, bool free)
+{
+    assert(begin <= end && end <= size_);
+
+    if (free)
+        free_slots_ += end - begin;
+    else
+        free_slots_ -= end - begin;
+
+    while (begin < end)
+    {
+        const uint64_t w = begin / 64;
+        const unsigned lo = begin % 64;
+        const unsigned hi = static_cast<unsigned>(
+            std::min<uint64_t>(64, lo + (end - begin)));
+
+        uint64_t& word = levels_[0][w];
+        const bool was_empty = (word == 0);
+
+        if (free)
+            word |= bit_mask(lo, hi);
+        else
+            word &= ~bit_mask(lo, hi);
+
+        if ((word == 0) != was_empty)
+            update_summary(0, w);
+
+        begin += hi - lo;
+    }
+}
+
+uint64_t bitmap_block_allocator::allocate()
+{
+    const uint64_t index = find_next(0, 0);
+    if (index == npos)
+        return npos;
+
+    assign_range(index, index + 1, false);
+    return index;
+}
+
+uint64_t bitmap_block_allocator::allocate_run(uint64_t num_slots)
+{
+    assert(num_slots > 0);
+
+    if (num_slots == 1)
+        return allocate();
+
+    if (num_slots > free_slots_)
+        return npos;
+
+    uint64_t index = find_next(0, 0);
+    while (index != npos)
+    {
+        const uint64_t length = free_run_length(index, num_slots);
+        if (length >= num_slots) {
+            assign_range(index, index + num_slots, false);
+            return index;
+        }
+
+        // index + length is allocated, continue after it
+        index = find_next(0, index + length);
+    }
+
+    return npos;
+}
+
+void bitmap_block_allocator::check_range(
+    uint64_t begin, uint64_t end, bool free, const char* func) const
+{
+    if (end > size_ || end < begin) {
+        FOXXLL_THROW2(
+            bad_ext_alloc, func,
+            "Error: slots " << begin << " + " << end - begin <<
+                " outside of " << size_ << " slots"
+        );
+    }
+
+    for (uint64_t i = begin; i < end; )
+    {
+        const unsigned lo = i % 64;
+        const unsigned hi = static_cast<unsigned>(
+            std::min<uint64_t>(64, lo + (end - i)));
+
+        // bits which are set although they should be clear or vice versa
+        const uint64_t word = levels_[0][i / 64];
+        const uint64_t wrong = (free ? ~word : word) & bit_mask(lo, hi);
+
+        if (wrong) {
+            FOXXLL_THROW2(
+                bad_ext_alloc, func,
+                "Error: slots " << begin << " + " << end - begin <<
+                    " overlap " << (free ? "allocated" : "free") << " slot " <<
+                    (i / 64 * 64 + tlx::ctz(wrong))
+            );
+        }
+
+        i += hi - lo;
+    }
+}
+
+void bitmap_block_allocator::free(uint64_t index, uint64_t num_slots)
+{
+    // check that all slots are allocated before modifying anything
+    check_range(index, index + num_slots, false, "bitmap_block_allocator::free");
+
+    assign_range(index, index + num_slots, true);
+}
+
+void bitmap_block_allocator::reserve(uint64_t index, uint64_t num_slots)
+{
+    check_range(index, index + num_slots, true, "bitmap_block_allocator::reserve");
+
+    assign_range(index, index + num_slots, false);
+}
+
+void bitmap_block_allocator::shrink(uint64_t num_slots)
+{
+    check_range(size_ - num_slots, size_, true, "bitmap_block_allocator::shrink");
+
+    // clear the bits, the words stay allocated for later growth
+    assign_range(size_ - num_slots, size_, false);
+    size_ -= num_slots;
+}
+
+} // namespace foxxll
+
+/**************************************************************************/
@@ -0,0 +1,115 @@
+/***************************************************************************
+ *  foxxll/mng/bitmap_block_allocator.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_BITMAP_BLOCK_ALLOCATOR_HEADER
+#define FOXXLL_MNG_BITMAP_BLOCK_ALLOCATOR_HEADER
+
+#include <cstdint>
+#include <vector>
+
+namespace foxxll {
+
+//! \ingroup foxxll_mnglayer
+//! \{
+
+/*!
+ * Hierarchical bitmap of free slots of equal size, used by
+ * disk_block_allocator for disks which serve a single block size.
+ *
+ * Level 0 contains one bit per slot, set if the slot is free. Each higher
+ * level contains one bit per 64-bit word of the level below, set if that word
+ * has any free slot. Allocating and freeing single slots therefore costs
+ * O(log_64 n) word operations and no memory allocation, and free runs are
+ * found by skipping fully allocated words using the summary levels. Slots are
+ * always allocated first-fit at the lowest index.
+ *
+ * The class is not thread-safe, disk_block_allocator serializes accesses.
+ */
+class bitmap_block_allocator
+{
+public:
+    //! returned if no free slot or run was found
+    static constexpr uint64_t npos = ~uint64_t(0);
+
+    //! construct bitmap with num_slots free slots
+    explicit bitmap_block_allocator(uint64_t num_slots = 0);
+
+    //! number of slots managed
+    uint64_t size() const { return size_; }
+
+    //! number of free slots
+    uint64_t free_slots() const { return free_slots_; }
+
+    //! append num_slots free slots
+    void grow(uint64_t num_slots);
+
+    //! remove num_slots slots from the end, which must all be free.
+    void shrink(uint64_t num_slots);
+
+    //! allocate the free slot with the lowest index, returns npos if full.
+    uint64_t allocate();
+
+    //! allocate the run of num_slots contiguous free slots with the lowest
+    //! index, returns npos if there is no such run.
+    uint64_t allocate_run(uint64_t num_slots);
+
+    //! allocate num_slots slots starting at index, which must all be free.
+    void reserve(uint64_t index, uint64_t num_slots);
+
+    //! free num_slots slots starting at index. Throws bad_ext_alloc if any of
+    //! them is already free or out of range; no slot is freed in that case.
+    void free(uint64_t index, uint64_t num_slots = 1);
+
+    //! check if slot is free
+    bool is_free(uint64_t index) const
+    {
+        return (levels_[0][index / 64] >> (index % 64)) & 1;
+    }
+
+    //! index of the first free slot at or after index, or npos
+    uint64_t find_free(uint64_t index) const
+    {
+        return find_next(0, index);
+    }
+
+    //! number of contiguous free slots starting at index, at most limit
+    uint64_t free_run_length(uint64_t index, uint64_t limit = npos) const;
+
+private:
+    //! bits of all levels, levels_[0] has one bit per slot
+    std::vector<std::vector<uint64_t> > levels_;
+
+    //! number of slots
+    uint64_t size_ = 0;
+
+    //! number of free slots
+    uint64_t free_slots_ = 0;
+
+    //! first set bit at or after bit in level, or npos
+    uint64_t find_next(size_t level, uint64_t bit) const;
+
+    //! set or clear bits [begin,end) of level 0 and update the summaries
+    void assign_range(uint64_t begin, uint64_t end, bool free);
+
+    //! check that slots [begin,end) are in range and all free or allocated,
+    //! throws bad_ext_alloc otherwise.
+    void check_range(uint64_t begin, uint64_t end, bool free, const char* func) const;
+
+    //! update summary bits above word of level after it changed emptiness
+    void update_summary(size_t level, uint64_t word);
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_BITMAP_BLOCK_ALLOCATOR_HEADER
+
+/**************************************************************************/
@@ -15,6 +15,7 @@
 #define FOXXLL_MNG_BLOCK_ALLOC_STRATEGY_HEADER
 
 #include <algorithm>
+#include <cmath>
 #include <random>
 #include <vector>
 
@@ -191,6 +192,148 @@ struct random_cyclic_flash : public random_cyclic
     }
 };
 
+//! Weighted striping parallel disk block allocation scheme functor.
+//!
+//! Distributes blocks over the disks in proportion to config::disk_weight():
+//! the configured weight (e.g. measured bandwidth), or the disk size if none
+//! is set. Disks of different sizes then fill up at the same rate, and faster
+//! disks serve a larger share of the I/O volume. The disks are interleaved
+//! smoothly in a fixed schedule, so consecutive blocks spread over all disks.
+//! \remarks model of \b allocation_strategy concept
+struct weighted_striping : public striping
+{
+private:
+    //! disk sequence repeated by operator (), relative to begin_
+    std::vector<size_t> schedule_;
+
+    void init()
+    {
+        config* cfg = config::get_instance();
+
+        std::vector<double> weight(diff_);
+        double sum = 0.0, max = 0.0;
+        for (size_t d = 0; d < diff_; ++d) {
+            if (begin_ + d < cfg->disks_number())
+                weight[d] = cfg->disk_weight(begin_ + d);
+            sum += weight[d];
+            max = std::max(max, weight[d]);
+        }
+
+        // quantize weights to slots of the schedule, at least one per disk.
+        // disks without weight (autogrow, size 0, or not configured) get the
+        // average weight.
+        size_t nonzero = 0;
+        for (size_t d = 0; d < diff_; ++d)
+            nonzero += (weight[d] > 0.0);
+
+        const double avg = nonzero ? sum / static_cast<double>(nonzero) : 1.0;
+        if (max == 0.0) max = 1.0;
+
+        std::vector<long> slots(diff_);
+        long total = 0;
+        for (size_t d = 0; d < diff_; ++d) {
+            const double w = (weight[d] > 0.0) ? weight[d] : avg;
+            slots[d] = std::max(1L, std::lround(slots_per_max_weight * w / max));
+            total += slots[d];
+        }
+
+        // smooth weighted round robin: each step, every disk gains its slots
+        // and the disk with most credit is picked and pays the total.
+        std::vector<long> credit(diff_, 0);
+        schedule_.resize(static_cast<size_t>(total));
+        for (size_t i = 0; i < schedule_.size(); ++i)
+        {
+            size_t best = 0;
+            for (size_t d = 0; d < diff_; ++d) {
+                credit[d] += slots[d];
+                if (credit[d] > credit[best])
+                    best = d;
+            }
+            credit[best] -= total;
+            schedule_[i] = best;
+        }
+    }
+
+public:
+    //! number of schedule slots of the disk with the largest weight
+    static constexpr long slots_per_max_weight = 32;
+
+    weighted_striping(size_t begin, size_t end) : striping(begin, end)
+    {
+        init();
+    }
+
+    weighted_striping() : striping()
+    {
+        init();
+    }
+
+    size_t operator () (size_t i) const
+    {
+        return begin_ + schedule_[i % schedule_.size()];
+    }
+
+    static const char * name()
+    {
+        return "weighted striping";
+    }
+};
+
+//! Load-aware randomized cycling parallel disk block allocation scheme functor.
+//!
+//! Like random_cyclic, consecutive blocks are placed in cycles which contain
+//! each disk at most once, hence runs of blocks can be read in parallel. At the
+//! start of each cycle the load of all disks is sampled with
+//! block_manager::disk_load() and disks loaded more than \c threshold times the
+//! average are left out of the cycle. Slow or busy disks therefore receive
+//! fewer new blocks until their queues drain.
+//! \remarks model of \b allocation_strategy concept
+struct load_aware_cyclic : public striping
+{
+private:
+    //! maximum load relative to the average of disks in a cycle, >= 1
+    double threshold_;
+
+    mutable std::default_random_engine rng_ { std::random_device { } () };
+
+    //! disks of the current cycle, relative to begin_
+    mutable std::vector<size_t> cycle_;
+    //! position of the next block in cycle_
+    mutable size_t pos_ = 0;
+    //! index of the next block if blocks are allocated in sequence
+    mutable size_t next_ = 0;
+
+    //! sample disk loads and draw the disks of a new cycle
+    void new_cycle() const;
+
+public:
+    load_aware_cyclic(size_t begin, size_t end, double threshold = 2.0)
+        : striping(begin, end), threshold_(threshold) { }
+
+    load_aware_cyclic() : striping(), threshold_(2.0) { }
+
+    //! maximum load relative to the average of disks in a cycle
+    double threshold() const
+    {
+        return threshold_;
+    }
+
+    size_t operator () (size_t i) const
+    {
+        // a cycle only covers blocks allocated in sequence
+        if (pos_ == cycle_.size() || i != next_)
+            new_cycle();
+
+        next_ = i + 1;
+        return begin_ + cycle_[pos_++];
+    }
+
+    static const char * name()
+    {
+        return "load-aware randomized cycling striping";
+    }
+};
+
 //! 'Single disk' parallel disk block allocation scheme functor.
 //! \remarks model of \b allocation_strategy concept
 struct single_disk
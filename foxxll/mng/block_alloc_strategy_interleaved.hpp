@@ -102,6 +102,41 @@ struct interleaved_random_cyclic : public interleaved_striping
     }
 };
 
+struct interleaved_weighted_striping : public interleaved_striping
+{
+    weighted_striping strategy_;
+
+    interleaved_weighted_striping(int nruns, const weighted_striping& strategy)
+        : interleaved_striping(nruns, strategy.begin_, strategy.diff_),
+          strategy_(strategy)
+    { }
+
+    size_t operator () (size_t i) const
+    {
+        return strategy_(i / nruns_);
+    }
+};
+
+struct interleaved_load_aware_cyclic : public interleaved_striping
+{
+    //! each run draws its own cycles, so that its blocks are spread
+    std::vector<load_aware_cyclic> runs_;
+
+    interleaved_load_aware_cyclic(int nruns, const load_aware_cyclic& strategy)
+        : interleaved_striping(nruns, strategy.begin_, strategy.diff_)
+    {
+        runs_.reserve(nruns);
+        for (int i = 0; i < nruns; i++)
+            runs_.emplace_back(begin_disk_, begin_disk_ + diff_,
+                               strategy.threshold());
+    }
+
+    size_t operator () (size_t i) const
+    {
+        return runs_[i % nruns_](i / nruns_);
+    }
+};
+
 struct first_disk_only : public interleaved_striping
 {
     first_disk_only(int nruns, const single_disk& strategy)
@@ -156,6 +191,18 @@ struct interleaved_alloc_traits<random_cyclic_flash>
     using strategy = interleaved_random_cyclic;
 };
 
+template <>
+struct interleaved_alloc_traits<weighted_striping>
+{
+    using strategy = interleaved_weighted_striping;
+};
+
+template <>
+struct interleaved_alloc_traits<load_aware_cyclic>
+{
+    using strategy = interleaved_load_aware_cyclic;
+};
+
 template <>
 struct interleaved_alloc_traits<single_disk>
 {
@@ -0,0 +1,253 @@
+/***************************************************************************
+ *  foxxll/mng/block_codec.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <foxxll/mng/block_codec.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace foxxll {
+namespace block_codec {
+
+namespace {
+
+constexpr size_t min_match = 4;
+constexpr size_t max_offset = 65535;
+constexpr unsigned hash_bits = 13;
+
+inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+//! bytes needed to write a length with a nibble of 15 and continuation
+inline size_t length_bytes(size_t len)
+{
+    return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+inline uint8_t* write_length(uint8_t* op, size_t len)
+{
+    if (len < 15)
+        return op;
+    len -= 15;
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<uint8_t>(len);
+    return op;
+}
+
+//! emit literals [anchor, ip) and a match, or the literals only if mlen is 0
+inline uint8_t * write_sequence(
+    uint8_t* op, uint8_t* oend, const uint8_t* anchor, const uint8_t* ip,
+    size_t offset, size_t mlen)
+{
+    const size_t lit = static_cast<size_t>(ip - anchor);
+    size_t need = 1 + length_bytes(lit) + lit;
+    if (mlen)
+        need += 2 + length_bytes(mlen - min_match);
+    if (need > static_cast<size_t>(oend - op))
+        return nullptr;
+
+    uint8_t* token = op++;
+    *token = static_cast<uint8_t>(std::min<size_t>(lit, 15) << 4);
+    op = write_length(op, lit);
+    std::memcpy(op, anchor, lit);
+    op += lit;
+
+    if (mlen) {
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+        *token |= static_cast<uint8_t>(std::min<size_t>(mlen - min_match, 15));
+        op = write_length(op, mlen - min_match);
+    }
+    return op;
+}
+
+//! read a length continued after a nibble of 15
+inline bool read_length(const uint8_t*& ip, const uint8_t* iend, size_t& len)
+{
+    if (len != 15)
+        return true;
+    uint8_t b;
+    do {
+        if (ip == iend)
+            return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+} // namespace
+
+size_t compress(const void* src, size_t n, void* dst, size_t capacity)
+{
+    const uint8_t* const in = static_cast<const uint8_t*>(src);
+    const uint8_t* const iend = in + n;
+    uint8_t* op = static_cast<uint8_t*>(dst);
+    uint8_t* const oend = op + capacity;
+
+    std::vector<uint32_t> table(size_t(1) << hash_bits, 0);
+
+    const uint8_t* ip = in;
+    const uint8_t* anchor = in;
+
+    // leave room to read four bytes at every candidate position
+    while (static_cast<size_t>(iend - ip) >= min_match)
+    {
+        const uint32_t seq = read32(ip);
+        const uint32_t h = hash32(seq);
+        const uint8_t* ref = in + table[h];
+        table[h] = static_cast<uint32_t>(ip - in);
+
+        if (ref >= ip || static_cast<size_t>(ip - ref) > max_offset ||
+            read32(ref) != seq)
+        {
+            ++ip;
+            continue;
+        }
+
+        size_t mlen = min_match;
+        while (ip + mlen < iend && ref[mlen] == ip[mlen])
+            ++mlen;
+
+        op = write_sequence(op, oend, anchor, ip,
+                            static_cast<size_t>(ip - ref), mlen);
+        if (!op)
+            return 0;
+
+        ip += mlen;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, oend, anchor, iend, 0, 0);
+    if (!op)
+        return 0;
+
+    return static_cast<size_t>(op - static_cast<uint8_t*>(dst));
+}
+
+bool decompress(const void* src, size_t n, void* dst, size_t out_size)
+{
+    const uint8_t* ip = static_cast<const uint8_t*>(src);
+    const uint8_t* const iend = ip + n;
+    uint8_t* const out = static_cast<uint8_t*>(dst);
+    uint8_t* op = out;
+    uint8_t* const oend = out + out_size;
+
+    while (true)
+    {
+        // the input ends with a token of literals only
+        if (ip == iend)
+            return false;
+
+        const uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (!read_length(ip, iend, lit))
+            return false;
+        if (lit > static_cast<size_t>(iend - ip) ||
+            lit > static_cast<size_t>(oend - op))
+            return false;
+        std::memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        // the last token has literals only
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        const size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+
+        size_t mlen = token & 15;
+        if (!read_length(ip, iend, mlen))
+            return false;
+        mlen += min_match;
+
+        if (offset == 0 || offset > static_cast<size_t>(op - out) ||
+            mlen > static_cast<size_t>(oend - op))
+            return false;
+
+        // byte by byte, the match may overlap its own output
+        const uint8_t* ref = op - offset;
+        for (size_t i = 0; i < mlen; ++i)
+            op[i] = ref[i];
+        op += mlen;
+    }
+
+    return op == oend;
+}
+
+} // namespace block_codec
+
+block_codec_workers::block_codec_workers(size_t nthreads)
+{
+    if (nthreads == 0)
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < nthreads; ++i)
+        threads_.emplace_back([this]() { work(); });
+}
+
+block_codec_workers::~block_codec_workers()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        terminate_ = true;
+        cv_.notify_all();
+    }
+    for (std::thread& thread : threads_)
+        thread.join();
+}
+
+void block_codec_workers::enqueue(std::function<void()> job)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.emplace_back(std::move(job));
+    cv_.notify_one();
+}
+
+void block_codec_workers::work()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        cv_.wait(lock, [this]() { return terminate_ || !jobs_.empty(); });
+        if (jobs_.empty())
+            break;
+
+        std::function<void()> job = std::move(jobs_.front());
+        jobs_.pop_front();
+
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+} // namespace foxxll
+
+/**************************************************************************/
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *  foxxll/mng/block_codec.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_BLOCK_CODEC_HEADER
+#define FOXXLL_MNG_BLOCK_CODEC_HEADER
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <foxxll/singleton.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_schedlayer
+//! \{
+
+/*!
+ * Fast LZ77 compression of blocks, built in so that no external library is
+ * needed.
+ *
+ * The format is a sequence of tokens, each with a run of literal bytes
+ * followed by a match of at least four bytes up to 64 KiB back. The high and
+ * low nibbles of the token hold the literal length and the match length
+ * minus four, a nibble of 15 is continued by bytes that are added up to a
+ * byte below 255. The last token has literals only.
+ */
+namespace block_codec {
+
+//! Compresses n bytes. Returns the compressed size, or 0 if it would exceed
+//! capacity.
+size_t compress(const void* src, size_t n, void* dst, size_t capacity);
+
+//! Decompresses n bytes, which must expand to exactly out_size bytes.
+//! Returns false if the data is corrupt.
+bool decompress(const void* src, size_t n, void* dst, size_t out_size);
+
+} // namespace block_codec
+
+//! Threads compressing and decompressing blocks in the background.
+//!
+//! Streams constructed without workers share get_instance(), which starts one
+//! thread per hardware thread on first use.
+class block_codec_workers : public singleton<block_codec_workers>
+{
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()> > jobs_;
+    bool terminate_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    void work();
+
+public:
+    //! Start nthreads workers, or one per hardware thread if 0.
+    explicit block_codec_workers(size_t nthreads = 0);
+
+    //! non-copyable: delete copy-constructor
+    block_codec_workers(const block_codec_workers&) = delete;
+    //! non-copyable: delete assignment operator
+    block_codec_workers& operator = (const block_codec_workers&) = delete;
+
+    //! Finishes the enqueued jobs and stops the workers.
+    ~block_codec_workers();
+
+    //! Run a job on one of the workers.
+    void enqueue(std::function<void()> job);
+
+    //! Returns the number of workers.
+    size_t size() const { return threads_.size(); }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_BLOCK_CODEC_HEADER
+
+/**************************************************************************/
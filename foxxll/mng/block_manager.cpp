@@ -12,17 +12,28 @@
  *  http://www.boost.org/LICENSE_1_0.txt)
  **************************************************************************/
 
+#include <algorithm>
+#include <cctype>
 #include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include <tlx/define/likely.hpp>
 #include <tlx/logger/core.hpp>
 
 #include <foxxll/mng/block_manager.hpp>
 
+#include <foxxll/common/exceptions.hpp>
 #include <foxxll/common/types.hpp>
 #include <foxxll/io/create_file.hpp>
 #include <foxxll/io/disk_queues.hpp>
 #include <foxxll/io/file.hpp>
+#include <foxxll/io/iostats.hpp>
+#include <foxxll/mng/block_alloc_strategy.hpp>
 #include <foxxll/mng/config.hpp>
 #include <foxxll/mng/disk_block_allocator.hpp>
 
@@ -30,7 +41,366 @@ namespace foxxll {
 
 class io_error;
 
+/******************************************************************************/
+// Thread-local BID magazines
+
+//! Free blocks of one disk and block size cached by a thread.
+struct bid_magazine
+{
+    size_t disk;
+    size_t block_size;
+    std::vector<external_size_type> offsets;
+};
+
+class bid_magazine_cache;
+
+//! magazine caches of all live threads that used them, such that their blocks
+//! can be returned from any thread
+static std::mutex s_magazine_caches_mutex;
+static std::vector<bid_magazine_cache*> s_magazine_caches;
+
+//! All BID magazines of one thread. Returns its blocks to the disk allocators
+//! when the thread exits.
+class bid_magazine_cache
+{
+public:
+    block_manager* bm_ = nullptr;
+
+    //! protects the magazines, only contended by flushes of other threads.
+    //! Lock order: s_magazine_caches_mutex before mutex_.
+    std::mutex mutex_;
+
+    std::vector<bid_magazine> magazines_;
+
+    //! scratch space for refilling magazines
+    std::vector<BID<0> > refill_;
+
+    //! whether the cache is in s_magazine_caches, only used by its thread
+    bool registered_ = false;
+
+    ~bid_magazine_cache()
+    {
+        std::unique_lock<std::mutex> registry_lock(s_magazine_caches_mutex);
+        if (registered_) {
+            s_magazine_caches.erase(
+                std::find(s_magazine_caches.begin(), s_magazine_caches.end(), this)
+            );
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        flush();
+    }
+
+    //! register the cache, call before locking mutex_ the first time
+    void attach(block_manager* bm)
+    {
+        if (TLX_LIKELY(registered_))
+            return;
+
+        std::unique_lock<std::mutex> registry_lock(s_magazine_caches_mutex);
+        std::unique_lock<std::mutex> lock(mutex_);
+        bm_ = bm;
+        s_magazine_caches.push_back(this);
+        registered_ = true;
+    }
+
+    //! return the magazine for disk and block size, mutex_ must be held
+    bid_magazine& get(size_t disk, size_t block_size)
+    {
+        for (bid_magazine& m : magazines_) {
+            if (m.disk == disk && m.block_size == block_size)
+                return m;
+        }
+
+        magazines_.push_back(bid_magazine { disk, block_size, { } });
+        magazines_.back().offsets.reserve(bm_->magazine_size() + 1);
+        return magazines_.back();
+    }
+
+    //! return some blocks of the magazine to its disk allocator, returns the
+    //! number of bytes returned
+    uint64_t flush(bid_magazine& m, size_t keep)
+    {
+        if (m.offsets.size() <= keep)
+            return 0;
+
+        // return the older blocks, the recently freed ones are reused first
+        const auto end = m.offsets.end() - static_cast<std::ptrdiff_t>(keep);
+        bm_->block_allocators_[m.disk]->delete_blocks(
+            m.offsets.begin(), end, m.block_size
+        );
+        const uint64_t bytes =
+            static_cast<uint64_t>(end - m.offsets.begin()) * m.block_size;
+        m.offsets.erase(m.offsets.begin(), end);
+        return bytes;
+    }
+
+    //! return all blocks to their disk allocators, mutex_ must be held
+    uint64_t flush()
+    {
+        if (!bm_)
+            return 0;
+
+        uint64_t bytes = 0;
+        for (bid_magazine& m : magazines_)
+            bytes += flush(m, 0);
+        return bytes;
+    }
+
+    //! number of bytes cached, mutex_ must be held
+    uint64_t cached_bytes() const
+    {
+        uint64_t bytes = 0;
+        for (const bid_magazine& m : magazines_)
+            bytes += m.offsets.size() * m.block_size;
+        return bytes;
+    }
+};
+
+static thread_local bid_magazine_cache tl_bid_magazines;
+
+bool block_manager::magazine_new_block(
+    size_t disk, size_t block_size,
+    file*& storage, external_size_type& offset)
+{
+    tl_bid_magazines.attach(this);
+    std::unique_lock<std::mutex> lock(tl_bid_magazines.mutex_);
+
+    bid_magazine& m = tl_bid_magazines.get(disk, block_size);
+
+    if (m.offsets.empty())
+    {
+        // refill half of the magazine with one allocator call
+        const size_t batch = std::max<size_t>(magazine_size_ / 2, 1);
+        if (!block_allocators_[disk]->has_available_space(batch * block_size))
+            return false;
+
+        std::vector<BID<0> >& refill = tl_bid_magazines.refill_;
+        refill.resize(batch);
+        for (BID<0>& b : refill)
+            b.size = block_size;
+
+        try {
+            block_allocators_[disk]->new_blocks(refill.begin(), refill.end());
+        }
+        catch (const bad_ext_alloc&) {
+            // lost a race for the remaining space, use the generic path
+            return false;
+        }
+
+        // blocks are taken from the back: hand out ascending offsets
+        for (size_t i = batch; i > 0; --i)
+            m.offsets.push_back(refill[i - 1].offset);
+    }
+
+    offset = m.offsets.back();
+    m.offsets.pop_back();
+    storage = disk_files_[disk].get();
+
+    add_allocation(block_size);
+    return true;
+}
+
+bool block_manager::magazine_delete_block(
+    size_t disk, size_t block_size, external_size_type offset)
+{
+    const size_t capacity = magazine_size_;
+    if (capacity == 0)
+        return false;
+
+    tl_bid_magazines.attach(this);
+    std::unique_lock<std::mutex> lock(tl_bid_magazines.mutex_);
+
+    bid_magazine& m = tl_bid_magazines.get(disk, block_size);
+    if (m.offsets.size() >= capacity)
+        tl_bid_magazines.flush(m, capacity / 2);
+
+    m.offsets.push_back(offset);
+    return true;
+}
+
+void block_manager::set_magazine_size(size_t blocks)
+{
+    magazine_size_ = blocks;
+}
+
+size_t block_manager::magazine_size() const
+{
+    return magazine_size_;
+}
+
+uint64_t block_manager::flush_magazines()
+{
+    std::unique_lock<std::mutex> registry_lock(s_magazine_caches_mutex);
+
+    uint64_t bytes = 0;
+    for (bid_magazine_cache* cache : s_magazine_caches) {
+        std::unique_lock<std::mutex> lock(cache->mutex_);
+        bytes += cache->flush();
+    }
+    return bytes;
+}
+
+uint64_t block_manager::magazine_bytes() const
+{
+    std::unique_lock<std::mutex> registry_lock(s_magazine_caches_mutex);
+
+    uint64_t bytes = 0;
+    for (bid_magazine_cache* cache : s_magazine_caches) {
+        std::unique_lock<std::mutex> lock(cache->mutex_);
+        bytes += cache->cached_bytes();
+    }
+    return bytes;
+}
+
+/******************************************************************************/
+// Persistent state
+
+void block_manager::set_root(const std::string& name, std::vector<BID<0> >&& bids)
+{
+    if (name.empty() || std::any_of(name.begin(), name.end(),
+                                    [](char c) { return std::isspace(static_cast<unsigned char>(c)); }))
+    {
+        FOXXLL_THROW(std::runtime_error, "Invalid root name '" << name << "'");
+    }
+
+    for (const BID<0>& bid : bids) {
+        if (!bid.valid() || !bid.is_managed()) {
+            FOXXLL_THROW(
+                std::runtime_error,
+                "Root '" << name << "' contains a block not managed by block_manager"
+            );
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(roots_mutex_);
+    roots_[name] = std::move(bids);
+}
+
+std::vector<BID<0> > block_manager::get_root(const std::string& name) const
+{
+    std::unique_lock<std::mutex> lock(roots_mutex_);
+    auto it = roots_.find(name);
+    if (it == roots_.end())
+        return std::vector<BID<0> >();
+    return it->second;
+}
+
+void block_manager::erase_root(const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(roots_mutex_);
+    roots_.erase(name);
+}
+
+void block_manager::load_roots(std::istream& is)
+{
+    std::string token;
+    size_t nroots = 0;
+    if (!(is >> token >> nroots) || token != "roots") {
+        FOXXLL_THROW(
+            std::runtime_error,
+            "Invalid roots in block manager state file '" << state_file_ << "'"
+        );
+    }
+
+    for (size_t r = 0; r < nroots; ++r)
+    {
+        std::string name;
+        size_t nbids = 0;
+        if (!(is >> name >> nbids)) {
+            FOXXLL_THROW(
+                std::runtime_error,
+                "Invalid root in block manager state file '" << state_file_ << "'"
+            );
+        }
+
+        std::vector<BID<0> >& bids = roots_[name];
+        bids.resize(nbids);
+        for (BID<0>& bid : bids)
+        {
+            size_t disk;
+            if (!(is >> disk >> bid.offset >> bid.size) || disk >= ndisks_) {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Invalid block of root '" << name << "' in block manager "
+                    "state file '" << state_file_ << "'"
+                );
+            }
+            bid.storage = disk_files_[disk].get();
+        }
+    }
+}
+
+void block_manager::save_state()
+{
+    if (state_file_.empty()) {
+        FOXXLL_THROW(
+            std::runtime_error,
+            "No block manager state file configured."
+        );
+    }
+
+    // write to temporary file and replace the old state atomically
+    const std::string tmp_file = state_file_ + ".tmp";
+    {
+        std::ofstream os(tmp_file.c_str());
+        config* cfg = config::get_instance();
+
+        std::unique_lock<std::mutex> lock(roots_mutex_);
+
+        // only blocks reachable from roots survive a restart, all other
+        // blocks are saved as free
+        std::vector<std::vector<std::pair<uint64_t, uint64_t> > > live(ndisks_);
+        for (const auto& root : roots_) {
+            for (const BID<0>& bid : root.second) {
+                live[static_cast<size_t>(bid.storage->get_allocator_id())]
+                .emplace_back(bid.offset, bid.size);
+            }
+        }
+
+        os << "foxxll-state 1 " << ndisks_ << '\n';
+        for (size_t d = 0; d < ndisks_; ++d) {
+            os << "disk " << cfg->disk_path(d) << '\n';
+            block_allocators_[d]->save_state(os, std::move(live[d]));
+        }
+
+        os << "roots " << roots_.size() << '\n';
+        for (const auto& root : roots_)
+        {
+            os << root.first << ' ' << root.second.size() << '\n';
+            for (const BID<0>& bid : root.second) {
+                os << bid.storage->get_allocator_id() << ' '
+                   << bid.offset << ' ' << bid.size << '\n';
+            }
+        }
+
+        if (!os.good()) {
+            FOXXLL_THROW(
+                std::runtime_error,
+                "Error writing block manager state file '" << tmp_file << "'"
+            );
+        }
+    }
+
+#if FOXXLL_WINDOWS
+    // rename() does not replace existing files on Windows
+    std::remove(state_file_.c_str());
+#endif
+    if (std::rename(tmp_file.c_str(), state_file_.c_str()) != 0) {
+        FOXXLL_THROW_ERRNO(
+            io_error,
+            "Error renaming '" << tmp_file << "' to '" << state_file_ << "'"
+        );
+    }
+
+    TLX_LOG << "foxxll: Saved block manager state to '" << state_file_ << "'";
+}
+
+/******************************************************************************/
+// block_manager
+
 block_manager::block_manager()
+    : magazine_size_(64)
 {
     config* config = config::get_instance();
 
@@ -44,10 +414,49 @@ block_manager::block_manager()
 
     uint64_t total_size = 0;
 
+    // open saved state of a previous run
+    state_file_ = config->state_file();
+    std::ifstream state;
+    if (!state_file_.empty())
+    {
+        state.open(state_file_.c_str());
+        if (state.good())
+        {
+            std::string magic;
+            size_t version = 0, ndisks = 0;
+            if (!(state >> magic >> version >> ndisks) ||
+                magic != "foxxll-state" || version != 1)
+            {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Invalid block manager state file '" << state_file_ << "'"
+                );
+            }
+            if (ndisks != ndisks_) {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Block manager state file '" << state_file_ << "' has " <<
+                        ndisks << " disks, but " << ndisks_ << " are configured"
+                );
+            }
+
+            TLX_LOG1 << "foxxll: Restoring block manager state from '"
+                     << state_file_ << "'";
+        }
+        else
+            state.close();
+    }
+
     for (size_t i = 0; i < ndisks_; ++i)
     {
         disk_config& cfg = config->disk(i);
 
+        // keep disk files for the next run
+        if (!state_file_.empty()) {
+            cfg.delete_on_exit = false;
+            cfg.unlink_on_open = false;
+        }
+
         // assign queues in order of disks.
         if (cfg.queue == file::DEFAULT_QUEUE)
             cfg.queue = i;
@@ -73,7 +482,40 @@ block_manager::block_manager()
         // create queue for the file.
         disk_queues::get_instance()->make_queue(disk_files_[i].get());
 
-        block_allocators_[i] = new disk_block_allocator(disk_files_[i].get(), cfg);
+        if (state.is_open())
+        {
+            std::string line;
+            std::getline(state >> std::ws, line);
+            if (line != "disk " + cfg.path) {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Block manager state file '" << state_file_ << "' does not "
+                    "match disk '" << cfg.path << "'"
+                );
+            }
+
+            block_allocators_[i] =
+                new disk_block_allocator(disk_files_[i].get(), cfg, state);
+        }
+        else
+        {
+            block_allocators_[i] =
+                new disk_block_allocator(disk_files_[i].get(), cfg);
+        }
+
+        if (!state_file_.empty())
+            block_allocators_[i]->set_persistent(true);
+    }
+
+    if (state.is_open())
+    {
+        load_roots(state);
+
+        // restored blocks count as allocated
+        uint64_t used = 0;
+        for (size_t i = 0; i < ndisks_; ++i)
+            used += block_allocators_[i]->used_bytes();
+        add_allocation(used);
     }
 
     if (ndisks_ > 1)
@@ -86,6 +528,28 @@ block_manager::block_manager()
 block_manager::~block_manager()
 {
     TLX_LOG << "foxxll: Block manager destructor";
+
+    if (!state_file_.empty())
+    {
+        try {
+            save_state();
+        }
+        catch (const std::exception& e) {
+            TLX_LOG1 << "foxxll: Error saving block manager state: " << e.what();
+        }
+    }
+
+    // return the blocks of threads still running, which must not use the
+    // block manager anymore
+    {
+        std::unique_lock<std::mutex> registry_lock(s_magazine_caches_mutex);
+        for (bid_magazine_cache* cache : s_magazine_caches) {
+            std::unique_lock<std::mutex> lock(cache->mutex_);
+            cache->flush();
+            cache->bm_ = nullptr;
+        }
+    }
+
     for (size_t i = ndisks_; i > 0; )
     {
         --i;
@@ -96,8 +560,6 @@ block_manager::~block_manager()
 
 uint64_t block_manager::total_bytes() const
 {
-    std::unique_lock<std::mutex> lock(mutex_);
-
     uint64_t total = 0;
 
     for (size_t i = 0; i < ndisks_; ++i)
@@ -108,34 +570,159 @@ uint64_t block_manager::total_bytes() const
 
 uint64_t block_manager::free_bytes() const
 {
-    std::unique_lock<std::mutex> lock(mutex_);
-
     uint64_t total = 0;
 
     for (size_t i = 0; i < ndisks_; ++i)
         total += block_allocators_[i]->free_bytes();
 
-    return total;
+    return total + magazine_bytes();
 }
 
 uint64_t block_manager::total_allocation() const
 {
-    std::unique_lock<std::mutex> lock(mutex_);
     return total_allocation_;
 }
 
 uint64_t block_manager::current_allocation() const
 {
-    std::unique_lock<std::mutex> lock(mutex_);
     return current_allocation_;
 }
 
 uint64_t block_manager::maximum_allocation() const
 {
-    std::unique_lock<std::mutex> lock(mutex_);
     return maximum_allocation_;
 }
 
+double block_manager::fragmentation(size_t disk) const
+{
+    return block_allocators_[disk]->fragmentation();
+}
+
+uint64_t block_manager::compact(
+    const relocate_callback& relocate, double threshold, uint64_t granularity)
+{
+    flush_magazines();
+
+    uint64_t released = 0;
+    for (size_t d = 0; d < ndisks_; ++d)
+    {
+        disk_block_allocator* alloc = block_allocators_[d];
+        if (!alloc->autogrow() || alloc->fragmentation() < threshold)
+            continue;
+
+        released += alloc->compact(relocate, granularity);
+    }
+
+    TLX_LOG << "block_manager::compact() released " << released << " bytes";
+
+    return released;
+}
+
+double block_manager::disk_load(size_t disk) const
+{
+    // strategies may span disks that are not configured, they look idle
+    if (disk >= ndisks_)
+        return 0.0;
+
+    file* f = disk_files_[disk].get();
+    return static_cast<double>(f->get_posted_requests() + 1)
+           * f->get_file_stats()->get_service_latency();
+}
+
+std::vector<double> block_manager::device_service_times() const
+{
+    //! devices differing less than this are scheduled as if equal
+    constexpr double min_spread = 1.25;
+
+    config* cfg = config::get_instance();
+    const size_t D = cfg->max_device_id();
+
+    // per device id, plus sentinel for files without device id
+    std::vector<double> sum(D + 1, 0.0);
+    std::vector<size_t> count(D + 1, 0);
+
+    bool configured = true;
+    for (size_t d = 0; d < ndisks_ && d < cfg->disks_number(); ++d)
+        configured = configured && cfg->disk(d).weight > 0.0;
+
+    for (size_t d = 0; d < ndisks_; ++d)
+    {
+        file* f = disk_files_[d].get();
+        size_t dev = f->get_device_id();
+        if (dev == file::DEFAULT_DEVICE_ID || dev > D)
+            dev = D;
+
+        double t = configured
+                   ? 1.0 / cfg->disk(d).weight
+                   : f->get_file_stats()->get_service_latency();
+        if (t <= 0.0)
+            continue;
+
+        sum[dev] += t;
+        count[dev]++;
+    }
+
+    double total = 0.0;
+    size_t known = 0;
+    for (size_t i = 0; i <= D; ++i) {
+        if (count[i] == 0)
+            continue;
+        sum[i] /= static_cast<double>(count[i]);
+        total += sum[i];
+        known++;
+    }
+    if (known == 0)
+        return std::vector<double>();
+
+    // devices without measurements are assumed to be average
+    const double mean = total / static_cast<double>(known);
+    for (size_t i = 0; i <= D; ++i) {
+        if (count[i] == 0)
+            sum[i] = mean;
+    }
+
+    const double fastest = *std::min_element(sum.begin(), sum.end());
+    const double slowest = *std::max_element(sum.begin(), sum.end());
+    if (slowest < min_spread * fastest)
+        return std::vector<double>();
+
+    for (double& t : sum)
+        t /= fastest;
+
+    return sum;
+}
+
+/******************************************************************************/
+// load_aware_cyclic
+
+void load_aware_cyclic::new_cycle() const
+{
+    block_manager* bm = block_manager::get_instance();
+
+    std::vector<double> load(diff_);
+    double sum = 0.0;
+    for (size_t d = 0; d < diff_; ++d) {
+        load[d] = bm->disk_load(begin_ + d);
+        sum += load[d];
+    }
+
+    const double limit = threshold_ * sum / static_cast<double>(diff_);
+
+    cycle_.clear();
+    for (size_t d = 0; d < diff_; ++d) {
+        if (load[d] <= limit)
+            cycle_.push_back(d);
+    }
+
+    // guard against rounding, the least loaded disk is always below average
+    if (cycle_.empty())
+        cycle_.push_back(static_cast<size_t>(
+                             std::min_element(load.begin(), load.end()) - load.begin()));
+
+    std::shuffle(cycle_.begin(), cycle_.end(), rng_);
+    pos_ = 0;
+}
+
 } // namespace foxxll
 
 /**************************************************************************/
@@ -16,13 +16,16 @@
 #define FOXXLL_MNG_BLOCK_MANAGER_HEADER
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <iterator>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
+#include <foxxll/common/exceptions.hpp>
 #include <foxxll/common/utils.hpp>
 #include <foxxll/config.hpp>
 #include <foxxll/defines.hpp>
@@ -49,7 +52,8 @@ namespace foxxll {
  * Block manager class.
  *
  * Manages allocation and deallocation of blocks in multiple/single disk setting
- * \remarks is a singleton
+ * \remarks is a singleton. There is no global lock: each disk_block_allocator
+ * protects itself, hence threads allocating on different disks do not contend.
  */
 class block_manager : public singleton<block_manager>
 {
@@ -65,6 +69,11 @@ public:
      * alloc_offset blocks. For BID<0> allocations, the objects' size field must
      * be initialized.
      *
+     * The blocks of each disk are allocated in one batch, and are stored back
+     * to back in the order of the range if the disk has a large enough free
+     * region or is configured as contiguous. Use contiguous_blocks() to find
+     * extents which can be transferred with one I/O.
+     *
      * \param functor object of model of \b allocation_strategy concept
      * \param bid_begin bidirectional BID iterator object
      * \param bid_end bidirectional BID iterator object
@@ -91,12 +100,28 @@ public:
     void new_block(const DiskAssignFunctor& functor,
                    BID<BlockSize>& bid, size_t alloc_offset = 0)
     {
-        new_blocks(functor, &bid, std::next(&bid, 1), alloc_offset);
+        if (BlockSize == 0 ||
+            magazine_size_.load(std::memory_order_relaxed) == 0)
+        {
+            new_blocks(functor, &bid, std::next(&bid, 1), alloc_offset);
+            return;
+        }
+
+        // fast path: take a block from the calling thread's magazine
+        const size_t disk = functor(alloc_offset);
+        if (magazine_new_block(disk, bid.size, bid.storage, bid.offset)) {
+            TLX_LOGC(verbose_block_life_cycle) << "BLC:new    " << bid;
+            return;
+        }
+
+        // do not ask a stateful strategy twice
+        new_blocks(single_disk(disk), &bid, std::next(&bid, 1));
     }
 
     //! Deallocates blocks.
     //!
-    //! Deallocates blocks in the range [ \b bid_begin, \b bid_end)
+    //! Deallocates blocks in the range [ \b bid_begin, \b bid_end) and returns
+    //! them to the disk allocators directly, bypassing the magazines.
     //! \param bid_begin iterator object of \b bid_iterator concept
     //! \param bid_end iterator object of \b bid_iterator concept
     template <typename BIDIterator>
@@ -108,6 +133,82 @@ public:
     template <size_t BlockSize>
     void delete_block(const BID<BlockSize>& bid);
 
+    //! \name Thread-local BID Magazines
+    //!
+    //! new_block() and delete_block() keep a small per-thread cache of free
+    //! blocks for each disk and fixed block size, variable-size BID<0> blocks
+    //! always use the disk allocators. Magazines are refilled from and
+    //! flushed to the disk_block_allocator in batches of half their size, so
+    //! most allocate/free pairs take only an uncontended per-thread lock and
+    //! allocate no memory. Blocks held in magazines count as free in
+    //! free_bytes(), and all magazines are flushed before an allocation fails
+    //! for lack of space.
+    //! \{
+
+    //! Set number of free blocks cached per thread, disk and block size.
+    //! 0 disables the magazines. Affects only subsequent refills and frees.
+    void set_magazine_size(size_t blocks);
+
+    //! Return number of free blocks cached per thread, disk and block size.
+    size_t magazine_size() const;
+
+    //! Return the blocks cached by all threads to the disk allocators. Returns
+    //! the number of bytes returned.
+    uint64_t flush_magazines();
+
+    //! \}
+
+    //! \name Persistent State
+    //!
+    //! If a state file is configured (config::set_state_file()), a table of
+    //! named roots is saved to it on destruction and by save_state(), and
+    //! restored on construction if the file exists. The disk files are kept
+    //! on exit, so blocks referenced by roots can be reused after a restart
+    //! with the same disk configuration. Only blocks referenced by roots are
+    //! saved as allocated, all other blocks are free after a restart.
+    //! \{
+
+    //! Store the BIDs of [begin, end) as root \b name, replacing a previous
+    //! root of that name. Names must not contain whitespace. The blocks stay
+    //! allocated across restarts until their owner deletes them.
+    template <typename BIDIterator>
+    void set_root(const std::string& name, BIDIterator begin, BIDIterator end)
+    {
+        std::vector<BID<0> > bids;
+        for ( ; begin != end; ++begin)
+            bids.push_back(BID<0>(begin->storage, begin->offset, begin->size));
+        set_root(name, std::move(bids));
+    }
+
+    //! Returns BIDs stored as root \b name, empty if there is no such root.
+    std::vector<BID<0> > get_root(const std::string& name) const;
+
+    //! Remove root \b name from the table, its blocks are not deleted.
+    void erase_root(const std::string& name);
+
+    //! Write the state file now. Throws if no state file is configured.
+    void save_state();
+
+    //! \}
+
+    //! \name Compaction
+    //! \{
+
+    //! Called for each relocated region, see disk_block_allocator::compact().
+    using relocate_callback = disk_block_allocator::relocate_callback;
+
+    //! Returns fragmentation of the free space of a disk, see
+    //! disk_block_allocator::fragmentation().
+    double fragmentation(size_t disk) const;
+
+    //! Compacts and truncates all autogrow disks whose fragmentation is at
+    //! least \b threshold, see disk_block_allocator::compact(). The magazines
+    //! of all threads are flushed first. Returns the number of bytes released.
+    uint64_t compact(const relocate_callback& relocate,
+                     double threshold = 0.0, uint64_t granularity = 0);
+
+    //! \}
+
     //! \name Statistics
     //! \{
 
@@ -126,6 +227,23 @@ public:
     //! return maximum number of bytes allocated during program run.
     uint64_t maximum_allocation() const;
 
+    //! return number of disks
+    size_t disks_number() const { return ndisks_; }
+
+    //! Return estimated time in seconds until a new request on the disk is
+    //! served: the number of requests queued or in flight plus one, times the
+    //! moving average service latency of the disk. 0 if no request completed
+    //! yet.
+    double disk_load(size_t disk) const;
+
+    //! Return the relative time to serve a block on each device id, followed
+    //! by the time for files without device id, as used by
+    //! compute_prefetch_schedule(). Configured disk weights are taken as
+    //! bandwidths, otherwise the measured service latencies are used; the
+    //! fastest device has time 1. Empty if the devices take about the same
+    //! time or nothing is known about them yet.
+    std::vector<double> device_service_times() const;
+
     //! \}
 
     ~block_manager();
@@ -143,19 +261,73 @@ private:
     tlx::simple_vector<disk_block_allocator*> block_allocators_;
 
     //! total requested allocation in bytes
-    uint64_t total_allocation_ = 0;
+    std::atomic<uint64_t> total_allocation_ { 0 };
 
     //! currently allocated bytes
-    uint64_t current_allocation_ = 0;
+    std::atomic<uint64_t> current_allocation_ { 0 };
 
     //! maximum number of bytes allocated during program run.
-    uint64_t maximum_allocation_ = 0;
+    std::atomic<uint64_t> maximum_allocation_ { 0 };
+
+    //! blocks cached per thread, disk and block size; 0 disables magazines
+    std::atomic<size_t> magazine_size_;
+
+    //! state file from config, empty if the state is not persistent
+    std::string state_file_;
+
+    //! named roots of persistent BID ranges
+    std::map<std::string, std::vector<BID<0> > > roots_;
+
+    //! mutex protecting roots_
+    mutable std::mutex roots_mutex_;
 
     //! private construction from singleton
     block_manager();
 
-    //! protect internal data structures
-    mutable std::mutex mutex_;
+    //! replace root name with bids
+    void set_root(const std::string& name, std::vector<BID<0> >&& bids);
+
+    //! read roots from the state file after the allocator states
+    void load_roots(std::istream& is);
+
+    //! take block from calling thread's magazine, refill it if empty. Returns
+    //! false if the magazine could not be refilled.
+    bool magazine_new_block(size_t disk, size_t block_size,
+                            file*& storage, external_size_type& offset);
+
+    //! put block into the calling thread's magazine, flush it if full.
+    //! Returns false if magazines are disabled.
+    bool magazine_delete_block(size_t disk, size_t block_size,
+                               external_size_type offset);
+
+    //! return number of bytes cached in the magazines of all threads
+    uint64_t magazine_bytes() const;
+
+    //! deallocate a block, put it into the calling thread's magazine if
+    //! use_magazine is set and magazines are enabled
+    template <size_t BlockSize>
+    void free_block(const BID<BlockSize>& bid, bool use_magazine);
+
+    //! new_blocks() without flushing the magazines. Allocates all blocks or
+    //! none, throws bad_ext_alloc if a disk is out of space.
+    template <typename DiskAssignFunctor, typename BIDIterator>
+    void allocate_blocks(
+        const DiskAssignFunctor& functor,
+        BIDIterator bid_begin, BIDIterator bid_end,
+        size_t alloc_offset);
+
+    friend class bid_magazine_cache;
+
+    //! account for newly allocated bytes in the global counters
+    void add_allocation(uint64_t bytes)
+    {
+        total_allocation_ += bytes;
+        const uint64_t current = (current_allocation_ += bytes);
+
+        uint64_t maximum = maximum_allocation_.load();
+        while (maximum < current &&
+               !maximum_allocation_.compare_exchange_weak(maximum, current)) { }
+    }
 
     //! log creation and destruction of blocks
     static constexpr bool verbose_block_life_cycle = false;
@@ -167,8 +339,23 @@ void block_manager::new_blocks(
     BIDIterator bid_begin, BIDIterator bid_end,
     size_t alloc_offset)
 {
-    std::unique_lock<std::mutex> lock(mutex_);
+    try {
+        allocate_blocks(functor, bid_begin, bid_end, alloc_offset);
+    }
+    catch (const bad_ext_alloc&) {
+        // the missing space may be cached in the magazines of any thread
+        if (flush_magazines() == 0)
+            throw;
+        allocate_blocks(functor, bid_begin, bid_end, alloc_offset);
+    }
+}
 
+template <typename DiskAssignFunctor, typename BIDIterator>
+void block_manager::allocate_blocks(
+    const DiskAssignFunctor& functor,
+    BIDIterator bid_begin, BIDIterator bid_end,
+    size_t alloc_offset)
+{
     using BIDType = typename std::iterator_traits<BIDIterator>::value_type;
 
     // choose disks for each block, sum up bytes allocated on a disk
@@ -214,9 +401,11 @@ void block_manager::new_blocks(
         disk_out[disk_id].push_back(i);
     }
 
-    // allocate blocks on disks in sequence, then scatter blocks into output
+    // allocate blocks on disks in sequence, then scatter blocks into output.
+    // each disk_block_allocator is locked separately.
 
     tlx::simple_vector<BIDType> bids;
+    uint64_t allocated_bytes = 0;
 
     for (size_t d = 0; d < ndisks_; ++d)
     {
@@ -229,8 +418,18 @@ void block_manager::new_blocks(
         for (size_t i = 0; i < disk_blocks[d]; ++i)
             bids[i] = bid_begin[bid_perm[i]];
 
-        // let block_allocator fill in offset fields
-        block_allocators_[d]->new_blocks(bids);
+        // let block_allocator fill in offset fields, on failure return the
+        // blocks already allocated on the previous disks
+        try {
+            block_allocators_[d]->new_blocks(bids);
+        }
+        catch (const bad_ext_alloc&) {
+            for (size_t p = 0; p < d; ++p) {
+                for (size_t i : disk_out[p])
+                    block_allocators_[p]->delete_block(bid_begin[i]);
+            }
+            throw;
+        }
 
         // distributed bids back to output
         for (size_t i = 0; i < disk_blocks[d]; ++i) {
@@ -238,20 +437,31 @@ void block_manager::new_blocks(
 
             TLX_LOGC(verbose_block_life_cycle) << "BLC:new    " << bids[i];
             bid_begin[bid_perm[i]] = bids[i];
-
-            total_allocation_ += bids[i].size;
-            current_allocation_ += bids[i].size;
         }
+
+        allocated_bytes += disk_bytes[d];
     }
 
-    maximum_allocation_ = std::max(maximum_allocation_, current_allocation_);
+    add_allocation(allocated_bytes);
 }
 
 template <size_t BlockSize>
 void block_manager::delete_block(const BID<BlockSize>& bid)
 {
-    std::unique_lock<std::mutex> lock(mutex_);
+    free_block(bid, BlockSize != 0);
+}
+
+template <typename BIDIterator>
+void block_manager::delete_blocks(
+    const BIDIterator& bid_begin, const BIDIterator& bid_end)
+{
+    for (BIDIterator it = bid_begin; it != bid_end; ++it)
+        free_block(*it, false);
+}
 
+template <size_t BlockSize>
+void block_manager::free_block(const BID<BlockSize>& bid, bool use_magazine)
+{
     if (!bid.valid()) {
         TLX_LOG << "Warning: invalid block to be deleted.";
         return;
@@ -261,18 +471,17 @@ void block_manager::delete_block(const BID<BlockSize>& bid)
 
     TLX_LOGC(verbose_block_life_cycle) << "BLC:delete " << bid;
     assert(bid.storage->get_allocator_id() >= 0);
-    block_allocators_[bid.storage->get_allocator_id()]->delete_block(bid);
-    disk_files_[bid.storage->get_allocator_id()]->discard(bid.offset, bid.size);
+    const size_t disk = static_cast<size_t>(bid.storage->get_allocator_id());
+    disk_files_[disk]->discard(bid.offset, bid.size);
 
-    current_allocation_ -= BlockSize;
-}
+    if (!use_magazine ||
+        magazine_size_.load(std::memory_order_relaxed) == 0 ||
+        !magazine_delete_block(disk, bid.size, bid.offset))
+    {
+        block_allocators_[disk]->delete_block(bid);
+    }
 
-template <typename BIDIterator>
-void block_manager::delete_blocks(
-    const BIDIterator& bid_begin, const BIDIterator& bid_end)
-{
-    for (BIDIterator it = bid_begin; it != bid_end; ++it)
-        delete_block(*it);
+    current_allocation_ -= bid.size;
 }
 
 //! \}
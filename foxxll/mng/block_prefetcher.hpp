@@ -16,12 +16,22 @@
 #define FOXXLL_MNG_BLOCK_PREFETCHER_HEADER
 
 #include <algorithm>
+#include <cmath>
+#include <deque>
+#include <memory>
 #include <queue>
 #include <vector>
 
+#include <tlx/unused.hpp>
+
 #include <foxxll/common/onoff_switch.hpp>
+#include <foxxll/common/timer.hpp>
 #include <foxxll/io/iostats.hpp>
 #include <foxxll/io/request.hpp>
+#include <foxxll/mng/async_schedule.hpp>
+#include <foxxll/mng/block_manager.hpp>
+#include <foxxll/mng/config.hpp>
+#include <foxxll/mng/memory_budget.hpp>
 
 namespace foxxll {
 
@@ -52,6 +62,29 @@ public:
 //!
 //! \c block_prefetcher overlaps I/Os with consumption of read data.
 //! Utilizes optimal asynchronous prefetch scheduling (by Peter Sanders et.al.)
+//! The read buffers are reserved from the memory_budget. The prefetch order is
+//! either given for the whole sequence, or computed window by window by a
+//! windowed_prefetch_schedule, so that very long sequences need memory only
+//! in the order of the window and the number of buffers. The windowed
+//! schedule accounts for devices of different speed, see
+//! block_manager::device_service_times().
+//!
+//! By default the number of read buffers is fixed. After set_adaptive() it
+//! follows the ratio of read latency to consumption time per block, and grows
+//! whenever the consumer has to wait, so that scans of slow disks prefetch
+//! deeper and scans of fast ones hold fewer buffers. Buffers are only added
+//! if they fit into the memory_budget. If the prefetch order needs more
+//! buffers than fit, the block waited for is read into the buffer of the
+//! posted block consumed last, which is read again later.
+//!
+//! After set_max_run(), consecutive blocks of the prefetch sequence that are
+//! adjacent in the same file are fetched with one request into adjacent read
+//! buffers. Reads are then posted a few at a time once enough buffers are
+//! free, but never keeping more than half of the buffers idle.
+//!
+//! After set_free_consumed(), each block is deleted from the block_manager as
+//! soon as it is consumed, so that reading a temporary sequence releases its
+//! external memory as it goes.
 template <typename BlockType, typename BidIteratorType>
 class block_prefetcher
 {
@@ -64,99 +97,558 @@ public:
     using bid_type = typename block_type::bid_type;
 
 protected:
+    //! a read buffer and the request filling it
+    struct read_slot
+    {
+        block_type* buffer = nullptr;
+        request_ptr req;
+        bid_type bid;
+        //! index of the block in the consumption sequence
+        size_t block = 0;
+        //! turned on when the read completed
+        onoff_switch completed;
+        //! times the read was posted and completed
+        double posted = 0.0, finished = 0.0;
+        //! next slot filled by the same request
+        read_slot* next_in_run = nullptr;
+        //! whether the buffer waits for a read to be posted
+        bool idle = false;
+        //! whether the buffer was allocated on its own, not in the initial array
+        bool owned = false;
+    };
+
+    //! sets the switches of all slots filled by one request
+    class run_handler
+    {
+        read_slot* first_;
+        completion_handler on_complete_;
+
+    public:
+        run_handler(read_slot* first, const completion_handler& on_complete)
+            : first_(first), on_complete_(on_complete) { }
+
+        void operator () (request* req, bool success)
+        {
+            const double now = timestamp();
+            read_slot* slot = first_;
+            while (slot)
+            {
+                // the consumer may reuse the slot once it is switched on
+                read_slot* next = slot->next_in_run;
+                slot->finished = now;
+                if (on_complete_)
+                    on_complete_(req, success);
+                slot->completed.on();
+                slot = next;
+            }
+        }
+    };
+
     bid_iterator_type consume_seq_begin;
     bid_iterator_type consume_seq_end;
     size_t seq_length;
 
+    //! prefetch order given by the caller, or nullptr
     size_t* prefetch_seq;
+    //! otherwise, the prefetch order computed window by window
+    std::unique_ptr<windowed_prefetch_schedule> schedule;
+    //! number of blocks passed to the schedule
+    size_t nscheduled;
 
     size_t nextread;
     size_t nextconsume;
 
-    const size_t nreadblocks;
+    //! blocks read out of the prefetch order, which are skipped when their
+    //! turn comes, and blocks whose buffer was taken for an earlier block,
+    //! which are read again before the prefetch order continues
+    std::vector<size_t> early, refetch;
 
-    block_type* read_buffers;
-    request_ptr* read_reqs;
-    bid_type* read_bids;
+    //! number of read buffers, and its bounds in adaptive mode
+    size_t nreadblocks;
+    size_t min_readblocks, max_readblocks;
+    bool adaptive;
+
+    //! longest run of blocks fetched with one request
+    size_t max_run;
 
-    onoff_switch* completed;
-    size_t* pref_buffer;
+    //! whether consumed blocks are deleted, and how many were consumed
+    bool free_consumed;
+    size_t nconsumed;
+
+    //! memory budget of the read buffers
+    memory_reservation memory_;
+
+    //! the initial read buffers, and how many of them were freed
+    block_type* read_buffers;
+    size_t nreadbuffers, freed_read_buffers;
+
+    //! all read buffers, the deque keeps them in place when growing
+    std::deque<read_slot> slots;
+    //! slots whose buffer was freed, which can be reused
+    std::vector<size_t> free_slots;
+    //! number of idle slots
+    size_t nidle;
+    //! number of requests posted
+    size_t nreads;
+    //! slot of the block handed to the consumer
+    size_t current_slot;
 
     completion_handler do_after_fetch;
 
+    //! smoothed read latency and consumption time per block
+    double avg_latency = 0.0;
+    double avg_consume = 0.0;
+    //! time the current block was handed to the consumer
+    double handed_out = 0.0;
+    //! whether the consumer had to wait for the current block
+    bool stalled = false;
+
+    //! Returns the index of the block prefetched i reads from now, or
+    //! seq_length if it is not known yet.
+    size_t prefetch_block(size_t i)
+    {
+        if (prefetch_seq)
+            return nextread + i < seq_length ? prefetch_seq[nextread + i] : seq_length;
+
+        while (schedule->available() == 0 && nscheduled < seq_length)
+        {
+            schedule->push((consume_seq_begin + nscheduled)->storage->get_device_id());
+            if (++nscheduled == seq_length)
+                schedule->finish();
+        }
+        return i < schedule->available() ? schedule->peek(i) : seq_length;
+    }
+
+    //! takes the next block of the prefetch order
+    size_t pop_block()
+    {
+        const size_t next = prefetch_seq ? prefetch_seq[nextread] : schedule->pop();
+        ++nextread;
+        return next;
+    }
+
+    //! skips the next blocks of the prefetch order that were read early
+    void skip_early()
+    {
+        while (!early.empty())
+        {
+            auto it = std::find(early.begin(), early.end(), prefetch_block(0));
+            if (it == early.end())
+                break;
+            early.erase(it);
+            pop_block();
+        }
+    }
+
+    //! whether two blocks are adjacent in the same file
+    bool adjacent_on_disk(size_t first, size_t second) const
+    {
+        const bid_type& a = *(consume_seq_begin + first);
+        const bid_type& b = *(consume_seq_begin + second);
+        return a.storage == b.storage &&
+               b.offset == a.offset + block_type::raw_size;
+    }
+
+    //! whether the run of length run of the next reads in islot can be
+    //! continued in the following slot
+    bool run_continues(size_t islot, size_t run)
+    {
+        const size_t next = prefetch_block(run);
+        return next != seq_length &&
+               std::find(early.begin(), early.end(), next) == early.end() &&
+               adjacent_on_disk(prefetch_block(run - 1), next) &&
+               islot + run < slots.size() &&
+               slots[islot + run].buffer == slots[islot].buffer + run;
+    }
+
+    //! returns the slot holding a posted block, or slots.size()
+    size_t find_slot(size_t iblock) const
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            const read_slot& slot = slots[i];
+            if (!slot.idle && slot.buffer && slot.block == iblock)
+                return i;
+        }
+        return slots.size();
+    }
+
+    //! set up the idle slot islot to be filled with block iblock
+    void prepare_slot(size_t islot, size_t iblock, double now)
+    {
+        TLX_LOG << "block_prefetcher: prefetching block " << iblock
+                << " into buffer " << islot;
+        assert(iblock < seq_length);
+
+        read_slot& slot = slots[islot];
+        assert(slot.idle);
+        slot.idle = false;
+        slot.block = iblock;
+        slot.bid = bid_type(*(consume_seq_begin + iblock));
+        slot.posted = now;
+        slot.next_in_run = nullptr;
+        slot.completed.off();
+    }
+
+    //! post a read of block iblock into the idle slot islot, outside of the
+    //! prefetch order
+    void post_block(size_t islot, size_t iblock)
+    {
+        prepare_slot(islot, iblock, timestamp());
+
+        read_slot& slot = slots[islot];
+        slot.req = slot.buffer->read(slot.bid, run_handler(&slot, do_after_fetch));
+
+        --nidle;
+        ++nreads;
+    }
+
+    //! post the next run reads into the idle slots starting at islot
+    void post_run(size_t islot, size_t run)
+    {
+        const double now = timestamp();
+        for (size_t i = 0; i < run; ++i)
+        {
+            prepare_slot(islot + i, pop_block(), now);
+            if (i + 1 < run)
+                slots[islot + i].next_in_run = &slots[islot + i + 1];
+        }
+
+        read_slot& first = slots[islot];
+        run_handler handler(&first, do_after_fetch);
+        if (run == 1) {
+            first.req = first.buffer->read(first.bid, handler);
+        }
+        else {
+            TLX_LOG << "block_prefetcher: reading " << run << " blocks at "
+                    << first.bid;
+            first.req = first.bid.storage->aread(
+                first.buffer, first.bid.offset, run * block_type::raw_size,
+                handler);
+            for (size_t i = 1; i < run; ++i)
+                slots[islot + i].req = first.req;
+        }
+
+        nidle -= run;
+        ++nreads;
+    }
+
+    //! post reads into idle slots, waiting for more idle slots while a run of
+    //! adjacent blocks could be extended, unless flush is set
+    void post_reads(bool flush)
+    {
+        const size_t run_limit = std::max(
+            size_t(1), std::min(max_run, nreadblocks / 2));
+
+        while (nidle > 0)
+        {
+            skip_early();
+            if (refetch.empty() && prefetch_block(0) == seq_length)
+                break;
+
+            size_t islot = 0;
+            while (!slots[islot].idle)
+                ++islot;
+
+            if (!refetch.empty())
+            {
+                auto it = std::min_element(refetch.begin(), refetch.end());
+                post_block(islot, *it);
+                refetch.erase(it);
+                continue;
+            }
+
+            size_t run = 1;
+            while (run < run_limit && run_continues(islot, run) &&
+                   slots[islot + run].idle)
+                ++run;
+
+            // the following buffer will be free once its block is consumed
+            if (!flush && run < run_limit && run_continues(islot, run))
+                break;
+
+            post_run(islot, run);
+        }
+    }
+
+    //! wait for the read of the posted block consumed last and make its slot
+    //! idle, the block is read again later. Returns slots.size() if no block
+    //! is posted.
+    size_t evict_slot()
+    {
+        size_t victim = slots.size();
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            const read_slot& slot = slots[i];
+            if (!slot.idle && slot.buffer &&
+                (victim == slots.size() || slot.block > slots[victim].block))
+                victim = i;
+        }
+        if (victim == slots.size())
+            return victim;
+
+        read_slot& slot = slots[victim];
+        TLX_LOG << "block_prefetcher: evicting block " << slot.block
+                << " from buffer " << victim;
+        slot.completed.wait_for_on();
+        slot.req = nullptr;
+        slot.idle = true;
+        ++nidle;
+        refetch.push_back(slot.block);
+        return victim;
+    }
+
+    //! allocate a read buffer, whose memory is already reserved
+    void add_buffer()
+    {
+        size_t islot;
+        if (!free_slots.empty()) {
+            islot = free_slots.back();
+            free_slots.pop_back();
+        }
+        else {
+            islot = slots.size();
+            slots.emplace_back();
+        }
+        slots[islot].buffer = new block_type;
+        slots[islot].owned = true;
+        slots[islot].idle = true;
+        ++nidle;
+        ++nreadblocks;
+    }
+
+    //! free a consumed read buffer, the initial ones are freed together
+    void remove_buffer(size_t islot)
+    {
+        read_slot& slot = slots[islot];
+        if (slot.owned) {
+            delete slot.buffer;
+            free_slots.push_back(islot);
+            memory_.release(sizeof(block_type));
+        }
+        else if (++freed_read_buffers == nreadbuffers) {
+            delete[] read_buffers;
+            read_buffers = nullptr;
+            memory_.release(nreadbuffers * sizeof(block_type));
+        }
+        slot.buffer = nullptr;
+        --nreadblocks;
+    }
+
+    //! number of read buffers needed to hide the latency of the reads,
+    //! updated with the measurements of a consumed block
+    size_t target_readblocks(const read_slot& slot)
+    {
+        const double latency = slot.finished - slot.posted;
+        const double consume = timestamp() - handed_out;
+
+        if (avg_consume == 0.0) {
+            avg_latency = latency;
+            avg_consume = consume;
+        }
+        else {
+            avg_latency += (latency - avg_latency) / 4;
+            avg_consume += (consume - avg_consume) / 4;
+        }
+
+        // blocks consumed while one read is in flight, plus the one in use
+        const double ratio = avg_latency / std::max(avg_consume, 1e-9);
+        size_t target = static_cast<size_t>(
+            std::ceil(std::min(ratio, static_cast<double>(max_readblocks)))) + 1;
+        if (stalled)
+            target = std::max(target, nreadblocks + 1);
+
+        return std::max(min_readblocks, std::min(target, max_readblocks));
+    }
+
     block_type * wait(size_t iblock)
     {
+        size_t islot = find_slot(iblock);
+        if (islot == slots.size())
+        {
+            // the block may have been held back waiting for a longer run
+            post_reads(true);
+
+            // with fewer buffers than the prefetch schedule was computed for,
+            // the block may not be posted yet
+            while ((islot = find_slot(iblock)) == slots.size())
+            {
+                if (memory_.try_reserve(sizeof(block_type))) {
+                    add_buffer();
+                    post_reads(true);
+                    continue;
+                }
+
+                // no memory for another buffer: read the block out of order
+                // into an idle buffer, or take the buffer of the block
+                // consumed last
+                size_t ifree = 0;
+                if (nidle > 0) {
+                    while (!slots[ifree].idle)
+                        ++ifree;
+                }
+                else if ((ifree = evict_slot()) == slots.size()) {
+                    // no buffer to wait for, the memory must come from others
+                    memory_.reserve(sizeof(block_type));
+                    add_buffer();
+                    continue;
+                }
+
+                auto it = std::find(refetch.begin(), refetch.end(), iblock);
+                if (it != refetch.end())
+                    refetch.erase(it);
+                else
+                    early.push_back(iblock);
+                post_block(ifree, iblock);
+            }
+        }
+
         TLX_LOG << "block_prefetcher: waiting block " << iblock;
+        read_slot& slot = slots[islot];
+        stalled = !slot.completed.is_on();
         {
             stats::scoped_wait_timer wait_timer(stats::WAIT_OP_READ);
 
-            completed[iblock].wait_for_on();
+            slot.completed.wait_for_on();
         }
         TLX_LOG << "block_prefetcher: finished waiting block " << iblock;
-        size_t ibuffer = pref_buffer[iblock];
-        TLX_LOG << "block_prefetcher: returning buffer " << ibuffer;
-        assert(ibuffer >= 0 && ibuffer < nreadblocks);
-        return (read_buffers + ibuffer);
+        TLX_LOG << "block_prefetcher: returning buffer " << islot;
+        current_slot = islot;
+        handed_out = timestamp();
+        return slot.buffer;
     }
 
-public:
-    //! Constructs an object and immediately starts prefetching.
-    //! \param _cons_begin \c bid_iterator pointing to the \c bid of the first block to be consumed
-    //! \param _cons_end \c bid_iterator pointing to the \c bid of the ( \b last + 1 ) block of consumption sequence
-    //! \param _pref_seq gives the prefetch order, is a pointer to the integer array that contains
-    //!        the indices of the blocks in the consumption sequence
-    //! \param _prefetch_buf_size amount of prefetch buffers to use
-    //! \param do_after_fetch unknown
     block_prefetcher(
         bid_iterator_type _cons_begin,
         bid_iterator_type _cons_end,
         size_t* _pref_seq,
         size_t _prefetch_buf_size,
-        completion_handler do_after_fetch = completion_handler())
+        size_t window,
+        completion_handler do_after_fetch)
         : consume_seq_begin(_cons_begin),
           consume_seq_end(_cons_end),
           seq_length(_cons_end - _cons_begin),
           prefetch_seq(_pref_seq),
-          nextread(std::min(_prefetch_buf_size, seq_length)),
+          nscheduled(0),
+          nextread(0),
           nextconsume(0),
-          nreadblocks(nextread),
+          nreadblocks(std::min(_prefetch_buf_size, seq_length)),
+          min_readblocks(nreadblocks),
+          max_readblocks(nreadblocks),
+          adaptive(false),
+          max_run(1),
+          free_consumed(false),
+          nconsumed(0),
+          memory_(nreadblocks * sizeof(block_type)),
+          nreadbuffers(nreadblocks),
+          freed_read_buffers(0),
+          slots(nreadblocks),
+          nidle(nreadblocks),
+          nreads(0),
+          current_slot(0),
           do_after_fetch(do_after_fetch)
     {
         TLX_LOG << "block_prefetcher: seq_length=" << seq_length;
         TLX_LOG << "block_prefetcher: _prefetch_buf_size=" << _prefetch_buf_size;
         assert(seq_length > 0);
         assert(_prefetch_buf_size > 0);
-        size_t i;
-        read_buffers = new block_type[nreadblocks];
-        read_reqs = new request_ptr[nreadblocks];
-        read_bids = new bid_type[nreadblocks];
-        pref_buffer = new size_t[seq_length];
 
-        std::fill(pref_buffer, pref_buffer + seq_length, -1);
-
-        completed = new onoff_switch[seq_length];
+        if (!prefetch_seq) {
+            schedule.reset(new windowed_prefetch_schedule(
+                               window, _prefetch_buf_size,
+                               config::get_instance()->max_device_id(),
+                               block_manager::get_instance()->device_service_times()));
+        }
 
-        for (i = 0; i < nreadblocks; ++i)
-        {
-            assert(prefetch_seq[i] < seq_length);
-            read_bids[i] = *(consume_seq_begin + prefetch_seq[i]);
-            TLX_LOG << "block_prefetcher: reading block " << i <<
-                " prefetch_seq[" << i << "]=" << prefetch_seq[i] <<
-                " @ " << &read_buffers[i] <<
-                " @ " << read_bids[i];
-            read_reqs[i] = read_buffers[i].read(
-                    read_bids[i],
-                    set_switch_handler(*(completed + prefetch_seq[i]), do_after_fetch)
-                );
-            pref_buffer[prefetch_seq[i]] = i;
+        read_buffers = new block_type[nreadbuffers];
+        for (size_t i = 0; i < nreadbuffers; ++i) {
+            slots[i].buffer = read_buffers + i;
+            slots[i].idle = true;
         }
+
+        post_reads(true);
     }
 
+public:
+    //! Constructs an object and immediately starts prefetching.
+    //! \param _cons_begin \c bid_iterator pointing to the \c bid of the first block to be consumed
+    //! \param _cons_end \c bid_iterator pointing to the \c bid of the ( \b last + 1 ) block of consumption sequence
+    //! \param _pref_seq gives the prefetch order, is a pointer to the integer array that contains
+    //!        the indices of the blocks in the consumption sequence
+    //! \param _prefetch_buf_size amount of prefetch buffers to use
+    //! \param do_after_fetch unknown
+    block_prefetcher(
+        bid_iterator_type _cons_begin,
+        bid_iterator_type _cons_end,
+        size_t* _pref_seq,
+        size_t _prefetch_buf_size,
+        completion_handler do_after_fetch = completion_handler())
+        : block_prefetcher(_cons_begin, _cons_end, _pref_seq,
+                           _prefetch_buf_size, 0, do_after_fetch)
+    { }
+
+    //! Constructs an object that computes the prefetch order window by
+    //! window, and immediately starts prefetching.
+    //! \param _cons_begin \c bid_iterator pointing to the \c bid of the first block to be consumed
+    //! \param _cons_end \c bid_iterator pointing to the \c bid of the ( \b last + 1 ) block of consumption sequence
+    //! \param _prefetch_buf_size amount of prefetch buffers to use
+    //! \param window number of blocks scheduled at once
+    //! \param do_after_fetch unknown
+    block_prefetcher(
+        bid_iterator_type _cons_begin,
+        bid_iterator_type _cons_end,
+        size_t _prefetch_buf_size,
+        size_t window,
+        completion_handler do_after_fetch = completion_handler())
+        : block_prefetcher(_cons_begin, _cons_end, nullptr,
+                           _prefetch_buf_size, window, do_after_fetch)
+    { }
+
     //! non-copyable: delete copy-constructor
     block_prefetcher(const block_prefetcher&) = delete;
     //! non-copyable: delete assignment operator
     block_prefetcher& operator = (const block_prefetcher&) = delete;
 
+    //! Let the number of read buffers adapt between min_buffers and
+    //! max_buffers. Buffers beyond the current number are only allocated if
+    //! they fit into the memory_budget.
+    void set_adaptive(size_t min_buffers, size_t max_buffers)
+    {
+        min_readblocks = std::max(min_buffers, size_t(1));
+        max_readblocks = std::max(max_buffers, min_readblocks);
+        adaptive = true;
+    }
+
+    //! Fetch up to run adjacent blocks with one request, from the next reads
+    //! on. Only possible if the blocks carry no meta info, so that their
+    //! buffers are contiguous.
+    void set_max_run(size_t run)
+    {
+        if (sizeof(block_type) == block_type::raw_size)
+            max_run = std::max(run, size_t(1));
+    }
+
+    //! Delete each block with block_manager::delete_block() once it was
+    //! consumed, which also discards its space on the device. The
+    //! prefetcher then owns the blocks of the sequence: those not consumed
+    //! are deleted by the destructor, the BIDs must not be used afterwards.
+    void set_free_consumed()
+    {
+        free_consumed = true;
+    }
+
+    //! Returns the current number of read buffers.
+    size_t num_buffers() const
+    {
+        return nreadblocks;
+    }
+
+    //! Returns the number of read requests posted so far.
+    size_t num_reads() const
+    {
+        return nreads;
+    }
+
     //! Pulls next unconsumed block from the consumption sequence.
     //! \return Pointer to the already prefetched block from the internal buffer pool
     block_type * pull_block()
@@ -171,30 +663,45 @@ public:
     //! \return \c false if there are no blocks to prefetch left, \c true if consumption sequence is not emptied
     bool block_consumed(block_type*& buffer)
     {
-        size_t ibuffer = buffer - read_buffers;
+        size_t ibuffer = current_slot;
         TLX_LOG << "block_prefetcher: buffer " << ibuffer << " consumed";
-        if (read_reqs[ibuffer].valid())
-            read_reqs[ibuffer]->wait();
+        read_slot& slot = slots[ibuffer];
+        assert(slot.buffer == buffer);
+        tlx::unused(buffer);
 
-        read_reqs[ibuffer] = nullptr;
+        if (slot.req.valid())
+            slot.req->wait();
 
-        if (nextread < seq_length)
-        {
-            assert(ibuffer >= 0 && ibuffer < nreadblocks);
-            size_t next_2_prefetch = prefetch_seq[nextread++];
-            TLX_LOG << "block_prefetcher: prefetching block " << next_2_prefetch;
+        slot.req = nullptr;
 
-            assert(next_2_prefetch < seq_length);
-            assert(!completed[next_2_prefetch].is_on());
+        if (free_consumed)
+            block_manager::get_instance()->delete_block(slot.bid);
+        ++nconsumed;
 
-            pref_buffer[next_2_prefetch] = ibuffer;
-            read_bids[ibuffer] =
-                bid_type(*(consume_seq_begin + next_2_prefetch));
-            read_reqs[ibuffer] = read_buffers[ibuffer].read(
-                    read_bids[ibuffer],
-                    set_switch_handler(*(completed + next_2_prefetch), do_after_fetch)
-                );
+        if (!adaptive)
+        {
+            slot.idle = true;
+            ++nidle;
         }
+        else
+        {
+            const size_t target = target_readblocks(slot);
+
+            if ((nextread < seq_length || !refetch.empty()) &&
+                nreadblocks <= target) {
+                slot.idle = true;
+                ++nidle;
+            }
+            else {
+                remove_buffer(ibuffer);
+            }
+
+            while (nreadblocks < target && nidle < seq_length - nextread &&
+                   memory_.try_reserve(sizeof(block_type)))
+                add_buffer();
+        }
+
+        post_reads(false);
 
         if (nextconsume >= seq_length)
             return false;
@@ -220,14 +727,18 @@ public:
     //! Frees used memory.
     ~block_prefetcher()
     {
-        for (size_t i = 0; i < nreadblocks; ++i)
-            if (read_reqs[i].valid())
-                read_reqs[i]->wait();
+        for (read_slot& slot : slots)
+            if (slot.req.valid())
+                slot.req->wait();
+
+        if (free_consumed)
+            block_manager::get_instance()->delete_blocks(
+                consume_seq_begin + nconsumed, consume_seq_end);
+
+        for (read_slot& slot : slots)
+            if (slot.owned)
+                delete slot.buffer;
 
-        delete[] read_reqs;
-        delete[] read_bids;
-        delete[] completed;
-        delete[] pref_buffer;
         delete[] read_buffers;
     }
 };
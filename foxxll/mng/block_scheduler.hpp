@@ -32,6 +32,8 @@
 #include <tlx/unused.hpp>
 
 #include <foxxll/mng/block_manager.hpp>
+#include <foxxll/mng/memory_budget.hpp>
+#include <foxxll/mng/memory_pressure.hpp>
 #include <foxxll/mng/typed_block.hpp>
 
 #include <foxxll/common/addressable_queues.hpp>
@@ -320,8 +322,8 @@ protected:
 
     const size_t max_internal_blocks;
     size_t remaining_internal_blocks;
-    //! Stores pointers to arrays of internal_blocks. Used to deallocate them only.
-    std::stack<internal_block_type*> internal_blocks_blocks;
+    //! Stores pointers to arrays of internal_blocks and their lengths. Used to deallocate them only.
+    std::vector<std::pair<internal_block_type*, size_t> > internal_blocks_blocks;
     //! holds free internal_blocks with attributes reset.
     std::stack<internal_block_type*> free_internal_blocks;
     //! temporary blocks that will not be needed after algorithm termination.
@@ -331,6 +333,60 @@ protected:
                         std::greater<swappable_block_identifier_type> > free_swappable_blocks;
     block_manager* bm;
     block_scheduler_algorithm<SwappableBlockType>* algo;
+    //! memory pressure state, checked on acquire and release.
+    memory_pressure_flag memory_pressure;
+
+    //! Deallocate all arrays of internal_blocks whose blocks are all in the freelist.
+    void free_unused_internal_blocks()
+    {
+        std::vector<internal_block_type*> free_blocks;
+        free_blocks.reserve(free_internal_blocks.size());
+        while (! free_internal_blocks.empty())
+        {
+            free_blocks.push_back(free_internal_blocks.top());
+            free_internal_blocks.pop();
+        }
+        std::sort(free_blocks.begin(), free_blocks.end(), std::less<internal_block_type*>());
+
+        std::vector<bool> gone(free_blocks.size(), false);
+        size_t num_freed_internal_blocks = 0;
+        for (size_t i = 0; i < internal_blocks_blocks.size(); )
+        {
+            internal_block_type* begin = internal_blocks_blocks[i].first;
+            const size_t num_blocks = internal_blocks_blocks[i].second;
+            typename std::vector<internal_block_type*>::iterator lo =
+                std::lower_bound(free_blocks.begin(), free_blocks.end(), begin, std::less<internal_block_type*>());
+            if (static_cast<size_t>(free_blocks.end() - lo) < num_blocks || *(lo + (num_blocks - 1)) != begin + (num_blocks - 1))
+            {
+                // => some block of the array is in use
+                ++i;
+                continue;
+            }
+            // mark the blocks of the array as gone
+            std::fill(gone.begin() + (lo - free_blocks.begin()),
+                      gone.begin() + (lo - free_blocks.begin() + num_blocks), true);
+            delete[] begin;
+            memory_budget::get_instance()->release(num_blocks * sizeof(internal_block_type));
+            remaining_internal_blocks += num_blocks;
+            num_freed_internal_blocks += num_blocks;
+            internal_blocks_blocks[i] = internal_blocks_blocks.back();
+            internal_blocks_blocks.pop_back();
+        }
+
+        for (size_t i = 0; i < free_blocks.size(); ++i)
+        {
+            if (! gone[i])
+                free_internal_blocks.push(free_blocks[i]);
+        }
+        TLX_LOG << "memory pressure: freed " << num_freed_internal_blocks << " internal_blocks";
+    }
+
+    //! Free unused internal_blocks when memory pressure starts.
+    void check_memory_pressure()
+    {
+        if (memory_pressure.changed() && memory_pressure.under_pressure())
+            free_unused_internal_blocks();
+    }
 
     //! Get an internal_block from the freelist or a newly allocated one if available.
     //! \return Pointer to the internal_block. nullptr if none available.
@@ -345,11 +401,32 @@ protected:
         }
         else if (remaining_internal_blocks > 0)
         {
-            // => more internal_blocks can be allocated
+            // => more internal_blocks can be allocated, as far as the memory budget permits
             size_t num_blocks = std::min(max_internal_blocks_alloc_at_once, remaining_internal_blocks);
+            if (memory_pressure.under_pressure())
+            {
+                if (remaining_internal_blocks < max_internal_blocks)
+                    // => evict instead of growing under memory pressure
+                    return 0;
+                num_blocks = 1;
+            }
+            memory_budget* budget = memory_budget::get_instance();
+            while (! budget->try_reserve(num_blocks * sizeof(internal_block_type)))
+            {
+                if (num_blocks > 1) {
+                    num_blocks /= 2;
+                    continue;
+                }
+                if (remaining_internal_blocks < max_internal_blocks)
+                    // => evict one of the blocks allocated so far instead
+                    return 0;
+                // => wait for memory for the first block
+                budget->reserve(sizeof(internal_block_type));
+                break;
+            }
             remaining_internal_blocks -= num_blocks;
             internal_block_type* iblocks = new internal_block_type[num_blocks];
-            internal_blocks_blocks.push(iblocks);
+            internal_blocks_blocks.emplace_back(iblocks, num_blocks);
             for (size_t i = num_blocks - 1; i > 0; --i)
                 free_internal_blocks.push(iblocks + i);
             return iblocks;
@@ -368,6 +445,8 @@ protected:
 public:
     //! Create a block_scheduler with empty prediction sequence in simple mode.
     //! \param max_internal_memory Amount of internal memory (in bytes) the scheduler is allowed to use for acquiring, prefetching and caching.
+    //! Internal blocks are allocated on demand and reserved from the memory_budget, which may cap them earlier.
+    //! Under memory_pressure, unused internal blocks are freed and the scheduler evicts instead of growing.
     explicit block_scheduler(const size_t max_internal_memory)
         : max_internal_blocks(div_ceil(max_internal_memory, sizeof(internal_block_type))),
           remaining_internal_blocks(max_internal_blocks),
@@ -405,9 +484,11 @@ public:
         }
         while (! internal_blocks_blocks.empty())
         {
-            delete[] internal_blocks_blocks.top();
-            internal_blocks_blocks.pop();
+            delete[] internal_blocks_blocks.back().first;
+            internal_blocks_blocks.pop_back();
         }
+        memory_budget::get_instance()->release(
+            (max_internal_blocks - remaining_internal_blocks) * sizeof(internal_block_type));
     }
 
     //! Acquire the given block.
@@ -415,14 +496,20 @@ public:
     //! \return Reference to the block's data.
     //! param sbid Swappable block to acquire.
     internal_block_type & acquire(const swappable_block_identifier_type sbid, const bool uninitialized = false)
-    { return algo->acquire(sbid, uninitialized); }
+    {
+        check_memory_pressure();
+        return algo->acquire(sbid, uninitialized);
+    }
 
     //! Release the given block.
     //! Has to be in pairs with acquire. Pairs may be nested and interleaved.
     //! \param sbid Swappable block to release.
     //! \param dirty If the data has been changed, invalidating possible data in external storage.
     void release(const swappable_block_identifier_type sbid, const bool dirty)
-    { algo->release(sbid, dirty); }
+    {
+        algo->release(sbid, dirty);
+        check_memory_pressure();
+    }
 
     //! Drop all data in the given block, freeing in- and external memory.
     void deinitialize(const swappable_block_identifier_type sbid)
@@ -48,12 +48,12 @@ protected:
     prefetcher_type* prefetcher;
     size_t current_elem;
     block_type* current_blk;
-    size_t* prefetch_seq;
 #ifdef BUF_ISTREAM_CHECK_END
     bool not_finished;
 #endif
 
 public:
+    using value_type = typename block_type::value_type;
     using reference = typename block_type::reference;
     using self_type = buf_istream<block_type, bid_iterator_type>;
 
@@ -68,22 +68,13 @@ public:
 #endif
     {
         const size_t ndisks = config::get_instance()->disks_number();
-        const size_t mdevid = config::get_instance()->max_device_id();
-        const size_t seq_length = end - begin;
-        prefetch_seq = new size_t[seq_length];
 
-        // obvious schedule
-        //for(size_t i = 0; i < seq_length; ++i)
-        //      prefetch_seq[i] = i;
-
-        // optimal schedule
+        // optimal schedule, computed window by window so that long streams
+        // need no memory per block
         nbuffers = std::max(2 * ndisks, size_t(nbuffers - 1));
-        compute_prefetch_schedule(
-            begin, end, prefetch_seq,
-            nbuffers, mdevid
-        );
+        const size_t window = std::max(size_t(4096), 8 * nbuffers);
 
-        prefetcher = new prefetcher_type(begin, end, prefetch_seq, nbuffers);
+        prefetcher = new prefetcher_type(begin, end, nbuffers, window);
 
         current_blk = prefetcher->pull_block();
     }
@@ -93,6 +84,34 @@ public:
     //! non-copyable: delete assignment operator
     buf_istream& operator = (const buf_istream&) = delete;
 
+    //! Let the prefetch depth adapt to the read latency and the consumption
+    //! rate, between min_buffers and max_buffers read buffers.
+    void set_adaptive_prefetch(size_t min_buffers, size_t max_buffers)
+    {
+        prefetcher->set_adaptive(min_buffers, max_buffers);
+    }
+
+    //! Fetch up to run blocks that are adjacent on disk with one request,
+    //! see block_prefetcher::set_max_run().
+    void set_max_read_run(size_t run)
+    {
+        prefetcher->set_max_run(run);
+    }
+
+    //! Delete each block once it was read, see
+    //! block_prefetcher::set_free_consumed(). The stream then owns the blocks:
+    //! those not read are deleted with the stream.
+    void set_free_consumed()
+    {
+        prefetcher->set_free_consumed();
+    }
+
+    //! Returns the current number of read buffers.
+    size_t num_prefetch_buffers() const
+    {
+        return prefetcher->num_buffers();
+    }
+
     //! Input stream operator, reads in \c record.
     //! \param record reference to the block record type,
     //!        contains value of the next record in the stream after the call of the operator
@@ -118,6 +137,46 @@ public:
         return (*this);
     }
 
+    //! Reads n records into an array, copying whole runs of a block at once.
+    //! \return reference to itself (stream object)
+    self_type & read(value_type* dst, size_t n)
+    {
+        return for_each_span(
+            n, [&dst](const value_type* span, size_t count) {
+                dst = std::copy(span, span + count, dst);
+            });
+    }
+
+    //! Consumes n records by calling f(const value_type* span, size_t count)
+    //! for each contiguous run of the blocks.
+    //! \return reference to itself (stream object)
+    template <typename Functor>
+    self_type & for_each_span(size_t n, Functor f)
+    {
+        while (n != 0)
+        {
+#ifdef BUF_ISTREAM_CHECK_END
+            assert(not_finished);
+#endif
+            const size_t count = std::min(n, block_type::size - current_elem);
+            f(static_cast<const value_type*>(current_blk->elem + current_elem),
+              count);
+            current_elem += count;
+            n -= count;
+
+            if (current_elem >= block_type::size)
+            {
+                current_elem = 0;
+#ifdef BUF_ISTREAM_CHECK_END
+                not_finished = prefetcher->block_consumed(current_blk);
+#else
+                prefetcher->block_consumed(current_blk);
+#endif
+            }
+        }
+        return *this;
+    }
+
     //! Returns reference to the current record in the stream.
     reference current()     /* const */
     {
@@ -156,7 +215,6 @@ public:
     ~buf_istream()
     {
         delete prefetcher;
-        delete[] prefetch_seq;
     }
 };
 
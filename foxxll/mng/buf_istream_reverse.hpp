@@ -104,6 +104,27 @@ public:
     //! non-copyable: delete assignment operator
     buf_istream_reverse& operator = (const buf_istream_reverse&) = delete;
 
+    //! Let the prefetch depth adapt to the read latency and the consumption
+    //! rate, between min_buffers and max_buffers read buffers.
+    void set_adaptive_prefetch(size_t min_buffers, size_t max_buffers)
+    {
+        prefetcher->set_adaptive(min_buffers, max_buffers);
+    }
+
+    //! Delete each block once it was read, see
+    //! block_prefetcher::set_free_consumed(). The stream then owns the blocks:
+    //! those not read are deleted with the stream.
+    void set_free_consumed()
+    {
+        prefetcher->set_free_consumed();
+    }
+
+    //! Returns the current number of read buffers.
+    size_t num_prefetch_buffers() const
+    {
+        return prefetcher->num_buffers();
+    }
+
     //! Input stream operator, reads in \c record.
     //! \param record reference to the block record type,
     //!        contains value of the next record in the stream after the call of the operator
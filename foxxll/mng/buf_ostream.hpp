@@ -13,6 +13,8 @@
 #ifndef FOXXLL_MNG_BUF_OSTREAM_HEADER
 #define FOXXLL_MNG_BUF_OSTREAM_HEADER
 
+#include <algorithm>
+
 #include <foxxll/mng/buf_writer.hpp>
 
 #include <tlx/define/likely.hpp>
@@ -40,6 +42,7 @@ protected:
     block_type* current_blk;
 
 public:
+    using value_type = typename block_type::value_type;
     using const_reference = typename block_type::const_reference;
     using reference = typename block_type::reference;
     using self_type = buf_ostream<block_type, bid_iterator_type>;
@@ -54,6 +57,14 @@ public:
         current_blk = writer.get_free_block();
     }
 
+    //! Keep all disks busy while writing, see
+    //! buffered_writer::set_disk_aware(). Must be called before the first
+    //! block is written.
+    void set_disk_aware_writes(size_t queue_depth = 2)
+    {
+        writer.set_disk_aware(queue_depth);
+    }
+
     //! non-copyable: delete copy-constructor
     buf_ostream(const buf_ostream&) = delete;
     //! non-copyable: delete assignment operator
@@ -73,6 +84,39 @@ public:
         return *this;
     }
 
+    //! Writes n records from an array, copying whole runs of a block at once.
+    //! \return reference to itself (stream object)
+    self_type & write(const value_type* src, size_t n)
+    {
+        return for_each_span(
+            n, [&src](value_type* span, size_t count) {
+                std::copy(src, src + count, span);
+                src += count;
+            });
+    }
+
+    //! Appends n records by calling f(value_type* span, size_t count) for
+    //! each contiguous run of the blocks, which must fill all count records.
+    //! \return reference to itself (stream object)
+    template <typename Functor>
+    self_type & for_each_span(size_t n, Functor f)
+    {
+        while (n != 0)
+        {
+            const size_t count = std::min(n, block_type::size - current_elem);
+            f(current_blk->elem + current_elem, count);
+            current_elem += count;
+            n -= count;
+
+            if (current_elem >= block_type::size)
+            {
+                current_elem = 0;
+                current_blk = writer.write(current_blk, *(current_bid++));
+            }
+        }
+        return *this;
+    }
+
     //! Returns reference to the current record.
     //! \return reference to the current record
     reference current()
@@ -13,11 +13,19 @@
 #ifndef FOXXLL_MNG_BUF_WRITER_HEADER
 #define FOXXLL_MNG_BUF_WRITER_HEADER
 
+#include <algorithm>
+#include <cassert>
 #include <queue>
 #include <vector>
 
+#include <foxxll/common/error_handling.hpp>
 #include <foxxll/io/disk_queues.hpp>
+#include <foxxll/io/file.hpp>
 #include <foxxll/io/request_operations.hpp>
+#include <foxxll/mng/async_schedule.hpp>
+#include <foxxll/mng/block_manager.hpp>
+#include <foxxll/mng/config.hpp>
+#include <foxxll/mng/memory_budget.hpp>
 
 #include <tlx/define/likely.hpp>
 
@@ -33,6 +41,15 @@ namespace foxxll {
 //! Encapsulates asynchronous buffered block writing engine.
 //!
 //! \c buffered_writer overlaps I/Os with filling of output buffer.
+//! The write buffers are reserved from the memory_budget.
+//!
+//! By default filled blocks are collected into batches, which are written in
+//! order of their offsets. After set_disk_aware() blocks are batched per
+//! device instead, and each time a block is filled the next writes go to the
+//! devices below their queue depth whose batched writes take longest, as
+//! estimated from block_manager::device_service_times(), so that all disks
+//! stay busy and slow ones are started first. compute_write_schedule()
+//! computes the resulting order for a batch.
 template <typename BlockType>
 class buffered_writer
 {
@@ -42,6 +59,7 @@ class buffered_writer
 
 protected:
     const size_t nwriteblocks;
+    memory_reservation memory_;                       // memory budget of write_buffers
     block_type* write_buffers;
     bid_type* write_bids;
     request_ptr* write_reqs;
@@ -68,6 +86,97 @@ protected:
     using batch_type = std::priority_queue<batch_entry, std::vector<batch_entry>, batch_entry_cmp>;
     batch_type batch_write_blocks;      // sorted sequence of blocks to write
 
+    //! writes kept in flight per device in disk aware mode, 0 if disabled
+    size_t disk_queue_depth_ = 0;
+    //! per device id, plus sentinel for files without device id: blocks to
+    //! write, sorted by offset
+    std::vector<batch_type> disk_batches_;
+    //! per device id: writes in flight
+    std::vector<size_t> disk_writing_;
+    //! per device id: relative time to write a block, empty if all are equal
+    std::vector<double> service_times_;
+    //! total number of blocks in disk_batches_
+    size_t disk_batched_ = 0;
+
+    //! device index of the block in a buffer
+    size_t device_of(size_t ibuffer) const
+    {
+        size_t dev = write_bids[ibuffer].storage->get_device_id();
+        return (dev < disk_batches_.size()) ? dev : disk_batches_.size() - 1;
+    }
+
+    //! called when the write of a buffer completed
+    void write_completed(size_t ibuffer)
+    {
+        if (disk_queue_depth_)
+            --disk_writing_[device_of(ibuffer)];
+    }
+
+    //! Posts writes from the per device batches to the devices chosen by
+    //! choose_write_device(). Stops when all devices with batched blocks
+    //! already have disk_queue_depth_ writes, unless all batched blocks are to
+    //! be written.
+    void schedule_writes(bool all)
+    {
+        while (disk_batched_ > 0)
+        {
+            const size_t best = choose_write_device(
+                disk_batches_.size(),
+                [this](size_t d) { return disk_batches_[d].size(); },
+                disk_writing_.data(),
+                service_times_.empty() ? nullptr : service_times_.data(),
+                disk_queue_depth_, all);
+            if (best == disk_batches_.size())
+                break;
+
+            size_t ibuffer = disk_batches_[best].top().ibuffer;
+            disk_batches_[best].pop();
+            --disk_batched_;
+
+            if (write_reqs[ibuffer].valid())
+                write_reqs[ibuffer]->wait();
+
+            write_reqs[ibuffer] = write_buffers[ibuffer].write(write_bids[ibuffer]);
+
+            busy_write_blocks.push_back(ibuffer);
+            ++disk_writing_[best];
+        }
+    }
+
+    //! posts the writes of the batch in offset order
+    void flush_batch()
+    {
+        while (!batch_write_blocks.empty())
+        {
+            size_t ibuffer = batch_write_blocks.top().ibuffer;
+            batch_write_blocks.pop();
+
+            if (write_reqs[ibuffer].valid())
+                write_reqs[ibuffer]->wait();
+
+            write_reqs[ibuffer] = write_buffers[ibuffer].write(write_bids[ibuffer]);
+
+            busy_write_blocks.push_back(ibuffer);
+        }
+    }
+
+    //! moves all completed writes to the free blocks
+    void reap_writes()
+    {
+        for (size_t i = 0; i < busy_write_blocks.size(); )
+        {
+            size_t ibuffer = busy_write_blocks[i];
+            if (write_reqs[ibuffer]->poll()) {
+                busy_write_blocks.erase(busy_write_blocks.begin() + i);
+                free_write_blocks.push_back(ibuffer);
+                write_completed(ibuffer);
+            }
+            else {
+                ++i;
+            }
+        }
+    }
+
 public:
     //! Constructs an object.
     //! \param write_buf_size number of write buffers to use
@@ -75,6 +184,7 @@ public:
     //!        order to flush write requests (bulk buffered writing)
     buffered_writer(size_t write_buf_size, size_t write_batch_size)
         : nwriteblocks((write_buf_size > 2) ? write_buf_size : 2),
+          memory_(nwriteblocks * sizeof(block_type)),
           writebatchsize(write_batch_size ? write_batch_size : 1)
     {
         write_buffers = new block_type[nwriteblocks];
@@ -88,6 +198,26 @@ public:
         disk_queues::get_instance()->set_priority_op(request_queue::WRITE);
     }
 
+    //! Switches to disk aware writing, which keeps up to queue_depth writes
+    //! in flight on each device. Blocks are still written in batches of at
+    //! most write_batch_size. Must be called before the first block is
+    //! written. 0 switches back to writing batches in offset order.
+    void set_disk_aware(size_t queue_depth = 2)
+    {
+        assert(batch_write_blocks.empty() && disk_batched_ == 0);
+        assert(busy_write_blocks.empty());
+        disk_queue_depth_ = queue_depth;
+        if (queue_depth) {
+            // device ids, plus sentinel for files without device id
+            const size_t ndevices = config::get_instance()->max_device_id() + 1;
+            disk_batches_.resize(ndevices);
+            disk_writing_.assign(ndevices, 0);
+            service_times_ = block_manager::get_instance()->device_service_times();
+            if (service_times_.size() != ndevices)
+                service_times_.clear();
+        }
+    }
+
     //! non-copyable: delete copy-constructor
     buffered_writer(const buffered_writer&) = delete;
     //! non-copyable: delete assignment operator
@@ -104,12 +234,30 @@ public:
             {
                 busy_write_blocks.erase(it);
                 free_write_blocks.push_back(ibuffer);
+                write_completed(ibuffer);
 
                 break;
             }
         }
         if (TLX_UNLIKELY(free_write_blocks.empty()))
         {
+            // all buffers may be held by the batches
+            if (busy_write_blocks.empty())
+            {
+                if (disk_queue_depth_)
+                    schedule_writes(true);
+                else
+                    flush_batch();
+            }
+            if (TLX_UNLIKELY(busy_write_blocks.empty()))
+            {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "buffered_writer: all " << nwriteblocks <<
+                        " write buffers are held by the caller"
+                );
+            }
+
             size_t size = busy_write_blocks.size();
             request_ptr* reqs = new request_ptr[size];
             size_t i = 0;
@@ -121,6 +269,11 @@ public:
             size_t completed_global = busy_write_blocks[completed];
             delete[] reqs;
             busy_write_blocks.erase(busy_write_blocks.begin() + completed);
+            write_completed(completed_global);
+
+            // the device may take the next block of its batch
+            if (disk_queue_depth_)
+                schedule_writes(false);
 
             return (write_buffers + completed_global);
         }
@@ -136,22 +289,21 @@ public:
     //! \return pointer to the new free block from the pool
     block_type * write(block_type* filled_block, const bid_type& bid)          // writes filled_block and returns a new block
     {
-        if (batch_write_blocks.size() >= writebatchsize)
+        if (disk_queue_depth_)
         {
-            // flush batch
-            while (!batch_write_blocks.empty())
-            {
-                size_t ibuffer = batch_write_blocks.top().ibuffer;
-                batch_write_blocks.pop();
-
-                if (write_reqs[ibuffer].valid())
-                    write_reqs[ibuffer]->wait();
+            size_t ibuffer = filled_block - write_buffers;
+            write_bids[ibuffer] = bid;
+            disk_batches_[device_of(ibuffer)].push(batch_entry(bid.offset, ibuffer));
+            ++disk_batched_;
 
-                write_reqs[ibuffer] = write_buffers[ibuffer].write(write_bids[ibuffer]);
+            reap_writes();
+            schedule_writes(disk_batched_ >= writebatchsize);
 
-                busy_write_blocks.push_back(ibuffer);
-            }
+            return get_free_block();
         }
+
+        if (batch_write_blocks.size() >= writebatchsize)
+            flush_batch();
         TLX_LOG << "Adding write request to batch";
 
         size_t ibuffer = filled_block - write_buffers;
@@ -164,18 +316,9 @@ public:
     void flush()
     {
         size_t ibuffer;
-        while (!batch_write_blocks.empty())
-        {
-            ibuffer = batch_write_blocks.top().ibuffer;
-            batch_write_blocks.pop();
-
-            if (write_reqs[ibuffer].valid())
-                write_reqs[ibuffer]->wait();
-
-            write_reqs[ibuffer] = write_buffers[ibuffer].write(write_bids[ibuffer]);
-
-            busy_write_blocks.push_back(ibuffer);
-        }
+        if (disk_queue_depth_)
+            schedule_writes(true);
+        flush_batch();
         for (auto it = busy_write_blocks.begin(); it != busy_write_blocks.end(); it++)
         {
             ibuffer = *it;
@@ -183,6 +326,7 @@ public:
         }
 
         assert(batch_write_blocks.empty());
+        std::fill(disk_writing_.begin(), disk_writing_.end(), 0);
         free_write_blocks.clear();
         busy_write_blocks.clear();
 
@@ -194,18 +338,9 @@ public:
     ~buffered_writer()
     {
         size_t ibuffer;
-        while (!batch_write_blocks.empty())
-        {
-            ibuffer = batch_write_blocks.top().ibuffer;
-            batch_write_blocks.pop();
-
-            if (write_reqs[ibuffer].valid())
-                write_reqs[ibuffer]->wait();
-
-            write_reqs[ibuffer] = write_buffers[ibuffer].write(write_bids[ibuffer]);
-
-            busy_write_blocks.push_back(ibuffer);
-        }
+        if (disk_queue_depth_)
+            schedule_writes(true);
+        flush_batch();
         for (auto it = busy_write_blocks.begin(); it != busy_write_blocks.end(); it++)
         {
             ibuffer = *it;
@@ -0,0 +1,611 @@
+/***************************************************************************
+ *  foxxll/mng/compressed_stream.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_COMPRESSED_STREAM_HEADER
+#define FOXXLL_MNG_COMPRESSED_STREAM_HEADER
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <tlx/define/likely.hpp>
+#include <tlx/logger/core.hpp>
+#include <tlx/unused.hpp>
+
+#include <foxxll/common/aligned_alloc.hpp>
+#include <foxxll/common/error_handling.hpp>
+#include <foxxll/io/request.hpp>
+#include <foxxll/mng/bid.hpp>
+#include <foxxll/mng/block_alloc_strategy.hpp>
+#include <foxxll/mng/block_codec.hpp>
+#include <foxxll/mng/block_manager.hpp>
+#include <foxxll/mng/memory_budget.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_schedlayer
+//! \{
+
+//! Header of a compressed block on disk, followed by the payload.
+struct compressed_block_header
+{
+    //! size of the payload
+    uint32_t size;
+    //! whether the payload is the block itself, as it did not compress
+    uint32_t stored;
+};
+
+//! Size of the extent holding a compressed block of a raw size, at most.
+inline size_t compressed_extent_capacity(size_t raw_size)
+{
+    const size_t bytes = sizeof(compressed_block_header) + raw_size;
+    return (bytes + BlockAlignment - 1) / BlockAlignment * BlockAlignment;
+}
+
+//! Encapsulates asynchronous writing of compressed blocks.
+//!
+//! Has the interface of buffered_writer, but each filled block is compressed
+//! with block_codec by block_codec_workers and written to a BID<0> extent of
+//! the compressed size, rounded to the BlockAlignment, which is allocated on
+//! demand from the block_manager. Blocks that do not compress are stored as
+//! they are. extents() lists the extents in the order of the blocks.
+//!
+//! The write buffers and the compression buffers are reserved from the
+//! memory_budget.
+template <typename BlockType, typename AllocStrategy = default_alloc_strategy>
+class compressing_writer
+{
+public:
+    using block_type = BlockType;
+    using extent_type = BID<0>;
+    using alloc_strategy_type = AllocStrategy;
+
+protected:
+    const size_t nbuffers_;
+    const size_t capacity_;
+    memory_reservation memory_;
+
+    block_codec_workers* workers_;
+
+    alloc_strategy_type alloc_;
+
+    block_type* blocks_;
+    std::vector<char*> scratch_;
+
+    std::vector<extent_type> extents_;
+    std::vector<size_t> free_;
+    size_t inflight_ = 0;
+    std::string error_;
+
+    //! write request of each buffer, and the number of steps left until the
+    //! buffer is free: storing the request and its completion
+    std::vector<request_ptr> reqs_;
+    std::vector<unsigned> pending_;
+
+    //! protects everything written by the workers
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    //! a step of writing buffer i is done or failed
+    void release(size_t i, const std::string& error,
+                 const request_ptr& req = request_ptr())
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!error.empty() && error_.empty())
+            error_ = error;
+        if (req)
+            reqs_[i] = req;
+        if (--pending_[i] == 0) {
+            free_.push_back(i);
+            --inflight_;
+            cv_.notify_all();
+        }
+    }
+
+    //! compresses buffer i and writes it as block seq, run by a worker
+    void compress_and_write(size_t i, size_t seq)
+    {
+        char* scratch = scratch_[i];
+        compressed_block_header header;
+
+        size_t size = block_codec::compress(
+            blocks_ + i, block_type::raw_size,
+            scratch + sizeof(header), block_type::raw_size);
+        header.stored = (size == 0);
+        if (header.stored) {
+            size = block_type::raw_size;
+            std::memcpy(scratch + sizeof(header), blocks_[i].elem, size);
+        }
+        header.size = static_cast<uint32_t>(size);
+        std::memcpy(scratch, &header, sizeof(header));
+
+        extent_type extent;
+        extent.size = compressed_extent_capacity(size);
+        // zero the padding, it is written as well
+        std::fill(scratch + sizeof(header) + size, scratch + extent.size, 0);
+
+        request_ptr req;
+        try {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                // extents vary in size, keep them out of the BID magazines
+                block_manager::get_instance()->new_blocks(
+                    alloc_, &extent, &extent + 1, seq);
+                extents_[seq] = extent;
+                pending_[i] = 2;
+            }
+            req = extent.storage->awrite(
+                scratch, extent.offset, extent.size,
+                [this, i](request* r, bool success) {
+                    release(i, success ? std::string() :
+                            "compressing_writer: write failed at " +
+                            std::to_string(r->offset()));
+                });
+        }
+        catch (const std::exception& e) {
+            {
+                // there is no completion to wait for
+                std::unique_lock<std::mutex> lock(mutex_);
+                pending_[i] = 1;
+            }
+            release(i, e.what());
+            return;
+        }
+        release(i, std::string(), req);
+    }
+
+    //! wait until no write is in flight
+    void wait_all(std::unique_lock<std::mutex>& lock)
+    {
+        cv_.wait(lock, [this]() { return inflight_ == 0; });
+    }
+
+public:
+    //! Constructs an object.
+    //! \param nbuffers number of write buffers to use
+    //! \param workers threads to compress with, or nullptr to use the shared
+    //!        block_codec_workers::get_instance()
+    //! \param alloc strategy to allocate the extents
+    compressing_writer(size_t nbuffers, block_codec_workers* workers = nullptr,
+                       const alloc_strategy_type& alloc = alloc_strategy_type())
+        : nbuffers_(std::max(nbuffers, size_t(2))),
+          capacity_(compressed_extent_capacity(block_type::raw_size)),
+          memory_(nbuffers_ * (sizeof(block_type) + capacity_)),
+          workers_(workers ? workers : block_codec_workers::get_instance()),
+          alloc_(alloc),
+          blocks_(new block_type[nbuffers_]),
+          reqs_(nbuffers_),
+          pending_(nbuffers_, 0)
+    {
+        for (size_t i = 0; i < nbuffers_; ++i) {
+            scratch_.push_back(
+                static_cast<char*>(aligned_alloc<BlockAlignment>(capacity_)));
+            free_.push_back(i);
+        }
+    }
+
+    //! non-copyable: delete copy-constructor
+    compressing_writer(const compressing_writer&) = delete;
+    //! non-copyable: delete assignment operator
+    compressing_writer& operator = (const compressing_writer&) = delete;
+
+    //! Returns a free block, waiting for a write to finish if necessary.
+    block_type * get_free_block()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !free_.empty() || !error_.empty(); });
+        if (!error_.empty())
+            FOXXLL_THROW(io_error, error_);
+
+        size_t i = free_.back();
+        free_.pop_back();
+        return blocks_ + i;
+    }
+
+    //! Submits a filled block as the next block of the sequence.
+    //! \return a free block
+    block_type * write(block_type* filled_block)
+    {
+        const size_t i = filled_block - blocks_;
+        size_t seq;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            seq = extents_.size();
+            extents_.emplace_back();
+            pending_[i] = 1;
+            ++inflight_;
+        }
+        workers_->enqueue([this, i, seq]() { compress_and_write(i, seq); });
+
+        return get_free_block();
+    }
+
+    //! Waits until all blocks are written.
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wait_all(lock);
+        if (!error_.empty())
+            FOXXLL_THROW(io_error, error_);
+    }
+
+    //! Returns the extents of the blocks written, complete after flush().
+    const std::vector<extent_type> & extents() const
+    {
+        return extents_;
+    }
+
+    //! Waits for the writes and frees used memory.
+    ~compressing_writer()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wait_all(lock);
+        }
+        for (char* s : scratch_)
+            aligned_dealloc<BlockAlignment>(s);
+        delete[] blocks_;
+    }
+};
+
+//! Encapsulates prefetching of compressed blocks.
+//!
+//! Has the interface of block_prefetcher for blocks written by
+//! compressing_writer: reads the extents in sequence and decompresses them by
+//! block_codec_workers, nbuffers blocks ahead of the consumer.
+//!
+//! The read buffers and the compressed buffers are reserved from the
+//! memory_budget.
+template <typename BlockType, typename ExtentIteratorType>
+class decompressing_prefetcher
+{
+public:
+    using block_type = BlockType;
+    using extent_iterator_type = ExtentIteratorType;
+
+protected:
+    extent_iterator_type begin_;
+    const size_t length_;
+    const size_t nbuffers_;
+    const size_t capacity_;
+    memory_reservation memory_;
+
+    block_codec_workers* workers_;
+
+    block_type* blocks_;
+    std::vector<char*> scratch_;
+
+    //! block read into each buffer, its request and whether it is ready
+    std::vector<size_t> seq_;
+    std::vector<request_ptr> reqs_;
+    std::vector<bool> ready_;
+
+    size_t next_read_ = 0, next_consume_ = 0;
+    size_t current_ = 0;
+    size_t inflight_ = 0;
+    std::string error_;
+
+    //! protects ready_, inflight_ and error_
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    //! the block in buffer i is ready or failed
+    void finished(size_t i, const std::string& error)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!error.empty() && error_.empty())
+            error_ = error;
+        ready_[i] = true;
+        --inflight_;
+        cv_.notify_all();
+    }
+
+    //! decompresses buffer i, run by a worker
+    void decode(size_t i)
+    {
+        const char* scratch = scratch_[i];
+        compressed_block_header header;
+        std::memcpy(&header, scratch, sizeof(header));
+
+        bool ok = header.size + sizeof(header) <= capacity_;
+        if (ok && header.stored)
+        {
+            ok = (header.size == block_type::raw_size);
+            if (ok)
+                std::memcpy(blocks_[i].elem, scratch + sizeof(header), header.size);
+        }
+        else if (ok)
+        {
+            ok = block_codec::decompress(
+                scratch + sizeof(header), header.size,
+                blocks_ + i, block_type::raw_size);
+        }
+
+        finished(i, ok ? std::string() :
+                 "decompressing_prefetcher: corrupt block " + std::to_string(seq_[i]));
+    }
+
+    //! read the next extent into buffer i
+    void post(size_t i)
+    {
+        const size_t seq = next_read_++;
+        const BID<0>& extent = *(begin_ + seq);
+        if (extent.size > capacity_)
+            FOXXLL_THROW(io_error, "decompressing_prefetcher: extent of "
+                         << extent.size << " bytes is too large for the block");
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            seq_[i] = seq;
+            ready_[i] = false;
+            ++inflight_;
+        }
+        reqs_[i] = extent.storage->aread(
+            scratch_[i], extent.offset, extent.size,
+            [this, i](request*, bool success) {
+                if (success)
+                    workers_->enqueue([this, i]() { decode(i); });
+                else
+                    finished(i, "decompressing_prefetcher: read failed");
+            });
+    }
+
+    //! wait for block seq
+    block_type * wait(size_t seq)
+    {
+        size_t i = 0;
+        while (seq_[i] != seq)
+            ++i;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this, i]() { return ready_[i]; });
+        if (!error_.empty())
+            FOXXLL_THROW(io_error, error_);
+
+        current_ = i;
+        return blocks_ + i;
+    }
+
+public:
+    //! Constructs an object and immediately starts prefetching.
+    //! \param begin first extent of the sequence
+    //! \param end end of the extents
+    //! \param nbuffers number of read buffers
+    //! \param workers threads to decompress with, or nullptr to use the shared
+    //!        block_codec_workers::get_instance()
+    decompressing_prefetcher(extent_iterator_type begin, extent_iterator_type end,
+                             size_t nbuffers, block_codec_workers* workers = nullptr)
+        : begin_(begin),
+          length_(end - begin),
+          nbuffers_(std::max(size_t(1), std::min(nbuffers, length_))),
+          capacity_(compressed_extent_capacity(block_type::raw_size)),
+          memory_(nbuffers_ * (sizeof(block_type) + capacity_)),
+          workers_(workers ? workers : block_codec_workers::get_instance()),
+          blocks_(new block_type[nbuffers_]),
+          seq_(nbuffers_, length_),
+          reqs_(nbuffers_),
+          ready_(nbuffers_, false)
+    {
+        for (size_t i = 0; i < nbuffers_; ++i)
+            scratch_.push_back(
+                static_cast<char*>(aligned_alloc<BlockAlignment>(capacity_)));
+
+        for (size_t i = 0; i < nbuffers_ && next_read_ < length_; ++i)
+            post(i);
+    }
+
+    //! non-copyable: delete copy-constructor
+    decompressing_prefetcher(const decompressing_prefetcher&) = delete;
+    //! non-copyable: delete assignment operator
+    decompressing_prefetcher& operator = (const decompressing_prefetcher&) = delete;
+
+    //! Pulls the next unconsumed block from the sequence.
+    block_type * pull_block()
+    {
+        return wait(next_consume_++);
+    }
+
+    //! Exchanges buffers between prefetcher and application, see
+    //! block_prefetcher::block_consumed().
+    //! \return false if there are no blocks left
+    bool block_consumed(block_type*& buffer)
+    {
+        assert(buffer == blocks_ + current_);
+        tlx::unused(buffer);
+
+        if (next_read_ < length_)
+            post(current_);
+        else
+            seq_[current_] = length_;
+
+        if (next_consume_ >= length_)
+            return false;
+
+        buffer = wait(next_consume_++);
+        return true;
+    }
+
+    //! Whether all blocks were pulled.
+    bool empty() const
+    {
+        return next_consume_ >= length_;
+    }
+
+    //! Waits for the reads and frees used memory.
+    ~decompressing_prefetcher()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return inflight_ == 0; });
+        }
+        for (char* s : scratch_)
+            aligned_dealloc<BlockAlignment>(s);
+        delete[] blocks_;
+    }
+};
+
+//! Buffered output stream writing compressed blocks, see compressing_writer.
+template <typename BlockType, typename AllocStrategy = default_alloc_strategy>
+class compressed_ostream
+{
+public:
+    using block_type = BlockType;
+    using value_type = typename block_type::value_type;
+    using writer_type = compressing_writer<block_type, AllocStrategy>;
+    using extent_type = typename writer_type::extent_type;
+
+protected:
+    writer_type writer_;
+    block_type* current_blk_;
+    size_t current_elem_ = 0;
+    uint64_t size_ = 0;
+    bool finished_ = false;
+
+public:
+    //! Constructs an output stream.
+    //! \param nbuffers number of buffers for internal use
+    //! \param workers threads to compress with, or nullptr to use the shared
+    //!        block_codec_workers::get_instance()
+    explicit compressed_ostream(size_t nbuffers,
+                                block_codec_workers* workers = nullptr)
+        : writer_(nbuffers, workers)
+    {
+        current_blk_ = writer_.get_free_block();
+    }
+
+    //! non-copyable: delete copy-constructor
+    compressed_ostream(const compressed_ostream&) = delete;
+    //! non-copyable: delete assignment operator
+    compressed_ostream& operator = (const compressed_ostream&) = delete;
+
+    //! Appends a record.
+    compressed_ostream& operator << (const value_type& record)
+    {
+        assert(!finished_);
+        current_blk_->elem[current_elem_++] = record;
+        ++size_;
+        if (TLX_UNLIKELY(current_elem_ >= block_type::size))
+        {
+            current_elem_ = 0;
+            current_blk_ = writer_.write(current_blk_);
+        }
+        return *this;
+    }
+
+    //! Writes the last, partially filled block and waits for all writes.
+    //! Throws io_error if a write failed.
+    void finish()
+    {
+        if (finished_)
+            return;
+        finished_ = true;
+
+        if (current_elem_ != 0) {
+            std::fill(current_blk_->elem + current_elem_,
+                      current_blk_->elem + block_type::size, value_type());
+            current_blk_ = writer_.write(current_blk_);
+        }
+        writer_.flush();
+    }
+
+    //! Returns the extents of the blocks, complete after finish().
+    const std::vector<extent_type> & extents() const
+    {
+        return writer_.extents();
+    }
+
+    //! Returns the number of records written.
+    uint64_t size() const { return size_; }
+
+    //! Finishes the stream if finish() was not called. Errors can then only
+    //! be logged, call finish() to handle them.
+    ~compressed_ostream()
+    {
+        try {
+            finish();
+        }
+        catch (const std::exception& e) {
+            TLX_LOG1 << "compressed_ostream: error finishing the stream: "
+                     << e.what();
+        }
+    }
+};
+
+//! Buffered input stream reading blocks written by compressed_ostream.
+template <typename BlockType, typename ExtentIteratorType>
+class compressed_istream
+{
+public:
+    using block_type = BlockType;
+    using value_type = typename block_type::value_type;
+    using prefetcher_type = decompressing_prefetcher<block_type, ExtentIteratorType>;
+
+protected:
+    prefetcher_type prefetcher_;
+    block_type* current_blk_;
+    size_t current_elem_ = 0;
+    uint64_t remaining_;
+
+public:
+    //! Constructs an input stream.
+    //! \param begin first extent of the stream
+    //! \param end end of the extents
+    //! \param nbuffers number of buffers for internal use
+    //! \param size number of records in the stream
+    //! \param workers threads to decompress with, or nullptr to use the shared
+    //!        block_codec_workers::get_instance()
+    compressed_istream(ExtentIteratorType begin, ExtentIteratorType end,
+                       size_t nbuffers, uint64_t size,
+                       block_codec_workers* workers = nullptr)
+        : prefetcher_(begin, end, nbuffers, workers),
+          current_blk_(begin != end ? prefetcher_.pull_block() : nullptr),
+          remaining_(size)
+    { }
+
+    //! non-copyable: delete copy-constructor
+    compressed_istream(const compressed_istream&) = delete;
+    //! non-copyable: delete assignment operator
+    compressed_istream& operator = (const compressed_istream&) = delete;
+
+    //! Reads the next record.
+    compressed_istream& operator >> (value_type& record)
+    {
+        assert(remaining_ != 0);
+        record = current_blk_->elem[current_elem_++];
+        --remaining_;
+        if (TLX_UNLIKELY(current_elem_ >= block_type::size))
+        {
+            current_elem_ = 0;
+            prefetcher_.block_consumed(current_blk_);
+        }
+        return *this;
+    }
+
+    //! Returns the current record.
+    const value_type& operator * () const
+    {
+        return current_blk_->elem[current_elem_];
+    }
+
+    //! Returns whether all records were read.
+    bool empty() const { return remaining_ == 0; }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_COMPRESSED_STREAM_HEADER
+
+/**************************************************************************/
@@ -0,0 +1,315 @@
+/***************************************************************************
+ *  foxxll/mng/concurrent_ostream.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_CONCURRENT_OSTREAM_HEADER
+#define FOXXLL_MNG_CONCURRENT_OSTREAM_HEADER
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tlx/define/likely.hpp>
+
+#include <foxxll/common/error_handling.hpp>
+#include <foxxll/io/request.hpp>
+#include <foxxll/mng/block_alloc_strategy.hpp>
+#include <foxxll/mng/block_manager.hpp>
+#include <foxxll/mng/memory_budget.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_schedlayer
+//! \{
+
+//! Buffered output stream for many producer threads.
+//!
+//! Each thread appends records through its own producer, which fills a block
+//! of its own without locking. Only a full block is handed to the stream,
+//! which allocates a BID for it on demand from the block_manager and posts its
+//! write right away. The blocks of all producers are interleaved in the order
+//! in which they were completed; blocks() lists them with their number of
+//! records, which is less than block_type::size only for the last block of
+//! each producer. All producers must be closed before the stream is
+//! flushed or destroyed.
+//!
+//! The stream lock is only held to take a free buffer and to allocate a BID,
+//! producers wait for writes to complete without it. Each producer holds one
+//! buffer, so there can be at most as many producers as buffers; at least two
+//! buffers per producer keep a write of each producer in flight. The buffers
+//! are reserved from the memory_budget.
+template <typename BlockType, typename AllocStrategy = default_alloc_strategy>
+class concurrent_ostream
+{
+public:
+    using block_type = BlockType;
+    using bid_type = typename block_type::bid_type;
+    using value_type = typename block_type::value_type;
+    using alloc_strategy_type = AllocStrategy;
+
+    //! a block written to the stream and its number of records
+    using output_block = std::pair<bid_type, size_t>;
+
+protected:
+    const size_t nbuffers_;
+    memory_reservation memory_;
+    block_type* buffers_;
+    alloc_strategy_type alloc_;
+
+    //! free buffers
+    std::vector<size_t> free_;
+    //! write request of each buffer, and the number of steps left until the
+    //! buffer is free: storing the request and its completion
+    std::vector<request_ptr> reqs_;
+    std::vector<unsigned> pending_;
+    //! number of writes in flight
+    size_t writing_ = 0;
+    //! number of open producers
+    size_t producers_ = 0;
+    //! first write error
+    std::string error_;
+
+    //! blocks written so far
+    std::vector<output_block> blocks_;
+    //! number of records written so far
+    uint64_t size_ = 0;
+
+    //! protects all of the above but the buffers
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    //! a step of writing buffer i is done or failed
+    void release(size_t i, const std::string& error,
+                 const request_ptr& req = request_ptr())
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!error.empty() && error_.empty())
+            error_ = error;
+        if (req)
+            reqs_[i] = req;
+        if (--pending_[i] == 0) {
+            free_.push_back(i);
+            --writing_;
+            cv_.notify_all();
+        }
+    }
+
+    //! Opens a producer and returns a free block for it to fill.
+    block_type * attach()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (producers_ >= nbuffers_) {
+            FOXXLL_THROW(
+                std::runtime_error,
+                "concurrent_ostream: more than " << nbuffers_ <<
+                    " producers for " << nbuffers_ << " buffers"
+            );
+        }
+        ++producers_;
+        return get_free_block(lock);
+    }
+
+    //! Closes a producer, which returns a block it wrote nothing into.
+    void detach(block_type* block)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        free_.push_back(block - buffers_);
+        --producers_;
+        cv_.notify_all();
+    }
+
+    //! Returns a free block to fill, waiting for a write to complete.
+    block_type * get_free_block(std::unique_lock<std::mutex>& lock)
+    {
+        cv_.wait(lock, [this]() { return !free_.empty() || !error_.empty(); });
+        if (!error_.empty())
+            FOXXLL_THROW(io_error, error_);
+
+        size_t i = free_.back();
+        free_.pop_back();
+        return buffers_ + i;
+    }
+
+    //! Writes a block with count records, returns a free block to fill.
+    block_type * write(block_type* block, size_t count)
+    {
+        const size_t i = block - buffers_;
+        bid_type bid;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            block_manager::get_instance()->new_block(alloc_, bid, blocks_.size());
+            blocks_.emplace_back(bid, count);
+            size_ += count;
+            pending_[i] = 2;
+            ++writing_;
+        }
+
+        request_ptr req;
+        try {
+            req = block->write(
+                bid, [this, i](request* r, bool success) {
+                    release(i, success ? std::string() :
+                            "concurrent_ostream: write failed at " +
+                            std::to_string(r->offset()));
+                });
+        }
+        catch (const std::exception& e) {
+            {
+                // there is no completion to wait for
+                std::unique_lock<std::mutex> lock(mutex_);
+                pending_[i] = 1;
+            }
+            release(i, e.what());
+            throw;
+        }
+        release(i, std::string(), req);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        return get_free_block(lock);
+    }
+
+public:
+    //! Appends records to the stream, for use by one thread.
+    class producer
+    {
+        concurrent_ostream* stream_;
+        block_type* block_;
+        size_t elem_ = 0;
+
+    public:
+        //! Opens a producer, throws std::runtime_error if the stream has as
+        //! many producers as buffers.
+        explicit producer(concurrent_ostream& stream)
+            : stream_(&stream), block_(stream.attach()) { }
+
+        //! non-copyable: delete copy-constructor
+        producer(const producer&) = delete;
+        //! non-copyable: delete assignment operator
+        producer& operator = (const producer&) = delete;
+
+        //! Appends a record.
+        producer& operator << (const value_type& record)
+        {
+            assert(block_);
+            block_->elem[elem_++] = record;
+            if (TLX_UNLIKELY(elem_ >= block_type::size))
+            {
+                elem_ = 0;
+                block_ = stream_->write(block_, block_type::size);
+            }
+            return *this;
+        }
+
+        //! Appends n records from an array.
+        producer & write(const value_type* src, size_t n)
+        {
+            assert(block_);
+            while (n != 0)
+            {
+                const size_t count = std::min(n, block_type::size - elem_);
+                std::copy(src, src + count, block_->elem + elem_);
+                src += count;
+                elem_ += count;
+                n -= count;
+
+                if (elem_ >= block_type::size)
+                {
+                    elem_ = 0;
+                    block_ = stream_->write(block_, block_type::size);
+                }
+            }
+            return *this;
+        }
+
+        //! Writes the partially filled block, after which the producer
+        //! cannot append anymore.
+        void close()
+        {
+            if (!block_)
+                return;
+            if (elem_ != 0)
+                block_ = stream_->write(block_, elem_);
+            stream_->detach(block_);
+            block_ = nullptr;
+        }
+
+        //! Closes the producer.
+        ~producer()
+        {
+            close();
+        }
+    };
+
+    //! Constructs an output stream.
+    //! \param nbuffers number of write buffers shared by all producers, at
+    //!        least one per producer, two are recommended
+    //! \param alloc strategy to allocate the BIDs
+    explicit concurrent_ostream(
+        size_t nbuffers, const alloc_strategy_type& alloc = alloc_strategy_type())
+        : nbuffers_(std::max(nbuffers, size_t(1))),
+          memory_(nbuffers_ * sizeof(block_type)),
+          buffers_(new block_type[nbuffers_]),
+          alloc_(alloc),
+          reqs_(nbuffers_),
+          pending_(nbuffers_, 0)
+    {
+        for (size_t i = 0; i < nbuffers_; ++i)
+            free_.push_back(i);
+    }
+
+    //! non-copyable: delete copy-constructor
+    concurrent_ostream(const concurrent_ostream&) = delete;
+    //! non-copyable: delete assignment operator
+    concurrent_ostream& operator = (const concurrent_ostream&) = delete;
+
+    //! Waits until all blocks are written. All producers must be closed.
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        assert(producers_ == 0);
+        cv_.wait(lock, [this]() { return writing_ == 0; });
+        if (!error_.empty())
+            FOXXLL_THROW(io_error, error_);
+    }
+
+    //! Returns the blocks written, in the order in which producers completed
+    //! them. Call after all producers are closed.
+    const std::vector<output_block> & blocks() const
+    {
+        return blocks_;
+    }
+
+    //! Returns the number of records written.
+    uint64_t size() const
+    {
+        return size_;
+    }
+
+    //! Waits for the writes and frees used memory.
+    ~concurrent_ostream()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return writing_ == 0; });
+        }
+        delete[] buffers_;
+    }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_CONCURRENT_OSTREAM_HEADER
+
+/**************************************************************************/
@@ -27,6 +27,7 @@
 #include <tlx/string/expand_environment_variables.hpp>
 #include <tlx/string/parse_si_iec_units.hpp>
 #include <tlx/string/split.hpp>
+#include <tlx/string/starts_with.hpp>
 
 #if FOXXLL_WINDOWS
    #ifndef NOMINMAX
@@ -156,6 +157,38 @@ void config::load_config_file(const std::string& config_path)
         // skip comments
         if (line.size() == 0 || line[0] == '#') continue;
 
+        if (tlx::starts_with(line, "state=")) {
+            state_file_ = tlx::expand_environment_variables(line.substr(6));
+            continue;
+        }
+
+        if (tlx::starts_with(line, "memory=")) {
+            uint64_t bytes;
+            if (!tlx::parse_si_iec_units(line.substr(7), &bytes, 'M')) {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Invalid memory limit '" << line.substr(7) <<
+                        "' in '" << config_path << "'."
+                );
+            }
+            memory_limit_ = static_cast<size_t>(bytes);
+            continue;
+        }
+
+        if (tlx::starts_with(line, "pressure=")) {
+            char* endp;
+            const std::string value = line.substr(9);
+            pressure_interval_ = strtoul(value.c_str(), &endp, 10);
+            if (value.empty() || *endp != 0) {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Invalid memory pressure interval '" << value <<
+                        "' in '" << config_path << "'."
+                );
+            }
+            continue;
+        }
+
         disk_config entry;
         entry.parse_line(line); // throws on errors
 
@@ -186,6 +219,24 @@ config& config::add_disk(const disk_config& cfg)
     return *this;
 }
 
+config& config::set_state_file(const std::string& path)
+{
+    state_file_ = path;
+    return *this;
+}
+
+config& config::set_memory_limit(size_t bytes)
+{
+    memory_limit_ = bytes;
+    return *this;
+}
+
+config& config::set_pressure_interval(size_t milliseconds)
+{
+    pressure_interval_ = milliseconds;
+    return *this;
+}
+
 unsigned int config::max_device_id()
 {
     return max_device_id_;
@@ -285,11 +336,22 @@ external_size_type config::total_size() const
     return total_size;
 }
 
+double config::disk_weight(size_t disk) const
+{
+    assert(is_initialized);
+    assert(disk < disks_list.size());
+    if (disks_list[disk].weight > 0.0)
+        return disks_list[disk].weight;
+    return static_cast<double>(disks_list[disk].size);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 disk_config::disk_config()
     : size(0),
       autogrow(true),
+      bitmap_block_size(0),
+      contiguous(false),
       delete_on_exit(false),
       direct(DIRECT_TRY),
       flash(false),
@@ -297,7 +359,8 @@ disk_config::disk_config()
       device_id(file::DEFAULT_DEVICE_ID),
       raw_device(false),
       unlink_on_open(false),
-      queue_length(0)
+      queue_length(0),
+      weight(0.0)
 { }
 
 disk_config::disk_config(const std::string& _path, external_size_type _size,
@@ -306,6 +369,8 @@ disk_config::disk_config(const std::string& _path, external_size_type _size,
       size(_size),
       io_impl(_io_impl),
       autogrow(true),
+      bitmap_block_size(0),
+      contiguous(false),
       delete_on_exit(false),
       direct(DIRECT_TRY),
       flash(false),
@@ -313,7 +378,8 @@ disk_config::disk_config(const std::string& _path, external_size_type _size,
       device_id(file::DEFAULT_DEVICE_ID),
       raw_device(false),
       unlink_on_open(false),
-      queue_length(0)
+      queue_length(0),
+      weight(0.0)
 {
     parse_fileio();
 }
@@ -321,6 +387,8 @@ disk_config::disk_config(const std::string& _path, external_size_type _size,
 disk_config::disk_config(const std::string& line)
     : size(0),
       autogrow(true),
+      bitmap_block_size(0),
+      contiguous(false),
       delete_on_exit(false),
       direct(DIRECT_TRY),
       flash(false),
@@ -328,7 +396,8 @@ disk_config::disk_config(const std::string& line)
       device_id(file::DEFAULT_DEVICE_ID),
       raw_device(false),
       unlink_on_open(false),
-      queue_length(0)
+      queue_length(0),
+      weight(0.0)
 {
     parse_line(line);
 }
@@ -354,12 +423,15 @@ void disk_config::parse_line(const std::string& line)
     // *** Set Default Extra Options ***
 
     autogrow = true; // was default for a long time, have to keep it this way
+    bitmap_block_size = 0;
+    contiguous = false;
     delete_on_exit = false;
     direct = DIRECT_TRY;
     // flash is already set
     queue = file::DEFAULT_QUEUE;
     device_id = file::DEFAULT_DEVICE_ID;
     unlink_on_open = false;
+    weight = 0.0;
 
     // *** Save Basic Options ***
 
@@ -447,6 +519,21 @@ void disk_config::parse_fileio()
                 );
             }
         }
+        else if (eq[0] == "bitmap")
+        {
+            if (!tlx::parse_si_iec_units(eq[1], &bitmap_block_size) ||
+                bitmap_block_size == 0)
+            {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Invalid parameter '" << *p << "' in disk configuration file."
+                );
+            }
+        }
+        else if (*p == "contiguous")
+        {
+            contiguous = true;
+        }
         else if (*p == "delete" || *p == "delete_on_exit")
         {
             delete_on_exit = true;
@@ -534,6 +621,17 @@ void disk_config::parse_fileio()
 
             unlink_on_open = true;
         }
+        else if (eq[0] == "weight")
+        {
+            char* endp;
+            weight = strtod(eq[1].c_str(), &endp);
+            if ((endp && *endp != 0) || !(weight > 0.0)) {
+                FOXXLL_THROW(
+                    std::runtime_error,
+                    "Invalid parameter '" << *p << "' in disk configuration file."
+                );
+            }
+        }
         else
         {
             FOXXLL_THROW(
@@ -553,6 +651,12 @@ std::string disk_config::fileio_string() const
     if (!autogrow)
         oss << " autogrow=no";
 
+    if (bitmap_block_size != 0)
+        oss << " bitmap=" << bitmap_block_size;
+
+    if (contiguous)
+        oss << " contiguous";
+
     if (delete_on_exit)
         oss << " delete_on_exit";
 
@@ -594,6 +698,10 @@ std::string disk_config::fileio_string() const
         oss << " queue_length=" << queue_length;
     }
 
+    if (weight != 0.0) {
+        oss << " weight=" << weight;
+    }
+
     return oss.str();
 }
 
@@ -77,6 +77,14 @@ public:
     //! autogrow file if more disk space is needed, automatically set if size == 0.
     bool autogrow;
 
+    //! allocate blocks of only this size (or multiples) from a hierarchical
+    //! bitmap instead of the general free space map. 0 -> free space map.
+    external_size_type bitmap_block_size;
+
+    //! grow an autogrow file instead of splitting a batch of blocks which
+    //! does not fit any free region, such that it stays contiguous.
+    bool contiguous;
+
     //! delete file on program exit (default for autoconfigurated files)
     bool delete_on_exit;
 
@@ -105,6 +113,11 @@ public:
     //! desired queue length for linuxaio_file and linuxaio_queue
     int queue_length;
 
+    //! relative share of blocks allocated on the disk by weighted_striping,
+    //! e.g. its bandwidth in MiB/s as reported by benchmark_disks. 0 -> use
+    //! the disk size as weight.
+    double weight;
+
     //! \}
 };
 
@@ -127,6 +140,15 @@ class config : public singleton<config>
     //! Finished initializing config
     bool is_initialized;
 
+    //! file storing the block manager state across restarts, empty if none
+    std::string state_file_;
+
+    //! cap of the memory_budget in bytes, zero if unlimited
+    size_t memory_limit_ = 0;
+
+    //! milliseconds between memory_pressure polls, zero disables polling
+    size_t pressure_interval_ = 500;
+
 protected:
     //! Constructor: this must be inlined to print the header version string.
     config();
@@ -165,6 +187,41 @@ public:
     //! has no effect after construction of block_manager.
     config & add_disk(const disk_config& cfg);
 
+    //! Set file in which block_manager saves its table of named roots and the
+    //! space of all disks they use on exit, and from which it restores them on
+    //! construction. Disk files are then kept on exit. Also set by a
+    //! "state=<path>" line in the configuration file.
+    //!
+    //! \warning This function should only be used during initialization, as it
+    //! has no effect after construction of block_manager.
+    config & set_state_file(const std::string& path);
+
+    //! Returns path of the block manager state file, empty if none is set.
+    const std::string & state_file() const { return state_file_; }
+
+    //! Set the cap of internal memory for block buffers used by the
+    //! memory_budget, zero if unlimited. Also set by a "memory=<size>" line in
+    //! the configuration file.
+    //!
+    //! \warning This function should only be used during initialization, as it
+    //! has no effect after construction of memory_budget.
+    config & set_memory_limit(size_t bytes);
+
+    //! Returns the cap of internal memory for block buffers, zero if none.
+    size_t memory_limit() const { return memory_limit_; }
+
+    //! Set the milliseconds between polls of the memory_pressure monitor,
+    //! which starts with the first pool, zero disables it. Also set by a
+    //! "pressure=<milliseconds>" line in the configuration file.
+    //!
+    //! \warning This function should only be used during initialization, as it
+    //! has no effect after the monitor started.
+    config & set_pressure_interval(size_t milliseconds);
+
+    //! Returns the milliseconds between memory pressure polls, zero if the
+    //! monitor is disabled.
+    size_t pressure_interval() const { return pressure_interval_; }
+
     //! \}
 
 protected:
@@ -243,6 +300,11 @@ public:
     //! Returns the total size over all disks
     external_size_type total_size() const;
 
+    //! Returns weight of disk for weighted_striping: the configured weight, or
+    //! the disk size if none is set.
+    //! \param disk disk's identifier
+    double disk_weight(size_t disk) const;
+
     //! \}
 };
 
@@ -11,20 +11,125 @@
  *  http://www.boost.org/LICENSE_1_0.txt)
  **************************************************************************/
 
+#include <algorithm>
 #include <cassert>
+#include <istream>
 #include <map>
 #include <ostream>
 #include <utility>
+#include <vector>
 
+#include <foxxll/common/aligned_alloc.hpp>
 #include <foxxll/common/error_handling.hpp>
 #include <foxxll/common/exceptions.hpp>
 #include <foxxll/common/types.hpp>
+#include <foxxll/io/request_operations.hpp>
 #include <foxxll/mng/disk_block_allocator.hpp>
 
 namespace foxxll {
 
+disk_block_allocator::disk_block_allocator(
+    file* storage, const disk_config& cfg, std::istream& state)
+    : cfg_bytes_(cfg.size),
+      storage_(storage),
+      autogrow_(cfg.autogrow),
+      contiguous_(cfg.contiguous),
+      bitmap_block_size_(cfg.bitmap_block_size),
+      persistent_(true)
+{
+    uint64_t disk_bytes, num_regions;
+    if (!(state >> disk_bytes >> num_regions)) {
+        FOXXLL_THROW(
+            std::runtime_error,
+            "Invalid allocator state of disk file " << cfg.path
+        );
+    }
+
+    if (storage_->size() < disk_bytes) {
+        FOXXLL_THROW(
+            std::runtime_error,
+            "Disk file " << cfg.path << " has " << storage_->size() <<
+                " bytes, but the saved state expects " << disk_bytes
+        );
+    }
+
+    if (bitmap_block_size_ != 0 && disk_bytes != 0)
+    {
+        // start with all blocks allocated
+        bitmap_.grow(bitmap_blocks(disk_bytes));
+        bitmap_.reserve(0, bitmap_.size());
+    }
+
+    storage_->set_size(disk_bytes);
+    disk_bytes_ = disk_bytes;
+
+    for (uint64_t i = 0; i < num_regions; ++i)
+    {
+        uint64_t offset, size;
+        if (!(state >> offset >> size) || offset + size > disk_bytes) {
+            FOXXLL_THROW(
+                std::runtime_error,
+                "Invalid free region in allocator state of disk file " << cfg.path
+            );
+        }
+        add_free_region(offset, size);
+    }
+}
+
+void disk_block_allocator::save_state(std::ostream& os)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    const std::vector<place> regions = free_regions();
+
+    os << disk_bytes_ << ' ' << regions.size() << '\n';
+    for (const place& region : regions)
+        os << region.first << ' ' << region.second << '\n';
+}
+
+void disk_block_allocator::save_state(
+    std::ostream& os, std::vector<place> allocated)
+{
+    std::sort(allocated.begin(), allocated.end());
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // free regions are the gaps between the allocated ones
+    std::vector<place> regions;
+    uint64_t pos = 0;
+    for (const place& region : allocated)
+    {
+        if (region.first > pos)
+            regions.emplace_back(pos, region.first - pos);
+        pos = std::max(pos, region.first + region.second);
+    }
+    if (pos < disk_bytes_)
+        regions.emplace_back(pos, disk_bytes_ - pos);
+
+    os << disk_bytes_ << ' ' << regions.size() << '\n';
+    for (const place& region : regions)
+        os << region.first << ' ' << region.second << '\n';
+}
+
 void disk_block_allocator::dump() const
 {
+    if (bitmap_block_size_ != 0)
+    {
+        TLX_LOG1 << "Free bitmap regions dump:";
+        uint64_t total = 0;
+        uint64_t block = bitmap_.find_free(0);
+        while (block != bitmap_block_allocator::npos)
+        {
+            const uint64_t run = bitmap_.free_run_length(block);
+            TLX_LOG1 << "Free chunk: begin: " << block * bitmap_block_size_
+                     << " size: " << run * bitmap_block_size_;
+            total += run * bitmap_block_size_;
+            block = bitmap_.find_free(block + run);
+        }
+        TLX_LOG1 << "Total bytes: " << total;
+        return;
+    }
+
     uint64_t total = 0;
     space_map_type::const_iterator cur = free_space_.begin();
     TLX_LOG1 << "Free regions dump:";
@@ -62,9 +167,36 @@ void disk_block_allocator::deallocation_error(
     dump();
 }
 
+uint64_t disk_block_allocator::bitmap_blocks(uint64_t size) const
+{
+    if (size == 0 || size % bitmap_block_size_ != 0) {
+        FOXXLL_THROW2(
+            bad_ext_alloc, "disk_block_allocator::bitmap_blocks",
+            "Error: block size " << size << " is not a multiple of the "
+            "bitmap block size " << bitmap_block_size_ << " of the disk"
+        );
+    }
+    return size / bitmap_block_size_;
+}
+
 void disk_block_allocator::add_free_region(uint64_t block_pos, uint64_t block_size)
 {
     TLX_LOG << "Deallocating a block with size: " << block_size << " position: " << block_pos;
+
+    if (bitmap_block_size_ != 0)
+    {
+        if (block_pos % bitmap_block_size_ != 0) {
+            FOXXLL_THROW2(
+                bad_ext_alloc, "disk_block_allocator::add_free_region",
+                "Error: deallocation of unaligned region " << block_pos <<
+                    " + " << block_size
+            );
+        }
+
+        bitmap_.free(block_pos / bitmap_block_size_, bitmap_blocks(block_size));
+        free_bytes_ += block_size;
+        return;
+    }
     uint64_t region_pos = block_pos;
     uint64_t region_size = block_size;
 
@@ -152,6 +284,250 @@ void disk_block_allocator::add_free_region(uint64_t block_pos, uint64_t block_si
     free_bytes_ += block_size;
 }
 
+std::vector<disk_block_allocator::place>
+disk_block_allocator::free_regions() const
+{
+    if (bitmap_block_size_ == 0)
+        return std::vector<place>(free_space_.begin(), free_space_.end());
+
+    std::vector<place> regions;
+    uint64_t block = bitmap_.find_free(0);
+    while (block != bitmap_block_allocator::npos)
+    {
+        const uint64_t run = bitmap_.free_run_length(block);
+        regions.emplace_back(block * bitmap_block_size_, run * bitmap_block_size_);
+        block = bitmap_.find_free(block + run);
+    }
+    return regions;
+}
+
+double disk_block_allocator::fragmentation()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (free_bytes_ == 0)
+        return 0.0;
+
+    uint64_t largest = 0;
+    for (const place& region : free_regions())
+        largest = std::max(largest, region.second);
+
+    return 1.0 - static_cast<double>(largest) / static_cast<double>(free_bytes_);
+}
+
+uint64_t disk_block_allocator::shrink_file()
+{
+    const std::vector<place> regions = free_regions();
+    if (regions.empty())
+        return 0;
+
+    // keep the configured size, the bitmap only covers whole blocks
+    const place& last = regions.back();
+    uint64_t new_size = cfg_bytes_;
+    if (bitmap_block_size_ != 0)
+        new_size = new_size / bitmap_block_size_ * bitmap_block_size_;
+    new_size = std::max(new_size, last.first);
+
+    if (last.first + last.second != disk_bytes_ || new_size >= disk_bytes_)
+        return 0;
+
+    const uint64_t cut = disk_bytes_ - new_size;
+
+    if (bitmap_block_size_ != 0)
+    {
+        bitmap_.shrink(cut / bitmap_block_size_);
+    }
+    else
+    {
+        free_space_.erase(last.first);
+        if (new_size > last.first)
+            free_space_[last.first] = new_size - last.first;
+    }
+
+    storage_->set_size(new_size);
+    free_bytes_ -= cut;
+    disk_bytes_ = new_size;
+
+    TLX_LOG << "disk_block_allocator::shrink_file() cut " << cut
+            << " bytes, total: " << disk_bytes_;
+
+    return cut;
+}
+
+uint64_t disk_block_allocator::compact(
+    const relocate_callback& relocate, uint64_t granularity)
+{
+    if (!autogrow_)
+        return 0;
+
+    if (bitmap_block_size_ != 0 && granularity != 0)
+        bitmap_blocks(granularity); // throws on invalid granularity
+
+    struct relocation {
+        uint64_t from, to, size;
+    };
+    std::vector<relocation> moves;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // plan relocations of live regions, starting at the end of the file. The
+    // target holes are allocated right away to keep them from new_blocks().
+    {
+        const std::vector<place> regions = free_regions();
+        std::vector<place> holes = regions;
+
+        uint64_t live_end = disk_bytes_;
+        bool done = false;
+
+        for (size_t r = regions.size(); !done; --r)
+        {
+            // live region [live_begin, live_end) before free region r
+            const uint64_t live_begin =
+                (r == 0) ? 0 : regions[r - 1].first + regions[r - 1].second;
+
+            const bool split =
+                granularity != 0 && live_begin % granularity == 0 &&
+                (live_end - live_begin) % granularity == 0;
+
+            uint64_t piece_end = live_end;
+            while (piece_end > live_begin)
+            {
+                if (piece_end <= cfg_bytes_) {
+                    done = true;
+                    break;
+                }
+
+                const uint64_t size = split ? granularity : piece_end - live_begin;
+                const uint64_t pos = piece_end - size;
+
+                std::vector<place>::iterator hole = std::find_if(
+                    holes.begin(), holes.end(),
+                    [size](const place& p) { return p.second >= size; }
+                );
+
+                if (hole == holes.end() || hole->first + size > pos) {
+                    done = true;
+                    break;
+                }
+
+                moves.push_back(relocation { pos, hole->first, size });
+                hole->first += size;
+                hole->second -= size;
+                piece_end = pos;
+            }
+
+            if (r == 0)
+                break;
+            live_end = regions[r - 1].first;
+        }
+
+        for (const relocation& m : moves)
+        {
+            if (bitmap_block_size_ != 0) {
+                bitmap_.reserve(m.to / bitmap_block_size_,
+                                m.size / bitmap_block_size_);
+            }
+            else {
+                // holes are reserved from their front
+                space_map_type::iterator hole = free_space_.find(m.to);
+                assert(hole != free_space_.end() && hole->second >= m.size);
+                const uint64_t rest = hole->second - m.size;
+                free_space_.erase(hole);
+                if (rest != 0)
+                    free_space_[m.to + m.size] = rest;
+            }
+            free_bytes_ -= m.size;
+        }
+    }
+
+    TLX_LOG << "disk_block_allocator::compact() relocating " << moves.size()
+            << " regions, free:" << free_bytes_ << " total:" << disk_bytes_;
+
+    lock.unlock();
+
+    // copy regions in chunks through one buffer, reads and writes of a
+    // chunk batch are issued asynchronously.
+    if (!moves.empty())
+    {
+        char* buffer = static_cast<char*>(
+            aligned_alloc<BlockAlignment>(compact_buffer_bytes));
+        std::vector<request_ptr> reqs;
+
+        try
+        {
+            size_t m = 0;
+            uint64_t done_bytes = 0;
+
+            while (m < moves.size())
+            {
+                // collect chunks (move, offset within region, length)
+                std::vector<relocation> chunks;
+                uint64_t fill = 0;
+                while (m < moves.size() && fill < compact_buffer_bytes)
+                {
+                    const uint64_t len = std::min(
+                        moves[m].size - done_bytes, compact_buffer_bytes - fill);
+                    chunks.push_back(relocation {
+                                         moves[m].from + done_bytes,
+                                         moves[m].to + done_bytes, len
+                                     });
+                    fill += len;
+                    done_bytes += len;
+                    if (done_bytes == moves[m].size) {
+                        ++m;
+                        done_bytes = 0;
+                    }
+                }
+
+                reqs.clear();
+                fill = 0;
+                for (const relocation& c : chunks) {
+                    reqs.push_back(storage_->aread(buffer + fill, c.from, c.size));
+                    fill += c.size;
+                }
+                wait_all(reqs.begin(), reqs.end());
+
+                reqs.clear();
+                fill = 0;
+                for (const relocation& c : chunks) {
+                    reqs.push_back(storage_->awrite(buffer + fill, c.to, c.size));
+                    fill += c.size;
+                }
+                wait_all(reqs.begin(), reqs.end());
+            }
+        }
+        catch (...)
+        {
+            // wait for outstanding requests before releasing the buffer
+            for (request_ptr& req : reqs) {
+                try {
+                    req->wait();
+                }
+                catch (...) { }
+            }
+            aligned_dealloc<BlockAlignment>(buffer);
+
+            // release the reserved holes, the blocks stay in place
+            lock.lock();
+            for (const relocation& m : moves)
+                add_free_region(m.to, m.size);
+            throw;
+        }
+
+        aligned_dealloc<BlockAlignment>(buffer);
+    }
+
+    for (const relocation& m : moves)
+        relocate(storage_, m.from, m.to, m.size);
+
+    lock.lock();
+
+    for (const relocation& m : moves)
+        add_free_region(m.from, m.size);
+
+    return shrink_file();
+}
+
 } // namespace foxxll
 
 /**************************************************************************/
@@ -17,19 +17,25 @@
 #define FOXXLL_MNG_DISK_BLOCK_ALLOCATOR_HEADER
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <functional>
+#include <istream>
 #include <map>
 #include <mutex>
 #include <ostream>
 #include <utility>
+#include <vector>
 
 #include <tlx/logger/core.hpp>
 
 #include <foxxll/common/error_handling.hpp>
 #include <foxxll/common/exceptions.hpp>
 #include <foxxll/common/types.hpp>
+#include <foxxll/common/utils.hpp>
 #include <foxxll/io/file.hpp>
 #include <foxxll/mng/bid.hpp>
+#include <foxxll/mng/bitmap_block_allocator.hpp>
 #include <foxxll/mng/config.hpp>
 
 namespace foxxll {
@@ -41,21 +47,60 @@ namespace foxxll {
  * This class manages allocation of blocks onto a single disk. It contains a map
  * of all currently allocated blocks. The block_manager selects which of the
  * disk_block_allocator objects blocks are drawn from.
+ *
+ * Each call to new_blocks() places its blocks back to back if a free region
+ * of the total size exists. On autogrow disks configured as contiguous
+ * (disk_config::contiguous) the file is grown to make room for the whole batch
+ * instead of splitting it into scattered pieces.
+ *
+ * Disks configured with a bitmap block size (disk_config::bitmap_block_size)
+ * instead keep one bit per block in a bitmap_block_allocator. They only serve
+ * blocks whose size is a multiple of the bitmap block size.
+ *
+ * Autogrow files can be compacted with compact(): live regions at the end of
+ * the file are copied into free holes, their owners are notified through a
+ * callback, and the file is truncated.
+ *
+ * The free space can be saved with save_state() and restored by the
+ * constructor taking a state stream, which reopens a persistent disk file with
+ * its allocations intact.
  */
 class disk_block_allocator
 {
     constexpr static bool debug = false;
 
 public:
+    //! Called by compact() for each relocated region of live blocks with the
+    //! file, the old and the new offset, and the size of the region. All blocks
+    //! inside the region moved by the same distance.
+    using relocate_callback = std::function<
+              void(file* storage, uint64_t old_offset, uint64_t new_offset,
+                   uint64_t size)>;
+
+    //! maximum number of bytes copied at once by compact()
+    static constexpr uint64_t compact_buffer_bytes = 16 * 1024 * 1024;
+
     disk_block_allocator(file* storage, const disk_config& cfg)
         : cfg_bytes_(cfg.size),
           storage_(storage),
-          autogrow_(cfg.autogrow)
+          autogrow_(cfg.autogrow),
+          contiguous_(cfg.contiguous),
+          bitmap_block_size_(cfg.bitmap_block_size)
     {
-        // initial growth to configured file size
-        grow_file(cfg.size);
+        // initial growth to configured file size, the bitmap only covers
+        // whole blocks.
+        if (bitmap_block_size_ != 0)
+            grow_file(cfg.size / bitmap_block_size_ * bitmap_block_size_);
+        else
+            grow_file(cfg.size);
     }
 
+    //! Restore allocator from a state written by save_state() for the same
+    //! disk file, throws std::runtime_error if the state is invalid or the file
+    //! is shorter than saved. The file size is kept on destruction.
+    disk_block_allocator(file* storage, const disk_config& cfg,
+                         std::istream& state);
+
     //! non-copyable: delete copy-constructor
     disk_block_allocator(const disk_block_allocator&) = delete;
     //! non-copyable: delete assignment operator
@@ -63,7 +108,7 @@ public:
 
     ~disk_block_allocator()
     {
-        if (disk_bytes_ > cfg_bytes_) { // reduce to original size
+        if (!persistent_ && disk_bytes_ > cfg_bytes_) { // reduce to original size
             storage_->set_size(cfg_bytes_);
         }
     }
@@ -71,6 +116,13 @@ public:
     //! Returns autogrow
     bool autogrow() const { return autogrow_; }
 
+    //! Returns whether batches are kept contiguous by growing the file
+    bool contiguous() const { return contiguous_; }
+
+    //! Returns block size of the bitmap allocator, or 0 if the free space map
+    //! is used.
+    uint64_t bitmap_block_size() const { return bitmap_block_size_; }
+
     bool has_available_space(uint64_t bytes) const
     {
         return autogrow_ || free_bytes_ >= bytes;
@@ -91,6 +143,39 @@ public:
         return disk_bytes_;
     }
 
+    //! Write size and free regions of the disk to a state stream.
+    void save_state(std::ostream& os);
+
+    //! Write size and free regions of the disk to a state stream, as if only
+    //! the given (offset, size) regions were allocated.
+    void save_state(std::ostream& os,
+                    std::vector<std::pair<uint64_t, uint64_t> > allocated);
+
+    //! Keep the file size on destruction, for disks whose state is saved.
+    void set_persistent(bool persistent) { persistent_ = persistent; }
+
+    //! Returns fragmentation of the free space: one minus the size of the
+    //! largest free region divided by the free bytes. 0 if there is no free
+    //! space.
+    double fragmentation();
+
+    /*!
+     * Compacts an autogrow file. Live regions beyond the configured size are
+     * relocated from the end of the file into the first free holes before
+     * them, until a region does not fit any hole. Regions are copied with
+     * asynchronous I/O, then reported to \b relocate, then their old space is
+     * released and the free end of the file is truncated.
+     *
+     * Live regions are moved whole, unless \b granularity is given: then
+     * regions consisting of whole granules are split into single granules. Use
+     * the block size if all blocks on the disk have that size. The relocated
+     * blocks must not be accessed concurrently.
+     *
+     * \return number of bytes the file shrank
+     */
+    uint64_t compact(const relocate_callback& relocate,
+                     uint64_t granularity = 0);
+
     template <size_t BlockSize>
     void new_blocks(BIDArray<BlockSize>& bids)
     {
@@ -107,6 +192,18 @@ public:
             delete_block(bids[i]);
     }
 
+    //! Deallocates a batch of blocks of equal size given by their offsets,
+    //! taking the lock only once.
+    template <typename OffsetIterator>
+    void delete_blocks(OffsetIterator begin, OffsetIterator end,
+                       uint64_t block_size)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        for ( ; begin != end; ++begin)
+            add_free_region(*begin, block_size);
+    }
+
     template <size_t BlockSize>
     void delete_block(const BID<BlockSize>& bid)
     {
@@ -127,11 +224,22 @@ private:
     std::mutex mutex_;
     //! map of free space as places
     space_map_type free_space_;
-    uint64_t free_bytes_ = 0;
-    uint64_t disk_bytes_ = 0;
+    //! modified only while holding mutex_, but may be read without it
+    std::atomic<uint64_t> free_bytes_ { 0 };
+    std::atomic<uint64_t> disk_bytes_ { 0 };
     uint64_t cfg_bytes_;
     file* storage_;
     bool autogrow_;
+    //! grow file instead of splitting batches which do not fit a free region
+    bool contiguous_;
+
+    //! block size of bitmap_, 0 if free_space_ is used
+    uint64_t bitmap_block_size_;
+    //! bitmap of free blocks, used instead of free_space_
+    bitmap_block_allocator bitmap_;
+
+    //! do not truncate the file to its configured size on destruction
+    bool persistent_ = false;
 
     void dump() const;
 
@@ -149,15 +257,63 @@ private:
         if (extend_bytes == 0)
             return;
 
+        if (bitmap_block_size_ != 0)
+        {
+            const uint64_t blocks = div_ceil(extend_bytes, bitmap_block_size_);
+            extend_bytes = blocks * bitmap_block_size_;
+
+            storage_->set_size(disk_bytes_ + extend_bytes);
+            bitmap_.grow(blocks);
+            free_bytes_ += extend_bytes;
+            disk_bytes_ += extend_bytes;
+            return;
+        }
+
         storage_->set_size(disk_bytes_ + extend_bytes);
         add_free_region(disk_bytes_, extend_bytes);
         disk_bytes_ += extend_bytes;
     }
+
+    //! free regions in ascending order, from free_space_ or bitmap_
+    std::vector<place> free_regions() const;
+
+    // expects the mutex_ to be locked to prevent concurrent access
+    uint64_t shrink_file();
+
+    //! first free region of at least size bytes, or free_space_.end()
+    space_map_type::iterator first_fit(uint64_t size)
+    {
+        return std::find_if(
+            free_space_.begin(), free_space_.end(),
+            [size](const place& entry) {
+                return (entry.second >= size);
+            }
+        );
+    }
+
+    //! size of the free region at the end of the file, if any
+    uint64_t free_tail_bytes() const
+    {
+        if (free_space_.empty())
+            return 0;
+        const place& last = *free_space_.rbegin();
+        return (last.first + last.second == disk_bytes_) ? last.second : 0;
+    }
+
+    //! number of bitmap blocks of a BID, throws if it is not a multiple.
+    uint64_t bitmap_blocks(uint64_t size) const;
+
+    //! new_blocks() implementation for disks using bitmap_
+    template <typename BIDIterator>
+    void new_blocks_bitmap(BIDIterator begin, BIDIterator end);
 };
 
 template <typename BIDIterator>
 void disk_block_allocator::new_blocks(BIDIterator begin, BIDIterator end)
 {
+    if (bitmap_block_size_ != 0)
+        return new_blocks_bitmap(begin, end);
+
     uint64_t requested_size = 0;
 
     for (BIDIterator cur = begin; cur != end; ++cur)
@@ -195,13 +351,7 @@ void disk_block_allocator::new_blocks(BIDIterator begin, BIDIterator end)
 
     // dump();
 
-    space_map_type::iterator space =
-        std::find_if(
-            free_space_.begin(), free_space_.end(),
-            [requested_size](const place& entry) {
-                return (entry.second >= requested_size);
-            }
-        );
+    space_map_type::iterator space = first_fit(requested_size);
 
     if (space == free_space_.end() && begin + 1 == end)
     {
@@ -216,12 +366,15 @@ void disk_block_allocator::new_blocks(BIDIterator begin, BIDIterator end)
 
         grow_file(begin->size);
 
-        space = std::find_if(
-                free_space_.begin(), free_space_.end(),
-                [requested_size](const place& entry) {
-                    return (entry.second >= requested_size);
-                }
-            );
+        space = first_fit(requested_size);
+    }
+    else if (space == free_space_.end() && contiguous_ && autogrow_)
+    {
+        // extend the free tail of the file to hold the whole batch
+        grow_file(requested_size - free_tail_bytes());
+
+        space = first_fit(requested_size);
+        assert(space != free_space_.end());
     }
 
     if (space != free_space_.end())
@@ -259,6 +412,112 @@ void disk_block_allocator::new_blocks(BIDIterator begin, BIDIterator end)
     new_blocks(middle, end);
 }
 
+template <typename BIDIterator>
+void disk_block_allocator::new_blocks_bitmap(BIDIterator begin, BIDIterator end)
+{
+    uint64_t requested_size = 0;
+
+    for (BIDIterator cur = begin; cur != end; ++cur)
+    {
+        bitmap_blocks(cur->size); // throws on invalid sizes
+        requested_size += cur->size;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    TLX_LOG << "disk_block_allocator::new_blocks_bitmap"
+        ", BlockSize = " << begin->size <<
+        ", free:" << free_bytes_ << " total:" << disk_bytes_ <<
+        ", blocks: " << (end - begin) <<
+        ", requested_size=" << requested_size;
+
+    if (free_bytes_ < requested_size)
+    {
+        if (!autogrow_) {
+            FOXXLL_THROW(
+                bad_ext_alloc,
+                "Out of external memory error: " << requested_size <<
+                    " requested, " << free_bytes_ << " bytes free. "
+                    "Maybe enable autogrow_ flags?"
+            );
+        }
+
+        grow_file(requested_size - free_bytes_);
+    }
+
+    // try to place the whole batch contiguously
+    uint64_t pos = bitmap_.allocate_run(requested_size / bitmap_block_size_);
+    if (pos != bitmap_block_allocator::npos)
+    {
+        pos *= bitmap_block_size_;
+        for ( ; begin != end; ++begin)
+        {
+            begin->offset = pos;
+            pos += begin->size;
+        }
+
+        free_bytes_ -= requested_size;
+        return;
+    }
+
+    if (contiguous_ && autogrow_)
+    {
+        // append the whole batch to the file
+        grow_file(requested_size);
+        pos = bitmap_.allocate_run(requested_size / bitmap_block_size_);
+        assert(pos != bitmap_block_allocator::npos);
+
+        pos *= bitmap_block_size_;
+        for ( ; begin != end; ++begin)
+        {
+            begin->offset = pos;
+            pos += begin->size;
+        }
+
+        free_bytes_ -= requested_size;
+        return;
+    }
+
+    TLX_LOG << "Warning, when allocating an external memory space, no"
+        "contiguous region found. It might harm the performance";
+
+    // place each block on its own
+    for (BIDIterator cur = begin; cur != end; ++cur)
+    {
+        const uint64_t blocks = cur->size / bitmap_block_size_;
+        pos = bitmap_.allocate_run(blocks);
+
+        if (pos == bitmap_block_allocator::npos && autogrow_)
+        {
+            // the new blocks are appended to a possibly free tail
+            grow_file(cur->size);
+            pos = bitmap_.allocate_run(blocks);
+        }
+
+        if (pos == bitmap_block_allocator::npos)
+        {
+            // return blocks already placed by this call
+            for ( ; begin != cur; ++begin) {
+                bitmap_.free(begin->offset / bitmap_block_size_,
+                             begin->size / bitmap_block_size_);
+            }
+
+            TLX_LOG1 << "Warning: Severe external memory space fragmentation!";
+            dump();
+
+            FOXXLL_THROW(
+                bad_ext_alloc,
+                "Out of external memory error: no free run of " << cur->size <<
+                    " bytes, " << free_bytes_ << " bytes free."
+            );
+        }
+
+        cur->offset = pos * bitmap_block_size_;
+    }
+
+    free_bytes_ -= requested_size;
+}
+
 //! \}
 
 } // namespace foxxll
@@ -0,0 +1,150 @@
+/***************************************************************************
+ *  foxxll/mng/memory_budget.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+#include <tlx/logger/core.hpp>
+
+#include <foxxll/common/error_handling.hpp>
+#include <foxxll/mng/config.hpp>
+#include <foxxll/mng/memory_budget.hpp>
+
+namespace foxxll {
+
+memory_budget::memory_budget()
+{
+    config* cfg = config::get_instance();
+    cfg->check_initialized();
+    limit_ = cfg->memory_limit();
+}
+
+void memory_budget::take(size_t bytes)
+{
+    used_ += bytes;
+    peak_ = std::max(peak_, used_);
+}
+
+void memory_budget::reclaim(size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(reclaimers_mutex_);
+    for (reclaim_callback& cb : reclaimers_)
+    {
+        size_t released = cb(bytes);
+        if (released >= bytes)
+            return;
+        bytes -= released;
+    }
+}
+
+void memory_budget::set_limit(size_t limit)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    limit_ = limit;
+    cv_.notify_all();
+}
+
+size_t memory_budget::limit() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return limit_;
+}
+
+size_t memory_budget::used() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return used_;
+}
+
+size_t memory_budget::peak() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return peak_;
+}
+
+size_t memory_budget::available() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (limit_ == 0)
+        return std::numeric_limits<size_t>::max();
+    return limit_ > used_ ? limit_ - used_ : 0;
+}
+
+bool memory_budget::try_reserve(size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!fits(bytes))
+    {
+        size_t missing = used_ + bytes - limit_;
+        lock.unlock();
+        reclaim(missing);
+        lock.lock();
+
+        if (!fits(bytes))
+            return false;
+    }
+    take(bytes);
+    return true;
+}
+
+void memory_budget::reserve(size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!fits(bytes))
+    {
+        if (bytes > limit_) {
+            FOXXLL_THROW(
+                std::runtime_error,
+                "memory_budget: cannot reserve " << bytes <<
+                    " bytes with a limit of " << limit_ << " bytes"
+            );
+        }
+
+        size_t missing = used_ + bytes - limit_;
+        lock.unlock();
+        reclaim(missing);
+        lock.lock();
+
+        if (fits(bytes))
+            break;
+
+        // wait for a release, deferred reclaims arrive as releases as well
+        TLX_LOG0 << "memory_budget: waiting for " << missing << " bytes";
+        cv_.wait(lock);
+    }
+    take(bytes);
+}
+
+void memory_budget::release(size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    assert(used_ >= bytes);
+    used_ -= bytes;
+    cv_.notify_all();
+}
+
+memory_budget::reclaimer_id
+memory_budget::add_reclaimer(reclaim_callback callback)
+{
+    std::unique_lock<std::mutex> lock(reclaimers_mutex_);
+    return reclaimers_.insert(reclaimers_.end(), std::move(callback));
+}
+
+void memory_budget::remove_reclaimer(reclaimer_id id)
+{
+    std::unique_lock<std::mutex> lock(reclaimers_mutex_);
+    reclaimers_.erase(id);
+}
+
+} // namespace foxxll
+
+/**************************************************************************/
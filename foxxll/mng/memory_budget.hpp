@@ -0,0 +1,442 @@
+/***************************************************************************
+ *  foxxll/mng/memory_budget.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_MEMORY_BUDGET_HEADER
+#define FOXXLL_MNG_MEMORY_BUDGET_HEADER
+
+#include <cassert>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <foxxll/mng/memory_pressure.hpp>
+#include <foxxll/singleton.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_mnglayer
+//! \{
+
+/*!
+ * Process-wide budget of internal memory for block buffers.
+ *
+ * Pools, streams and the block_scheduler reserve the memory of their block
+ * buffers here before allocating them and release it after freeing them, so
+ * that the total stays below limit(). A limit of zero (the default) disables
+ * the cap, the budget then only keeps count.
+ *
+ * Components holding idle buffers can register a reclaim callback. When a
+ * reservation does not fit, the callbacks are asked in turn to give memory
+ * back, either right away by calling release(), or later, e.g. on the next
+ * operation of a pool that is not thread-safe. Callbacks are invoked from the
+ * reserving thread and must not call reserve(). Memory promised for later is
+ * only waited for by reserve(), so a component must give back memory right
+ * away when the reserving thread is the one that would free it later.
+ *
+ * \remarks is a singleton. The limit is taken from a "memory=<size>" line in
+ * the configuration file, or set by config::set_memory_limit() or
+ * set_limit(). It is never destroyed, so buffers freed during exit can still
+ * be released.
+ */
+class memory_budget : public singleton<memory_budget, false>
+{
+    friend class singleton<memory_budget, false>;
+
+public:
+    //! Asked to give back up to the given number of bytes. Returns the number
+    //! of bytes released or promised to be released soon.
+    using reclaim_callback = std::function<size_t(size_t bytes)>;
+
+    //! handle of a registered reclaim callback
+    using reclaimer_id = std::list<reclaim_callback>::iterator;
+
+private:
+    //! cap in bytes, zero if unlimited
+    size_t limit_;
+
+    //! currently reserved bytes
+    size_t used_ = 0;
+
+    //! maximum of used_ since construction
+    size_t peak_ = 0;
+
+    //! protects limit_, used_ and peak_
+    mutable std::mutex mutex_;
+
+    //! signaled on release() and set_limit()
+    std::condition_variable cv_;
+
+    //! registered reclaim callbacks
+    std::list<reclaim_callback> reclaimers_;
+
+    //! protects reclaimers_, held while callbacks run
+    std::mutex reclaimers_mutex_;
+
+    //! private construction from singleton
+    memory_budget();
+
+    //! check whether bytes fit, requires mutex_ held
+    bool fits(size_t bytes) const
+    {
+        return limit_ == 0 || used_ + bytes <= limit_;
+    }
+
+    //! account bytes, requires mutex_ held
+    void take(size_t bytes);
+
+    //! ask reclaim callbacks to give back bytes
+    void reclaim(size_t bytes);
+
+public:
+    //! Set the cap in bytes, zero disables it.
+    void set_limit(size_t limit);
+
+    //! Returns the cap in bytes, zero if unlimited.
+    size_t limit() const;
+
+    //! Returns the currently reserved bytes.
+    size_t used() const;
+
+    //! Returns the highest number of reserved bytes so far.
+    size_t peak() const;
+
+    //! Returns the bytes that can still be reserved without reclaiming.
+    size_t available() const;
+
+    //! Reserve bytes if they fit, possibly after reclaiming memory from idle
+    //! components. Never blocks.
+    //! \return true if the bytes were reserved
+    bool try_reserve(size_t bytes);
+
+    //! Reserve bytes, blocking until enough memory was released by other
+    //! components. Throws std::runtime_error if bytes exceeds the limit.
+    void reserve(size_t bytes);
+
+    //! Return previously reserved bytes.
+    void release(size_t bytes);
+
+    //! Register a reclaim callback.
+    reclaimer_id add_reclaimer(reclaim_callback callback);
+
+    //! Unregister a reclaim callback. Waits for running callbacks to finish.
+    void remove_reclaimer(reclaimer_id id);
+};
+
+/*!
+ * Bytes reserved from the memory_budget, released on destruction. Used by
+ * components that size their buffers once on construction.
+ */
+class memory_reservation
+{
+    size_t bytes_ = 0;
+
+public:
+    memory_reservation() = default;
+
+    //! Reserve bytes, blocking until they fit.
+    explicit memory_reservation(size_t bytes)
+    {
+        reserve(bytes);
+    }
+
+    //! non-copyable: delete copy-constructor
+    memory_reservation(const memory_reservation&) = delete;
+    //! non-copyable: delete assignment operator
+    memory_reservation& operator = (const memory_reservation&) = delete;
+
+    ~memory_reservation()
+    {
+        release();
+    }
+
+    //! Reserve additional bytes, blocking until they fit.
+    void reserve(size_t bytes)
+    {
+        memory_budget::get_instance()->reserve(bytes);
+        bytes_ += bytes;
+    }
+
+    //! Reserve additional bytes if they fit.
+    bool try_reserve(size_t bytes)
+    {
+        if (!memory_budget::get_instance()->try_reserve(bytes))
+            return false;
+        bytes_ += bytes;
+        return true;
+    }
+
+    //! Release part of the bytes.
+    void release(size_t bytes)
+    {
+        assert(bytes <= bytes_);
+        if (bytes != 0)
+            memory_budget::get_instance()->release(bytes);
+        bytes_ -= bytes;
+    }
+
+    //! Release all bytes.
+    void release()
+    {
+        release(bytes_);
+    }
+
+    void swap(memory_reservation& obj)
+    {
+        std::swap(bytes_, obj.bytes_);
+    }
+
+    //! Returns the reserved bytes.
+    size_t size() const { return bytes_; }
+};
+
+/*!
+ * Budget accounting of a pool of dynamically allocated blocks.
+ *
+ * Reserves the memory of all blocks owned by a pool, blocks handed out to the
+ * caller are not accounted. Idle blocks are lent to the memory_budget.
+ *
+ * Ownership rule: a pool that is not shared is used by one thread at a time,
+ * its owner. Every operation of the pool calls enter() first, which makes the
+ * calling thread the owner, so a pool may be handed to another thread between
+ * operations. If the reclaim callback runs in the owner, the pool cannot be in
+ * an operation other than the call into the budget that triggered it, so the
+ * callback frees the idle blocks from the pool's free list right away. The
+ * pool must therefore call into the budget only while its free list is
+ * consistent. In any other thread the callback only records how many blocks
+ * the pool should give up, the pool frees them in its next call of trim(), so
+ * pools need not be thread-safe. Pools used by several threads under a lock
+ * must call set_shared(), their blocks are then only freed in trim().
+ *
+ * Under memory_pressure, trim() sheds all idle blocks but one, and regrow()
+ * hands them back once the pressure subsided.
+ */
+template <typename BlockType>
+class pool_budget
+{
+public:
+    using block_type = BlockType;
+
+private:
+    //! memory of the blocks owned by the pool
+    memory_reservation memory_;
+
+    //! free list of the pool, a stack
+    std::vector<block_type*>& free_blocks_;
+
+    //! thread using the pool, set by enter()
+    std::atomic<std::thread::id> owner_;
+
+    //! set while the reclaim callback checks the owner and frees blocks
+    std::atomic<bool> reclaiming_ { false };
+
+    //! whether the pool is used by several threads
+    std::atomic<bool> shared_ { false };
+
+    //! idle blocks as published by the last trim()
+    std::atomic<size_t> idle_ { 0 };
+
+    //! blocks promised to the budget but not yet freed
+    std::atomic<size_t> lend_ { 0 };
+
+    memory_budget::reclaimer_id id_;
+
+    //! memory pressure state
+    memory_pressure_flag pressure_;
+
+    //! blocks shed under pressure, to be regrown later
+    size_t shed_ = 0;
+
+    size_t reclaim(size_t bytes)
+    {
+        size_t want = (bytes + sizeof(block_type) - 1) / sizeof(block_type);
+
+        if (!shared_)
+        {
+            // pairs with enter(): a new owner waits until this is done
+            reclaiming_ = true;
+            if (owner_.load() == std::this_thread::get_id())
+            {
+                // the pool cannot run a trim() while this thread waits for
+                // it, and its free list is consistent: free the blocks now
+                size_t lendable = free_blocks_.empty() ? 0 : free_blocks_.size() - 1;
+                size_t blocks = std::min(want, lendable);
+                for (size_t i = 0; i < blocks; ++i) {
+                    delete free_blocks_.back();
+                    free_blocks_.pop_back();
+                }
+                shrink(blocks);
+                idle_ = std::min(idle_.load(), lendable - blocks);
+                reclaiming_ = false;
+                return blocks * sizeof(block_type);
+            }
+            reclaiming_ = false;
+        }
+
+        size_t idle = idle_.load();
+        size_t blocks;
+        do {
+            blocks = std::min(want, idle);
+        } while (!idle_.compare_exchange_weak(idle, idle - blocks));
+
+        lend_ += blocks;
+        return blocks * sizeof(block_type);
+    }
+
+public:
+    //! Constructs the accounting of a pool with the given free list.
+    explicit pool_budget(std::vector<block_type*>& free_blocks)
+        : free_blocks_(free_blocks),
+          owner_(std::this_thread::get_id()),
+          id_(memory_budget::get_instance()->add_reclaimer(
+                  [this](size_t bytes) { return reclaim(bytes); }))
+    { }
+
+    //! non-copyable: delete copy-constructor
+    pool_budget(const pool_budget&) = delete;
+    //! non-copyable: delete assignment operator
+    pool_budget& operator = (const pool_budget&) = delete;
+
+    ~pool_budget()
+    {
+        memory_budget::get_instance()->remove_reclaimer(id_);
+    }
+
+    //! Exchange the accounted blocks, used when swapping pools.
+    void swap(pool_budget& obj)
+    {
+        memory_.swap(obj.memory_);
+        std::swap(shed_, obj.shed_);
+    }
+
+    //! Make the calling thread the owner of the pool, called first in every
+    //! operation of the pool.
+    void enter()
+    {
+        const std::thread::id self = std::this_thread::get_id();
+        if (owner_.load(std::memory_order_relaxed) == self)
+            return;
+
+        // the previous owner may be freeing blocks in its reclaim callback
+        owner_ = self;
+        while (reclaiming_.load())
+            std::this_thread::yield();
+    }
+
+    //! Declare that the pool is used by several threads under a lock, blocks
+    //! are then only freed in trim().
+    void set_shared()
+    {
+        shared_ = true;
+    }
+
+    //! Account blocks joining the pool, blocking until they fit.
+    void grow(size_t blocks)
+    {
+        memory_.reserve(blocks * sizeof(block_type));
+    }
+
+    //! Account blocks returning to the pool if they fit, without blocking:
+    //! the budget freed when they left may have been taken by others.
+    bool try_grow(size_t blocks)
+    {
+        return memory_.try_reserve(blocks * sizeof(block_type));
+    }
+
+    //! Stop accounting blocks leaving the pool.
+    void shrink(size_t blocks)
+    {
+        memory_.release(blocks * sizeof(block_type));
+    }
+
+    //! Allocate a block for the pool, blocking until it fits.
+    block_type * allocate()
+    {
+        grow(1);
+        try {
+            return new block_type;
+        }
+        catch (...) {
+            shrink(1);
+            throw;
+        }
+    }
+
+    //! Free a block owned by the pool.
+    void deallocate(block_type* block)
+    {
+        delete block;
+        shrink(1);
+    }
+
+    //! Returns true once when memory pressure started, the pool may then
+    //! also give up clean blocks that are not idle.
+    bool pressure_started()
+    {
+        return pressure_.changed() && pressure_.under_pressure();
+    }
+
+    //! Returns the number of idle blocks the pool should free now, and
+    //! publishes the number of idle blocks it can lend afterwards. One idle
+    //! block is always kept, so that the pool can serve steal().
+    //! \param idle number of free blocks currently held by the pool
+    size_t trim(size_t idle)
+    {
+        size_t lendable = idle > 0 ? idle - 1 : 0;
+        size_t blocks = std::min(lend_.exchange(0), lendable);
+        if (pressure_.under_pressure()) {
+            shed_ += lendable - blocks;
+            blocks = lendable;
+        }
+        idle_ = lendable - blocks;
+        return blocks;
+    }
+
+    //! Returns a new block replacing one shed under pressure, or nullptr if
+    //! there is none, pressure persists or the memory_budget is exhausted.
+    block_type * regrow()
+    {
+        if (shed_ == 0 || pressure_.under_pressure())
+            return nullptr;
+        if (memory_budget::get_instance()->available() < sizeof(block_type) ||
+            !memory_.try_reserve(sizeof(block_type)))
+            return nullptr;
+
+        --shed_;
+        try {
+            return new block_type;
+        }
+        catch (...) {
+            shrink(1);
+            throw;
+        }
+    }
+
+    //! Forget blocks shed under pressure, used when the pool is resized.
+    void reset_shed()
+    {
+        shed_ = 0;
+    }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_MEMORY_BUDGET_HEADER
+
+/**************************************************************************/
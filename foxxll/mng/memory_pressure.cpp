@@ -0,0 +1,201 @@
+/***************************************************************************
+ *  foxxll/mng/memory_pressure.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#include <tlx/logger/core.hpp>
+#include <tlx/string/starts_with.hpp>
+
+#include <foxxll/common/exithandler.hpp>
+#include <foxxll/mng/config.hpp>
+#include <foxxll/mng/memory_pressure.hpp>
+
+namespace foxxll {
+
+//! Returns the memory.events file of the cgroup v2 of this process, or an
+//! empty string if there is none.
+static std::string cgroup_events_path()
+{
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(in, line))
+    {
+        // cgroup v2 has a single hierarchy with id 0 and no controllers
+        if (tlx::starts_with(line, "0::"))
+            return "/sys/fs/cgroup" + line.substr(3) + "/memory.events";
+    }
+    return std::string();
+}
+
+memory_pressure::memory_pressure()
+    : psi_path_("/proc/pressure/memory"),
+      events_path_(cgroup_events_path())
+{
+    last_events_ = read_events();
+    register_exit_handler(exit_handler);
+}
+
+void memory_pressure::exit_handler()
+{
+    get_instance()->stop();
+}
+
+uint64_t memory_pressure::read_events()
+{
+    if (events_path_.empty())
+        return 0;
+
+    std::ifstream in(events_path_);
+    std::string key;
+    uint64_t value, sum = 0;
+    while (in >> key >> value)
+    {
+        if (key == "high" || key == "max" || key == "oom")
+            sum += value;
+    }
+    return sum;
+}
+
+void memory_pressure::set_sources(
+    const std::string& psi_path, const std::string& events_path)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    psi_path_ = psi_path;
+    events_path_ = events_path;
+    last_events_ = read_events();
+    calm_ = 0;
+}
+
+void memory_pressure::set_psi_threshold(double percent)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    psi_threshold_ = percent;
+}
+
+void memory_pressure::set_calm_polls(unsigned polls)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    calm_polls_ = polls;
+}
+
+bool memory_pressure::poll()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // PSI: "some avg10=1.23 avg60=0.50 avg300=0.10 total=12345"
+    double avg10 = 0;
+    if (!psi_path_.empty())
+    {
+        std::ifstream in(psi_path_);
+        std::string kind, field;
+        while (in >> kind >> field)
+        {
+            if (kind == "some" && tlx::starts_with(field, "avg10="))
+                avg10 = std::strtod(field.c_str() + 6, nullptr);
+            std::getline(in, field);
+        }
+    }
+
+    uint64_t events = read_events();
+    bool event = events > last_events_;
+    last_events_ = events;
+
+    bool pressure = pressure_;
+    if (avg10 >= psi_threshold_ || event) {
+        pressure = true;
+        calm_ = 0;
+    }
+    else if (pressure && avg10 < psi_threshold_ / 2) {
+        if (++calm_ >= calm_polls_) {
+            pressure = false;
+            calm_ = 0;
+        }
+    }
+    else {
+        calm_ = 0;
+    }
+
+    if (pressure != pressure_)
+    {
+        TLX_LOG1 << "memory_pressure: pressure "
+                 << (pressure ? "started" : "subsided")
+                 << ", PSI avg10=" << avg10;
+        pressure_ = pressure;
+        for (listener& l : listeners_)
+            l(pressure);
+    }
+    return pressure;
+}
+
+void memory_pressure::start(std::chrono::milliseconds interval)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    started_ = true;
+    if (thread_.joinable())
+        return;
+
+    stop_ = false;
+    thread_ = std::thread(
+        [this, interval]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stop_)
+            {
+                lock.unlock();
+                poll();
+                lock.lock();
+                cv_.wait_for(lock, interval, [this]() { return stop_; });
+            }
+        });
+}
+
+void memory_pressure::stop()
+{
+    std::thread thread;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        started_ = true;
+        stop_ = true;
+        cv_.notify_all();
+        thread = std::move(thread_);
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+void memory_pressure::auto_start()
+{
+    if (started_.exchange(true))
+        return;
+
+    config* cfg = config::get_instance();
+    cfg->check_initialized();
+    if (cfg->pressure_interval() != 0)
+        start(std::chrono::milliseconds(cfg->pressure_interval()));
+}
+
+memory_pressure::listener_id
+memory_pressure::add_listener(listener callback)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return listeners_.insert(listeners_.end(), std::move(callback));
+}
+
+void memory_pressure::remove_listener(listener_id id)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    listeners_.erase(id);
+}
+
+} // namespace foxxll
+
+/**************************************************************************/
@@ -0,0 +1,198 @@
+/***************************************************************************
+ *  foxxll/mng/memory_pressure.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_MEMORY_PRESSURE_HEADER
+#define FOXXLL_MNG_MEMORY_PRESSURE_HEADER
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <foxxll/singleton.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_mnglayer
+//! \{
+
+/*!
+ * Watches the memory pressure of the host and notifies listeners when it
+ * starts and when it subsides.
+ *
+ * Two sources are read, each may be missing: the Linux pressure stall
+ * information (PSI) file, usually /proc/pressure/memory, whose "some avg10"
+ * value is compared to a threshold, and the memory.events file of the
+ * process' cgroup v2, whose "high", "max" and "oom" counters signal pressure
+ * when they increase. Tests can point both at ordinary files.
+ *
+ * Pressure subsides when the PSI value drops below half the threshold and no
+ * event counter increased for calm_polls() polls.
+ *
+ * The first memory_pressure_flag, i.e. the first pool, starts polling in a
+ * background thread at the interval of config::pressure_interval(), unless
+ * start() or stop() was called before.
+ *
+ * \remarks is a singleton. It is never destroyed, the polling thread is
+ * stopped by an exit handler.
+ */
+class memory_pressure : public singleton<memory_pressure, false>
+{
+    friend class singleton<memory_pressure, false>;
+
+public:
+    //! Called with true when pressure starts and with false when it subsides.
+    using listener = std::function<void(bool pressure)>;
+
+    //! handle of a registered listener
+    using listener_id = std::list<listener>::iterator;
+
+private:
+    //! path of the PSI file
+    std::string psi_path_;
+
+    //! path of the cgroup memory.events file
+    std::string events_path_;
+
+    //! PSI "some avg10" percentage that signals pressure
+    double psi_threshold_ = 10.0;
+
+    //! number of calm polls before pressure subsides
+    unsigned calm_polls_ = 3;
+
+    //! sum of the event counters at the last poll
+    uint64_t last_events_ = 0;
+
+    //! number of calm polls in a row
+    unsigned calm_ = 0;
+
+    //! current state
+    std::atomic<bool> pressure_ { false };
+
+    //! registered listeners
+    std::list<listener> listeners_;
+
+    //! protects all of the above except pressure_, held during callbacks
+    std::mutex mutex_;
+
+    //! polling thread
+    std::thread thread_;
+
+    //! tells the polling thread to stop
+    bool stop_ = false;
+
+    //! set once polling was started or stopped, by auto_start() or the user
+    std::atomic<bool> started_ { false };
+
+    //! wakes the polling thread on stop
+    std::condition_variable cv_;
+
+    //! private construction from singleton
+    memory_pressure();
+
+    //! read the current sum of event counters, requires mutex_ held
+    uint64_t read_events();
+
+    //! stop the polling thread on exit
+    static void exit_handler();
+
+public:
+    //! Set the files to read, an empty path disables a source.
+    void set_sources(const std::string& psi_path,
+                     const std::string& events_path);
+
+    //! Set the PSI "some avg10" percentage that signals pressure.
+    void set_psi_threshold(double percent);
+
+    //! Set the number of calm polls before pressure subsides.
+    void set_calm_polls(unsigned polls);
+
+    //! Returns the number of calm polls before pressure subsides.
+    unsigned calm_polls() const { return calm_polls_; }
+
+    //! Read the sources once and notify listeners if the state changed.
+    //! \return the current state
+    bool poll();
+
+    //! Returns true while under memory pressure.
+    bool under_pressure() const { return pressure_; }
+
+    //! Start polling in a background thread.
+    void start(std::chrono::milliseconds interval = std::chrono::milliseconds(500));
+
+    //! Stop the background thread.
+    void stop();
+
+    //! Start polling at the configured interval, unless polling was started
+    //! or stopped before. Called by memory_pressure_flag.
+    void auto_start();
+
+    //! Register a listener. It is called from the polling thread.
+    listener_id add_listener(listener callback);
+
+    //! Unregister a listener. Waits for running callbacks to finish.
+    void remove_listener(listener_id id);
+};
+
+/*!
+ * Records the memory_pressure state for an owner that is not thread-safe,
+ * such as a pool, which checks it on its next operation.
+ */
+class memory_pressure_flag
+{
+    //! current state
+    std::atomic<bool> pressure_;
+
+    //! set on every change, cleared by changed()
+    std::atomic<bool> changed_ { false };
+
+    memory_pressure::listener_id id_;
+
+public:
+    memory_pressure_flag()
+        : pressure_(memory_pressure::get_instance()->under_pressure()),
+          id_(memory_pressure::get_instance()->add_listener(
+                  [this](bool pressure) {
+                      pressure_ = pressure;
+                      changed_ = true;
+                  }))
+    {
+        memory_pressure::get_instance()->auto_start();
+    }
+
+    //! non-copyable: delete copy-constructor
+    memory_pressure_flag(const memory_pressure_flag&) = delete;
+    //! non-copyable: delete assignment operator
+    memory_pressure_flag& operator = (const memory_pressure_flag&) = delete;
+
+    ~memory_pressure_flag()
+    {
+        memory_pressure::get_instance()->remove_listener(id_);
+    }
+
+    //! Returns true while under memory pressure.
+    bool under_pressure() const { return pressure_; }
+
+    //! Returns true once after each change of the state.
+    bool changed() { return changed_.exchange(false); }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_MEMORY_PRESSURE_HEADER
+
+/**************************************************************************/
@@ -0,0 +1,298 @@
+/***************************************************************************
+ *  foxxll/mng/merge_prefetcher.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_MERGE_PREFETCHER_HEADER
+#define FOXXLL_MNG_MERGE_PREFETCHER_HEADER
+
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <tlx/logger/core.hpp>
+
+#include <foxxll/io/request.hpp>
+#include <foxxll/mng/memory_budget.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_schedlayer
+//! \{
+
+//! Prefetches the blocks of many sorted runs for a k-way merge from one
+//! shared set of read buffers.
+//!
+//! Each run holds its current block. The remaining buffers are given to the
+//! runs in the order in which the merge will need their next blocks, which is
+//! forecast by the last element of the last block read of each run: the run
+//! with the smallest such key runs out first. A run whose last read is still
+//! in flight has no forecast yet, it competes for buffers again once the read
+//! completed. Reads of different runs are in flight at the same time, so the
+//! I/O overlaps across all disks while only nbuffers blocks are held.
+//!
+//! The read buffers are reserved from the memory_budget.
+template <typename BlockType, typename BidIteratorType,
+          typename CompareType = std::less<typename BlockType::value_type> >
+class merge_prefetcher
+{
+    constexpr static bool debug = false;
+
+public:
+    using block_type = BlockType;
+    using bid_iterator_type = BidIteratorType;
+    using value_type = typename block_type::value_type;
+    using compare_type = CompareType;
+
+    //! BIDs of a run, which is sorted by compare_type
+    using run_type = std::pair<bid_iterator_type, bid_iterator_type>;
+
+protected:
+    struct run_state
+    {
+        //! next block not yet read, and end of the run
+        bid_iterator_type next, end;
+        //! buffers of the blocks read or in reading, front is the current
+        std::deque<size_t> blocks;
+        //! the read of blocks.back() is in flight, its forecast is unknown
+        bool last_pending = false;
+        //! number of blocks read so far, validates forecast entries
+        size_t fetched = 0;
+    };
+
+    //! forecast of a run: the last key of its last block read
+    struct forecast_entry
+    {
+        value_type key;
+        size_t run;
+        size_t fetched;
+    };
+
+    struct forecast_cmp
+    {
+        compare_type cmp;
+        explicit forecast_cmp(const compare_type& c) : cmp(c) { }
+        //! smallest key on top, ties by run
+        bool operator () (const forecast_entry& a, const forecast_entry& b) const
+        {
+            if (cmp(b.key, a.key))
+                return true;
+            if (cmp(a.key, b.key))
+                return false;
+            return a.run > b.run;
+        }
+    };
+
+    using forecast_queue =
+        std::priority_queue<forecast_entry, std::vector<forecast_entry>, forecast_cmp>;
+
+    const size_t nbuffers_;
+    memory_reservation memory_;
+    block_type* buffers_;
+    std::vector<request_ptr> reqs_;
+    std::vector<size_t> free_buffers_;
+
+    std::vector<run_state> runs_;
+    //! runs whose last read is in flight
+    std::vector<size_t> pending_runs_;
+    forecast_queue forecasts_;
+
+    //! number of read requests posted
+    size_t num_reads_ = 0;
+
+    //! Read the next block of a run into a free buffer.
+    void fetch(size_t r)
+    {
+        run_state& run = runs_[r];
+        assert(run.next != run.end && !free_buffers_.empty());
+
+        size_t b = free_buffers_.back();
+        free_buffers_.pop_back();
+
+        TLX_LOG << "merge_prefetcher: run " << r << " reads block "
+                << run.fetched << " into buffer " << b;
+
+        reqs_[b] = buffers_[b].read(*run.next);
+        ++run.next;
+        ++run.fetched;
+        ++num_reads_;
+
+        run.blocks.push_back(b);
+        if (!run.last_pending) {
+            run.last_pending = true;
+            pending_runs_.push_back(r);
+        }
+    }
+
+    //! The last read of a run completed: its forecast is known.
+    void forecast(size_t r)
+    {
+        run_state& run = runs_[r];
+        run.last_pending = false;
+        if (run.next == run.end)
+            return;
+
+        const block_type& last = buffers_[run.blocks.back()];
+        forecasts_.push(forecast_entry {
+                            last.elem[block_type::size - 1], r, run.fetched
+                        });
+    }
+
+    //! Collects completed reads and gives the free buffers to the runs with
+    //! the smallest forecasts.
+    void schedule()
+    {
+        for (size_t i = 0; i < pending_runs_.size(); )
+        {
+            size_t r = pending_runs_[i];
+            if (reqs_[runs_[r].blocks.back()]->poll()) {
+                pending_runs_[i] = pending_runs_.back();
+                pending_runs_.pop_back();
+                forecast(r);
+            }
+            else {
+                ++i;
+            }
+        }
+
+        while (!free_buffers_.empty() && !forecasts_.empty())
+        {
+            forecast_entry top = forecasts_.top();
+            forecasts_.pop();
+
+            // a run that was read since is forecast anew
+            const run_state& run = runs_[top.run];
+            if (top.fetched != run.fetched || run.next == run.end)
+                continue;
+
+            fetch(top.run);
+        }
+    }
+
+    //! Waits for the current block of a run.
+    block_type * wait_current(size_t r)
+    {
+        run_state& run = runs_[r];
+        if (run.blocks.empty())
+            return nullptr;
+
+        size_t b = run.blocks.front();
+        reqs_[b]->wait();
+
+        if (run.last_pending && run.blocks.size() == 1) {
+            pending_runs_.erase(
+                std::find(pending_runs_.begin(), pending_runs_.end(), r));
+            forecast(r);
+            schedule();
+        }
+        return buffers_ + b;
+    }
+
+public:
+    //! Constructs a prefetcher for the runs and starts reading their first
+    //! blocks.
+    //! \param runs BID ranges of the runs
+    //! \param nbuffers number of read buffers shared by all runs, at least
+    //!        one per run plus one
+    //! \param cmp order of the elements within the runs
+    merge_prefetcher(const std::vector<run_type>& runs, size_t nbuffers,
+                     const compare_type& cmp = compare_type())
+        : nbuffers_(std::max(nbuffers, runs.size() + 1)),
+          memory_(nbuffers_ * sizeof(block_type)),
+          buffers_(new block_type[nbuffers_]),
+          reqs_(nbuffers_),
+          forecasts_(forecast_cmp(cmp))
+    {
+        free_buffers_.reserve(nbuffers_);
+        for (size_t i = nbuffers_; i > 0; --i)
+            free_buffers_.push_back(i - 1);
+
+        runs_.resize(runs.size());
+        for (size_t r = 0; r < runs.size(); ++r)
+        {
+            runs_[r].next = runs[r].first;
+            runs_[r].end = runs[r].second;
+            if (runs_[r].next != runs_[r].end)
+                fetch(r);
+        }
+    }
+
+    //! non-copyable: delete copy-constructor
+    merge_prefetcher(const merge_prefetcher&) = delete;
+    //! non-copyable: delete assignment operator
+    merge_prefetcher& operator = (const merge_prefetcher&) = delete;
+
+    //! Returns the number of runs.
+    size_t num_runs() const { return runs_.size(); }
+
+    //! Returns the number of read buffers.
+    size_t num_buffers() const { return nbuffers_; }
+
+    //! Returns the number of read requests posted so far.
+    size_t num_reads() const { return num_reads_; }
+
+    //! Returns the current block of a run, waiting for it to be read.
+    //! \return nullptr if the run is exhausted
+    block_type * current_block(size_t r)
+    {
+        return wait_current(r);
+    }
+
+    //! Signals that the current block of a run is consumed and returns the
+    //! next block of the run, waiting for it to be read.
+    //! \return nullptr if the run is exhausted
+    block_type * block_consumed(size_t r)
+    {
+        run_state& run = runs_[r];
+        assert(!run.blocks.empty());
+
+        // make sure the request is done before the buffer is reused
+        size_t b = run.blocks.front();
+        reqs_[b]->wait();
+        reqs_[b].reset();
+        run.blocks.pop_front();
+        free_buffers_.push_back(b);
+
+        if (run.blocks.empty() && run.last_pending) {
+            // the only block of the run was the one in flight
+            pending_runs_.erase(
+                std::find(pending_runs_.begin(), pending_runs_.end(), r));
+            run.last_pending = false;
+        }
+
+        // the run needs its next block now, whatever the forecasts say
+        if (run.blocks.empty() && run.next != run.end)
+            fetch(r);
+
+        schedule();
+
+        return wait_current(r);
+    }
+
+    ~merge_prefetcher()
+    {
+        for (size_t i = 0; i < nbuffers_; ++i)
+        {
+            if (reqs_[i].valid())
+                reqs_[i]->wait();
+        }
+        delete[] buffers_;
+    }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_MERGE_PREFETCHER_HEADER
+
+/**************************************************************************/
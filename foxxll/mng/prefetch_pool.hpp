@@ -15,13 +15,14 @@
 #define FOXXLL_MNG_PREFETCH_POOL_HEADER
 
 #include <algorithm>
-#include <list>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <tlx/logger/core.hpp>
 
 #include <foxxll/config.hpp>
+#include <foxxll/mng/bid_index.hpp>
+#include <foxxll/mng/memory_budget.hpp>
 #include <foxxll/mng/write_pool.hpp>
 
 namespace foxxll {
@@ -30,6 +31,15 @@ namespace foxxll {
 //! \{
 
 //! Implements dynamically resizable prefetching pool.
+//!
+//! Free blocks are kept in a stack and hinted blocks in a bid_index, both
+//! sized to the pool, so hint() and read() take constant time and do not
+//! allocate memory.
+//!
+//! The memory of the blocks owned by the pool is reserved from the
+//! memory_budget, free blocks are lent to it when other components run short.
+//! Under memory_pressure the pool sheds its free and completely prefetched
+//! blocks and regrows when the pressure subsided.
 template <class BlockType>
 class prefetch_pool
 {
@@ -40,50 +50,86 @@ public:
     using bid_type = typename block_type::bid_type;
 
 protected:
-    struct bid_hash
+    using busy_entry = std::pair<block_type*, request_ptr>;
+
+    //! a block that is in reading or already read
+    struct busy_slot
     {
-        size_t operator () (const bid_type& bid) const noexcept
-        {
-            size_t result = size_t(bid.storage) +
-                size_t(bid.offset & 0xffffffff) +
-                size_t(bid.offset >> 32);
-            return result;
-        }
-#if FOXXLL_MSVC
-        bool operator () (const bid_type& a, const bid_type& b) const noexcept
-        {
-            return (a.storage < b.storage) || (a.storage == b.storage && a.offset < b.offset);
-        }
-        enum
-        {                               // parameters for hash table
-            bucket_size = 4,            // 0 < bucket_size
-            min_buckets = 8             // min_buckets = 2 ^^ N, 0 < N
-        };
-#endif
+        bid_type bid;
+        block_type* block;
+        request_ptr req;
     };
-    using busy_entry = std::pair<block_type*, request_ptr>;
-    using unordered_map_type = typename std::unordered_map<bid_type, busy_entry, bid_hash>;
-    using free_blocks_iterator = typename std::list<block_type*>::iterator;
-    using busy_blocks_iterator = typename unordered_map_type::iterator;
 
-    //! contains free prefetch blocks
-    std::list<block_type*> free_blocks;
+    using busy_index_type = bid_index<busy_slot>;
+    using free_blocks_iterator = typename std::vector<block_type*>::iterator;
+    using busy_blocks_iterator = typename busy_index_type::iterator;
+
+    //! contains free prefetch blocks, used as a stack
+    std::vector<block_type*> free_blocks;
 
     //! blocks that are in reading or already read but not retrieved by user
-    unordered_map_type busy_blocks;
+    busy_index_type busy_blocks;
 
-    //! count number of free blocks, since traversing the std::list is slow.
-    size_t free_blocks_size;
+    //! memory budget accounting of the blocks
+    pool_budget<block_type> budget_;
+
+    //! Preallocate the free list and index for all owned blocks, so that
+    //! hint() and read() never allocate.
+    void reserve_capacity()
+    {
+        if (free_blocks.capacity() < size())
+            free_blocks.reserve(std::max(size(), 2 * free_blocks.capacity()));
+        busy_blocks.reserve(size());
+    }
+
+    //! Move a busy block back to the free list.
+    //! \return the block and its request
+    busy_slot release_busy(size_t pos)
+    {
+        busy_slot slot = busy_blocks.erase(pos);
+        free_blocks.push_back(slot.block);
+        return slot;
+    }
+
+    //! Free the blocks lent to the memory_budget or shed under memory
+    //! pressure, and regrow once the pressure subsided.
+    void trim()
+    {
+        if (budget_.pressure_started())
+        {
+            // prefetched blocks that were read completely are clean, drop them
+            size_t pos = 0;
+            while (pos < busy_blocks.size())
+            {
+                request_ptr& req = busy_blocks[pos].req;
+                if (req->op() == request::READ && req->poll())
+                    release_busy(pos);
+                else
+                    ++pos;
+            }
+        }
+        for (size_t n = budget_.trim(free_blocks.size()); n > 0; --n)
+        {
+            budget_.deallocate(free_blocks.back());
+            free_blocks.pop_back();
+        }
+        while (block_type* block = budget_.regrow())
+        {
+            free_blocks.push_back(block);
+            reserve_capacity();
+        }
+    }
 
 public:
     //! Constructs pool.
     //! \param init_size initial number of blocks in the pool
     explicit prefetch_pool(size_t init_size = 1)
-        : free_blocks_size(init_size)
+        : busy_blocks(init_size), budget_(free_blocks)
     {
-        size_t i = 0;
-        for ( ; i < init_size; ++i)
-            free_blocks.push_back(new block_type);
+        free_blocks.reserve(init_size);
+        for (size_t i = 0; i < init_size; ++i)
+            free_blocks.push_back(budget_.allocate());
+        trim();
     }
 
     //! non-copyable: delete copy-constructor
@@ -93,43 +139,52 @@ public:
 
     void swap(prefetch_pool& obj)
     {
+        budget_.enter();
+        obj.budget_.enter();
         std::swap(free_blocks, obj.free_blocks);
-        std::swap(busy_blocks, obj.busy_blocks);
-        std::swap(free_blocks_size, obj.free_blocks_size);
+        busy_blocks.swap(obj.busy_blocks);
+        budget_.swap(obj.budget_);
     }
 
     //! Waits for completion of all ongoing read requests and frees memory.
     virtual ~prefetch_pool()
     {
+        budget_.enter();
         while (!free_blocks.empty())
         {
-            delete free_blocks.back();
+            budget_.deallocate(free_blocks.back());
             free_blocks.pop_back();
         }
 
         try
         {
-            busy_blocks_iterator i2 = busy_blocks.begin();
-            for ( ; i2 != busy_blocks.end(); ++i2)
+            for (busy_blocks_iterator i2 = busy_blocks.begin(); i2 != busy_blocks.end(); ++i2)
             {
-                i2->second.second->wait();
-                delete i2->second.first;
+                i2->req->wait();
+                budget_.deallocate(i2->block);
             }
         }
         catch (...)
         { }
     }
 
+    //! Declare that the pool is used by several threads under a lock, blocks
+    //! lent to the memory_budget are then only freed by the pool's operations.
+    void set_shared()
+    {
+        budget_.set_shared();
+    }
+
     //! Returns number of owned blocks.
     size_t size() const
     {
-        return free_blocks_size + busy_blocks.size();
+        return free_blocks.size() + busy_blocks.size();
     }
 
     //! Returns the number of free prefetching blocks.
     size_t free_size() const
     {
-        return free_blocks_size;
+        return free_blocks.size();
     }
 
     //! Returns the number of busy prefetching blocks.
@@ -138,12 +193,21 @@ public:
         return busy_blocks.size();
     }
 
-    //! Add a new block to prefetch pool, enlarges size of pool.
+    //! Add a new block to prefetch pool, enlarges size of pool. The block is
+    //! freed instead if the memory_budget has no room for it.
     void add(block_type*& block)
     {
+        budget_.enter();
+        if (!budget_.try_grow(1))
+        {
+            delete block;
+            block = nullptr;
+            return;
+        }
         free_blocks.push_back(block);
-        ++free_blocks_size;
+        reserve_capacity();
         block = nullptr; // prevent caller from using the block any further
+        trim();
     }
 
     //! Take out a block from the pool, one unhinted free block must be
@@ -151,11 +215,12 @@ public:
     //! \return pointer to the block. Ownership of the block goes to the caller.
     block_type * steal()
     {
+        budget_.enter();
         tlx_die_unless(!free_blocks.empty());
 
         block_type* p = free_blocks.back();
         free_blocks.pop_back();
-        --free_blocks_size;
+        budget_.shrink(1);
         return p;
     }
 
@@ -173,20 +238,22 @@ public:
      */
     bool hint(bid_type bid)
     {
+        budget_.enter();
+        trim();
+
         // if block is already hinted, no need to hint it again
         if (in_prefetching(bid)) {
             TLX_LOG << "prefetch_pool::hint2 bid=" << bid << " was already cached";
             return true;
         }
 
-        if (free_blocks_size) //  only if we have a free block
+        if (!free_blocks.empty()) //  only if we have a free block
         {
-            --free_blocks_size;
             block_type* block = free_blocks.back();
             free_blocks.pop_back();
             TLX_LOG << "prefetch_pool::hint bid=" << bid << " => prefetching";
             request_ptr req = block->read(bid);
-            busy_blocks[bid] = busy_entry(block, req);
+            busy_blocks.insert(busy_slot { bid, block, req });
             return true;
         }
         TLX_LOG << "prefetch_pool::hint bid=" << bid << " => no free blocks for prefetching";
@@ -211,15 +278,17 @@ public:
      */
     bool hint(bid_type bid, write_pool<block_type>& w_pool)
     {
+        budget_.enter();
+        trim();
+
         // if block is already hinted, no need to hint it again
         if (in_prefetching(bid)) {
             TLX_LOG << "prefetch_pool::hint2 bid=" << bid << " was already cached";
             return true;
         }
 
-        if (free_blocks_size) //  only if we have a free block
+        if (!free_blocks.empty()) //  only if we have a free block
         {
-            --free_blocks_size;
             block_type* block = free_blocks.back();
             free_blocks.pop_back();
             if (w_pool.has_request(bid))
@@ -228,12 +297,12 @@ public:
                 TLX_LOG << "prefetch_pool::hint2 bid=" << bid << " was in write cache at " << wp_request.first;
                 assert(wp_request.first != 0);
                 w_pool.add(block);  //in exchange
-                busy_blocks[bid] = wp_request;
+                busy_blocks.insert(busy_slot { bid, wp_request.first, wp_request.second });
                 return true;
             }
             TLX_LOG << "prefetch_pool::hint2 bid=" << bid << " => prefetching";
             request_ptr req = block->read(bid);
-            busy_blocks[bid] = busy_entry(block, req);
+            busy_blocks.insert(busy_slot { bid, block, req });
             return true;
         }
         TLX_LOG << "prefetch_pool::hint2 bid=" << bid << " => no free blocks for prefetching";
@@ -243,38 +312,58 @@ public:
     //! Cancel a hint request in case the block is no longer desired.
     bool invalidate(bid_type bid)
     {
-        busy_blocks_iterator cache_el = busy_blocks.find(bid);
-        if (cache_el == busy_blocks.end())
+        budget_.enter();
+        size_t pos = busy_blocks.position(bid);
+        if (pos == busy_index_type::npos)
             return false;
 
         // cancel request if it is a read request, there might be
         // write requests 'stolen' from a write_pool that may not be canceled
-        if (cache_el->second.second->op() == request::READ)
-            cache_el->second.second->cancel();
+        request_ptr& req = busy_blocks[pos].req;
+        if (req->op() == request::READ)
+            req->cancel();
         // finish the request
-        cache_el->second.second->wait();
-        ++free_blocks_size;
-        free_blocks.push_back(cache_el->second.first);
-        busy_blocks.erase(cache_el);
+        req->wait();
+        release_busy(pos);
+        trim();
         return true;
     }
 
+    //! Take out the block of a hint in case the block is no longer desired,
+    //! without waiting for its request. Read requests are canceled.
+    //! \return the block and its request, which the caller must wait for
+    //! before using the block, or nullptr if the block was not hinted.
+    //! Ownership of the block goes to the caller.
+    busy_entry steal_request(bid_type bid)
+    {
+        budget_.enter();
+        size_t pos = busy_blocks.position(bid);
+        if (pos == busy_index_type::npos)
+            return busy_entry(nullptr, request_ptr());
+
+        busy_slot slot = busy_blocks.erase(pos);
+        if (slot.req->op() == request::READ)
+            slot.req->cancel();
+        budget_.shrink(1);
+        return busy_entry(slot.block, slot.req);
+    }
+
     //! Checks if a block is in the hinted block set.
     bool in_prefetching(bid_type bid)
     {
-        return (busy_blocks.find(bid) != busy_blocks.end());
+        return busy_blocks.find(bid) != nullptr;
     }
 
     //! Returns the request pointer for a hinted block, or an invalid nullptr
     //! request in case it was not requested due to lack of prefetch buffers.
     request_ptr find(bid_type bid)
     {
-        busy_blocks_iterator cache_el = busy_blocks.find(bid);
+        busy_slot* slot = busy_blocks.find(bid);
 
-        if (cache_el == busy_blocks.end())
+        if (slot == nullptr)
             return request_ptr(); // invalid pointer
         else
-            return cache_el->second.second;
+            return slot->req;
     }
 
     //! Returns true if the blocks was hinted and the request is finished.
@@ -300,8 +389,9 @@ public:
      */
     request_ptr read(block_type*& block, bid_type bid)
     {
-        busy_blocks_iterator cache_el = busy_blocks.find(bid);
-        if (cache_el == busy_blocks.end())
+        budget_.enter();
+        size_t pos = busy_blocks.position(bid);
+        if (pos == busy_index_type::npos)
         {
             // not cached
             TLX_LOG << "prefetch_pool::read bid=" << bid << " => no copy in cache, retrieving to " << block;
@@ -310,28 +400,27 @@ public:
 
         // cached
         TLX_LOG << "prefetch_pool::read bid=" << bid << " => copy in cache exists";
-        ++free_blocks_size;
+        busy_slot slot = busy_blocks.erase(pos);
         free_blocks.push_back(block);
-        block = cache_el->second.first;
-        request_ptr result = cache_el->second.second;
-        busy_blocks.erase(cache_el);
-        return result;
+        block = slot.block;
+        trim();
+        return slot.req;
     }
 
     request_ptr read(block_type*& block, bid_type bid, write_pool<block_type>& w_pool)
     {
+        budget_.enter();
         // try cache
-        busy_blocks_iterator cache_el = busy_blocks.find(bid);
-        if (cache_el != busy_blocks.end())
+        size_t pos = busy_blocks.position(bid);
+        if (pos != busy_index_type::npos)
         {
             // cached
             TLX_LOG << "prefetch_pool::read bid=" << bid << " => copy in cache exists";
-            ++free_blocks_size;
+            busy_slot slot = busy_blocks.erase(pos);
             free_blocks.push_back(block);
-            block = cache_el->second.first;
-            request_ptr result = cache_el->second.second;
-            busy_blocks.erase(cache_el);
-            return result;
+            block = slot.block;
+            trim();
+            return slot.req;
         }
 
         // try w_pool cache
@@ -358,23 +447,27 @@ public:
     //! \return new size of the pool
     size_t resize(size_t new_size)
     {
+        budget_.enter();
+        budget_.reset_shed();
         int64_t diff = int64_t(new_size) - int64_t(size());
         if (diff > 0)
         {
-            free_blocks_size += diff;
+            free_blocks.reserve(free_blocks.size() + diff);
             while (--diff >= 0)
-                free_blocks.push_back(new block_type);
+                free_blocks.push_back(budget_.allocate());
 
+            reserve_capacity();
+            trim();
             return size();
         }
 
-        while (diff < 0 && free_blocks_size > 0)
+        while (diff < 0 && !free_blocks.empty())
         {
             ++diff;
-            --free_blocks_size;
-            delete free_blocks.back();
+            budget_.deallocate(free_blocks.back());
             free_blocks.pop_back();
         }
+        trim();
         return size();
     }
 };
@@ -0,0 +1,297 @@
+/***************************************************************************
+ *  foxxll/mng/record_stream.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_RECORD_STREAM_HEADER
+#define FOXXLL_MNG_RECORD_STREAM_HEADER
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include <foxxll/mng/block_alloc_strategy.hpp>
+#include <foxxll/mng/block_manager.hpp>
+#include <foxxll/mng/buf_istream.hpp>
+#include <foxxll/mng/buf_writer.hpp>
+#include <foxxll/mng/typed_block.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_schedlayer
+//! \{
+
+//! Index entry of a block of a record stream: the first record starting in
+//! the block and its offset. offset is the block size if no record starts in
+//! the block.
+struct record_block_index
+{
+    uint64_t record;
+    size_t offset;
+};
+
+//! Output stream of variable-length records.
+//!
+//! Each record is written as its length, in 7-bit groups with the high bit
+//! set on all but the last byte, followed by its bytes. Records are packed
+//! densely and span block boundaries, the last block is padded with zeros.
+//! The BIDs are allocated on demand from the block_manager and listed by
+//! bids(). Optionally, index() records for each block where its first record
+//! starts, so that record_istream can start reading in the middle.
+template <size_t BlockSize, typename AllocStrategy = default_alloc_strategy>
+class record_ostream
+{
+public:
+    using block_type = typed_block<BlockSize, char>;
+    using bid_type = typename block_type::bid_type;
+    using alloc_strategy_type = AllocStrategy;
+
+protected:
+    buffered_writer<block_type> writer_;
+    alloc_strategy_type alloc_;
+    bool with_index_;
+
+    std::vector<bid_type> bids_;
+    std::vector<record_block_index> index_;
+
+    block_type* block_;
+    size_t elem_ = 0;
+    uint64_t records_ = 0, bytes_ = 0;
+    bool finished_ = false;
+
+    //! write out the current block and start the next one
+    void next_block()
+    {
+        bid_type bid;
+        block_manager::get_instance()->new_block(alloc_, bid, bids_.size());
+        bids_.push_back(bid);
+        block_ = writer_.write(block_, bid);
+        elem_ = 0;
+    }
+
+    //! append bytes, spanning blocks
+    void put(const char* src, size_t n)
+    {
+        bytes_ += n;
+        while (n != 0)
+        {
+            const size_t count = std::min(n, block_type::size - elem_);
+            std::copy(src, src + count, block_->elem + elem_);
+            src += count;
+            elem_ += count;
+            n -= count;
+
+            if (elem_ >= block_type::size) {
+                next_block();
+                if (with_index_)
+                    index_.push_back(record_block_index { records_, block_type::size });
+            }
+        }
+    }
+
+public:
+    //! Constructs an output stream.
+    //! \param nbuffers number of write buffers
+    //! \param with_index whether to build the index of the blocks
+    //! \param alloc strategy to allocate the BIDs
+    explicit record_ostream(
+        size_t nbuffers, bool with_index = false,
+        const alloc_strategy_type& alloc = alloc_strategy_type())
+        : writer_(nbuffers, nbuffers / 2), alloc_(alloc),
+          with_index_(with_index)
+    {
+        block_ = writer_.get_free_block();
+        if (with_index_)
+            index_.push_back(record_block_index { 0, block_type::size });
+    }
+
+    //! non-copyable: delete copy-constructor
+    record_ostream(const record_ostream&) = delete;
+    //! non-copyable: delete assignment operator
+    record_ostream& operator = (const record_ostream&) = delete;
+
+    //! Appends a record of size bytes.
+    record_ostream& write(const void* data, size_t size)
+    {
+        assert(!finished_);
+        if (with_index_ && index_.back().offset == block_type::size)
+            index_.back() = record_block_index { records_, elem_ };
+
+        char prefix[10];
+        size_t len = 0;
+        uint64_t v = size;
+        do {
+            prefix[len++] = static_cast<char>((v & 0x7F) | (v > 0x7F ? 0x80 : 0));
+            v >>= 7;
+        } while (v != 0);
+
+        put(prefix, len);
+        put(static_cast<const char*>(data), size);
+        ++records_;
+        return *this;
+    }
+
+    //! Appends a string as record.
+    record_ostream& operator << (const std::string& record)
+    {
+        return write(record.data(), record.size());
+    }
+
+    //! Pads and writes the last block and waits for all writes.
+    void finish()
+    {
+        if (finished_)
+            return;
+        finished_ = true;
+
+        if (elem_ != 0) {
+            std::fill(block_->elem + elem_, block_->elem + block_type::size, 0);
+            next_block();
+        }
+        else if (with_index_) {
+            // the entry of the block that is not written
+            index_.pop_back();
+        }
+        writer_.flush();
+    }
+
+    //! Returns the BIDs of the blocks written.
+    const std::vector<bid_type> & bids() const { return bids_; }
+
+    //! Returns the index, one entry per block, if it was enabled.
+    const std::vector<record_block_index> & index() const { return index_; }
+
+    //! Returns the number of records written.
+    uint64_t num_records() const { return records_; }
+
+    //! Returns the number of bytes written, including length prefixes.
+    uint64_t num_bytes() const { return bytes_; }
+
+    //! Finishes the stream.
+    ~record_ostream()
+    {
+        finish();
+    }
+};
+
+//! Input stream of variable-length records written by record_ostream.
+template <size_t BlockSize, typename BidIteratorType>
+class record_istream
+{
+public:
+    using block_type = typed_block<BlockSize, char>;
+    using bid_iterator_type = BidIteratorType;
+
+protected:
+    buf_istream<block_type, bid_iterator_type> in_;
+    uint64_t remaining_;
+
+    //! block to start reading at for a record
+    static size_t find_block(const std::vector<record_block_index>& index,
+                             uint64_t first_record)
+    {
+        // the entries are sorted by record
+        size_t block = std::upper_bound(
+            index.begin(), index.end(), first_record,
+            [](uint64_t r, const record_block_index& e) { return r < e.record; })
+                       - index.begin();
+        if (block > 0)
+            --block;
+        while (block > 0 && index[block].offset == block_type::size)
+            --block;
+        return block;
+    }
+
+    record_istream(bid_iterator_type begin, bid_iterator_type end,
+                   size_t nbuffers, uint64_t num_records,
+                   const std::vector<record_block_index>& index,
+                   uint64_t first_record, size_t block)
+        : in_(begin + block, end, nbuffers),
+          remaining_(num_records - index[block].record)
+    {
+        assert(first_record < num_records);
+        in_.for_each_span(index[block].offset, [](const char*, size_t) { });
+        for (uint64_t r = index[block].record; r < first_record; ++r)
+            skip();
+    }
+
+    //! reads the length prefix of the next record
+    uint64_t read_length()
+    {
+        assert(remaining_ != 0);
+        uint64_t len = 0;
+        for (unsigned shift = 0; ; shift += 7)
+        {
+            char c;
+            in_ >> c;
+            len |= static_cast<uint64_t>(c & 0x7F) << shift;
+            if (!(c & 0x80))
+                break;
+        }
+        return len;
+    }
+
+public:
+    //! Constructs an input stream reading all records.
+    //! \param begin first BID of the stream
+    //! \param end end of the BIDs
+    //! \param nbuffers number of prefetch buffers
+    //! \param num_records number of records in the stream
+    record_istream(bid_iterator_type begin, bid_iterator_type end,
+                   size_t nbuffers, uint64_t num_records)
+        : in_(begin, end, nbuffers), remaining_(num_records)
+    { }
+
+    //! Constructs an input stream starting at a record, using the index of
+    //! the blocks to skip the blocks before it.
+    record_istream(bid_iterator_type begin, bid_iterator_type end,
+                   size_t nbuffers, uint64_t num_records,
+                   const std::vector<record_block_index>& index,
+                   uint64_t first_record)
+        : record_istream(begin, end, nbuffers, num_records, index,
+                         first_record, find_block(index, first_record))
+    { }
+
+    //! non-copyable: delete copy-constructor
+    record_istream(const record_istream&) = delete;
+    //! non-copyable: delete assignment operator
+    record_istream& operator = (const record_istream&) = delete;
+
+    //! Returns whether all records were read.
+    bool empty() const { return remaining_ == 0; }
+
+    //! Returns the number of records left.
+    uint64_t remaining() const { return remaining_; }
+
+    //! Reads the next record.
+    record_istream& operator >> (std::string& record)
+    {
+        record.resize(read_length());
+        if (!record.empty())
+            in_.read(&record[0], record.size());
+        --remaining_;
+        return *this;
+    }
+
+    //! Skips the next record.
+    record_istream& skip()
+    {
+        in_.for_each_span(read_length(), [](const char*, size_t) { });
+        --remaining_;
+        return *this;
+    }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_RECORD_STREAM_HEADER
+
+/**************************************************************************/
@@ -0,0 +1,351 @@
+/***************************************************************************
+ *  foxxll/mng/shared_read_write_pool.hpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#ifndef FOXXLL_MNG_SHARED_READ_WRITE_POOL_HEADER
+#define FOXXLL_MNG_SHARED_READ_WRITE_POOL_HEADER
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <tlx/die/core.hpp>
+
+#include <foxxll/mng/bid_index.hpp>
+#include <foxxll/mng/prefetch_pool.hpp>
+#include <foxxll/mng/write_pool.hpp>
+
+namespace foxxll {
+
+//! \addtogroup foxxll_schedlayer
+//! \{
+
+/*!
+ * Thread-safe variant of read_write_pool, shared by many threads.
+ *
+ * The pool is split into shards, each a prefetch_pool and a write_pool under
+ * its own mutex. All operations on a block go to the shard selected by the
+ * hash of its BID, so a block hinted or written by one thread satisfies a read
+ * of another thread and coherence is kept as in read_write_pool. Requests are
+ * issued under the shard lock, but waited for outside of it.
+ *
+ * Free blocks of any shard serve steal(). Blocks thus wander between shards,
+ * the total number of blocks is what the resize functions set.
+ */
+template <typename BlockType>
+class shared_read_write_pool
+{
+public:
+    using block_type = BlockType;
+    using bid_type = typename block_type::bid_type;
+    using size_type = size_t;
+
+protected:
+    using write_pool_type = write_pool<block_type>;
+    using prefetch_pool_type = prefetch_pool<block_type>;
+
+    struct shard
+    {
+        std::mutex mutex;
+        write_pool_type w_pool;
+        prefetch_pool_type p_pool;
+
+        shard(size_type init_size_prefetch, size_type init_size_write)
+            : w_pool(init_size_write), p_pool(init_size_prefetch)
+        {
+            w_pool.set_shared();
+            p_pool.set_shared();
+        }
+    };
+
+    std::vector<std::unique_ptr<shard> > shards_;
+
+    //! Returns the shard responsible for bid.
+    shard& shard_of(const bid_type& bid)
+    {
+        return *shards_[bid_hash(bid) % shards_.size()];
+    }
+
+    //! Returns the first shard a thread looks at for free blocks.
+    size_t home_shard() const
+    {
+        return std::hash<std::thread::id>()(std::this_thread::get_id()) % shards_.size();
+    }
+
+    //! Returns the share of shard i of n, such that the shares sum to size.
+    static size_type share(size_type size, size_t i, size_t n)
+    {
+        return size / n + (i < size % n ? 1 : 0);
+    }
+
+public:
+    //! Constructs pool.
+    //! \param init_size_prefetch initial number of blocks in the prefetch pools
+    //! \param init_size_write initial number of blocks in the write pools
+    //! \param num_shards number of independently locked shards, at most
+    //!        init_size_prefetch, so that each shard can prefetch
+    explicit shared_read_write_pool(
+        size_type init_size_prefetch = 1, size_type init_size_write = 1,
+        size_t num_shards = 16)
+    {
+        num_shards = std::max<size_t>(
+            1, std::min<size_t>(num_shards, init_size_prefetch));
+        shards_.reserve(num_shards);
+        for (size_t i = 0; i < num_shards; ++i)
+        {
+            shards_.emplace_back(new shard(
+                                     share(init_size_prefetch, i, num_shards),
+                                     share(init_size_write, i, num_shards)));
+        }
+    }
+
+    //! non-copyable: delete copy-constructor
+    shared_read_write_pool(const shared_read_write_pool&) = delete;
+    //! non-copyable: delete assignment operator
+    shared_read_write_pool& operator = (const shared_read_write_pool&) = delete;
+
+    //! Returns the number of shards.
+    size_t num_shards() const { return shards_.size(); }
+
+    //! Returns number of blocks owned by the write_pools.
+    size_type size_write()
+    {
+        size_type size = 0;
+        for (std::unique_ptr<shard>& s : shards_) {
+            std::unique_lock<std::mutex> lock(s->mutex);
+            size += s->w_pool.size();
+        }
+        return size;
+    }
+
+    //! Returns number of blocks owned by the prefetch_pools.
+    size_type size_prefetch()
+    {
+        size_type size = 0;
+        for (std::unique_ptr<shard>& s : shards_) {
+            std::unique_lock<std::mutex> lock(s->mutex);
+            size += s->p_pool.size();
+        }
+        return size;
+    }
+
+    //! Resizes the write pools, spreading the blocks evenly over the shards.
+    //! \param new_size new total size of the write pools after the call
+    void resize_write(size_type new_size)
+    {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            std::unique_lock<std::mutex> lock(shards_[i]->mutex);
+            shards_[i]->w_pool.resize(share(new_size, i, shards_.size()));
+        }
+    }
+
+    //! Resizes the prefetch pools, spreading the blocks evenly over the
+    //! shards. Blocks in prefetching are not freed. Shards left without
+    //! blocks cannot serve hints.
+    //! \param new_size desired total size of the prefetch pools
+    void resize_prefetch(size_type new_size)
+    {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            std::unique_lock<std::mutex> lock(shards_[i]->mutex);
+            shards_[i]->p_pool.resize(share(new_size, i, shards_.size()));
+        }
+    }
+
+    // WRITE POOL METHODS
+
+    //! Passes a block to the pool for writing.
+    //! \param block block to write. Ownership of the block goes to the pool.
+    //! \param bid location, where to write
+    //! \return request object of the write operation
+    request_ptr write(block_type*& block, bid_type bid)
+    {
+        shard& s = shard_of(bid);
+        std::unique_lock<std::mutex> lock(s.mutex);
+
+        request_ptr result = s.w_pool.write(block, bid);
+
+        // if there is a copy of this block in the prefetch pool, it is now a
+        // stale copy, so take it out, wait for its request outside the lock,
+        // and re-hint the block
+        std::pair<block_type*, request_ptr> stale = s.p_pool.steal_request(bid);
+        if (stale.first)
+        {
+            lock.unlock();
+            stale.second->wait();
+            lock.lock();
+            s.p_pool.add(stale.first);
+            s.p_pool.hint(bid, s.w_pool);
+        }
+
+        return result;
+    }
+
+    //! Take out a free block from any write pool, preferring the calling
+    //! thread's home shard. Waits for a write to finish only if no shard has
+    //! a free block.
+    //! \return pointer to the block. Ownership of the block goes to the caller.
+    block_type * steal()
+    {
+        size_t home = home_shard();
+        for (size_t k = 0; k < shards_.size(); ++k)
+        {
+            shard& s = *shards_[(home + k) % shards_.size()];
+            std::unique_lock<std::mutex> lock(s.mutex);
+            if (s.w_pool.free_size() > 0)
+                return s.w_pool.steal();
+        }
+        for (size_t k = 0; k < shards_.size(); ++k)
+        {
+            shard& s = *shards_[(home + k) % shards_.size()];
+            std::unique_lock<std::mutex> lock(s.mutex);
+            if (s.w_pool.free_size() > 0)
+                return s.w_pool.steal();
+            if (s.w_pool.size() > 0)
+            {
+                std::pair<block_type*, request_ptr> busy = s.w_pool.steal_any_request();
+                lock.unlock();
+                busy.second->wait();
+                return busy.first;
+            }
+        }
+        // the write pools gave up all their blocks to the memory_budget,
+        // blocks handed out are not accounted
+        return new block_type;
+    }
+
+    //! Add block to the write pool of the calling thread's home shard.
+    void add(block_type*& block)
+    {
+        shard& s = *shards_[home_shard()];
+        std::unique_lock<std::mutex> lock(s.mutex);
+        s.w_pool.add(block);
+    }
+
+    // PREFETCH POOL METHODS
+
+    //! Gives a hint for prefetching a block.
+    //! \param bid address of a block to be prefetched
+    //! \return \c true if there was a free block to do prefetch and prefetching
+    //! was scheduled, \c false otherwise
+    bool hint(bid_type bid)
+    {
+        shard& s = shard_of(bid);
+        std::unique_lock<std::mutex> lock(s.mutex);
+        return s.p_pool.hint(bid, s.w_pool);
+    }
+
+    //! Cancel a hint request in case the block is no longer desired.
+    bool invalidate(bid_type bid)
+    {
+        shard& s = shard_of(bid);
+        std::unique_lock<std::mutex> lock(s.mutex);
+        return s.p_pool.invalidate(bid);
+    }
+
+    /*!
+     * Reads block. If this block was hinted or is being written by any thread,
+     * it is not read but passed from the cache.
+     *
+     * \param block block object, where data to be read to. If block was cached
+     * \c block 's ownership goes to the pool and block from cache is returned
+     * in \c block value.
+     *
+     * \param bid address of the block
+     * \return request pointer object of read operation, the caller waits for it
+     */
+    request_ptr read(block_type*& block, bid_type bid)
+    {
+        shard& s = shard_of(bid);
+        std::unique_lock<std::mutex> lock(s.mutex);
+        return s.p_pool.read(block, bid, s.w_pool);
+    }
+
+    //! Returns the request pointer for a hinted block, or an invalid nullptr
+    //! request in case it was not requested due to lack of prefetch buffers.
+    request_ptr find_hint(bid_type bid)
+    {
+        shard& s = shard_of(bid);
+        std::unique_lock<std::mutex> lock(s.mutex);
+        return s.p_pool.find(bid);
+    }
+
+    //! Returns true if the blocks was hinted and the request is finished.
+    bool poll_hint(bid_type bid)
+    {
+        shard& s = shard_of(bid);
+        std::unique_lock<std::mutex> lock(s.mutex);
+        return s.p_pool.poll(bid);
+    }
+
+    //! Add block to the prefetch pool of the calling thread's home shard.
+    void add_prefetch(block_type*& block)
+    {
+        shard& s = *shards_[home_shard()];
+        std::unique_lock<std::mutex> lock(s.mutex);
+        s.p_pool.add(block);
+    }
+
+    //! Take out a free block from any prefetch pool, one unhinted free block
+    //! must be available.
+    //! \return pointer to the block. Ownership of the block goes to the caller.
+    block_type * steal_prefetch()
+    {
+        size_t home = home_shard();
+        for (size_t k = 0; k < shards_.size(); ++k)
+        {
+            shard& s = *shards_[(home + k) % shards_.size()];
+            std::unique_lock<std::mutex> lock(s.mutex);
+            if (s.p_pool.free_size() > 0)
+                return s.p_pool.steal();
+        }
+        tlx_die("shared_read_write_pool::steal_prefetch: no free blocks");
+    }
+
+    //! Checks if a block is in the hinted block set.
+    bool in_prefetching(bid_type bid)
+    {
+        shard& s = shard_of(bid);
+        std::unique_lock<std::mutex> lock(s.mutex);
+        return s.p_pool.in_prefetching(bid);
+    }
+
+    //! Returns the number of free prefetching blocks.
+    size_t free_size_prefetch()
+    {
+        size_t size = 0;
+        for (std::unique_ptr<shard>& s : shards_) {
+            std::unique_lock<std::mutex> lock(s->mutex);
+            size += s->p_pool.free_size();
+        }
+        return size;
+    }
+
+    //! Returns the number of busy prefetching blocks.
+    size_t busy_size_prefetch()
+    {
+        size_t size = 0;
+        for (std::unique_ptr<shard>& s : shards_) {
+            std::unique_lock<std::mutex> lock(s->mutex);
+            size += s->p_pool.busy_size();
+        }
+        return size;
+    }
+};
+
+//! \}
+
+} // namespace foxxll
+
+#endif // !FOXXLL_MNG_SHARED_READ_WRITE_POOL_HEADER
+
+/**************************************************************************/
@@ -17,13 +17,15 @@
 #include <cassert>
 
 #include <algorithm>
-#include <list>
 #include <utility>
+#include <vector>
 
 #include <tlx/define.hpp>
 
 #include <foxxll/config.hpp>
 #include <foxxll/io/request_operations.hpp>
+#include <foxxll/mng/bid_index.hpp>
+#include <foxxll/mng/memory_budget.hpp>
 
 #define FOXXLL_VERBOSE_WPOOL(msg) \
     TLX_LOG << "write_pool[" << static_cast<void*>(this) << "]" << msg
@@ -34,6 +36,15 @@ namespace foxxll {
 //! \{
 
 //! Implements dynamically resizable buffered writing pool.
+//!
+//! Free blocks are kept in a stack and blocks in writing in a bid_index, both
+//! sized to the pool, so write(), has_request() and steal_request() take
+//! constant time and do not allocate memory.
+//!
+//! The memory of the blocks owned by the pool is reserved from the
+//! memory_budget, free blocks are lent to it when other components run short.
+//! Under memory_pressure the pool sheds its free blocks and blocks whose
+//! writes completed, and regrows when the pressure subsided.
 template <class BlockType>
 class write_pool
 {
@@ -51,31 +62,68 @@ public:
         bid_type bid;
 
         busy_entry() : block(nullptr) { }
-        busy_entry(const busy_entry& a) : block(a.block), req(a.req), bid(a.bid) { }
+        busy_entry(const busy_entry&) = default;
+        busy_entry& operator = (const busy_entry&) = default;
         busy_entry(block_type*& bl, request_ptr& r, bid_type& bi)
             : block(bl), req(r), bid(bi) { }
 
         operator request_ptr () { return req; }
     };
-    using free_blocks_iterator = typename std::list<block_type*>::iterator;
-    using busy_blocks_iterator = typename std::list<busy_entry>::iterator;
+    using busy_index_type = bid_index<busy_entry>;
+    using free_blocks_iterator = typename std::vector<block_type*>::iterator;
+    using busy_blocks_iterator = typename busy_index_type::iterator;
 
 protected:
-    // contains free write blocks
-    std::list<block_type*> free_blocks;
-    // blocks that are in writing
-    std::list<busy_entry> busy_blocks;
+    // contains free write blocks, used as a stack
+    std::vector<block_type*> free_blocks;
+    // blocks that are in writing, stale writes are not indexed
+    busy_index_type busy_blocks;
+    // memory budget accounting of the blocks
+    pool_budget<block_type> budget_;
+
+    //! Preallocate the free list and index for all owned blocks, so that
+    //! write() never allocates.
+    void reserve_capacity()
+    {
+        if (free_blocks.capacity() < size())
+            free_blocks.reserve(std::max(size(), 2 * free_blocks.capacity()));
+        busy_blocks.reserve(size());
+    }
+
+    //! Free the blocks lent to the memory_budget or shed under memory
+    //! pressure, and regrow once the pressure subsided.
+    void trim()
+    {
+        if (budget_.pressure_started())
+            // collect blocks whose writes completed, they are clean
+            check_all_busy();
+        for (size_t n = budget_.trim(free_blocks.size()); n > 0; --n)
+        {
+            FOXXLL_VERBOSE_WPOOL("  lend block=" << free_blocks.back());
+            budget_.deallocate(free_blocks.back());
+            free_blocks.pop_back();
+        }
+        while (block_type* block = budget_.regrow())
+        {
+            FOXXLL_VERBOSE_WPOOL("  regrow block=" << block);
+            free_blocks.push_back(block);
+            reserve_capacity();
+        }
+    }
 
 public:
     //! Constructs pool.
     //! \param init_size initial number of blocks in the pool
     explicit write_pool(size_t init_size = 1)
+        : busy_blocks(init_size), budget_(free_blocks)
     {
+        free_blocks.reserve(init_size);
         for (size_t i = 0; i < init_size; ++i)
         {
-            free_blocks.push_back(new block_type);
+            free_blocks.push_back(budget_.allocate());
             FOXXLL_VERBOSE_WPOOL("  create block=" << free_blocks.back());
         }
+        trim();
     }
 
     //! non-copyable: delete copy-constructor
@@ -85,13 +133,17 @@ public:
 
     void swap(write_pool& obj)
     {
+        budget_.enter();
+        obj.budget_.enter();
         std::swap(free_blocks, obj.free_blocks);
-        std::swap(busy_blocks, obj.busy_blocks);
+        busy_blocks.swap(obj.busy_blocks);
+        budget_.swap(obj.budget_);
     }
 
     //! Waits for completion of all ongoing write requests and frees memory.
     ~write_pool()
     {
+        budget_.enter();
         FOXXLL_VERBOSE_WPOOL(
             "::~write_pool free_blocks.size()=" << free_blocks.size() <<
                 " busy_blocks.size()=" << busy_blocks.size()
@@ -99,7 +151,7 @@ public:
         while (!free_blocks.empty())
         {
             FOXXLL_VERBOSE_WPOOL("  delete free block=" << free_blocks.back());
-            delete free_blocks.back();
+            budget_.deallocate(free_blocks.back());
             free_blocks.pop_back();
         }
 
@@ -112,53 +164,86 @@ public:
                     FOXXLL_VERBOSE_WPOOL("  delete busy block=(empty)");
                 else
                     FOXXLL_VERBOSE_WPOOL("  delete busy block=" << free_blocks.back());
-                delete i2->block;
+                budget_.deallocate(i2->block);
             }
         }
         catch (...)
         { }
     }
 
+    //! Declare that the pool is used by several threads under a lock, blocks
+    //! lent to the memory_budget are then only freed by the pool's operations.
+    void set_shared()
+    {
+        budget_.set_shared();
+    }
+
     //! Returns number of owned blocks.
     size_t size() const { return free_blocks.size() + busy_blocks.size(); }
 
+    //! Returns number of free blocks, that steal() returns without waiting.
+    size_t free_size() const { return free_blocks.size(); }
+
     //! Passes a block to the pool for writing.
     //! \param block block to write. Ownership of the block goes to the pool.
     //! \c block must be allocated dynamically with using \c new .
     //! \param bid location, where to write
     //! \warning \c block must be allocated dynamically with using \c new .
     //! \return request object of the write operation
+    //! \note If the memory_budget has no room for the block anymore, it is
+    //! freed once its write completed and the pool shrinks by one block.
     request_ptr write(block_type*& block, bid_type bid)
     {
+        budget_.enter();
         FOXXLL_VERBOSE_WPOOL("::write: " << block << " @ " << bid);
-        for (busy_blocks_iterator i2 = busy_blocks.begin(); i2 != busy_blocks.end(); ++i2)
+        size_t pos = busy_blocks.position(bid);
+        if (pos != busy_index_type::npos)
         {
-            if (i2->bid == bid) {
-                assert(i2->block != block);
-                FOXXLL_VERBOSE_WPOOL("WAW dependency");
-                // try to cancel the obsolete request
-                i2->req->cancel();
-                // invalidate the bid of the stale write request,
-                // prevents prefetch_pool from stealing a stale block
-                i2->bid.storage = 0;
-            }
+            busy_entry& stale = busy_blocks[pos];
+            assert(stale.block != block);
+            FOXXLL_VERBOSE_WPOOL("WAW dependency");
+            // try to cancel the obsolete request
+            stale.req->cancel();
+            // invalidate the bid of the stale write request,
+            // prevents prefetch_pool from stealing a stale block
+            busy_blocks.unindex(pos);
+            stale.bid.storage = 0;
+        }
+        if (!budget_.try_grow(1))
+        {
+            FOXXLL_VERBOSE_WPOOL("  no budget, drop block=" << block);
+            block_type* dropped = block;
+            block = nullptr;
+            return dropped->write(
+                bid, [dropped](request*, bool) { delete dropped; });
         }
         request_ptr result = block->write(bid);
-        busy_blocks.push_back(busy_entry(block, result, bid));
+        busy_blocks.insert(busy_entry(block, result, bid));
+        reserve_capacity();
         block = nullptr; // prevent caller from using the block any further
+        trim();
         return result;
     }
 
-    //! Take out a block from the pool.
+    //! Take out a block from the pool. If the pool gave up all its blocks
+    //! to the memory_budget, a new block is allocated.
     //! \return pointer to the block. Ownership of the block goes to the caller.
     block_type * steal()
     {
-        assert(size() > 0);
+        budget_.enter();
+        if (size() == 0)
+        {
+            block_type* p = budget_.allocate();
+            budget_.shrink(1);
+            FOXXLL_VERBOSE_WPOOL("::steal : pool is empty, serve new block=" << p);
+            return p;
+        }
         if (!free_blocks.empty())
         {
             block_type* p = free_blocks.back();
             FOXXLL_VERBOSE_WPOOL("::steal : " << free_blocks.size() << " free blocks available, serve block=" << p);
             free_blocks.pop_back();
+            budget_.shrink(1);
             return p;
         }
         FOXXLL_VERBOSE_WPOOL("::steal : all " << busy_blocks.size() << " are busy");
@@ -167,6 +252,7 @@ public:
         assert(completed->req->poll());         // and it is *really* completed
         block_type* p = completed->block;
         busy_blocks.erase(completed);
+        budget_.shrink(1);
         check_all_busy();                       // for debug
         FOXXLL_VERBOSE_WPOOL("  serve block=" << p);
         return p;
@@ -176,76 +262,103 @@ public:
     //! \param new_size new size of the pool after the call
     void resize(size_t new_size)
     {
+        budget_.enter();
+        budget_.reset_shed();
         int64_t diff = int64_t(new_size) - int64_t(size());
         if (diff > 0)
         {
+            free_blocks.reserve(free_blocks.size() + diff);
             while (--diff >= 0)
             {
-                free_blocks.push_back(new block_type);
+                free_blocks.push_back(budget_.allocate());
                 FOXXLL_VERBOSE_WPOOL("  create block=" << free_blocks.back());
             }
 
+            reserve_capacity();
+            trim();
             return;
         }
 
         while (++diff <= 0)
             delete steal();
+        trim();
     }
 
     bool has_request(bid_type bid)
     {
-        for (busy_blocks_iterator i2 = busy_blocks.begin(); i2 != busy_blocks.end(); ++i2)
-        {
-            if (i2->bid == bid)
-                return true;
-        }
-        return false;
+        return busy_blocks.find(bid) != nullptr;
     }
 
     // returns a block and a (potentially unfinished) I/O request associated with it
     std::pair<block_type*, request_ptr> steal_request(bid_type bid)
     {
-        for (busy_blocks_iterator i2 = busy_blocks.begin(); i2 != busy_blocks.end(); ++i2)
+        budget_.enter();
+        size_t pos = busy_blocks.position(bid);
+        if (pos != busy_index_type::npos)
         {
-            if (i2->bid == bid)
-            {
-                // remove busy block from list, request has not yet been waited for!
-                block_type* blk = i2->block;
-                request_ptr req = i2->req;
-                busy_blocks.erase(i2);
-
-                FOXXLL_VERBOSE_WPOOL("::steal_request block=" << blk);
-                // hand over block and (unfinished) request to caller
-                return std::pair<block_type*, request_ptr>(blk, req);
-            }
+            // remove busy block from index, request has not yet been waited for!
+            busy_entry entry = busy_blocks.erase(pos);
+            budget_.shrink(1);
+
+            FOXXLL_VERBOSE_WPOOL("::steal_request block=" << entry.block);
+            // hand over block and (unfinished) request to caller
+            return std::pair<block_type*, request_ptr>(entry.block, entry.req);
         }
         FOXXLL_VERBOSE_WPOOL("::steal_request NOT FOUND");
         // not matching request found, return a dummy
         return std::pair<block_type*, request_ptr>(nullptr, request_ptr());
     }
 
+    //! Take out a block that is in writing, preferring one whose write
+    //! completed, without waiting. There must be no free blocks.
+    //! \return the block and its request, which the caller must wait for
+    //! before using the block. Ownership of the block goes to the caller.
+    std::pair<block_type*, request_ptr> steal_any_request()
+    {
+        budget_.enter();
+        assert(free_blocks.empty() && !busy_blocks.empty());
+        size_t pos = 0;
+        while (pos + 1 < busy_blocks.size() && !busy_blocks[pos].req->poll())
+            ++pos;
+        busy_entry entry = busy_blocks.erase(pos);
+        budget_.shrink(1);
+
+        FOXXLL_VERBOSE_WPOOL("::steal_any_request block=" << entry.block);
+        return std::pair<block_type*, request_ptr>(entry.block, entry.req);
+    }
+
+    //! Passes a free block to the pool. Ownership of the block goes to the
+    //! pool, which frees it if the memory_budget has no room for it.
     void add(block_type*& block)
     {
+        budget_.enter();
         FOXXLL_VERBOSE_WPOOL("::add " << block);
+        if (!budget_.try_grow(1))
+        {
+            FOXXLL_VERBOSE_WPOOL("  no budget, delete block=" << block);
+            delete block;
+            block = nullptr;
+            return;
+        }
         free_blocks.push_back(block);
+        reserve_capacity();
         block = nullptr; // prevent caller from using the block any further
+        trim();
     }
 
 protected:
     void check_all_busy()
     {
-        busy_blocks_iterator cur = busy_blocks.begin();
-        size_t cnt = 0;
-        while (cur != busy_blocks.end())
+        size_t pos = 0, cnt = 0;
+        while (pos < busy_blocks.size())
         {
-            if (cur->req->poll())
+            if (busy_blocks[pos].req->poll())
             {
-                free_blocks.push_back(cur->block);
-                cur = busy_blocks.erase(cur);
+                free_blocks.push_back(busy_blocks.erase(pos).block);
                 ++cnt;
                 continue;
             }
-            ++cur;
+            ++pos;
         }
         FOXXLL_VERBOSE_WPOOL(
             "::check_all_busy : " << cnt <<
@@ -0,0 +1,135 @@
+/***************************************************************************
+ *  tests/io/test_io_tags.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/common/aligned_alloc.hpp>
+#include <foxxll/io.hpp>
+
+//! \example io/test_io_tags.cpp
+//! Attribute I/O of concurrently running phases to I/O tags.
+
+using foxxll::file;
+
+constexpr size_t block_size = 64 * 1024;
+constexpr size_t num_blocks = 16;
+
+static void write_blocks(file* f, char* buffer)
+{
+    foxxll::request_ptr req[num_blocks];
+    for (size_t i = 0; i < num_blocks; ++i)
+        req[i] = f->awrite(buffer, i * block_size, block_size);
+    wait_all(req, num_blocks);
+}
+
+static void read_blocks(file* f, char* buffer, size_t count)
+{
+    foxxll::request_ptr req[num_blocks];
+    for (size_t i = 0; i < count; ++i)
+        req[i] = f->aread(buffer, i * block_size, block_size);
+    wait_all(req, count);
+}
+
+int main()
+{
+    auto* buffer1 = static_cast<char*>(foxxll::aligned_alloc<4096>(block_size));
+    auto* buffer2 = static_cast<char*>(foxxll::aligned_alloc<4096>(block_size));
+    memset(buffer1, 0, block_size);
+    memset(buffer2, 0, block_size);
+
+    foxxll::file_ptr file1 = tlx::make_counting<foxxll::memory_file>(0);
+    foxxll::file_ptr file2 = tlx::make_counting<foxxll::memory_file>(1);
+    file1->set_size(num_blocks * block_size);
+    file2->set_size(num_blocks * block_size);
+
+    foxxll::stats_data begin(*foxxll::stats::get_instance());
+
+    {
+        // untagged I/O is accounted to the default tag
+        write_blocks(file2.get(), buffer2);
+    }
+
+    std::thread run_formation(
+        [&]() {
+            foxxll::stats::scoped_io_tag tag("run formation");
+            write_blocks(file1.get(), buffer1);
+        });
+
+    std::thread merge(
+        [&]() {
+            foxxll::stats::scoped_io_tag tag("merge");
+            read_blocks(file2.get(), buffer2, num_blocks);
+
+            {
+                // tags nest, the outer tag is restored afterwards
+                foxxll::stats::scoped_io_tag inner("scan");
+                read_blocks(file2.get(), buffer2, 4);
+            }
+
+            read_blocks(file2.get(), buffer2, 2);
+        });
+
+    run_formation.join();
+    merge.join();
+
+    foxxll::stats_data result =
+        foxxll::stats_data(*foxxll::stats::get_instance()) - begin;
+
+    LOG1 << result;
+
+    const foxxll::io_tag_stats_data untagged = result.get_io_tag_stats("");
+    die_unequal(untagged.get_write_count(), num_blocks);
+    die_unequal(untagged.get_read_count(), 0u);
+
+    const foxxll::io_tag_stats_data rf = result.get_io_tag_stats("run formation");
+    die_unequal(rf.get_write_count(), num_blocks);
+    die_unequal(rf.get_write_bytes(), num_blocks * block_size);
+    die_unequal(rf.get_read_count(), 0u);
+
+    const foxxll::io_tag_stats_data merge_stats = result.get_io_tag_stats("merge");
+    die_unequal(merge_stats.get_read_count(), num_blocks + 2);
+    die_unequal(merge_stats.get_read_bytes(), (num_blocks + 2) * block_size);
+    die_unequal(merge_stats.get_write_count(), 0u);
+
+    const foxxll::io_tag_stats_data scan = result.get_io_tag_stats("scan");
+    die_unequal(scan.get_read_count(), 4u);
+
+    // tags are per thread: the main thread is still untagged
+    die_unequal(foxxll::stats::current_io_tag(), 0u);
+
+    // totals over all tags match the per-file counters
+    unsigned reads = 0, writes = 0;
+    for (const foxxll::io_tag_stats_data& t : result.get_io_tag_stats_data_list()) {
+        reads += t.get_read_count();
+        writes += t.get_write_count();
+    }
+    die_unequal(reads, result.get_read_count());
+    die_unequal(writes, result.get_write_count());
+
+    // counters are preallocated for a bounded number of tags
+    auto register_many = []() {
+                             for (unsigned i = 0; i < foxxll::stats::max_io_tags; ++i)
+                                 foxxll::stats::get_instance()->register_io_tag(
+                                     "tag " + std::to_string(i));
+                         };
+    die_unless_throws(register_many(), std::runtime_error);
+
+    foxxll::aligned_dealloc<4096>(buffer1);
+    foxxll::aligned_dealloc<4096>(buffer2);
+
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,209 @@
+/***************************************************************************
+ *  tests/io/test_remote_file.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/io/block_protocol.hpp>
+#include <foxxll/mng/typed_block.hpp>
+
+//! \example io/test_remote_file.cpp
+//! This runs a block_server on localhost and accesses it with remote_file.
+
+using block_type = foxxll::typed_block<64 * 1024, size_t>;
+
+constexpr size_t num_blocks = 64;
+constexpr size_t max_outstanding = 8;
+
+static void test_endpoint(const std::string& listen)
+{
+    foxxll::block_server server(listen, max_outstanding);
+    server.add_export(
+        "scratch", foxxll::create_file("memory", "", foxxll::file::RDWR),
+        num_blocks * sizeof(block_type));
+    server.add_export(
+        "other", foxxll::create_file("memory", "", foxxll::file::RDWR));
+    std::thread thread([&server]() { server.run(); });
+
+    LOG1 << "Serving on " << server.endpoint();
+    const std::string location = "scratch@" + server.endpoint();
+
+    std::vector<block_type*> blocks(num_blocks), check(num_blocks);
+    for (size_t i = 0; i < num_blocks; ++i) {
+        blocks[i] = new block_type;
+        check[i] = new block_type;
+        for (size_t j = 0; j < block_type::size; ++j)
+            (*blocks[i])[j] = i * block_type::size + j;
+    }
+
+    foxxll::file_ptr file = foxxll::create_file(
+        "remote", location, foxxll::file::RDWR);
+    file->set_size(num_blocks * sizeof(block_type));
+    die_unequal(file->size(), num_blocks * sizeof(block_type));
+
+    // more requests than the window, all pipelined on one connection
+    std::vector<foxxll::request_ptr> reqs(num_blocks);
+    for (size_t i = 0; i < num_blocks; ++i)
+        reqs[i] = file->awrite(blocks[i], i * sizeof(block_type),
+                               sizeof(block_type));
+    foxxll::wait_all(reqs.begin(), reqs.end());
+
+    for (size_t i = 0; i < num_blocks; ++i)
+        reqs[i] = file->aread(check[i], i * sizeof(block_type),
+                              sizeof(block_type));
+    foxxll::wait_all(reqs.begin(), reqs.end());
+
+    for (size_t i = 0; i < num_blocks; ++i) {
+        for (size_t j = 0; j < block_type::size; ++j)
+            die_unequal((*check[i])[j], i * block_type::size + j);
+    }
+
+    // a second connection sees the same export, the default one is the first
+    {
+        foxxll::file_ptr again = foxxll::create_file(
+            "remote", server.endpoint(), foxxll::file::RDWR);
+        die_unequal(again->size(), num_blocks * sizeof(block_type));
+        (*check[0])[0] = 0;
+        again->aread(check[0], 5 * sizeof(block_type), sizeof(block_type))->wait();
+        die_unequal((*check[0])[0], 5 * block_type::size);
+
+        foxxll::file_ptr other = foxxll::create_file(
+            "remote", "other@" + server.endpoint(), foxxll::file::RDWR);
+        die_unequal(other->size(), 0u);
+    }
+
+    // clients cannot reach or grow the export beyond its size limit, and
+    // offsets near the end of the address space do not wrap around
+    die_unless_throws(
+        file->set_size((num_blocks + 1) * sizeof(block_type)), foxxll::io_error);
+    die_unless_throws(
+        file->awrite(blocks[0], num_blocks * sizeof(block_type),
+                     sizeof(block_type))->wait(),
+        foxxll::io_error);
+    die_unless_throws(
+        file->aread(check[0], std::numeric_limits<uint64_t>::max() - 1,
+                    sizeof(block_type))->wait(),
+        foxxll::io_error);
+    file->discard(num_blocks * sizeof(block_type), sizeof(block_type));
+    die_unequal(file->size(), num_blocks * sizeof(block_type));
+    {
+        // without a limit, an export keeps the size it was exported with
+        foxxll::file_ptr other = foxxll::create_file(
+            "remote", "other@" + server.endpoint(), foxxll::file::RDWR);
+        die_unless_throws(other->set_size(1), foxxll::io_error);
+        other->set_size(0);
+    }
+
+    // discarding is not answered and does not disturb later requests
+    file->discard(0, sizeof(block_type));
+    die_unequal(file->size(), num_blocks * sizeof(block_type));
+
+    // oversized requests are refused by the client, and a client sending one
+    // anyway is disconnected by the server
+    die_unless_throws(
+        file->aread(check[1], 0, foxxll::block_protocol::max_request_bytes + 1)->wait(),
+        foxxll::io_error);
+    {
+        int fd = foxxll::block_protocol::open_socket(server.endpoint(), false);
+        foxxll::block_protocol::request_header header;
+        header.magic = foxxll::block_protocol::magic;
+        header.op = foxxll::block_protocol::WRITE;
+        header.id = 1;
+        header.offset = 0;
+        header.bytes = uint64_t(1) << 62;
+        die_unless(foxxll::block_protocol::send_all(fd, &header, sizeof(header)));
+        foxxll::block_protocol::response_header response;
+        die_if(foxxll::block_protocol::recv_all(fd, &response, sizeof(response)));
+        ::close(fd);
+    }
+    die_unequal(file->size(), num_blocks * sizeof(block_type));
+
+    // unknown exports are refused
+    die_unless_throws(
+        foxxll::create_file("remote", "missing@" + server.endpoint(),
+                            foxxll::file::RDWR),
+        foxxll::io_error);
+
+    // once the server is gone, requests fail instead of hanging
+    server.stop();
+    thread.join();
+    die_unless_throws(
+        file->aread(check[1], 0, sizeof(block_type))->wait(),
+        foxxll::io_error);
+    die_unless_throws(file->size(), foxxll::io_error);
+
+    for (size_t i = 0; i < num_blocks; ++i) {
+        delete blocks[i];
+        delete check[i];
+    }
+}
+
+static void test_max_connections()
+{
+    foxxll::block_server server("127.0.0.1:0", max_outstanding, 2);
+    server.add_export(
+        "scratch", foxxll::create_file("memory", "", foxxll::file::RDWR));
+    std::thread thread([&server]() { server.run(); });
+
+    // connections beyond the limit are closed right away
+    foxxll::file_ptr first = foxxll::create_file(
+        "remote", server.endpoint(), foxxll::file::RDWR);
+    foxxll::file_ptr second = foxxll::create_file(
+        "remote", server.endpoint(), foxxll::file::RDWR);
+    die_unless_throws(
+        foxxll::create_file("remote", server.endpoint(), foxxll::file::RDWR),
+        foxxll::io_error);
+    die_unequal(first->size(), 0u);
+
+    // closing a connection frees its slot once the server noticed
+    second.reset();
+    for (size_t retry = 0; !second; ++retry)
+    {
+        try {
+            second = foxxll::create_file(
+                "remote", server.endpoint(), foxxll::file::RDWR);
+        }
+        catch (const foxxll::io_error&) {
+            die_unless(retry < 1000);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    die_unequal(second->size(), 0u);
+
+    first.reset();
+    second.reset();
+    server.stop();
+    thread.join();
+}
+
+int main()
+{
+    test_endpoint("127.0.0.1:0");
+
+    const std::string socket = "./foxxll_test_remote_file.sock";
+    test_endpoint("unix:" + socket);
+    std::remove(socket.c_str());
+
+    test_max_connections();
+
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,122 @@
+/***************************************************************************
+ *  tests/mng/benchmark_buf_streams.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+// Compares per-element and bulk access of buf_ostream and buf_istream on a
+// memory disk, where the copying of records dominates.
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/common/timer.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/buf_istream.hpp>
+#include <foxxll/mng/buf_ostream.hpp>
+
+using block_type = foxxll::typed_block<1024 * 1024, uint64_t>;
+using bid_vector_type = std::vector<block_type::bid_type>;
+using bid_iterator_type = bid_vector_type::iterator;
+
+using buf_ostream_type = foxxll::buf_ostream<block_type, bid_iterator_type>;
+using buf_istream_type = foxxll::buf_istream<block_type, bid_iterator_type>;
+
+int main(int argc, char* argv[])
+{
+    size_t num_blocks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    size_t chunk_size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4096;
+    size_t rounds = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 4;
+
+    foxxll::config* cfg = foxxll::config::get_instance();
+    cfg->add_disk(foxxll::disk_config(
+                      "memory", num_blocks * block_type::raw_size, "memory"));
+
+    bid_vector_type bids(num_blocks);
+    foxxll::block_manager::get_instance()->new_blocks(
+        foxxll::striping(), bids.begin(), bids.end());
+
+    const uint64_t num_elements = num_blocks * block_type::size;
+    std::vector<uint64_t> chunk(chunk_size);
+    uint64_t checksum = 0;
+
+    // per-element write and read
+    foxxll::timer elem_write_timer, elem_read_timer;
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        elem_write_timer.start();
+        {
+            buf_ostream_type out(bids.begin(), 4);
+            for (uint64_t i = 0; i < num_elements; ++i)
+                out << i;
+        }
+        elem_write_timer.stop();
+
+        elem_read_timer.start();
+        {
+            buf_istream_type in(bids.begin(), bids.end(), 4);
+            uint64_t value;
+            for (uint64_t i = 0; i < num_elements; ++i) {
+                in >> value;
+                checksum += value;
+            }
+        }
+        elem_read_timer.stop();
+    }
+
+    // bulk write and read in chunks
+    foxxll::timer bulk_write_timer, bulk_read_timer;
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        bulk_write_timer.start();
+        {
+            buf_ostream_type out(bids.begin(), 4);
+            for (uint64_t i = 0; i < num_elements; )
+            {
+                const size_t n = std::min<uint64_t>(chunk_size, num_elements - i);
+                for (size_t j = 0; j < n; ++j)
+                    chunk[j] = i + j;
+                out.write(chunk.data(), n);
+                i += n;
+            }
+        }
+        bulk_write_timer.stop();
+
+        bulk_read_timer.start();
+        {
+            buf_istream_type in(bids.begin(), bids.end(), 4);
+            in.for_each_span(
+                num_elements, [&checksum](const uint64_t* span, size_t n) {
+                    for (size_t j = 0; j < n; ++j)
+                        checksum -= span[j];
+                });
+        }
+        bulk_read_timer.stop();
+    }
+
+    die_unequal(checksum, 0u);
+
+    const double mib = static_cast<double>(
+        rounds * num_elements * sizeof(uint64_t)) / 1024.0 / 1024.0;
+    LOG1 << "blocks=" << num_blocks << " chunk_size=" << chunk_size
+         << " rounds=" << rounds;
+    LOG1 << "per-element write: " << mib / elem_write_timer.seconds() << " MiB/s"
+         << "  read: " << mib / elem_read_timer.seconds() << " MiB/s";
+    LOG1 << "bulk        write: " << mib / bulk_write_timer.seconds() << " MiB/s"
+         << "  read: " << mib / bulk_read_timer.seconds() << " MiB/s";
+
+    foxxll::block_manager::get_instance()->delete_blocks(
+        bids.begin(), bids.end());
+
+    return 0;
+}
+
+/**************************************************************************/
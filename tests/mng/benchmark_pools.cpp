@@ -0,0 +1,88 @@
+/***************************************************************************
+ *  tests/mng/benchmark_pools.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+// Measures the bookkeeping cost of prefetch_pool and write_pool operations on
+// a memory disk, where I/O itself is cheap.
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/common/timer.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/prefetch_pool.hpp>
+#include <foxxll/mng/write_pool.hpp>
+
+using block_type = foxxll::typed_block<4096, size_t>;
+using bid_type = block_type::bid_type;
+
+int main(int argc, char* argv[])
+{
+    size_t pool_size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    size_t num_blocks = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4096;
+    size_t rounds = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 16;
+
+    foxxll::config* cfg = foxxll::config::get_instance();
+    cfg->add_disk(foxxll::disk_config(
+                      "memory", num_blocks * block_type::raw_size, "memory"));
+
+    std::vector<bid_type> bids(num_blocks);
+    foxxll::block_manager::get_instance()->new_blocks(
+        foxxll::striping(), bids.begin(), bids.end());
+
+    foxxll::write_pool<block_type> w_pool(pool_size);
+    foxxll::prefetch_pool<block_type> p_pool(pool_size);
+
+    // write all blocks through the write pool
+    foxxll::timer write_timer(true);
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (size_t i = 0; i < num_blocks; ++i)
+        {
+            block_type* blk = w_pool.steal();
+            (*blk)[0] = i;
+            w_pool.write(blk, bids[i]);
+        }
+    }
+    w_pool.resize(pool_size);
+    write_timer.stop();
+
+    // read all blocks, hinting pool_size blocks ahead
+    foxxll::timer read_timer(true);
+    block_type* blk = new block_type;
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (size_t i = 0; i < std::min(pool_size, num_blocks); ++i)
+            p_pool.hint(bids[i], w_pool);
+        for (size_t i = 0; i < num_blocks; ++i)
+        {
+            p_pool.read(blk, bids[i], w_pool)->wait();
+            die_unequal((*blk)[0], i);
+            if (i + pool_size < num_blocks)
+                p_pool.hint(bids[i + pool_size], w_pool);
+        }
+    }
+    read_timer.stop();
+    delete blk;
+
+    double ops = static_cast<double>(rounds * num_blocks);
+    LOG1 << "pool_size=" << pool_size << " blocks=" << num_blocks
+         << " rounds=" << rounds;
+    LOG1 << "write_pool: " << ops / write_timer.seconds() << " writes/s";
+    LOG1 << "prefetch_pool: " << ops / read_timer.seconds() << " hinted reads/s";
+
+    foxxll::block_manager::get_instance()->delete_blocks(bids.begin(), bids.end());
+    return 0;
+}
+
+/**************************************************************************/
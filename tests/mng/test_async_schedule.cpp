@@ -11,8 +11,10 @@
  *  http://www.boost.org/LICENSE_1_0.txt)
  **************************************************************************/
 
+#include <algorithm>
 #include <cstdlib>
 #include <random>
+#include <vector>
 
 #include <tlx/die.hpp>
 #include <tlx/logger.hpp>
@@ -21,6 +23,74 @@
 
 // Test async schedule algorithm
 
+//! check that a prefetch order is a permutation that never holds more than m
+//! blocks which cannot be consumed yet
+static void check_prefetch_order(const size_t* order, size_t L, size_t m)
+{
+    std::vector<bool> fetched(L, false);
+    size_t consumed = 0;
+    for (size_t k = 0; k < L; ++k)
+    {
+        die_unless(order[k] < L);
+        die_unless(!fetched[order[k]]);
+        // a buffer must be free for the k-th fetch
+        die_unless(k - consumed < m);
+        fetched[order[k]] = true;
+        while (consumed < L && fetched[consumed])
+            ++consumed;
+    }
+}
+
+//! check that a write order is a permutation that writes the blocks of each
+//! disk in sequence order
+static void check_write_order(
+    const size_t* order, const size_t* disks, size_t L, size_t D)
+{
+    std::vector<size_t> next(D, 0);
+    std::vector<bool> seen(L, false);
+    for (size_t i = 0; i < L; ++i)
+    {
+        const size_t b = order[i];
+        die_unless(b < L && !seen[b]);
+        seen[b] = true;
+        die_unless(next[disks[b]] <= b);
+        next[disks[b]] = b;
+    }
+}
+
+//! a slow device is started earlier than in the unit time write schedule
+static void test_slow_writes()
+{
+    const size_t D = 4, L = 16;
+    std::vector<size_t> disks(L);
+    for (size_t i = 0; i < L; ++i)
+        disks[i] = i % D;
+
+    std::vector<double> service_times(D + 1, 1.0);
+    service_times[D - 1] = 4.0;
+
+    std::vector<size_t> unit_order(L), weighted_order(L);
+    foxxll::compute_write_schedule(
+        disks.data(), disks.data() + L, unit_order.data(), 1, D);
+    foxxll::compute_write_schedule(
+        disks.data(), disks.data() + L, weighted_order.data(), 1, D,
+        service_times.data());
+    check_write_order(unit_order.data(), disks.data(), L, D);
+    check_write_order(weighted_order.data(), disks.data(), L, D);
+
+    // position of the first write to the slow device
+    auto first_slow = [&](const std::vector<size_t>& order) {
+                          size_t k = 0;
+                          while (disks[order[k]] != D - 1)
+                              ++k;
+                          return k;
+                      };
+    LOG1 << "first write to the slow device: " << first_slow(unit_order)
+         << " with unit times, " << first_slow(weighted_order)
+         << " with service times";
+    die_unless(first_slow(weighted_order) < first_slow(unit_order));
+}
+
 int main(int argc, char* argv[])
 {
     if (argc < 5)
@@ -65,6 +135,52 @@ int main(int argc, char* argv[])
         LOG1 << "request " << i << "  on disk " << disks[i] << "  scheduled as " << j;
     }
 
+    check_prefetch_order(prefetch_order, L, m);
+
+    // devices of different speed: disk 0 takes four times longer
+    std::vector<double> service_times(D + 1, 1.0);
+    service_times[0] = 4.0;
+    std::vector<size_t> weighted_order(L), write_order(L);
+    foxxll::compute_prefetch_schedule(
+        disks, disks + L, weighted_order.data(), m, D, service_times.data());
+    check_prefetch_order(weighted_order.data(), L, m);
+
+    // the write schedule posts all blocks, per disk in sequence order
+    foxxll::compute_write_schedule(
+        disks, disks + L, write_order.data(), m, D, service_times.data());
+    check_write_order(write_order.data(), disks, L, D);
+    test_slow_writes();
+
+    // windowed schedule: same order if the stream fits into one window,
+    // otherwise each window is a permutation of its blocks
+    for (size_t window : { L, 2 * m + 1 })
+    {
+        foxxll::windowed_prefetch_schedule schedule(window, m, D);
+        std::vector<size_t> order;
+        for (size_t i = 0; i < L; ++i)
+        {
+            schedule.push(disks[i]);
+            if (i + 1 == L)
+                schedule.finish();
+            while (schedule.available())
+                order.push_back(schedule.pop());
+        }
+        die_unequal(order.size(), L);
+        if (window >= m)
+            check_prefetch_order(order.data(), L, m);
+
+        for (size_t i = 0; i < L; ++i)
+        {
+            if (window == L)
+                die_unequal(order[i], prefetch_order[i]);
+            else
+                die_unequal(order[i] / window, i / window);
+        }
+        std::sort(order.begin(), order.end());
+        for (size_t i = 0; i < L; ++i)
+            die_unequal(order[i], i);
+    }
+
     delete[] count;
     delete[] disks;
     delete[] prefetch_order;
@@ -0,0 +1,79 @@
+/***************************************************************************
+ *  tests/mng/test_bid_index.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <map>
+#include <random>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng/bid.hpp>
+#include <foxxll/mng/bid_index.hpp>
+
+using bid_type = foxxll::BID<4096>;
+
+struct entry
+{
+    bid_type bid;
+    size_t value;
+};
+
+int main()
+{
+    // fake storage pointers, never dereferenced
+    foxxll::file* files[2] = {
+        reinterpret_cast<foxxll::file*>(0x1000),
+        reinterpret_cast<foxxll::file*>(0x2000)
+    };
+
+    foxxll::bid_index<entry> index(16);
+    std::map<std::pair<size_t, uint64_t>, size_t> reference;
+    std::mt19937 rng(42);
+
+    for (size_t round = 0; round < 100000; ++round)
+    {
+        size_t f = rng() % 2;
+        uint64_t offset = (rng() % 64) * 4096;
+        bid_type bid(files[f], offset);
+        auto key = std::make_pair(f, offset);
+
+        size_t pos = index.position(bid);
+        if (reference.count(key)) {
+            die_unless(pos != index.npos);
+            die_unequal(index[pos].value, reference[key]);
+            die_unequal(index.erase(pos).value, reference[key]);
+            reference.erase(key);
+        }
+        else {
+            die_unequal(pos, index.npos);
+            index.insert(entry { bid, round });
+            reference[key] = round;
+        }
+        die_unequal(index.size(), reference.size());
+    }
+
+    // unindexed entries stay in the array but are not found
+    while (!index.empty())
+        index.erase(index.begin());
+    bid_type bid(files[0], 0);
+    index.insert(entry { bid, 1 });
+    index.unindex(0);
+    index.insert(entry { bid, 2 });
+    die_unequal(index.size(), 2u);
+    die_unequal(index.find(bid)->value, 2u);
+    index.erase(index.position(bid));
+    die_unless(index.find(bid) == nullptr);
+    die_unequal(index.size(), 1u);
+
+    LOG1 << "bid_index test passed.";
+    return 0;
+}
+
+/**************************************************************************/
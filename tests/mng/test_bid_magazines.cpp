@@ -0,0 +1,225 @@
+/***************************************************************************
+ *  tests/mng/test_bid_magazines.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <future>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+
+//! \example mng/test_bid_magazines.cpp
+//! Allocate and free single blocks through the thread-local BID magazines.
+
+constexpr size_t block_size = 64 * 1024;
+constexpr size_t num_blocks = 1000;
+
+const char* disk_path = "./foxxll_test_bid_magazines.dat";
+
+using bid_type = foxxll::BID<block_size>;
+
+static void alloc_free(foxxll::block_manager* bm, size_t rounds)
+{
+    std::vector<bid_type> bids(num_blocks);
+
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (size_t i = 0; i < num_blocks; ++i)
+            bm->new_block(foxxll::striping(), bids[i], i);
+
+        // no block is handed out twice
+        std::set<std::pair<foxxll::file*, uint64_t> > seen;
+        for (const bid_type& b : bids)
+            die_unless(seen.emplace(b.storage, b.offset).second);
+
+        for (const bid_type& b : bids)
+            bm->delete_block(b);
+    }
+
+    bm->flush_magazines();
+}
+
+//! blocks cached by another thread count as free and are used before an
+//! allocation fails
+static void test_other_thread(foxxll::block_manager* bm)
+{
+    const uint64_t free_before = bm->free_bytes();
+
+    std::promise<void> cached, done;
+    std::thread other(
+        [&]() {
+            std::vector<bid_type> bids(10);
+            for (bid_type& b : bids)
+                bm->new_block(foxxll::striping(), b);
+            for (const bid_type& b : bids)
+                bm->delete_block(b);
+            cached.set_value();
+            done.get_future().wait();
+        });
+    cached.get_future().wait();
+
+    die_unequal(bm->current_allocation(), 0u);
+    die_unequal(bm->free_bytes(), free_before);
+
+    // allocate the whole disk, including the other thread's magazine
+    std::vector<bid_type> all(free_before / block_size);
+    bm->new_blocks(foxxll::striping(), all.begin(), all.end());
+    die_unequal(bm->free_bytes(), 0u);
+
+    std::set<std::pair<foxxll::file*, uint64_t> > seen;
+    for (const bid_type& b : all)
+        die_unless(seen.emplace(b.storage, b.offset).second);
+
+    // nothing is left, a failed allocation leaves nothing allocated
+    {
+        std::vector<bid_type> more(2);
+        die_unless_throws(
+            bm->new_blocks(foxxll::striping(), more.begin(), more.end()),
+            foxxll::bad_ext_alloc);
+    }
+    die_unequal(bm->current_allocation(), free_before);
+
+    for (const bid_type& b : all)
+        bm->delete_block(b);
+    die_unequal(bm->free_bytes(), free_before);
+
+    // flush_magazines() returns the blocks of all threads
+    die_unless(bm->flush_magazines() != 0);
+    die_unequal(bm->free_bytes(), free_before);
+    die_unequal(bm->flush_magazines(), 0u);
+
+    done.set_value();
+    other.join();
+}
+
+//! counts how often the strategy is asked for a disk
+struct counting_disk
+{
+    size_t* calls;
+
+    size_t operator () (size_t) const
+    {
+        ++*calls;
+        return 0;
+    }
+};
+
+//! only single fixed-size blocks use the magazines, the strategy is asked once
+static void test_bypass(foxxll::block_manager* bm)
+{
+    const size_t batch = bm->magazine_size() / 2;
+
+    // delete_blocks() returns blocks to the allocators
+    {
+        bid_type bid;
+        bm->new_block(foxxll::striping(), bid);
+        bm->delete_blocks(&bid, &bid + 1);
+        die_unequal(bm->flush_magazines(), (batch - 1) * block_size);
+    }
+
+    // variable-size blocks are never cached
+    {
+        foxxll::BID<0> bid;
+        bid.size = 3 * 4096;
+        bm->new_block(foxxll::striping(), bid);
+        bm->delete_block(bid);
+        die_unequal(bm->flush_magazines(), 0u);
+    }
+
+    // a magazine miss does not call the strategy again
+    {
+        std::vector<bid_type> all(bm->free_bytes() / block_size - 1);
+        bm->new_blocks(foxxll::striping(), all.begin(), all.end());
+
+        size_t calls = 0;
+        bid_type bid;
+        bm->new_block(counting_disk { &calls }, bid);
+        die_unequal(calls, 1u);
+        die_unequal(bm->free_bytes(), 0u);
+
+        bm->delete_blocks(all.begin(), all.end());
+        bm->delete_blocks(&bid, &bid + 1);
+    }
+    die_unequal(bm->current_allocation(), 0u);
+}
+
+int main()
+{
+    // a disk without autogrow, such that allocations can run out of space
+    foxxll::disk_config disk(disk_path, 8 * num_blocks * block_size, "syscall");
+    disk.autogrow = false;
+    disk.delete_on_exit = true;
+    foxxll::config::get_instance()->add_disk(disk);
+
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    const uint64_t free_before = bm->free_bytes();
+    die_unequal(bm->magazine_size(), 64u);
+
+    // single thread: all blocks return to the allocators after a flush
+    alloc_free(bm, 3);
+    die_unequal(bm->current_allocation(), 0u);
+    die_unequal(bm->free_bytes(), free_before);
+
+    // blocks allocated concurrently are disjoint across threads
+    {
+        std::vector<bid_type> all(4 * num_blocks);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; ++t) {
+            threads.emplace_back(
+                [&, t]() {
+                    for (size_t i = 0; i < num_blocks; ++i)
+                        bm->new_block(foxxll::striping(), all[t * num_blocks + i], i);
+                });
+        }
+        for (std::thread& t : threads)
+            t.join();
+
+        std::set<std::pair<foxxll::file*, uint64_t> > seen;
+        for (const bid_type& b : all)
+            die_unless(seen.emplace(b.storage, b.offset).second);
+
+        bm->delete_blocks(all.begin(), all.end());
+        bm->flush_magazines();
+    }
+
+    // magazines of exited threads are returned on thread exit
+    {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; ++t)
+            threads.emplace_back([bm]() { alloc_free(bm, 2); });
+        for (std::thread& t : threads)
+            t.join();
+    }
+    die_unequal(bm->current_allocation(), 0u);
+    die_unequal(bm->free_bytes(), free_before);
+
+    test_other_thread(bm);
+    test_bypass(bm);
+
+    // disabled magazines use the allocators directly
+    bm->set_magazine_size(0);
+    {
+        bid_type bid;
+        bm->new_block(foxxll::striping(), bid);
+        die_unequal(bm->free_bytes(), free_before - block_size);
+        bm->delete_block(bid);
+        die_unequal(bm->free_bytes(), free_before);
+    }
+    die_unequal(bm->current_allocation(), 0u);
+
+    return 0;
+}
+
+/**************************************************************************/
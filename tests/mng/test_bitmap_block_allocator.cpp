@@ -0,0 +1,180 @@
+/***************************************************************************
+ *  tests/mng/test_bitmap_block_allocator.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <random>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/bitmap_block_allocator.hpp>
+#include <foxxll/mng/disk_block_allocator.hpp>
+
+using foxxll::bitmap_block_allocator;
+
+//! compare the bitmap against a plain vector of free flags
+void test_random_operations()
+{
+    std::mt19937 rng(42);
+    bitmap_block_allocator bitmap(1000);
+    std::vector<bool> ref(1000, true);
+
+    for (size_t iter = 0; iter < 5000; ++iter)
+    {
+        const unsigned op = rng() % 64;
+
+        if (op == 0)
+        {
+            // grow by a few slots, crossing word and level boundaries
+            const uint64_t n = rng() % 300;
+            bitmap.grow(n);
+            ref.resize(ref.size() + n, true);
+        }
+        else if (op < 32)
+        {
+            const uint64_t n = 1 + rng() % 70;
+
+            // reference first-fit
+            uint64_t expect = bitmap_block_allocator::npos;
+            for (uint64_t i = 0, run = 0; i < ref.size(); ++i) {
+                run = ref[i] ? run + 1 : 0;
+                if (run == n) {
+                    expect = i + 1 - n;
+                    break;
+                }
+            }
+
+            const uint64_t pos = bitmap.allocate_run(n);
+            die_unequal(pos, expect);
+            if (pos != bitmap_block_allocator::npos) {
+                for (uint64_t i = pos; i < pos + n; ++i)
+                    ref[i] = false;
+            }
+        }
+        else
+        {
+            // free a random allocated run
+            const uint64_t i = rng() % ref.size();
+            if (ref[i])
+                continue;
+            uint64_t n = 1;
+            while (i + n < ref.size() && !ref[i + n] && n < 50)
+                ++n;
+            n = 1 + rng() % n;
+
+            bitmap.free(i, n);
+            for (uint64_t j = i; j < i + n; ++j)
+                ref[j] = true;
+        }
+
+        uint64_t free_slots = 0;
+        for (bool b : ref)
+            free_slots += b;
+        die_unequal(bitmap.free_slots(), free_slots);
+        die_unequal(bitmap.size(), ref.size());
+    }
+
+    for (uint64_t i = 0; i < ref.size(); ++i)
+        die_unequal(bitmap.is_free(i), ref[i]);
+}
+
+//! double and out of range deallocation are detected
+void test_errors()
+{
+    bitmap_block_allocator bitmap(128);
+    die_unequal(bitmap.allocate_run(100), 0u);
+    die_unequal(bitmap.allocate(), 100u);
+
+    bitmap.free(10, 5);
+    die_unless_throws(bitmap.free(12), foxxll::bad_ext_alloc);
+    die_unless_throws(bitmap.free(5, 10), foxxll::bad_ext_alloc);
+    die_unless_throws(bitmap.free(120, 10), foxxll::bad_ext_alloc);
+    die_unequal(bitmap.free_slots(), 128u - 101u + 5u);
+
+    // first fit reuses the hole
+    die_unequal(bitmap.allocate_run(5), 10u);
+    die_unequal(bitmap.allocate_run(28), bitmap_block_allocator::npos);
+    die_unequal(bitmap.allocate_run(27), 101u);
+    die_unequal(bitmap.allocate(), bitmap_block_allocator::npos);
+}
+
+//! disk_block_allocator on a bitmap disk
+void test_disk_block_allocator()
+{
+    constexpr size_t block_size = 4096;
+
+    foxxll::file_ptr file = tlx::make_counting<foxxll::memory_file>(0);
+    foxxll::disk_config cfg("/dev/null", 100 * block_size + 100, "memory bitmap=4KiB");
+    die_unequal(cfg.bitmap_block_size, block_size);
+    cfg.autogrow = false;
+
+    foxxll::disk_block_allocator alloc(file.get(), cfg);
+    die_unequal(alloc.total_bytes(), 100 * block_size);
+    die_unequal(alloc.free_bytes(), 100 * block_size);
+
+    // batches are placed contiguously
+    std::vector<foxxll::BID<0> > bids(10);
+    for (auto& b : bids)
+        b.size = block_size;
+    alloc.new_blocks(bids.begin(), bids.end());
+    for (size_t i = 0; i < bids.size(); ++i)
+        die_unequal(bids[i].offset, i * block_size);
+
+    // multiples of the block size are runs
+    std::vector<foxxll::BID<0> > big(1);
+    big[0].size = 3 * block_size;
+    alloc.new_blocks(big.begin(), big.end());
+    die_unequal(big[0].offset, 10 * block_size);
+
+    std::vector<foxxll::BID<0> > bad(1);
+    bad[0].size = block_size + 1;
+    die_unless_throws(alloc.new_blocks(bad.begin(), bad.end()),
+                      foxxll::bad_ext_alloc);
+
+    alloc.delete_block(bids[3]);
+    die_unless_throws(alloc.delete_block(bids[3]), foxxll::bad_ext_alloc);
+    die_unequal(alloc.free_bytes(), (100 - 13 + 1) * block_size);
+
+    // a fragmented batch is split into single blocks
+    std::vector<foxxll::BID<0> > rest(100 - 13 + 1);
+    for (auto& b : rest)
+        b.size = block_size;
+    alloc.new_blocks(rest.begin(), rest.end());
+    die_unequal(rest[0].offset, 3 * block_size);
+    die_unequal(rest[1].offset, 13 * block_size);
+    die_unequal(alloc.free_bytes(), 0u);
+
+    // no space left without autogrow
+    die_unless_throws(alloc.new_blocks(big.begin(), big.end()),
+                      foxxll::bad_ext_alloc);
+
+    for (size_t i = 0; i < bids.size(); ++i) {
+        if (i != 3)
+            alloc.delete_block(bids[i]);
+    }
+    alloc.delete_block(big[0]);
+    for (const auto& b : rest)
+        alloc.delete_block(b);
+    die_unequal(alloc.free_bytes(), 100 * block_size);
+}
+
+int main()
+{
+    test_random_operations();
+    test_errors();
+    test_disk_block_allocator();
+
+    LOG1 << "Bitmap block allocator tests passed.";
+    return 0;
+}
+
+/**************************************************************************/
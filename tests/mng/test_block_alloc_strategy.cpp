@@ -12,14 +12,54 @@
  *  http://www.boost.org/LICENSE_1_0.txt)
  **************************************************************************/
 
+#include <cmath>
 #include <sstream>
+#include <vector>
 
+#include <tlx/die.hpp>
 #include <tlx/logger.hpp>
 
 #include <foxxll/common/error_handling.hpp>
+#include <foxxll/io/request_with_state.hpp>
 #include <foxxll/mng.hpp>
 #include <foxxll/mng/block_alloc_strategy_interleaved.hpp>
 
+//! A request that counts as posted on its file until completed by the test,
+//! like one waiting in a slow queue.
+class held_request : public foxxll::request_with_state
+{
+public:
+    explicit held_request(foxxll::file* file)
+        : foxxll::request_with_state(
+              foxxll::completion_handler(), file, nullptr, 0, 0, READ)
+    {
+        mark_posted();
+    }
+
+    void complete()
+    {
+        completed(false);
+    }
+};
+
+//! Post n requests to a file and hold them.
+static void hold_requests(
+    foxxll::file* file, size_t n,
+    std::vector<tlx::counting_ptr<held_request> >& held)
+{
+    for (size_t i = 0; i < n; ++i)
+        held.push_back(tlx::make_counting<held_request>(file));
+}
+
+//! Complete held requests.
+static void complete_requests(
+    std::vector<tlx::counting_ptr<held_request> >& held)
+{
+    for (tlx::counting_ptr<held_request>& req : held)
+        req->complete();
+    held.clear();
+}
+
 template <typename strategy>
 void test_strategy()
 {
@@ -70,6 +110,104 @@ int main()
     if (cfg->flash_range().first != cfg->flash_range().second)
         test_strategy<foxxll::random_cyclic_flash>();
     test_strategy<foxxll::single_disk>();
+    test_strategy<foxxll::load_aware_cyclic>();
+    test_strategy<foxxll::weighted_striping>();
+
+    // idle disks: cycles of the load-aware strategy cover all disks once
+    {
+        foxxll::load_aware_cyclic s;
+        const size_t ndisks = cfg->disks_number();
+        for (size_t c = 0; c < 4; ++c) {
+            std::vector<bool> seen(ndisks, false);
+            for (size_t i = c * ndisks; i < (c + 1) * ndisks; ++i) {
+                const size_t d = s(i);
+                die_unless(d < ndisks && !seen[d]);
+                seen[d] = true;
+            }
+        }
+    }
+
+    // a loaded disk is left out of the cycles until its requests complete
+    if (cfg->disks_number() >= 2)
+    {
+        using block_type = foxxll::typed_block<4096, int>;
+        foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+        const size_t ndisks = cfg->disks_number();
+
+        // give each disk a service time
+        std::vector<block_type::bid_type> bids(ndisks);
+        block_type* block = new block_type;
+        for (size_t d = 0; d < ndisks; ++d) {
+            bm->new_block(foxxll::single_disk(d), bids[d]);
+            foxxll::request_ptr req = block->write(bids[d]);
+            req->wait();
+            // a completed request does not count, even while referenced
+            die_unequal(bids[d].storage->get_posted_requests(), 0u);
+            block->read(bids[d])->wait();
+        }
+        delete block;
+
+        std::vector<tlx::counting_ptr<held_request> > held, others;
+        hold_requests(bids[0].storage, 1000, held);
+        die_unequal(bids[0].storage->get_posted_requests(), 1000u);
+
+        foxxll::load_aware_cyclic s(0, ndisks, 1.2);
+        for (size_t i = 0; i < 10 * ndisks; ++i)
+            die_unless(s(i) != 0);
+
+        // interleaved runs each avoid the loaded disk as well
+        foxxll::interleaved_alloc_traits<foxxll::load_aware_cyclic>::strategy
+            itl(5, s);
+        for (size_t i = 0; i < 5 * 10 * ndisks; ++i)
+            die_unless(itl(i) != 0);
+
+        // once the load moves to the other disks, allocation moves back
+        complete_requests(held);
+        die_unequal(bids[0].storage->get_posted_requests(), 0u);
+        for (size_t d = 1; d < ndisks; ++d)
+            hold_requests(bids[d].storage, 1000, others);
+
+        bool used = false;
+        for (size_t i = 10 * ndisks; i < 20 * ndisks; ++i)
+            used = used || s(i) == 0;
+        die_unless(used);
+
+        complete_requests(others);
+
+        bm->delete_blocks(bids.begin(), bids.end());
+    }
+
+    // weighted striping allocates in proportion to the disk weights
+    {
+        foxxll::weighted_striping s;
+        const size_t ndisks = cfg->disks_number();
+        const size_t nblocks = 1000 * ndisks;
+        // disks without size or weight (autogrow) get the average share
+        double weight_sum = 0.0;
+        bool weighted = true;
+        for (size_t d = 0; d < ndisks; ++d) {
+            weight_sum += cfg->disk_weight(d);
+            weighted = weighted && cfg->disk_weight(d) > 0.0;
+        }
+
+        std::vector<size_t> count(ndisks, 0);
+        for (size_t i = 0; i < nblocks; ++i)
+            ++count[s(i)];
+
+        for (size_t d = 0; d < ndisks; ++d) {
+            LOG1 << "weighted_striping: disk " << d << " weight "
+                 << cfg->disk_weight(d) << " blocks " << count[d];
+            if (weighted) {
+                const double share = cfg->disk_weight(d) / weight_sum;
+                die_unless(std::abs(count[d] - share * nblocks) <= 0.1 * nblocks);
+            }
+        }
+
+        // interleaved runs follow the same weighted schedule
+        foxxll::interleaved_weighted_striping itl(7, s);
+        for (size_t i = 0; i < 7 * nblocks; i += 13)
+            die_unequal(itl(i), s(i / 7));
+    }
 }
 
 /**************************************************************************/
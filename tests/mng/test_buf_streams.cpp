@@ -13,13 +13,19 @@
 //! \example mng/test_buf_streams.cpp
 //! This is an example of use of \c foxxll::buf_istream and \c foxxll::buf_ostream
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include <foxxll/mng.hpp>
 #include <foxxll/mng/buf_istream.hpp>
 #include <foxxll/mng/buf_istream_reverse.hpp>
 #include <foxxll/mng/buf_ostream.hpp>
+#include <foxxll/mng/memory_budget.hpp>
 #include <tlx/die.hpp>
+#include <tlx/logger.hpp>
 
 static const size_t test_block_size = 1024 * 512;
 
@@ -63,6 +69,114 @@ int main()
             die_unless(prevalue == value);
         }
     }
+    {
+        // adaptive prefetch depth stays within its bounds
+        buf_istream_type in(bids.begin(), bids.end(), 2);
+        in.set_adaptive_prefetch(1, 16);
+        for (unsigned i = 0; i < nelements; i++)
+        {
+            unsigned value;
+            in >> value;
+
+            die_unequal(value, i);
+            die_unless(in.num_prefetch_buffers() <= 16);
+        }
+    }
+    {
+        // a consumer faster than the reads makes the prefetch depth grow
+        buf_istream_type in(bids.begin(), bids.end(), 2);
+        in.set_adaptive_prefetch(1, 16);
+        size_t max_buffers = 0;
+        for (unsigned i = 0; i < nelements; i++)
+        {
+            unsigned value;
+            in >> value;
+            max_buffers = std::max(max_buffers, in.num_prefetch_buffers());
+        }
+        LOG1 << "fast consumer: up to " << max_buffers << " prefetch buffers";
+        die_unless(max_buffers > 2);
+    }
+    {
+        // a consumer slower than the reads makes it shrink
+        std::vector<size_t> prefetch_seq(nblocks);
+        for (size_t i = 0; i < nblocks; ++i)
+            prefetch_seq[i] = i;
+
+        foxxll::block_prefetcher<block_type, bid_iterator_type> prefetcher(
+            bids.begin(), bids.end(), prefetch_seq.data(), 8);
+        prefetcher.set_adaptive(1, 8);
+
+        size_t mid_buffers = 0;
+        block_type* blk = prefetcher.pull_block();
+        for (unsigned i = 0; i < nblocks; ++i)
+        {
+            die_unequal((*blk)[0], i * block_type::size);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            if (i == nblocks / 2)
+                mid_buffers = prefetcher.num_buffers();
+            die_unless(prefetcher.block_consumed(blk) == (i + 1 < nblocks));
+        }
+        LOG1 << "slow consumer: " << mid_buffers << " prefetch buffers";
+        die_unless(mid_buffers < 8);
+    }
+    {
+        // a prefetch order needing more buffers than the memory_budget allows
+        // makes progress by reading a block again
+        std::vector<size_t> prefetch_seq(nblocks);
+        for (size_t i = 0; i < nblocks; ++i)
+            prefetch_seq[i] = i;
+        std::swap(prefetch_seq[0], prefetch_seq[2]);
+
+        foxxll::memory_budget* budget = foxxll::memory_budget::get_instance();
+        foxxll::block_prefetcher<block_type, bid_iterator_type> prefetcher(
+            bids.begin(), bids.end(), prefetch_seq.data(), 2);
+        budget->set_limit(budget->used());
+
+        block_type* blk = prefetcher.pull_block();
+        for (unsigned i = 0; i < nblocks; ++i)
+        {
+            die_unequal((*blk)[0], i * block_type::size);
+            die_unless(prefetcher.block_consumed(blk) == (i + 1 < nblocks));
+        }
+        budget->set_limit(0);
+
+        die_unequal(prefetcher.num_buffers(), 2u);
+        die_unequal(prefetcher.num_reads(), nblocks + 1);
+    }
+    {
+        // adjacent blocks are fetched with fewer requests
+        std::vector<size_t> prefetch_seq(nblocks);
+        for (size_t i = 0; i < nblocks; ++i)
+            prefetch_seq[i] = i;
+
+        foxxll::block_prefetcher<block_type, bid_iterator_type> prefetcher(
+            bids.begin(), bids.end(), prefetch_seq.data(), 8);
+        prefetcher.set_max_run(4);
+
+        block_type* blk = prefetcher.pull_block();
+        for (unsigned i = 0; i < nblocks; ++i)
+        {
+            die_unequal((*blk)[0], i * block_type::size);
+            die_unequal((*blk)[block_type::size - 1], (i + 1) * block_type::size - 1);
+            die_unless(prefetcher.block_consumed(blk) == (i + 1 < nblocks));
+        }
+        LOG1 << "coalesced reads: " << prefetcher.num_reads()
+             << " requests for " << nblocks << " blocks";
+        die_unless(prefetcher.num_reads() < nblocks);
+    }
+    {
+        // prefetch order computed over small windows
+        foxxll::block_prefetcher<block_type, bid_iterator_type> prefetcher(
+            bids.begin(), bids.end(), 4, 10);
+
+        block_type* blk = prefetcher.pull_block();
+        for (unsigned i = 0; i < nblocks; ++i)
+        {
+            die_unequal((*blk)[0], i * block_type::size);
+            die_unless(prefetcher.block_consumed(blk) == (i + 1 < nblocks));
+        }
+        die_unequal(prefetcher.num_buffers(), 4u);
+    }
     {
         buf_istream_reverse_type in(bids.begin(), bids.end(), 2);
         for (unsigned i = 0; i < nelements; i++)
@@ -78,7 +192,73 @@ int main()
             die_unless(prevalue == value);
         }
     }
+    {
+        // bulk writes and reads in chunks not aligned to the blocks
+        std::vector<unsigned> chunk(3 * block_type::size / 2 + 7);
+        {
+            buf_ostream_type out(bids.begin(), 2);
+            for (unsigned i = 0; i < nelements; )
+            {
+                const unsigned n = std::min<unsigned>(chunk.size(), nelements - i);
+                for (unsigned j = 0; j < n; ++j)
+                    chunk[j] = nelements - (i + j);
+                out.write(chunk.data(), n);
+                i += n;
+            }
+        }
+        buf_istream_type in(bids.begin(), bids.end(), 2);
+        for (unsigned i = 0; i < nelements; )
+        {
+            const unsigned n = std::min<unsigned>(chunk.size(), nelements - i);
+            in.read(chunk.data(), n);
+            for (unsigned j = 0; j < n; ++j)
+                die_unequal(chunk[j], nelements - (i + j));
+            i += n;
+        }
+    }
+    {
+        // disk aware write order
+        {
+            buf_ostream_type out(bids.begin(), 8);
+            out.set_disk_aware_writes(2);
+            for (unsigned i = 0; i < nelements; i++)
+                out << (i ^ 0x5a5a5a5a);
+        }
+        buf_istream_type in(bids.begin(), bids.end(), 2);
+        for (unsigned i = 0; i < nelements; i++)
+        {
+            unsigned value;
+            in >> value;
+            die_unequal(value, i ^ 0x5a5a5a5a);
+        }
+    }
     bm->delete_blocks(bids.begin(), bids.end());
+    {
+        // blocks are freed while reading a temporary run
+        foxxll::BIDArray<test_block_size> run(nblocks);
+        const uint64_t before = bm->current_allocation();
+        bm->new_blocks(foxxll::striping(), run.begin(), run.end());
+        {
+            buf_ostream_type out(run.begin(), 2);
+            for (unsigned i = 0; i < nelements; i++)
+                out << i;
+        }
+        die_unequal(bm->current_allocation(), before + nblocks * test_block_size);
+        {
+            buf_istream_type in(run.begin(), run.end(), 2);
+            in.set_free_consumed();
+            for (unsigned i = 0; i < nelements / 2; i++)
+            {
+                unsigned value;
+                in >> value;
+                die_unequal(value, i);
+            }
+            die_unless(bm->current_allocation() <=
+                       before + (nblocks / 2) * test_block_size);
+        }
+        // the blocks not read are deleted with the stream
+        die_unequal(bm->current_allocation(), before);
+    }
 
     return 0;
 }
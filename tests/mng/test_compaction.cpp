@@ -0,0 +1,127 @@
+/***************************************************************************
+ *  tests/mng/test_compaction.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <string>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/disk_block_allocator.hpp>
+
+constexpr size_t block_size = 4096;
+
+using bid_type = foxxll::BID<0>;
+
+//! write the block index into every word of the block
+void write_block(const bid_type& bid, size_t index)
+{
+    std::vector<size_t> data(block_size / sizeof(size_t), index);
+    bid.storage->awrite(data.data(), bid.offset, block_size)->wait();
+}
+
+void check_block(const bid_type& bid, size_t index)
+{
+    std::vector<size_t> data(block_size / sizeof(size_t));
+    bid.storage->aread(data.data(), bid.offset, block_size)->wait();
+    for (const size_t& x : data)
+        die_unequal(x, index);
+}
+
+void test_compaction(const std::string& io_impl, uint64_t granularity)
+{
+    foxxll::file_ptr file = tlx::make_counting<foxxll::memory_file>(0);
+    foxxll::disk_config cfg("/dev/null", 8 * block_size, io_impl);
+    foxxll::disk_block_allocator alloc(file.get(), cfg);
+
+    // fill configured size, then grow the file to twice its size
+    std::vector<bid_type> bids(16);
+    for (bid_type& b : bids) {
+        b.storage = file.get();
+        b.size = block_size;
+    }
+    alloc.new_blocks(bids.begin(), bids.begin() + 8);
+    alloc.new_blocks(bids.begin() + 8, bids.end());
+    die_unequal(alloc.total_bytes(), 16 * block_size);
+    die_unequal(file->size(), 16 * block_size);
+
+    for (size_t i = 0; i < bids.size(); ++i) {
+        die_unequal(bids[i].offset, i * block_size);
+        write_block(bids[i], i);
+    }
+
+    // punch holes, live blocks: 1, 5, 8, 10, 11, 13, 14, 15
+    std::vector<size_t> live;
+    for (size_t i = 0; i < bids.size(); ++i) {
+        if (i == 1 || i == 5 || (i >= 8 && i != 9 && i != 12))
+            live.push_back(i);
+        else
+            alloc.delete_block(bids[i]);
+    }
+    die_unequal(alloc.free_bytes(), 8 * block_size);
+
+    const double frag = alloc.fragmentation();
+    LOG1 << io_impl << " fragmentation " << frag;
+    die_unless(frag > 0.5 && frag < 1.0);
+
+    // update BIDs of relocated regions
+    size_t relocations = 0;
+    const uint64_t released = alloc.compact(
+        [&](foxxll::file* storage, uint64_t old_offset, uint64_t new_offset,
+            uint64_t size) {
+            die_unequal(storage, file.get());
+            if (granularity != 0)
+                die_unequal(size, granularity);
+            for (size_t i : live) {
+                if (bids[i].offset >= old_offset &&
+                    bids[i].offset < old_offset + size)
+                    bids[i].offset = bids[i].offset - old_offset + new_offset;
+            }
+            ++relocations;
+        }, granularity);
+
+    LOG1 << io_impl << " granularity " << granularity << ": "
+         << relocations << " relocations";
+
+    die_unequal(released, 8 * block_size);
+    die_unequal(alloc.total_bytes(), 8 * block_size);
+    die_unequal(file->size(), 8 * block_size);
+    die_unequal(alloc.free_bytes(), 0u);
+    die_unequal(alloc.fragmentation(), 0.0);
+
+    for (size_t i : live) {
+        die_unless(bids[i].offset < 8 * block_size);
+        check_block(bids[i], i);
+    }
+
+    // nothing left to compact, the file does not shrink below its size
+    die_unequal(alloc.compact([](foxxll::file*, uint64_t, uint64_t, uint64_t) {
+                                  die("unexpected relocation");
+                              }), 0u);
+
+    for (size_t i : live)
+        alloc.delete_block(bids[i]);
+    die_unequal(alloc.free_bytes(), 8 * block_size);
+}
+
+int main()
+{
+    test_compaction("memory", 0);
+    test_compaction("memory", block_size);
+    test_compaction("memory bitmap=4KiB", 0);
+    test_compaction("memory bitmap=4KiB", block_size);
+
+    LOG1 << "Compaction tests passed.";
+    return 0;
+}
+
+/**************************************************************************/
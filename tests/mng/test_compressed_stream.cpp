@@ -0,0 +1,197 @@
+/***************************************************************************
+ *  tests/mng/test_compressed_stream.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/block_codec.hpp>
+#include <foxxll/mng/compressed_stream.hpp>
+
+//! \example mng/test_compressed_stream.cpp
+//! This round-trips data through the block codec, and writes a compressible
+//! sequence to a compressed stream and reads it back.
+
+static const size_t test_block_size = 64 * 1024;
+
+using block_type = foxxll::typed_block<test_block_size, uint64_t>;
+using compressed_ostream_type = foxxll::compressed_ostream<block_type, foxxll::striping>;
+using extent_iterator_type = std::vector<foxxll::BID<0> >::const_iterator;
+using compressed_istream_type = foxxll::compressed_istream<block_type, extent_iterator_type>;
+
+// forced instantiations
+template class foxxll::compressed_ostream<block_type, foxxll::striping>;
+template class foxxll::compressed_istream<block_type, extent_iterator_type>;
+
+//! compress and decompress, returns the compressed size or 0
+static size_t round_trip(const std::vector<char>& data)
+{
+    std::vector<char> packed(data.size()), unpacked(data.size());
+    size_t size = foxxll::block_codec::compress(
+        data.data(), data.size(), packed.data(), packed.size());
+    if (size == 0)
+        return 0;
+
+    die_unless(foxxll::block_codec::decompress(
+                   packed.data(), size, unpacked.data(), unpacked.size()));
+    die_unless(unpacked == data);
+
+    // truncated or corrupt input is rejected, or at least stays in bounds
+    die_if(foxxll::block_codec::decompress(
+               packed.data(), size - 1, unpacked.data(), unpacked.size()));
+    packed[size / 2] ^= 0x5A;
+    foxxll::block_codec::decompress(
+        packed.data(), size, unpacked.data(), unpacked.size());
+
+    return size;
+}
+
+static void test_codec()
+{
+    std::default_random_engine rng(42);
+    const size_t n = 64 * 1024;
+
+    // random bytes do not compress
+    std::vector<char> data(n);
+    for (char& c : data)
+        c = static_cast<char>(rng());
+    die_unequal(round_trip(data), 0u);
+
+    // zeros compress to almost nothing
+    std::fill(data.begin(), data.end(), 0);
+    die_unless(round_trip(data) < n / 100);
+
+    // text with repeated words
+    static const char* words[] = { "block ", "stream ", "disk ", "prefetch ", "write " };
+    data.clear();
+    while (data.size() < n) {
+        const char* w = words[rng() % 5];
+        while (*w && data.size() < n)
+            data.push_back(*w++);
+    }
+    size_t size = round_trip(data);
+    die_unless(size != 0 && size < n / 2);
+
+    // short inputs
+    for (size_t len : { 1, 3, 4, 5, 17 }) {
+        std::vector<char> small(len, 'x');
+        std::vector<char> packed(len + 16), unpacked(len);
+        size = foxxll::block_codec::compress(
+            small.data(), len, packed.data(), packed.size());
+        die_unless(size != 0);
+        die_unless(foxxll::block_codec::decompress(
+                       packed.data(), size, unpacked.data(), len));
+        die_unless(unpacked == small);
+    }
+}
+
+static void test_stream(foxxll::block_codec_workers& workers)
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    // slowly increasing values compress well, a few random blocks do not
+    const size_t nblocks = 64;
+    const uint64_t size = nblocks * block_type::size - 100;
+    std::default_random_engine rng(7);
+    std::vector<uint64_t> data(size);
+    for (uint64_t i = 0; i < size; ++i)
+        data[i] = (i / block_type::size % 16 == 3) ? rng() : i / 8;
+
+    bm->flush_magazines();
+
+    compressed_ostream_type out(4, &workers);
+    for (uint64_t x : data)
+        out << x;
+    out.finish();
+
+    // extents are allocated exactly, no thread caches blocks of their sizes
+    die_unequal(bm->flush_magazines(), 0u);
+
+    const std::vector<foxxll::BID<0> >& extents = out.extents();
+    die_unequal(out.size(), size);
+    die_unequal(extents.size(), nblocks);
+
+    uint64_t bytes = 0;
+    for (const foxxll::BID<0>& e : extents) {
+        die_unless(e.valid());
+        bytes += e.size;
+    }
+    LOG1 << nblocks << " blocks of " << test_block_size << " bytes in "
+         << bytes << " bytes";
+    die_unless(bytes < nblocks * test_block_size / 2);
+
+    for (size_t nbuffers : { 1, 4, 100 })
+    {
+        compressed_istream_type in(extents.begin(), extents.end(), nbuffers,
+                                   size, &workers);
+        uint64_t x;
+        for (uint64_t i = 0; i < size; ++i) {
+            die_unless(!in.empty());
+            die_unequal(*in, data[i]);
+            in >> x;
+            die_unequal(x, data[i]);
+        }
+        die_unless(in.empty());
+    }
+
+    for (const foxxll::BID<0>& e : extents)
+        bm->delete_block(e);
+}
+
+//! streams constructed without workers share one set of threads
+static void test_shared_workers()
+{
+    foxxll::block_codec_workers* workers =
+        foxxll::block_codec_workers::get_instance();
+    die_unequal(workers->size(),
+                std::max<size_t>(1, std::thread::hardware_concurrency()));
+
+    const uint64_t size = 3 * block_type::size + 5;
+    std::vector<foxxll::BID<0> > extents;
+    {
+        compressed_ostream_type out(2);
+        for (uint64_t i = 0; i < size; ++i)
+            out << i / 16;
+        out.finish();
+        extents = out.extents();
+    }
+    die_unequal(foxxll::block_codec_workers::get_instance(), workers);
+
+    {
+        compressed_istream_type in(extents.begin(), extents.end(), 2, size);
+        for (uint64_t i = 0; i < size; ++i) {
+            uint64_t x;
+            in >> x;
+            die_unequal(x, i / 16);
+        }
+        die_unless(in.empty());
+    }
+
+    for (const foxxll::BID<0>& e : extents)
+        foxxll::block_manager::get_instance()->delete_block(e);
+}
+
+int main()
+{
+    test_codec();
+
+    foxxll::block_codec_workers workers(3);
+    test_stream(workers);
+    test_shared_workers();
+
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,108 @@
+/***************************************************************************
+ *  tests/mng/test_concurrent_ostream.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <thread>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/concurrent_ostream.hpp>
+
+//! \example mng/test_concurrent_ostream.cpp
+//! This appends records from several threads to one concurrent_ostream.
+
+static const size_t test_block_size = 64 * 1024;
+
+using block_type = foxxll::typed_block<test_block_size, uint64_t>;
+using stream_type = foxxll::concurrent_ostream<block_type, foxxll::striping>;
+
+// forced instantiation
+template class foxxll::concurrent_ostream<block_type, foxxll::striping>;
+
+void test_producers(size_t nthreads, size_t nbuffers)
+{
+    // not a multiple of the block size, each producer ends with a partial block
+    const uint64_t nrecords = 20 * block_type::size + 123;
+
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    stream_type stream(nbuffers);
+    {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < nthreads; ++t)
+        {
+            threads.emplace_back(
+                [&stream, t, nrecords]() {
+                    stream_type::producer out(stream);
+                    std::vector<uint64_t> chunk(1000);
+                    uint64_t i = 0;
+                    // single records and bulk writes
+                    for ( ; i < nrecords / 2; ++i)
+                        out << ((t << 32) | i);
+                    while (i < nrecords)
+                    {
+                        size_t n = std::min<uint64_t>(chunk.size(), nrecords - i);
+                        for (size_t j = 0; j < n; ++j)
+                            chunk[j] = (t << 32) | (i + j);
+                        out.write(chunk.data(), n);
+                        i += n;
+                    }
+                });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+    stream.flush();
+
+    die_unequal(stream.size(), nthreads * nrecords);
+    LOG1 << "wrote " << stream.blocks().size() << " blocks";
+
+    // the records of each producer appear in order
+    std::vector<uint64_t> next(nthreads, 0);
+    block_type* block = new block_type;
+    for (const stream_type::output_block& out : stream.blocks())
+    {
+        block->read(out.first)->wait();
+        die_unless(out.second > 0 && out.second <= block_type::size);
+        const uint64_t t = (*block)[0] >> 32;
+        die_unless(t < nthreads);
+        for (size_t j = 0; j < out.second; ++j)
+            die_unequal((*block)[j], (t << 32) | next[t]++);
+    }
+    for (size_t t = 0; t < nthreads; ++t)
+        die_unequal(next[t], nrecords);
+    delete block;
+
+    for (const stream_type::output_block& out : stream.blocks())
+        bm->delete_block(out.first);
+}
+
+int main()
+{
+    test_producers(4, 16);
+    // one buffer per producer still makes progress
+    test_producers(3, 3);
+
+    {
+        // each producer holds a buffer
+        stream_type stream(2);
+        stream_type::producer a(stream), b(stream);
+        die_unless_throws(stream_type::producer c(stream), std::runtime_error);
+        b.close();
+        stream_type::producer c(stream);
+        c << 42;
+    }
+
+    return 0;
+}
+
+/**************************************************************************/
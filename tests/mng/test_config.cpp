@@ -36,6 +36,27 @@ void test1()
     die_unequal(cfg.queue, 5);
     die_unequal(cfg.direct, foxxll::disk_config::DIRECT_ON);
 
+    // bitmap allocator with fixed block size
+
+    cfg.parse_line("disk=/var/tmp/foxxll.tmp, 1 GiB, syscall bitmap=2MiB");
+
+    die_unequal(cfg.bitmap_block_size, 2 * 1024 * uint64_t(1024));
+    die_unequal(cfg.fileio_string(), "syscall bitmap=2097152");
+
+    // contiguous batches on autogrow disks
+
+    cfg.parse_line("disk=/var/tmp/foxxll.tmp, 0, syscall contiguous");
+
+    die_unless(cfg.contiguous);
+    die_unequal(cfg.fileio_string(), "syscall contiguous delete_on_exit");
+
+    // weight for weighted striping
+
+    cfg.parse_line("disk=/var/tmp/foxxll.tmp, 1 GiB, syscall weight=2.5");
+
+    die_unequal(cfg.weight, 2.5);
+    die_unequal(cfg.fileio_string(), "syscall weight=2.5");
+
     // bad configurations
 
     die_unless_throws(
@@ -43,6 +64,16 @@ void test1()
         std::runtime_error
     );
 
+    die_unless_throws(
+        cfg.parse_line("disk=/var/tmp/foxxll.tmp,1G,syscall bitmap=0"),
+        std::runtime_error
+    );
+
+    die_unless_throws(
+        cfg.parse_line("disk=/var/tmp/foxxll.tmp,1G,syscall weight=fast"),
+        std::runtime_error
+    );
+
     die_unless_throws(
         cfg.parse_line("disk=/var/tmp/foxxll.tmp,0x,syscall"),
         std::runtime_error
@@ -0,0 +1,105 @@
+/***************************************************************************
+ *  tests/mng/test_contiguous_extents.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <string>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/disk_block_allocator.hpp>
+
+constexpr size_t block_size = 4096;
+
+using bid_type = foxxll::BID<0>;
+
+std::vector<bid_type> make_bids(size_t n)
+{
+    std::vector<bid_type> bids(n);
+    for (bid_type& b : bids)
+        b.size = block_size;
+    return bids;
+}
+
+//! fragment a disk, then allocate a batch larger than any hole
+void test_allocator(const std::string& io_impl, bool contiguous)
+{
+    foxxll::file_ptr file = tlx::make_counting<foxxll::memory_file>(0);
+    foxxll::disk_config cfg(
+        "/dev/null", 64 * block_size,
+        io_impl + (contiguous ? " contiguous" : "")
+    );
+    foxxll::disk_block_allocator alloc(file.get(), cfg);
+    die_unequal(alloc.contiguous(), contiguous);
+
+    std::vector<bid_type> fill = make_bids(64);
+    alloc.new_blocks(fill.begin(), fill.end());
+    die_unequal(foxxll::contiguous_blocks(fill.begin(), fill.end()), 64u);
+
+    // free every other block: 32 free blocks, all holes of one block
+    for (size_t i = 0; i < fill.size(); i += 2)
+        alloc.delete_block(fill[i]);
+
+    std::vector<bid_type> batch = make_bids(16);
+    alloc.new_blocks(batch.begin(), batch.end());
+
+    if (contiguous) {
+        die_unequal(foxxll::contiguous_blocks(batch.begin(), batch.end()), 16u);
+        die_unequal(batch[0].offset, 64 * block_size);
+    }
+    else {
+        die_unless(foxxll::contiguous_blocks(batch.begin(), batch.end()) < 16u);
+    }
+
+    // stride follows every other block
+    die_unequal(foxxll::contiguous_blocks(fill.begin() + 1, fill.end(), 2), 1u);
+
+    for (size_t i = 1; i < fill.size(); i += 2)
+        alloc.delete_block(fill[i]);
+    for (const bid_type& b : batch)
+        alloc.delete_block(b);
+}
+
+//! contiguous_blocks() on striped sequences
+void test_contiguous_blocks()
+{
+    foxxll::file_ptr f0 = tlx::make_counting<foxxll::memory_file>(0);
+    foxxll::file_ptr f1 = tlx::make_counting<foxxll::memory_file>(0);
+
+    // two disks, blocks alternate, third block of disk 0 is out of line
+    std::vector<bid_type> bids = make_bids(8);
+    for (size_t i = 0; i < bids.size(); ++i) {
+        bids[i].storage = (i % 2 == 0) ? f0.get() : f1.get();
+        bids[i].offset = (i / 2) * block_size;
+    }
+    bids[4].offset = 10 * block_size;
+
+    die_unequal(foxxll::contiguous_blocks(bids.begin(), bids.begin()), 0u);
+    die_unequal(foxxll::contiguous_blocks(bids.begin(), bids.end()), 1u);
+    die_unequal(foxxll::contiguous_blocks(bids.begin(), bids.end(), 2), 2u);
+    die_unequal(foxxll::contiguous_blocks(bids.begin() + 1, bids.end(), 2), 4u);
+    die_unequal(foxxll::contiguous_blocks(bids.begin() + 4, bids.end(), 2), 1u);
+}
+
+int main()
+{
+    test_allocator("memory", false);
+    test_allocator("memory", true);
+    test_allocator("memory bitmap=4KiB", false);
+    test_allocator("memory bitmap=4KiB", true);
+    test_contiguous_blocks();
+
+    LOG1 << "Contiguous extent tests passed.";
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,213 @@
+/***************************************************************************
+ *  tests/mng/test_memory_budget.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/memory_budget.hpp>
+#include <foxxll/mng/prefetch_pool.hpp>
+#include <foxxll/mng/write_pool.hpp>
+
+using block_type = foxxll::typed_block<64 * 1024, int>;
+constexpr size_t block_bytes = sizeof(block_type);
+
+void test_reserve()
+{
+    foxxll::memory_budget* budget = foxxll::memory_budget::get_instance();
+    budget->set_limit(4 * block_bytes);
+
+    die_unless(budget->try_reserve(3 * block_bytes));
+    die_unequal(budget->available(), block_bytes);
+    die_unless(!budget->try_reserve(2 * block_bytes));
+    die_unless_throws(budget->reserve(5 * block_bytes), std::runtime_error);
+
+    // blocking reservation waits for a release in another thread
+    std::atomic<bool> reserved { false };
+    std::thread t([&]() {
+                      budget->reserve(2 * block_bytes);
+                      reserved = true;
+                  });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    die_unless(!reserved);
+
+    budget->release(block_bytes);
+    t.join();
+    die_unless(reserved);
+    die_unequal(budget->used(), 4 * block_bytes);
+
+    budget->release(4 * block_bytes);
+    die_unequal(budget->used(), 0u);
+    die_unequal(budget->peak(), 4 * block_bytes);
+
+    // immediate reclaim
+    size_t lent = 0;
+    foxxll::memory_budget::reclaimer_id id = budget->add_reclaimer(
+        [&](size_t bytes) {
+            lent += bytes;
+            budget->release(bytes);
+            return bytes;
+        });
+    budget->reserve(4 * block_bytes);
+    die_unless(budget->try_reserve(block_bytes));
+    die_unequal(lent, block_bytes);
+    budget->remove_reclaimer(id);
+    budget->release(4 * block_bytes);
+
+    budget->set_limit(0);
+}
+
+void test_pools()
+{
+    foxxll::memory_budget* budget = foxxll::memory_budget::get_instance();
+    budget->set_limit(6 * block_bytes);
+
+    foxxll::write_pool<block_type> w_pool(3);
+    foxxll::prefetch_pool<block_type> p_pool(2);
+    die_unequal(budget->used(), 5 * block_bytes);
+
+    // blocks handed out are not accounted
+    block_type* blk = w_pool.steal();
+    die_unequal(budget->used(), 4 * block_bytes);
+    w_pool.add(blk);
+    die_unequal(budget->used(), 5 * block_bytes);
+
+    // idle pools of this thread lend blocks right away, keeping one each
+    die_unless(budget->try_reserve(3 * block_bytes));
+    die_unequal(w_pool.size() + p_pool.size(), 3u);
+    budget->release(3 * block_bytes);
+
+    // pools of other threads lend blocks on their next operation
+    w_pool.resize(3);
+    p_pool.resize(2);
+    die_unequal(budget->used(), 5 * block_bytes);
+    std::thread t([&]() { die_unless(!budget->try_reserve(3 * block_bytes)); });
+    t.join();
+    w_pool.resize(w_pool.size());
+    p_pool.resize(p_pool.size());
+    die_unequal(w_pool.size() + p_pool.size(), 3u);
+    die_unless(budget->try_reserve(3 * block_bytes));
+    budget->release(3 * block_bytes);
+
+    p_pool.resize(0);
+    w_pool.resize(0);
+    die_unequal(budget->used(), 0u);
+
+    budget->set_limit(0);
+}
+
+void test_single_thread()
+{
+    foxxll::memory_budget* budget = foxxll::memory_budget::get_instance();
+    budget->set_limit(4 * block_bytes);
+
+    // a blocking reservation must not wait for idle blocks of a pool of the
+    // same thread, which cannot free them while the thread waits
+    {
+        foxxll::prefetch_pool<block_type> p1(4);
+        foxxll::prefetch_pool<block_type> p2(1);
+        die_unequal(p1.size(), 3u);
+
+        foxxll::write_pool<block_type> w_pool(1);
+        die_unequal(p1.size(), 2u);
+        die_unequal(budget->used(), 4 * block_bytes);
+
+        // handing a block back to a full pool reclaims as well
+        block_type* blk = w_pool.steal();
+        die_unless(budget->try_reserve(block_bytes));
+        w_pool.add(blk);
+        die_unequal(p1.size(), 1u);
+        budget->release(block_bytes);
+    }
+    die_unequal(budget->used(), 0u);
+
+    budget->set_limit(0);
+}
+
+void test_return()
+{
+    foxxll::memory_budget* budget = foxxll::memory_budget::get_instance();
+    budget->set_limit(2 * block_bytes);
+
+    block_type::bid_type bid;
+    foxxll::block_manager::get_instance()->new_block(foxxll::striping(), bid);
+    {
+        // the budget freed by steal() is taken by another component, the
+        // block coming back must not wait for it
+        foxxll::write_pool<block_type> w_pool(2);
+        block_type* blk = w_pool.steal();
+        foxxll::memory_reservation other(block_bytes);
+
+        w_pool.write(blk, bid)->wait();
+        die_unless(blk == nullptr);
+        die_unequal(w_pool.size(), 1u);
+        die_unequal(budget->used(), 2 * block_bytes);
+
+        // an empty pool allocates, a returning block without room is freed
+        blk = w_pool.steal();
+        block_type* blk2 = w_pool.steal();
+        die_unequal(w_pool.size(), 0u);
+        w_pool.add(blk);
+        w_pool.add(blk2);
+        die_unless(blk2 == nullptr);
+        die_unequal(w_pool.size(), 1u);
+        die_unequal(budget->used(), 2 * block_bytes);
+    }
+    foxxll::block_manager::get_instance()->delete_block(bid);
+    die_unequal(budget->used(), 0u);
+
+    budget->set_limit(0);
+}
+
+void test_handover()
+{
+    foxxll::memory_budget* budget = foxxll::memory_budget::get_instance();
+    budget->set_limit(4 * block_bytes);
+
+    foxxll::prefetch_pool<block_type> pool(4);
+    std::thread t([&]() {
+                      // the first operation makes this thread the owner, which
+                      // frees idle blocks right away
+                      pool.resize(4);
+                      die_unless(budget->try_reserve(2 * block_bytes));
+                      die_unequal(pool.size(), 2u);
+                      budget->release(2 * block_bytes);
+                  });
+    t.join();
+
+    // the previous owner only gets a promise until it uses the pool again
+    die_unless(!budget->try_reserve(3 * block_bytes));
+    die_unequal(pool.size(), 2u);
+    pool.resize(pool.size());
+    die_unequal(pool.size(), 1u);
+    die_unless(budget->try_reserve(3 * block_bytes));
+    budget->release(3 * block_bytes);
+
+    pool.resize(0);
+    budget->set_limit(0);
+}
+
+int main()
+{
+    test_reserve();
+    test_pools();
+    test_single_thread();
+    test_return();
+    test_handover();
+
+    LOG1 << "Memory budget test passed.";
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,128 @@
+/***************************************************************************
+ *  tests/mng/test_memory_pressure.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/memory_pressure.hpp>
+#include <foxxll/mng/prefetch_pool.hpp>
+#include <foxxll/mng/write_pool.hpp>
+
+using block_type = foxxll::typed_block<64 * 1024, int>;
+
+// stand-ins for /proc/pressure/memory and the cgroup memory.events
+const char* psi_path = "./foxxll_test_memory_pressure.psi";
+const char* events_path = "./foxxll_test_memory_pressure.events";
+
+void write_psi(double avg10)
+{
+    std::ofstream out(psi_path);
+    out << "some avg10=" << avg10 << " avg60=0.00 avg300=0.00 total=0\n"
+        << "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+}
+
+void write_events(unsigned high)
+{
+    std::ofstream out(events_path);
+    out << "low 0\nhigh " << high << "\nmax 0\noom 0\noom_kill 0\n";
+}
+
+//! the first pool starts polling at the configured interval
+void test_auto_start(foxxll::memory_pressure* mp)
+{
+    foxxll::config::get_instance()->set_pressure_interval(10);
+    write_psi(50.0);
+    {
+        foxxll::write_pool<block_type> w_pool(4);
+        for (size_t i = 0; i < 500 && !mp->under_pressure(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        die_unless(mp->under_pressure());
+
+        block_type* blk = w_pool.steal();
+        w_pool.add(blk);
+        die_unequal(w_pool.size(), 1u);
+    }
+
+    // poll by hand from now on
+    mp->stop();
+    write_psi(0);
+    while (mp->poll()) { }
+}
+
+int main()
+{
+    write_psi(0);
+    write_events(0);
+
+    foxxll::memory_pressure* mp = foxxll::memory_pressure::get_instance();
+    mp->set_sources(psi_path, events_path);
+    mp->set_psi_threshold(10.0);
+    mp->set_calm_polls(2);
+
+    test_auto_start(mp);
+
+    size_t notified = 0;
+    foxxll::memory_pressure::listener_id id =
+        mp->add_listener([&](bool) { ++notified; });
+
+    foxxll::write_pool<block_type> w_pool(4);
+    foxxll::prefetch_pool<block_type> p_pool(3);
+    block_type* blk;
+
+    die_unless(!mp->poll());
+
+    // PSI above threshold: pools shed all free blocks but one
+    write_psi(50.0);
+    die_unless(mp->poll());
+    die_unequal(notified, 1u);
+
+    blk = w_pool.steal();
+    w_pool.add(blk);
+    die_unequal(w_pool.size(), 1u);
+    blk = p_pool.steal();
+    p_pool.add(blk);
+    die_unequal(p_pool.size(), 1u);
+
+    // pressure subsides after two calm polls, pools regrow
+    write_psi(2.0);
+    die_unless(mp->poll());
+    die_unless(!mp->poll());
+    die_unequal(notified, 2u);
+
+    blk = w_pool.steal();
+    w_pool.add(blk);
+    die_unequal(w_pool.size(), 4u);
+    blk = p_pool.steal();
+    p_pool.add(blk);
+    die_unequal(p_pool.size(), 3u);
+
+    // cgroup memory.high events also signal pressure
+    write_events(3);
+    die_unless(mp->poll());
+    die_unless(mp->poll());
+    die_unless(!mp->poll());
+    die_unequal(notified, 4u);
+
+    mp->remove_listener(id);
+    std::remove(psi_path);
+    std::remove(events_path);
+
+    LOG1 << "Memory pressure test passed.";
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *  tests/mng/test_merge_prefetcher.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/buf_ostream.hpp>
+#include <foxxll/mng/merge_prefetcher.hpp>
+
+//! \example mng/test_merge_prefetcher.cpp
+//! This merges sorted runs of different lengths with a merge_prefetcher.
+
+static const size_t test_block_size = 4096;
+
+using block_type = foxxll::typed_block<test_block_size, uint64_t>;
+using bid_type = block_type::bid_type;
+using bid_vector = std::vector<bid_type>;
+using bid_iterator_type = bid_vector::iterator;
+using merge_prefetcher_type =
+    foxxll::merge_prefetcher<block_type, bid_iterator_type>;
+
+// forced instantiation
+template class foxxll::merge_prefetcher<block_type, bid_iterator_type>;
+
+static void merge_runs(std::vector<bid_vector>& runs, size_t nbuffers,
+                       uint64_t total)
+{
+    std::vector<merge_prefetcher_type::run_type> ranges;
+    for (bid_vector& run : runs)
+        ranges.emplace_back(run.begin(), run.end());
+
+    merge_prefetcher_type prefetcher(ranges, nbuffers);
+    die_unless(prefetcher.num_buffers() >= runs.size() + 1);
+
+    // k-way merge on the first element of each run's current position
+    using cursor = std::pair<uint64_t, size_t>;
+    std::priority_queue<cursor, std::vector<cursor>, std::greater<cursor> > heap;
+    std::vector<block_type*> current(runs.size());
+    std::vector<size_t> pos(runs.size(), 0);
+
+    for (size_t r = 0; r < runs.size(); ++r)
+    {
+        current[r] = prefetcher.current_block(r);
+        if (current[r])
+            heap.emplace((*current[r])[0], r);
+    }
+
+    uint64_t expected = 0;
+    while (!heap.empty())
+    {
+        cursor top = heap.top();
+        heap.pop();
+        die_unequal(top.first, expected);
+        ++expected;
+
+        size_t r = top.second;
+        if (++pos[r] == block_type::size) {
+            current[r] = prefetcher.block_consumed(r);
+            pos[r] = 0;
+            if (!current[r])
+                continue;
+        }
+        heap.emplace((*current[r])[pos[r]], r);
+    }
+    die_unequal(expected, total);
+
+    LOG1 << "merged " << runs.size() << " runs with " << nbuffers
+         << " buffers: " << prefetcher.num_reads() << " reads";
+}
+
+int main()
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    const size_t nruns = 24;
+    std::default_random_engine rng(42);
+
+    // distribute consecutive values to random runs, each run is sorted;
+    // runs are padded to full blocks with values beyond the end
+    std::vector<std::vector<uint64_t> > values(nruns);
+    uint64_t total = 0;
+    for (size_t r = 0; r < nruns; ++r)
+    {
+        // some runs are long, some have a single block
+        size_t nblocks = (r % 4 == 0) ? 1 : 2 + rng() % 12;
+        values[r].resize(nblocks * block_type::size);
+        total += values[r].size();
+    }
+    {
+        std::vector<size_t> fill(nruns, 0);
+        uint64_t v = 0;
+        while (v < total)
+        {
+            size_t r = rng() % nruns;
+            // skewed: runs take values in bursts
+            size_t burst = 1 + rng() % 300;
+            for (size_t i = 0; i < burst && fill[r] < values[r].size(); ++i)
+                values[r][fill[r]++] = v++;
+        }
+    }
+
+    std::vector<bid_vector> runs(nruns);
+    for (size_t r = 0; r < nruns; ++r)
+    {
+        runs[r].resize(values[r].size() / block_type::size);
+        bm->new_blocks(foxxll::striping(), runs[r].begin(), runs[r].end());
+
+        foxxll::buf_ostream<block_type, bid_iterator_type> out(runs[r].begin(), 2);
+        for (uint64_t x : values[r])
+            out << x;
+    }
+
+    // minimal budget, and one that prefetches deeply
+    merge_runs(runs, 0, total);
+    merge_runs(runs, 4 * nruns, total);
+
+    for (bid_vector& run : runs)
+        bm->delete_blocks(run.begin(), run.end());
+
+    return 0;
+}
+
+/**************************************************************************/
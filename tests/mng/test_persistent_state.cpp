@@ -0,0 +1,157 @@
+/***************************************************************************
+ *  tests/mng/test_persistent_state.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+// Run with "save" first, then with "load" to check a warm restart.
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/disk_block_allocator.hpp>
+
+constexpr size_t block_size = 1024 * 1024;
+constexpr size_t num_blocks = 8;
+
+using block_type = foxxll::typed_block<block_size, size_t>;
+
+const char* disk_path = "./foxxll_test_persistent_state.dat";
+const char* state_path = "./foxxll_test_persistent_state.state";
+
+//! save and restore the free space of a single disk
+void test_allocator(const std::string& io_impl)
+{
+    foxxll::file_ptr file = tlx::make_counting<foxxll::memory_file>(0);
+    foxxll::disk_config cfg("/dev/null", 4 * block_size, io_impl);
+
+    std::vector<foxxll::BID<0> > bids(6);
+    for (foxxll::BID<0>& b : bids)
+        b.size = block_size;
+
+    std::stringstream state;
+    uint64_t free_bytes, disk_bytes;
+    {
+        foxxll::disk_block_allocator alloc(file.get(), cfg);
+        alloc.new_blocks(bids.begin(), bids.end());
+        alloc.delete_block(bids[1]);
+        alloc.delete_block(bids[4]);
+        free_bytes = alloc.free_bytes();
+        disk_bytes = alloc.total_bytes();
+
+        alloc.save_state(state);
+        alloc.set_persistent(true);
+    }
+    // the grown file is kept
+    die_unequal(file->size(), disk_bytes);
+
+    foxxll::disk_block_allocator alloc(file.get(), cfg, state);
+    die_unequal(alloc.total_bytes(), disk_bytes);
+    die_unequal(alloc.free_bytes(), free_bytes);
+
+    // freed blocks stay free and are reused first
+    die_unless_throws(alloc.delete_block(bids[1]), foxxll::bad_ext_alloc);
+    std::vector<foxxll::BID<0> > hole(1);
+    hole[0].size = block_size;
+    alloc.new_blocks(hole.begin(), hole.end());
+    die_unequal(hole[0].offset, bids[1].offset);
+
+    // truncated state
+    std::istringstream bad("100");
+    die_unless_throws(
+        foxxll::disk_block_allocator(file.get(), cfg, bad), std::runtime_error);
+}
+
+void run_save()
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    std::vector<foxxll::BID<block_size> > bids(num_blocks);
+    bm->new_blocks(foxxll::striping(), bids.begin(), bids.end());
+
+    block_type* data = new block_type;
+    for (size_t i = 0; i < num_blocks; ++i) {
+        std::fill(data->begin(), data->end(), i);
+        bids[i].write(data, block_size)->wait();
+    }
+    delete data;
+
+    bm->set_root("result", bids.begin(), bids.end());
+    die_unequal(bm->get_root("result").size(), num_blocks);
+    die_unless_throws(
+        bm->set_root("bad name", bids.begin(), bids.end()), std::runtime_error);
+
+    // a temporary that is not deleted before exit is not restored
+    foxxll::BID<block_size> temp;
+    bm->new_block(foxxll::striping(), temp);
+
+    // state is saved on exit
+}
+
+void run_load()
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    std::vector<foxxll::BID<0> > root = bm->get_root("result");
+    die_unequal(root.size(), num_blocks);
+    die_unequal(bm->current_allocation(), num_blocks * block_size);
+
+    block_type* data = new block_type;
+    for (size_t i = 0; i < num_blocks; ++i) {
+        die_unequal(root[i].size, block_size);
+        root[i].read(data, block_size)->wait();
+        for (const size_t& x : *data)
+            die_unequal(x, i);
+    }
+    delete data;
+
+    bm->erase_root("result");
+    bm->delete_blocks(root.begin(), root.end());
+    die_unequal(bm->get_root("result").size(), 0u);
+    die_unequal(bm->current_allocation(), 0u);
+    bm->flush_magazines();
+    die_unequal(bm->free_bytes(), bm->total_bytes());
+}
+
+int main(int argc, char* argv[])
+{
+    test_allocator("memory");
+    test_allocator("memory bitmap=1MiB");
+
+    if (argc < 2)
+        return 0;
+
+    const std::string mode = argv[1];
+    if (mode == "save") {
+        // start from scratch
+        std::remove(state_path);
+        std::remove(disk_path);
+    }
+
+    foxxll::config* cfg = foxxll::config::get_instance();
+    cfg->add_disk(foxxll::disk_config(disk_path, 4 * num_blocks * block_size, "syscall"));
+    cfg->set_state_file(state_path);
+
+    if (mode == "save")
+        run_save();
+    else if (mode == "load")
+        run_load();
+    else
+        die("Usage: test_persistent_state [save|load]");
+
+    LOG1 << "Persistent state test (" << mode << ") passed.";
+    return 0;
+}
+
+/**************************************************************************/
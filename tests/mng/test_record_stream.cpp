@@ -0,0 +1,98 @@
+/***************************************************************************
+ *  tests/mng/test_record_stream.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/record_stream.hpp>
+
+//! \example mng/test_record_stream.cpp
+//! This writes strings of random length to a record stream and reads them
+//! back, from the start and from records in the middle.
+
+static const size_t test_block_size = 4096;
+
+using record_ostream_type = foxxll::record_ostream<test_block_size, foxxll::striping>;
+using bid_iterator_type = std::vector<record_ostream_type::bid_type>::const_iterator;
+using record_istream_type = foxxll::record_istream<test_block_size, bid_iterator_type>;
+
+// forced instantiations
+template class foxxll::record_ostream<test_block_size, foxxll::striping>;
+template class foxxll::record_istream<test_block_size, bid_iterator_type>;
+
+int main()
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    // mostly short records, some longer than a block
+    std::default_random_engine rng(42);
+    std::vector<std::string> records(3000);
+    uint64_t payload = 0;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        size_t len = (i % 100 == 7) ? 2 * test_block_size + rng() % 5000 : rng() % 300;
+        records[i].resize(len);
+        for (size_t j = 0; j < len; ++j)
+            records[i][j] = static_cast<char>('a' + (i + j) % 26);
+        payload += len;
+    }
+
+    record_ostream_type out(4, /* with_index */ true);
+    for (const std::string& r : records)
+        out << r;
+    out.finish();
+
+    const auto& bids = out.bids();
+    die_unequal(out.num_records(), records.size());
+    die_unequal(out.index().size(), bids.size());
+    // the length prefixes take one or two bytes
+    die_unless(out.num_bytes() <= payload + 2 * records.size());
+    die_unequal(bids.size(), (out.num_bytes() + test_block_size - 1) / test_block_size);
+    LOG1 << records.size() << " records of " << payload << " bytes in "
+         << bids.size() << " blocks";
+
+    {
+        record_istream_type in(bids.begin(), bids.end(), 4, records.size());
+        std::string r;
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            die_unless(!in.empty());
+            in >> r;
+            die_unless(r == records[i]);
+        }
+        die_unless(in.empty());
+    }
+
+    // start at records in the middle, some within long records' blocks
+    for (uint64_t first : { 0ul, 1ul, 7ul, 8ul, 1500ul, 2907ul, 2999ul })
+    {
+        record_istream_type in(bids.begin(), bids.end(), 4, records.size(),
+                               out.index(), first);
+        die_unequal(in.remaining(), records.size() - first);
+        std::string r;
+        for (size_t i = first; i < records.size(); ++i)
+        {
+            in >> r;
+            die_unless(r == records[i]);
+        }
+        die_unless(in.empty());
+    }
+
+    bm->delete_blocks(bids.begin(), bids.end());
+
+    return 0;
+}
+
+/**************************************************************************/
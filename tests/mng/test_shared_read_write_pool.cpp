@@ -0,0 +1,117 @@
+/***************************************************************************
+ *  tests/mng/test_shared_read_write_pool.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <thread>
+#include <vector>
+
+#include <tlx/die.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/shared_read_write_pool.hpp>
+
+using block_type = foxxll::typed_block<64 * 1024, size_t>;
+using bid_type = block_type::bid_type;
+
+// forced instantiation
+template class foxxll::shared_read_write_pool<block_type>;
+
+constexpr size_t num_threads = 4;
+constexpr size_t blocks_per_thread = 64;
+
+int main()
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+    std::vector<bid_type> bids(num_threads * blocks_per_thread);
+    bm->new_blocks(foxxll::striping(), bids.begin(), bids.end());
+
+    foxxll::shared_read_write_pool<block_type> pool(16, 16, 4);
+
+    // each thread writes its own blocks through the shared pool
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back(
+            [&, t]() {
+                for (size_t i = t * blocks_per_thread; i < (t + 1) * blocks_per_thread; ++i)
+                {
+                    block_type* blk = pool.steal();
+                    (*blk)[0] = i;
+                    pool.write(blk, bids[i]);
+                }
+            });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    threads.clear();
+    die_unequal(pool.size_write(), 16u);
+
+    // each thread hints the blocks of its neighbour and reads its own
+    for (size_t t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back(
+            [&, t]() {
+                size_t other = (t + 1) % num_threads;
+                for (size_t i = 0; i < blocks_per_thread; ++i)
+                    pool.hint(bids[other * blocks_per_thread + i]);
+
+                block_type* blk = new block_type;
+                for (size_t i = t * blocks_per_thread; i < (t + 1) * blocks_per_thread; ++i)
+                {
+                    pool.read(blk, bids[i])->wait();
+                    die_unequal((*blk)[0], i);
+                }
+                delete blk;
+            });
+    }
+    for (std::thread& t : threads)
+        t.join();
+
+    // drop hints that raced behind the reads
+    for (const bid_type& bid : bids)
+        pool.invalidate(bid);
+    die_unequal(pool.free_size_prefetch(), 16u);
+
+    // a block hinted by one thread serves the read of another
+    std::thread([&]() { die_unless(pool.hint(bids[0])); }).join();
+    die_unless(pool.in_prefetching(bids[0]));
+    block_type* blk = new block_type;
+    pool.read(blk, bids[0])->wait();
+    die_unequal((*blk)[0], 0u);
+    die_unless(!pool.in_prefetching(bids[0]));
+
+    // writing a hinted block replaces the stale copy in the prefetch pool
+    die_unless(pool.hint(bids[1]));
+    block_type* wblk = pool.steal();
+    (*wblk)[0] = 4242;
+    pool.write(wblk, bids[1]);
+    die_unless(pool.in_prefetching(bids[1]));
+    pool.read(blk, bids[1])->wait();
+    die_unequal((*blk)[0], 4242u);
+    delete blk;
+
+    // every shard can prefetch, also with the default sizes
+    {
+        foxxll::shared_read_write_pool<block_type> small;
+        die_unequal(small.num_shards(), 1u);
+        for (size_t i = 0; i < 8; ++i) {
+            die_unless(small.hint(bids[i]));
+            die_unless(small.invalidate(bids[i]));
+        }
+        die_unequal(foxxll::shared_read_write_pool<block_type>(4, 1).num_shards(), 4u);
+    }
+
+    bm->delete_blocks(bids.begin(), bids.end());
+
+    LOG1 << "Shared read_write_pool test passed.";
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,200 @@
+/***************************************************************************
+ *  tools/benchmark_alloc.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+/*
+  This program measures the throughput of block allocation and deallocation in
+  the block_manager from a varying number of threads. No I/O is performed on the
+  blocks, only the allocators of the .foxxll configured disks are exercised.
+*/
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tlx/cmdline_parser.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/mng.hpp>
+
+using foxxll::timestamp;
+
+template <typename AllocStrategy>
+double benchmark_alloc_threads(
+    size_t num_threads, size_t num_blocks, size_t batch_size,
+    size_t block_size)
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+
+    const double begin = timestamp();
+
+    for (size_t t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back(
+            [=]() {
+                AllocStrategy alloc;
+                std::vector<foxxll::BID<0> > bids(batch_size);
+                for (auto& b : bids)
+                    b.size = block_size;
+
+                size_t offset = t * num_blocks;
+                if (batch_size == 1)
+                {
+                    // single blocks are served from the thread's magazines
+                    for (size_t i = 0; i < num_blocks; ++i)
+                    {
+                        bm->new_block(alloc, bids[0], offset++);
+                        bm->delete_block(bids[0]);
+                    }
+                    bm->flush_magazines();
+                    return;
+                }
+
+                for (size_t i = 0; i < num_blocks; i += batch_size)
+                {
+                    bm->new_blocks(alloc, bids.begin(), bids.end(), offset);
+                    offset += batch_size;
+                    bm->delete_blocks(bids.begin(), bids.end());
+                }
+            });
+    }
+
+    for (std::thread& t : threads)
+        t.join();
+
+    return timestamp() - begin;
+}
+
+template <typename AllocStrategy>
+int benchmark_alloc_strategy(
+    size_t max_threads, size_t num_blocks, size_t batch_size,
+    size_t block_size)
+{
+    // round number of blocks per thread to full batches
+    num_blocks = foxxll::div_ceil(num_blocks, batch_size) * batch_size;
+
+    LOG1 << "# Allocation strategy: " << AllocStrategy::name();
+    LOG1 << "# Blocks per thread: " << num_blocks
+         << " in batches of " << batch_size
+         << " blocks of " << foxxll::add_IEC_binary_multiplier(block_size, "B");
+
+    double base_rate = 0;
+
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+        const double elapsed = benchmark_alloc_threads<AllocStrategy>(
+                num_threads, num_blocks, batch_size, block_size);
+
+        // one operation is a new_block() plus a delete_block()
+        const double rate = static_cast<double>(num_threads * num_blocks) / elapsed;
+        if (num_threads == 1)
+            base_rate = rate;
+
+        LOG1 << "threads " << std::setw(3) << num_threads
+             << " time " << std::fixed << std::setw(8) << std::setprecision(3)
+             << elapsed << " s: "
+             << std::setw(12) << std::setprecision(0) << rate << " alloc+free/s"
+             << " speedup " << std::setprecision(2) << (rate / base_rate);
+
+        std::cout << "RESULT"
+                  << (getenv("RESULT") ? getenv("RESULT") : "")
+                  << " alloc=" << AllocStrategy::name()
+                  << " threads=" << num_threads
+                  << " num_blocks=" << num_blocks
+                  << " batch_size=" << batch_size
+                  << " block_size=" << block_size
+                  << " time=" << elapsed
+                  << " rate=" << rate
+                  << std::endl;
+    }
+
+    if (foxxll::block_manager::get_instance()->current_allocation() != 0) {
+        LOG1 << "Error: blocks were lost during the benchmark.";
+        return -1;
+    }
+
+    return 0;
+}
+
+int benchmark_alloc(int argc, char* argv[])
+{
+    // parse command line
+    tlx::CmdlineParser cp;
+
+    unsigned max_threads = 64, batch_size = 1;
+    uint64_t num_blocks = 100000, block_size = 2 * 1024 * 1024;
+    std::string allocstr;
+
+    cp.add_unsigned(
+        't', "threads", max_threads,
+        "Maximum number of threads, doubled starting from one (default: 64)"
+    );
+    cp.add_bytes(
+        'n', "blocks", num_blocks,
+        "Number of blocks allocated and freed per thread (default: 100000)"
+    );
+    cp.add_unsigned(
+        'b', "batch", batch_size,
+        "Number of blocks allocated in one new_blocks() call (default: 1)"
+    );
+    cp.add_bytes(
+        'B', "block_size", block_size,
+        "Size of the allocated blocks (default: 2 MiB)"
+    );
+    cp.add_opt_param_string(
+        "alloc", allocstr,
+        "Block allocation strategy: random_cyclic, simple_random, fully_random, striping. (default: random_cyclic)"
+    );
+
+    cp.set_description(
+        "This program measures the throughput of concurrent block allocation "
+        "and deallocation on the disks configured by the standard .foxxll disk "
+        "configuration files mechanism. No I/O is performed."
+    );
+
+    if (!cp.process(argc, argv))
+        return -1;
+
+    batch_size = std::max(batch_size, 1u);
+
+    // initialize disk configuration
+    foxxll::block_manager::get_instance();
+
+    if (allocstr.size())
+    {
+        if (allocstr == "random_cyclic")
+            return benchmark_alloc_strategy<foxxll::random_cyclic>(
+                max_threads, num_blocks, batch_size, block_size);
+        if (allocstr == "simple_random")
+            return benchmark_alloc_strategy<foxxll::simple_random>(
+                max_threads, num_blocks, batch_size, block_size);
+        if (allocstr == "fully_random")
+            return benchmark_alloc_strategy<foxxll::fully_random>(
+                max_threads, num_blocks, batch_size, block_size);
+        if (allocstr == "striping")
+            return benchmark_alloc_strategy<foxxll::striping>(
+                max_threads, num_blocks, batch_size, block_size);
+
+        LOG1 << "Unknown allocation strategy '" << allocstr << "'";
+        cp.print_usage();
+        return -1;
+    }
+
+    return benchmark_alloc_strategy<foxxll::default_alloc_strategy>(
+        max_threads, num_blocks, batch_size, block_size);
+}
+
+/**************************************************************************/
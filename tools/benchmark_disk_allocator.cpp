@@ -0,0 +1,173 @@
+/***************************************************************************
+ *  tools/benchmark_disk_allocator.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+/*
+  This program compares the free space map and the bitmap implementation of
+  disk_block_allocator on a single memory_file. The disk is first filled to a
+  given ratio with blocks of one size, then random blocks are freed and
+  reallocated in batches. No I/O is performed on the blocks.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <tlx/cmdline_parser.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/disk_block_allocator.hpp>
+
+using foxxll::timestamp;
+
+static void benchmark_disk_allocator_mode(
+    bool bitmap, uint64_t num_blocks, uint64_t block_size, double fill,
+    uint64_t rounds, unsigned batch_size)
+{
+    using bid_type = foxxll::BID<0>;
+
+    foxxll::file_ptr file = tlx::make_counting<foxxll::memory_file>(0);
+    foxxll::disk_config cfg(
+        "/dev/null", num_blocks * block_size,
+        bitmap ? "memory bitmap=" + std::to_string(block_size) : "memory"
+    );
+    cfg.autogrow = false;
+
+    foxxll::disk_block_allocator alloc(file.get(), cfg);
+
+    std::mt19937_64 rng(42);
+    std::vector<bid_type> used(static_cast<size_t>(num_blocks * fill));
+    for (bid_type& b : used)
+        b.size = block_size;
+
+    // fill phase: allocate blocks in batches
+    double begin = timestamp();
+    for (size_t i = 0; i < used.size(); i += batch_size) {
+        const size_t end = std::min<size_t>(i + batch_size, used.size());
+        alloc.new_blocks(used.begin() + i, used.begin() + end);
+    }
+    const double fill_time = timestamp() - begin;
+
+    // churn phase: free random blocks and allocate them again
+    std::vector<bid_type> batch(batch_size);
+    std::vector<size_t> slots(batch_size);
+
+    begin = timestamp();
+    for (uint64_t r = 0; r < rounds; ++r)
+    {
+        for (unsigned i = 0; i < batch_size; ++i)
+        {
+            // pick distinct random blocks of this batch
+            size_t slot;
+            do {
+                slot = rng() % used.size();
+            } while (std::find(slots.begin(), slots.begin() + i, slot)
+                     != slots.begin() + i);
+            slots[i] = slot;
+            alloc.delete_block(used[slot]);
+        }
+
+        for (bid_type& b : batch)
+            b.size = block_size;
+        alloc.new_blocks(batch.begin(), batch.end());
+
+        for (unsigned i = 0; i < batch_size; ++i)
+            used[slots[i]] = batch[i];
+    }
+    const double churn_time = timestamp() - begin;
+
+    const double ops = static_cast<double>(rounds * batch_size);
+    const char* name = bitmap ? "bitmap" : "map";
+
+    LOG1 << name << ": fill " << used.size() << " blocks in "
+         << fill_time << " s, churn " << ops / churn_time
+         << " free+alloc/s";
+
+    std::cout << "RESULT"
+              << (getenv("RESULT") ? getenv("RESULT") : "")
+              << " allocator=" << name
+              << " num_blocks=" << num_blocks
+              << " block_size=" << block_size
+              << " fill=" << fill
+              << " batch_size=" << batch_size
+              << " fill_time=" << fill_time
+              << " churn_time=" << churn_time
+              << " churn_rate=" << ops / churn_time
+              << std::endl;
+
+    for (const bid_type& b : used)
+        alloc.delete_block(b);
+}
+
+int benchmark_disk_allocator(int argc, char* argv[])
+{
+    // parse command line
+    tlx::CmdlineParser cp;
+
+    uint64_t num_blocks = 1024 * 1024, block_size = 4096, rounds = 100000;
+    unsigned batch_size = 1;
+    double fill = 0.8;
+    std::string mode;
+
+    cp.add_bytes(
+        'n', "blocks", num_blocks,
+        "Number of blocks on the disk (default: 1 Mi)"
+    );
+    cp.add_bytes(
+        'B', "block_size", block_size,
+        "Size of the allocated blocks (default: 4 KiB)"
+    );
+    cp.add_double(
+        'f', "fill", fill,
+        "Fraction of blocks allocated during churn (default: 0.8)"
+    );
+    cp.add_bytes(
+        'r', "rounds", rounds,
+        "Number of free/allocate batches during churn (default: 100000)"
+    );
+    cp.add_unsigned(
+        'b', "batch", batch_size,
+        "Number of blocks freed and allocated per batch (default: 1)"
+    );
+    cp.add_opt_param_string(
+        "allocator", mode,
+        "Allocator to benchmark: map, bitmap or both (default: both)"
+    );
+
+    cp.set_description(
+        "This program compares the free space map and the bitmap "
+        "disk_block_allocator on a memory file filled with blocks of one "
+        "size. No I/O is performed."
+    );
+
+    if (!cp.process(argc, argv))
+        return -1;
+
+    batch_size = std::max(batch_size, 1u);
+    fill = std::min(std::max(fill, 0.0), 1.0);
+    if (static_cast<uint64_t>(num_blocks * fill) < batch_size) {
+        LOG1 << "Error: fill ratio too small for batch size.";
+        return -1;
+    }
+
+    if (mode.empty() || mode == "both" || mode == "map")
+        benchmark_disk_allocator_mode(
+            false, num_blocks, block_size, fill, rounds, batch_size);
+    if (mode.empty() || mode == "both" || mode == "bitmap")
+        benchmark_disk_allocator_mode(
+            true, num_blocks, block_size, fill, rounds, batch_size);
+
+    return 0;
+}
+
+/**************************************************************************/
@@ -241,6 +241,34 @@ int benchmark_disks_alloc(
          << std::setw(5) << std::setprecision(1)
          << (double(total_size_read) / MiB / total_time_read) << " MiB/s read";
 
+    // report bandwidth of each disk, usable as weight for weighted_striping
+    {
+        foxxll::config* cfg = foxxll::config::get_instance();
+        std::vector<foxxll::file_stats_data> fsd =
+            foxxll::stats::get_instance()->deepcopy_file_stats_data_list();
+
+        for (size_t d = 0; d < cfg->disks_number(); ++d)
+        {
+            external_size_type bytes = 0;
+            double time = 0.0;
+            for (const foxxll::file_stats_data& f : fsd) {
+                if (f.get_device_id() != cfg->disk(d).device_id)
+                    continue;
+                bytes += f.get_read_bytes() + f.get_write_bytes();
+                time += f.get_read_time() + f.get_write_time();
+            }
+
+            if (time == 0.0)
+                continue;
+
+            LOG1 << "# Disk " << d << " " << cfg->disk_path(d) << ": "
+                 << std::fixed << std::setprecision(1)
+                 << (double(bytes) / MiB / time)
+                 << " MiB/s -> weight=" << std::setprecision(0)
+                 << (double(bytes) / MiB / time);
+        }
+    }
+
     std::cout << "RESULT"
               << (getenv("RESULT") ? getenv("RESULT") : "")
               << " size=" << size
@@ -289,7 +317,7 @@ int benchmark_disks(int argc, char* argv[])
     );
     cp.add_opt_param_string(
         "alloc", allocstr,
-        "Block allocation strategy: random_cyclic, simple_random, fully_random, striping. (default: random_cyclic)"
+        "Block allocation strategy: random_cyclic, simple_random, fully_random, striping, weighted_striping. (default: random_cyclic)"
     );
 
     cp.add_unsigned(
@@ -340,6 +368,10 @@ int benchmark_disks(int argc, char* argv[])
             return benchmark_disks_alloc<foxxll::striping>(
                 size, offset, batch_size, block_size, optrw
             );
+        if (allocstr == "weighted_striping")
+            return benchmark_disks_alloc<foxxll::weighted_striping>(
+                size, offset, batch_size, block_size, optrw
+            );
 
         LOG1 << "Unknown allocation strategy '" << allocstr << "'";
         cp.print_usage();
@@ -0,0 +1,182 @@
+/***************************************************************************
+ *  tools/benchmark_write_order.cpp
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+/*
+  This program writes a sequence of blocks allocated on the .foxxll configured
+  disks with buffered_writer, once writing batches in offset order as before
+  and once in disk aware order, and reports the aggregate write bandwidth.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <tlx/cmdline_parser.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+#include <foxxll/mng.hpp>
+#include <foxxll/mng/buf_writer.hpp>
+
+using foxxll::timestamp;
+using foxxll::external_size_type;
+
+static constexpr size_t write_order_block_size = 2 * 1024 * 1024;
+
+using write_order_block = foxxll::typed_block<write_order_block_size, uint64_t>;
+
+template <typename AllocStrategy>
+static void benchmark_write_order_mode(
+    bool disk_aware, size_t nblocks, size_t nbuffers, size_t batch_size,
+    size_t queue_depth)
+{
+    foxxll::block_manager* bm = foxxll::block_manager::get_instance();
+
+    std::vector<write_order_block::bid_type> bids(nblocks);
+    bm->new_blocks(AllocStrategy(), bids.begin(), bids.end());
+
+    double begin = timestamp();
+    {
+        foxxll::buffered_writer<write_order_block> writer(nbuffers, batch_size);
+        if (disk_aware)
+            writer.set_disk_aware(queue_depth);
+
+        write_order_block* blk = writer.get_free_block();
+        for (size_t i = 0; i < nblocks; ++i)
+        {
+            for (size_t j = 0; j < write_order_block::size; ++j)
+                (*blk)[j] = i * write_order_block::size + j;
+            blk = writer.write(blk, bids[i]);
+        }
+        writer.flush();
+    }
+    const double elapsed = timestamp() - begin;
+
+    const double volume = static_cast<double>(nblocks) * write_order_block::raw_size;
+    const char* name = disk_aware ? "disk_aware" : "offset";
+
+    LOG1 << name << ": wrote " << nblocks << " blocks in " << elapsed
+         << " s, " << volume / elapsed / (1024 * 1024) << " MiB/s";
+
+    std::cout << "RESULT"
+              << (getenv("RESULT") ? getenv("RESULT") : "")
+              << " order=" << name
+              << " disks=" << bm->disks_number()
+              << " blocks=" << nblocks
+              << " block_size=" << write_order_block::raw_size
+              << " buffers=" << nbuffers
+              << " batch_size=" << batch_size
+              << " queue_depth=" << (disk_aware ? queue_depth : 0)
+              << " time=" << elapsed
+              << " bandwidth=" << volume / elapsed / (1024 * 1024)
+              << std::endl;
+
+    bm->delete_blocks(bids.begin(), bids.end());
+}
+
+template <typename AllocStrategy>
+static void benchmark_write_order_alloc(
+    const std::string& mode, size_t nblocks, size_t nbuffers,
+    size_t batch_size, size_t queue_depth)
+{
+    if (mode.empty() || mode == "both" || mode == "offset")
+        benchmark_write_order_mode<AllocStrategy>(
+            false, nblocks, nbuffers, batch_size, queue_depth);
+    if (mode.empty() || mode == "both" || mode == "disk_aware")
+        benchmark_write_order_mode<AllocStrategy>(
+            true, nblocks, nbuffers, batch_size, queue_depth);
+}
+
+int benchmark_write_order(int argc, char* argv[])
+{
+    // parse command line
+    tlx::CmdlineParser cp;
+
+    external_size_type volume = 4ull * 1024 * 1024 * 1024;
+    unsigned nbuffers = 0, batch_size = 0, queue_depth = 2;
+    std::string allocstr = "simple_random", mode;
+
+    cp.add_bytes(
+        's', "size", volume,
+        "Amount of data to write (default: 4 GiB)"
+    );
+    cp.add_unsigned(
+        'b', "buffers", nbuffers,
+        "Number of write buffers (default: 4 per disk)"
+    );
+    cp.add_unsigned(
+        'w', "batch", batch_size,
+        "Number of blocks written as one batch (default: half the buffers)"
+    );
+    cp.add_unsigned(
+        'q', "queue_depth", queue_depth,
+        "Writes in flight per disk in disk aware order (default: 2)"
+    );
+    cp.add_string(
+        'a', "alloc", allocstr,
+        "Block allocation strategy: random_cyclic, simple_random, "
+        "fully_random, striping or weighted_striping (default: simple_random)"
+    );
+    cp.add_opt_param_string(
+        "order", mode,
+        "Write order to benchmark: offset, disk_aware or both (default: both)"
+    );
+
+    cp.set_description(
+        "This program writes blocks of 2 MiB allocated on the configured "
+        "disks with buffered_writer, in offset order and in disk aware "
+        "order, and reports the aggregate write bandwidth."
+    );
+
+    if (!cp.process(argc, argv))
+        return -1;
+
+    if (!mode.empty() && mode != "both" && mode != "offset" &&
+        mode != "disk_aware")
+    {
+        LOG1 << "Unknown write order '" << mode << "'";
+        return -1;
+    }
+
+    const size_t ndisks = foxxll::block_manager::get_instance()->disks_number();
+    if (nbuffers == 0)
+        nbuffers = static_cast<unsigned>(4 * ndisks);
+    if (batch_size == 0)
+        batch_size = std::max(nbuffers / 2, 1u);
+    queue_depth = std::max(queue_depth, 1u);
+
+    const size_t nblocks = static_cast<size_t>(
+        (volume + write_order_block::raw_size - 1) / write_order_block::raw_size);
+
+    if (allocstr == "random_cyclic")
+        benchmark_write_order_alloc<foxxll::random_cyclic>(
+            mode, nblocks, nbuffers, batch_size, queue_depth);
+    else if (allocstr == "simple_random")
+        benchmark_write_order_alloc<foxxll::simple_random>(
+            mode, nblocks, nbuffers, batch_size, queue_depth);
+    else if (allocstr == "fully_random")
+        benchmark_write_order_alloc<foxxll::fully_random>(
+            mode, nblocks, nbuffers, batch_size, queue_depth);
+    else if (allocstr == "striping")
+        benchmark_write_order_alloc<foxxll::striping>(
+            mode, nblocks, nbuffers, batch_size, queue_depth);
+    else if (allocstr == "weighted_striping")
+        benchmark_write_order_alloc<foxxll::weighted_striping>(
+            mode, nblocks, nbuffers, batch_size, queue_depth);
+    else {
+        LOG1 << "Unknown allocation strategy '" << allocstr << "'";
+        return -1;
+    }
+
+    return 0;
+}
+
+/**************************************************************************/
@@ -0,0 +1,127 @@
+/***************************************************************************
+ *  tools/block_server.cpp
+ *
+ *  Serve local files to remote_file clients, so that compute nodes can pool
+ *  their scratch disks.
+ *
+ *  Part of FOXXLL. See http://foxxll.org
+ *
+ *  Distributed under the Boost Software License, Version 1.0.
+ *  (See accompanying file LICENSE_1_0.txt or copy at
+ *  http://www.boost.org/LICENSE_1_0.txt)
+ **************************************************************************/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <tlx/cmdline_parser.hpp>
+#include <tlx/logger.hpp>
+
+#include <foxxll/io.hpp>
+
+#if FOXXLL_HAVE_REMOTE_FILE
+
+int block_server(int argc, char* argv[])
+{
+    std::string endpoint = ":5010";
+    std::string file_type = "syscall";
+    bool no_direct_io = false;
+    unsigned int max_outstanding = 64;
+    unsigned int max_connections = 16;
+    uint64_t max_size = 0;
+    std::vector<std::string> exports;
+
+    tlx::CmdlineParser cp;
+
+    cp.add_param_stringlist(
+        "exports", exports,
+        "Files to serve, as name=path. The first one is the default export."
+    );
+
+    cp.add_string(
+        'l', "listen", endpoint,
+        "Endpoint to listen on, [host]:port or unix:path "
+        "(default: " + endpoint + ")"
+    );
+
+    cp.add_string(
+        'f', "file-type", file_type,
+        "Method to open the local files (syscall|linuxaio|mmap|memory|...) "
+        "default: " + file_type
+    );
+
+    cp.add_bool(
+        0, "no-direct", no_direct_io,
+        "open files without O_DIRECT"
+    );
+
+    cp.add_unsigned(
+        0, "max_outstanding", max_outstanding,
+        "maximum number of requests in flight per connection (default 64)"
+    );
+
+    cp.add_unsigned(
+        0, "max_connections", max_connections,
+        "maximum number of connections served at a time (default 16)"
+    );
+
+    cp.add_bytes(
+        's', "max_size", max_size,
+        "size up to which clients may access and grow each export "
+        "(default: the current size of the file)"
+    );
+
+    cp.set_description(
+        "Serve local files to remote_file clients over TCP or a Unix socket. "
+        "Clients use the fileio 'remote' with path name@host:port, e.g. "
+        "'disk=scratch@node7:5010,100GiB,remote' in their .foxxll file. "
+        "Memory consumption: block size * max_outstanding per connection, "
+        "for up to max_connections connections"
+    );
+
+    if (!cp.process(argc, argv))
+        return -1;
+
+    foxxll::block_server server(endpoint, max_outstanding, max_connections);
+
+    int mode = foxxll::file::CREAT | foxxll::file::RDWR;
+    if (!no_direct_io)
+        mode |= foxxll::file::DIRECT;
+
+    for (size_t i = 0; i < exports.size(); ++i)
+    {
+        size_t eq = exports[i].find('=');
+        if (eq == std::string::npos) {
+            LOG1 << "Export '" << exports[i] << "' is not of the form name=path";
+            return -1;
+        }
+        std::string name = exports[i].substr(0, eq);
+        std::string path = exports[i].substr(eq + 1);
+
+        foxxll::file_ptr file = foxxll::create_file(
+            file_type, path, mode, static_cast<int>(i));
+        server.add_export(name, file, max_size);
+
+        LOG1 << "Exporting " << name << " = " << path
+             << " (" << file->size() << " bytes, limit "
+             << (max_size ? max_size : file->size()) << ")";
+    }
+
+    LOG1 << "Listening on " << server.endpoint();
+    server.run();
+
+    return 0;
+}
+
+#else
+
+int block_server(int, char*[])
+{
+    LOG1 << "block_server is not available on this platform";
+    return -1;
+}
+
+#endif // FOXXLL_HAVE_REMOTE_FILE
+
+/**************************************************************************/
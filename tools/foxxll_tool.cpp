@@ -47,6 +47,10 @@ extern int benchmark_disks(int argc, char* argv[]);
 extern int benchmark_files(int argc, char* argv[]);
 extern int benchmark_sort(int argc, char* argv[]);
 extern int benchmark_disks_random(int argc, char* argv[]);
+extern int benchmark_alloc(int argc, char* argv[]);
+extern int benchmark_disk_allocator(int argc, char* argv[]);
+extern int benchmark_write_order(int argc, char* argv[]);
+extern int block_server(int argc, char* argv[]);
 extern int benchmark_pqueue(int argc, char* argv[]);
 extern int do_mlock(int argc, char* argv[]);
 extern int do_mallinfo(int argc, char* argv[]);
@@ -82,6 +86,26 @@ struct SubTool subtools[] = {
         "benchmark_disks_random", &benchmark_disks_random, false,
         "Benchmark random block access time to .foxxll configured disks."
     },
+    {
+        "benchmark_alloc", &benchmark_alloc, false,
+        "Benchmark concurrent block allocation and deallocation on .foxxll "
+        "configured disks with an increasing number of threads."
+    },
+    {
+        "benchmark_disk_allocator", &benchmark_disk_allocator, false,
+        "Compare the free space map and the bitmap block allocator of a "
+        "single disk under random allocation and deallocation."
+    },
+    {
+        "benchmark_write_order", &benchmark_write_order, false,
+        "Compare the aggregate write bandwidth of buffered_writer on the "
+        "configured disks in offset order and in disk aware order."
+    },
+    {
+        "block_server", &block_server, false,
+        "Serve local files over TCP or a Unix socket to other nodes, which "
+        "access them with the fileio 'remote'."
+    },
     { nullptr, nullptr, false, nullptr }
 };
 